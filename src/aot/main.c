@@ -0,0 +1,694 @@
+// ----------------------------------------------------------------------
+//
+//        ▐ ▄ ▪   ▐ ▄ ▄ •▄  ▄▄▄· .▄▄ · ▪
+//       •█▌▐███ •█▌▐██▌▄▌▪▐█ ▀█ ▐█ ▀. ██
+//       ▐█▐▐▌▐█·▐█▐▐▌▐▀▀▄·▄█▀▀█ ▄▀▀▀█▄▐█·
+//       ██▐█▌▐█▌██▐█▌▐█.█▌▐█ ▪▐▌▐█▄▪▐█▐█▌
+//       ▀▀ █▪▀▀▀▀▀ █▪·▀  ▀ ▀  ▀  ▀▀▀▀ ▀▀▀
+//
+// ----------------------------------------------------------------------
+//
+//   Ninkasi 0.01
+//
+//   By Kiri "ExpiredPopsicle" Jolly
+//     https://expiredpopsicle.com
+//     https://intoxicoding.com
+//     expiredpopsicle@gmail.com
+//
+// ----------------------------------------------------------------------
+//
+//   Copyright (c) 2017 Kiri Jolly
+//
+//   Permission is hereby granted, free of charge, to any person
+//   obtaining a copy of this software and associated documentation files
+//   (the "Software"), to deal in the Software without restriction,
+//   including without limitation the rights to use, copy, modify, merge,
+//   publish, distribute, sublicense, and/or sell copies of the Software,
+//   and to permit persons to whom the Software is furnished to do so,
+//   subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be
+//   included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+//   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+//   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+//   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+//   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+//   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//   SOFTWARE.
+//
+// -------------------------- END HEADER -------------------------------------
+
+// Ninkasi ahead-of-time compiler.
+//
+// Reads a serialized VM image (like the .nkb files "ninkasi_test -c"
+// writes, or anything else saved with nkxVmSerialize()) and writes C
+// source for an NKAotModule covering all of its bytecode. See nkaot.h
+// for how the generated code works, and nkxVmLoadAotModule() for how
+// a hosting application uses it.
+//
+// Unlike the command-line interpreter, this has to look at the VM's
+// internals, and the code it generates calls internal opcode
+// functions directly. Build the generated file with the Ninkasi src
+// directory in the include path.
+
+#include "../nkcommon.h"
+
+#include <string.h>
+
+// This gets filled with information in parseCmdLine.
+struct Settings
+{
+    const char *inputFilename;
+    const char *outputFilename;
+    const char *moduleName;
+
+    // Names of the hosting application's external functions. Loading
+    // an image needs all of them to exist.
+    const char **externalFunctionNames;
+    int externalFunctionCount;
+};
+
+// Image file contents, for the nkxVmSerialize() reader.
+struct ImageBuffer
+{
+    char *data;
+    nkuint32_t size;
+    nkuint32_t readPtr;
+};
+
+void showHelp(const char *argv0)
+{
+    printf("Usage: %s [options] <image.nkb> <output.c>\n\n", argv0);
+
+    printf(
+        "Ninkasi Ahead-of-Time Compiler 0.01\n"
+        "\n"
+        "Translates the bytecode in a serialized VM image into C code\n"
+        "that a hosting application can link in and load with\n"
+        "nkxVmLoadAotModule().\n"
+        "\n"
+        "Options:\n"
+        "\n"
+        "  --help             You're sitting in it.\n"
+        "  --name <name>      Name of the generated NKAotModule variable.\n"
+        "                     Defaults to nkAotModule.\n"
+        "  --external <name>  Name of an external function the image\n"
+        "                     uses. Repeat for each one.\n"
+
+        "\n");
+}
+
+int parseCmdLine(int argc, char *argv[], struct Settings *settings)
+{
+    int i;
+
+    for(i = 1; i < argc; i++) {
+
+        if(argv[i][0] == '-') {
+
+            if(!strcmp(argv[i], "--help")) {
+
+                showHelp(argv[0]);
+                return 0;
+
+            } else if(!strcmp(argv[i], "--name") && i + 1 < argc) {
+
+                settings->moduleName = argv[++i];
+
+            } else if(!strcmp(argv[i], "--external") && i + 1 < argc) {
+
+                settings->externalFunctionNames[
+                    settings->externalFunctionCount++] = argv[++i];
+
+            } else {
+                fprintf(stderr, "error: Unknown command line parameter: %s\n", argv[i]);
+                return 0;
+            }
+
+        } else if(!settings->inputFilename) {
+
+            settings->inputFilename = argv[i];
+
+        } else if(!settings->outputFilename) {
+
+            settings->outputFilename = argv[i];
+
+        } else {
+
+            fprintf(stderr, "error: Too many filenames specified.\n");
+            return 0;
+        }
+    }
+
+    if(!settings->inputFilename || !settings->outputFilename) {
+        showHelp(argv[0]);
+        return 0;
+    }
+
+    return 1;
+}
+
+// Load a whole file into a heap-allocated buffer. Returns NULL on
+// error.
+char *loadFile(const char *filename, nkuint32_t *size)
+{
+    FILE *in = fopen(filename, "rb");
+    char *buf = NULL;
+    long fileSize;
+
+    if(!in) {
+        return NULL;
+    }
+
+    fseek(in, 0, SEEK_END);
+    fileSize = ftell(in);
+    fseek(in, 0, SEEK_SET);
+
+    if(fileSize > 0) {
+        buf = (char*)malloc(fileSize);
+        if(buf && fread(buf, fileSize, 1, in) != 1) {
+            free(buf);
+            buf = NULL;
+        }
+    }
+
+    fclose(in);
+
+    *size = buf ? (nkuint32_t)fileSize : 0;
+    return buf;
+}
+
+nkbool imageReader(void *data, nkuint32_t size, void *userdata, nkbool writeMode)
+{
+    struct ImageBuffer *image = (struct ImageBuffer *)userdata;
+
+    if(writeMode || size > image->size - image->readPtr) {
+        return nkfalse;
+    }
+
+    memcpy(data, image->data + image->readPtr, size);
+    image->readPtr += size;
+    return nktrue;
+}
+
+void printErrors(struct NKVM *vm)
+{
+    nkuint32_t errorBufLen = nkxGetErrorLength(vm);
+    char *buf = (char*)malloc(errorBufLen);
+    nkxGetErrorText(vm, buf);
+    fprintf(stderr, "error:\n%s\n", buf);
+    free(buf);
+}
+
+// Stand-in for external functions. Nothing ever runs here.
+void externalFunctionStub(struct NKVMFunctionCallbackData *data)
+{
+}
+
+int compareAddresses(const void *a, const void *b)
+{
+    nkuint32_t addressA = *(const nkuint32_t *)a;
+    nkuint32_t addressB = *(const nkuint32_t *)b;
+    return addressA < addressB ? -1 : (addressA > addressB ? 1 : 0);
+}
+
+// Get the target of a branch with a fixed offset, or NK_INVALID_VALUE
+// for anything else. All of these leave the instruction pointer on
+// their single operand before adding the offset, and it gets
+// incremented again afterwards.
+nkuint32_t getBranchTarget(struct NKVM *vm, nkuint32_t address)
+{
+    switch(vm->instructions[address].opcode) {
+        case NK_OP_JUMP:
+        case NK_OP_JZ:
+        case NK_OP_GREATERTHAN_JZ:
+        case NK_OP_LESSTHAN_JZ:
+        case NK_OP_GREATERTHANOREQUAL_JZ:
+        case NK_OP_LESSTHANOREQUAL_JZ:
+        case NK_OP_EQUAL_JZ:
+        case NK_OP_NOTEQUAL_JZ:
+            return address + 2 + vm->instructions[address + 1].opData_int;
+        default:
+            return NK_INVALID_VALUE;
+    }
+}
+
+// Write an int constant. The most negative one can't be written as a
+// plain literal.
+void writeInt(FILE *out, nkint32_t value)
+{
+    if(value == -2147483647 - 1) {
+        fprintf(out, "(-2147483647 - 1)");
+    } else {
+        fprintf(out, NK_PRINTF_INT32, value);
+    }
+}
+
+// Get the aotComparison test for a comparison instruction, or NULL.
+const char *getComparisonTest(enum NKOpcode op)
+{
+    switch(op) {
+        case NK_OP_GREATERTHAN:
+        case NK_OP_GREATERTHAN_JZ:
+            return "aotComparison == 1";
+        case NK_OP_LESSTHAN:
+        case NK_OP_LESSTHAN_JZ:
+            return "aotComparison == -1";
+        case NK_OP_GREATERTHANOREQUAL:
+        case NK_OP_GREATERTHANOREQUAL_JZ:
+            return "aotComparison == 0 || aotComparison == 1";
+        case NK_OP_LESSTHANOREQUAL:
+        case NK_OP_LESSTHANOREQUAL_JZ:
+            return "aotComparison == 0 || aotComparison == -1";
+        case NK_OP_EQUAL:
+        case NK_OP_EQUAL_JZ:
+            return "aotComparison == 0";
+        case NK_OP_NOTEQUAL:
+        case NK_OP_NOTEQUAL_JZ:
+            return "aotComparison != 0";
+        default:
+            return NULL;
+    }
+}
+
+// Write the macro for one instruction. Quickened instructions have
+// already been turned back into generic ones here. The C code doesn't
+// care what the bytecode says.
+void writeInstruction(
+    struct NKVM *vm, FILE *out,
+    enum NKOpcode op, nkuint32_t address, nkuint32_t next,
+    nkuint32_t target, nkbool targetInChunk)
+{
+    const char *functionName = nkiVmGetOpcodeFunctionName(op);
+    const char *arithmeticOp = NULL;
+    const char *valueType = NULL;
+    const char *field = NULL;
+    const char *operandField = NULL;
+    nkuint32_t operandCount = nkiVmGetOpcodeOperandCount(op);
+    nkuint32_t i;
+
+    switch(op) {
+
+        case NK_OP_END:
+            fprintf(out, "    NK_AOT_END(" NK_PRINTF_UINT32 ")\n", address);
+            return;
+
+        case NK_OP_JUMP:
+            if(targetInChunk) {
+                fprintf(out, "    NK_AOT_JUMP(" NK_PRINTF_UINT32 ", " NK_PRINTF_UINT32 ")\n",
+                    address, target);
+                return;
+            }
+            break;
+
+        case NK_OP_JZ:
+            if(targetInChunk) {
+                fprintf(out, "    NK_AOT_JZ(" NK_PRINTF_UINT32 ", " NK_PRINTF_UINT32
+                    ", " NK_PRINTF_UINT32 ")\n",
+                    address, next, target);
+                return;
+            }
+            break;
+
+        case NK_OP_GREATERTHAN_JZ:
+        case NK_OP_LESSTHAN_JZ:
+        case NK_OP_GREATERTHANOREQUAL_JZ:
+        case NK_OP_LESSTHANOREQUAL_JZ:
+        case NK_OP_EQUAL_JZ:
+        case NK_OP_NOTEQUAL_JZ:
+            if(targetInChunk) {
+                fprintf(out, "    NK_AOT_COMPARE_JZ(" NK_PRINTF_UINT32 ", " NK_PRINTF_UINT32
+                    ", " NK_PRINTF_UINT32 ", %s, %s)\n",
+                    address, next, target, getComparisonTest(op), functionName);
+                return;
+            }
+            break;
+
+        case NK_OP_GREATERTHAN:
+        case NK_OP_LESSTHAN:
+        case NK_OP_GREATERTHANOREQUAL:
+        case NK_OP_LESSTHANOREQUAL:
+        case NK_OP_EQUAL:
+        case NK_OP_NOTEQUAL:
+            fprintf(out, "    NK_AOT_COMPARE(" NK_PRINTF_UINT32 ", " NK_PRINTF_UINT32
+                ", %s, %s)\n",
+                address, next, getComparisonTest(op), functionName);
+            return;
+
+        case NK_OP_PUSHLITERAL_INT:
+            valueType = "NK_VALUETYPE_INT";
+            field = "intData";
+            operandField = "opData_int";
+            break;
+
+        case NK_OP_PUSHLITERAL_FLOAT:
+            valueType = "NK_VALUETYPE_FLOAT";
+            field = "floatData";
+            operandField = "opData_float";
+            break;
+
+        case NK_OP_PUSHLITERAL_STRING:
+            valueType = "NK_VALUETYPE_STRING";
+            field = "stringTableEntry";
+            operandField = "opData_string";
+            break;
+
+        case NK_OP_PUSHLITERAL_FUNCTIONID:
+            valueType = "NK_VALUETYPE_FUNCTIONID";
+            field = "functionId";
+            operandField = "opData_functionId";
+            break;
+
+        case NK_OP_POP:
+            fprintf(out, "    NK_AOT_POP(" NK_PRINTF_UINT32 ", " NK_PRINTF_UINT32 ")\n",
+                address, next);
+            return;
+
+        case NK_OP_ADD:
+        case NK_OP_ADD3:
+            arithmeticOp = "+";
+            break;
+
+        case NK_OP_SUBTRACT:
+        case NK_OP_SUBTRACT3:
+            arithmeticOp = "-";
+            break;
+
+        case NK_OP_MULTIPLY:
+        case NK_OP_MULTIPLY3:
+            arithmeticOp = "*";
+            break;
+
+        default:
+            break;
+    }
+
+    if(valueType) {
+
+        fprintf(out, "    NK_AOT_PUSH(" NK_PRINTF_UINT32 ", " NK_PRINTF_UINT32
+            ", %s, %s, %s, %s)\n",
+            address, next, valueType, field, operandField, functionName);
+
+    } else if(arithmeticOp && !operandCount) {
+
+        fprintf(out, "    NK_AOT_ARITHMETIC(" NK_PRINTF_UINT32 ", " NK_PRINTF_UINT32
+            ", %s, %s)\n",
+            address, next, arithmeticOp, functionName);
+
+    } else if(arithmeticOp) {
+
+        fprintf(out, "    NK_AOT_ARITHMETIC3(" NK_PRINTF_UINT32 ", " NK_PRINTF_UINT32
+            ", %s", address, next, arithmeticOp);
+        for(i = 1; i <= operandCount; i++) {
+            fprintf(out, ", ");
+            writeInt(out, vm->instructions[address + i].opData_int);
+        }
+        fprintf(out, ", %s)\n", functionName);
+
+    } else {
+
+        // Instructions whose inline versions just take the operands
+        // as arguments. Everything else calls the opcode function.
+        const char *macroName = "NK_AOT_OP";
+
+        switch(op) {
+            case NK_OP_LOAD_LOCAL:   macroName = "NK_AOT_LOAD_LOCAL";   break;
+            case NK_OP_STORE_LOCAL:  macroName = "NK_AOT_STORE_LOCAL";  break;
+            case NK_OP_POP_LOCAL:    macroName = "NK_AOT_POP_LOCAL";    break;
+            case NK_OP_MOVE_LOCAL:   macroName = "NK_AOT_MOVE_LOCAL";   break;
+            case NK_OP_LOAD_STATIC:  macroName = "NK_AOT_LOAD_STATIC";  break;
+            case NK_OP_STORE_STATIC: macroName = "NK_AOT_STORE_STATIC"; break;
+            case NK_OP_POP_STATIC:   macroName = "NK_AOT_POP_STATIC";   break;
+            case NK_OP_ADD_LITERAL:  macroName = "NK_AOT_ADD_LITERAL";  break;
+            default:                                                    break;
+        }
+
+        fprintf(out, "    %s(" NK_PRINTF_UINT32 ", " NK_PRINTF_UINT32,
+            macroName, address, next);
+
+        if(!strcmp(macroName, "NK_AOT_OP")) {
+            fprintf(out, ", %s)", functionName);
+            if(operandCount) {
+                fprintf(out, " //");
+                for(i = 1; i <= operandCount; i++) {
+                    fprintf(out, " " NK_PRINTF_INT32,
+                        vm->instructions[address + i].opData_int);
+                }
+            }
+            fprintf(out, "\n");
+        } else {
+            for(i = 1; i <= operandCount; i++) {
+                fprintf(out, ", ");
+                writeInt(out, vm->instructions[address + i].opData_int);
+            }
+            fprintf(out, ")\n");
+        }
+    }
+}
+
+// Write the generated function for instructions [start, end).
+void writeChunk(
+    struct NKVM *vm, FILE *out,
+    const nkbool *isInstruction,
+    nkuint32_t start, nkuint32_t end)
+{
+    nkuint32_t address;
+
+    fprintf(out,
+        "// Instructions " NK_PRINTF_UINT32 " to " NK_PRINTF_UINT32 ".\n"
+        "static nkuint32_t nkAotChunk_" NK_PRINTF_UINT32 "(struct NKVM *vm, nkuint32_t budget)\n"
+        "{\n"
+        "    NK_AOT_BEGIN()\n",
+        start, end - 1, start);
+
+    for(address = start; address < end; address++) {
+        if(isInstruction[address]) {
+            fprintf(out, "        NK_AOT_CASE(" NK_PRINTF_UINT32 ")\n", address);
+        }
+    }
+
+    fprintf(out, "    NK_AOT_DISPATCH()\n");
+
+    for(address = start; address < end; address++) {
+
+        enum NKOpcode op;
+        nkuint32_t target;
+
+        if(!isInstruction[address]) {
+            continue;
+        }
+
+        op = (enum NKOpcode)(
+            vm->instructions[address].opcode & (NK_OPCODE_PADDEDCOUNT - 1));
+        target = getBranchTarget(vm, address);
+
+        writeInstruction(
+            vm, out, nkiVmGetGenericOpcode(op),
+            address, address + 1 + nkiVmGetOpcodeOperandCount(op),
+            target, target >= start && target < end && isInstruction[target]);
+    }
+
+    fprintf(out,
+        "    NK_AOT_FINISH(" NK_PRINTF_UINT32 ")\n"
+        "}\n"
+        "\n",
+        end);
+}
+
+nkbool writeModule(
+    struct NKVM *vm, FILE *out,
+    const struct Settings *settings)
+{
+    nkuint32_t instructionCount = vm->instructionAddressMask;
+    nkbool *isInstruction;
+    nkuint32_t *chunkStarts;
+    nkuint32_t chunkCount = 0;
+    nkuint32_t address;
+    nkuint32_t i;
+
+    // Find the actual end of the code, the same way the serializer
+    // does.
+    while(instructionCount && vm->instructions[instructionCount].opcode == NK_OP_NOP) {
+        instructionCount--;
+    }
+    instructionCount++;
+
+    isInstruction = (nkbool*)calloc(vm->instructionAddressMask + 1, sizeof(nkbool));
+    chunkStarts = (nkuint32_t*)malloc(sizeof(nkuint32_t) * (vm->functionCount + 1));
+    if(!isInstruction || !chunkStarts) {
+        free(isInstruction);
+        free(chunkStarts);
+        fprintf(stderr, "error: Out of memory.\n");
+        return nkfalse;
+    }
+
+    // Mark where each instruction starts, so we don't try to treat
+    // operands as instructions. The last instruction's operands
+    // might have looked like NOPs.
+    address = 0;
+    while(address < instructionCount) {
+        isInstruction[address] = nktrue;
+        address += 1 + nkiVmGetOpcodeOperandCount(
+            (enum NKOpcode)vm->instructions[address].opcode);
+    }
+    if(address - 1 > vm->instructionAddressMask) {
+        free(isInstruction);
+        free(chunkStarts);
+        fprintf(stderr, "error: Instructions run off the end of the image.\n");
+        return nkfalse;
+    }
+    instructionCount = address;
+
+    // One chunk for the top-level code, and one for each function.
+    // Functions are laid out inline, so each chunk just runs up to
+    // the start of the next one.
+    chunkStarts[chunkCount++] = 0;
+    for(i = 0; i < vm->functionCount; i++) {
+        struct NKVMFunction *func = &vm->functionTable[i];
+        if(func->externalFunctionId.id == NK_INVALID_VALUE &&
+            func->firstInstructionIndex < instructionCount &&
+            isInstruction[func->firstInstructionIndex])
+        {
+            chunkStarts[chunkCount++] = func->firstInstructionIndex;
+        }
+    }
+
+    qsort(chunkStarts, chunkCount, sizeof(nkuint32_t), compareAddresses);
+    {
+        nkuint32_t uniqueCount = 1;
+        for(i = 1; i < chunkCount; i++) {
+            if(chunkStarts[i] != chunkStarts[uniqueCount - 1]) {
+                chunkStarts[uniqueCount++] = chunkStarts[i];
+            }
+        }
+        chunkCount = uniqueCount;
+    }
+
+    fprintf(out,
+        "// Generated by ninkasi_aot from %s. Do not edit.\n"
+        "\n"
+        "#include \"nkcommon.h\"\n"
+        "\n",
+        settings->inputFilename);
+
+    for(i = 0; i < chunkCount; i++) {
+        writeChunk(
+            vm, out, isInstruction, chunkStarts[i],
+            i + 1 < chunkCount ? chunkStarts[i + 1] : instructionCount);
+    }
+
+    fprintf(out, "static const struct NKAotChunk nkAotChunks[] = {\n");
+    for(i = 0; i < chunkCount; i++) {
+        fprintf(out,
+            "    { " NK_PRINTF_UINT32 ", " NK_PRINTF_UINT32
+            ", nkAotChunk_" NK_PRINTF_UINT32 " },\n",
+            chunkStarts[i],
+            i + 1 < chunkCount ? chunkStarts[i + 1] : instructionCount,
+            chunkStarts[i]);
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out,
+        "const struct NKAotModule %s = {\n"
+        "    " NK_PRINTF_UINT32 ",\n"
+        "    " NK_PRINTF_UINT32 "UL,\n"
+        "    " NK_PRINTF_UINT32 ",\n"
+        "    nkAotChunks\n"
+        "};\n",
+        settings->moduleName,
+        instructionCount,
+        nkiAotChecksumInstructions(vm, instructionCount),
+        chunkCount);
+
+    free(isInstruction);
+    free(chunkStarts);
+
+    return nktrue;
+}
+
+// Load just the code part of an image. The rest (objects, external
+// types, subsystem data) would need the hosting application itself.
+static nkbool loadCode(struct NKVM *vm, struct ImageBuffer *image)
+{
+    NK_FAILURE_RECOVERY_DECL();
+    nkbool ret = nkfalse;
+    NK_SET_FAILURE_RECOVERY(ret);
+    ret = nkiVmSerializeCode(vm, imageReader, image, nkfalse);
+    NK_CLEAR_FAILURE_RECOVERY();
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    struct Settings settings;
+    struct ImageBuffer image;
+    struct NKVM *vm;
+    FILE *out;
+    int ret = 1;
+    int i;
+
+    memset(&settings, 0, sizeof(settings));
+    settings.moduleName = "nkAotModule";
+    settings.externalFunctionNames = (const char **)malloc(sizeof(const char *) * argc);
+
+    if(!settings.externalFunctionNames || !parseCmdLine(argc, argv, &settings)) {
+        free(settings.externalFunctionNames);
+        return 1;
+    }
+
+    image.readPtr = 0;
+    image.data = loadFile(settings.inputFilename, &image.size);
+    if(!image.data) {
+        fprintf(stderr, "error: Cannot load %s.\n", settings.inputFilename);
+        free(settings.externalFunctionNames);
+        return 1;
+    }
+
+    // VM images start with \0. Anything else is probably a script.
+    if(image.data[0] != 0) {
+        fprintf(stderr, "error: %s is not a VM image.\n", settings.inputFilename);
+        free(image.data);
+        free(settings.externalFunctionNames);
+        return 1;
+    }
+
+    vm = nkxVmCreate();
+    if(!vm) {
+        fprintf(stderr, "error: Failed to create VM.\n");
+        free(image.data);
+        free(settings.externalFunctionNames);
+        return 1;
+    }
+
+    for(i = 0; i < settings.externalFunctionCount; i++) {
+        nkxVmRegisterExternalFunction(
+            vm, settings.externalFunctionNames[i],
+            externalFunctionStub);
+    }
+
+    if(!loadCode(vm, &image) || nkxVmHasErrors(vm)) {
+
+        printErrors(vm);
+
+    } else {
+
+        out = fopen(settings.outputFilename, "wb");
+        if(!out) {
+            fprintf(stderr, "error: Cannot open %s for writing.\n", settings.outputFilename);
+        } else {
+            if(writeModule(vm, out, &settings)) {
+                ret = 0;
+            }
+            fclose(out);
+        }
+    }
+
+    nkxVmDelete(vm);
+    free(image.data);
+    free(settings.externalFunctionNames);
+
+    return ret;
+}
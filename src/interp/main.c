@@ -213,7 +213,12 @@ void printFunc(struct NKVMFunctionCallbackData *data)
 {
     nkuint32_t i;
     for(i = 0; i < data->argumentCount; i++) {
-        printf("%s", nkxValueToString(data->vm, &data->arguments[i]));
+        nkuint32_t length = 0;
+        const char *str = nkxValueToStringBytes(
+            data->vm, &data->arguments[i], &length);
+        if(str) {
+            fwrite(str, 1, length, stdout);
+        }
     }
 }
 
@@ -0,0 +1,157 @@
+// ----------------------------------------------------------------------
+//
+//        ▐ ▄ ▪   ▐ ▄ ▄ •▄  ▄▄▄· .▄▄ · ▪
+//       •█▌▐███ •█▌▐██▌▄▌▪▐█ ▀█ ▐█ ▀. ██
+//       ▐█▐▐▌▐█·▐█▐▐▌▐▀▀▄·▄█▀▀█ ▄▀▀▀█▄▐█·
+//       ██▐█▌▐█▌██▐█▌▐█.█▌▐█ ▪▐▌▐█▄▪▐█▐█▌
+//       ▀▀ █▪▀▀▀▀▀ █▪·▀  ▀ ▀  ▀  ▀▀▀▀ ▀▀▀
+//
+// ----------------------------------------------------------------------
+//
+//   Ninkasi 0.01
+//
+//   By Kiri "ExpiredPopsicle" Jolly
+//     https://expiredpopsicle.com
+//     https://intoxicoding.com
+//     expiredpopsicle@gmail.com
+//
+// ----------------------------------------------------------------------
+//
+//   Copyright (c) 2017 Kiri Jolly
+//
+//   Permission is hereby granted, free of charge, to any person
+//   obtaining a copy of this software and associated documentation files
+//   (the "Software"), to deal in the Software without restriction,
+//   including without limitation the rights to use, copy, modify, merge,
+//   publish, distribute, sublicense, and/or sell copies of the Software,
+//   and to permit persons to whom the Software is furnished to do so,
+//   subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be
+//   included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+//   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+//   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+//   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+//   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+//   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//   SOFTWARE.
+//
+// -------------------------- END HEADER -------------------------------------
+
+#include "nkcommon.h"
+
+nkuint32_t nkiAotChecksumInstructions(
+    struct NKVM *vm, nkuint32_t instructionCount)
+{
+    // FNV-1a over every instruction word. Opcodes go through
+    // nkiVmGetGenericOpcode() so the checksum doesn't change when the
+    // interpreter quickens instructions. Operand words are left
+    // alone, except for inline caches, which count as zero for the
+    // same reason.
+    nkuint32_t checksum = 2166136261UL;
+    nkuint32_t operandsLeft = 0;
+    nkbool inlineCache = nkfalse;
+    nkuint32_t i;
+
+    if(!instructionCount || instructionCount - 1 > vm->instructionAddressMask) {
+        return NK_INVALID_VALUE;
+    }
+
+    for(i = 0; i < instructionCount; i++) {
+
+        nkuint32_t word;
+        nkuint32_t byteIndex;
+
+        if(operandsLeft) {
+            word = (nkuint32_t)vm->instructions[i].opData_int;
+            operandsLeft--;
+            if(!operandsLeft && inlineCache) {
+                word = 0;
+            }
+        } else {
+            enum NKOpcode op = (enum NKOpcode)(
+                vm->instructions[i].opcode & (NK_OPCODE_PADDEDCOUNT - 1));
+            word = nkiVmGetGenericOpcode(op);
+            operandsLeft = nkiVmGetOpcodeOperandCount(op);
+            inlineCache = nkiVmOpcodeHasInlineCache(op);
+        }
+
+        for(byteIndex = 0; byteIndex < 4; byteIndex++) {
+            checksum ^= (word >> (byteIndex * 8)) & 0xff;
+            checksum *= 16777619UL;
+        }
+    }
+
+    return checksum;
+}
+
+nkbool nkiAotLoadModule(struct NKVM *vm, const struct NKAotModule *module)
+{
+    vm->aotModule = NULL;
+
+    if(!module) {
+        return nktrue;
+    }
+
+    if(nkiAotChecksumInstructions(vm, module->instructionCount) !=
+        module->instructionChecksum)
+    {
+        return nkfalse;
+    }
+
+    vm->aotModule = module;
+    return nktrue;
+}
+
+void nkiAotRevalidate(struct NKVM *vm)
+{
+    if(vm->aotModule) {
+        nkiAotLoadModule(vm, vm->aotModule);
+    }
+}
+
+NKAotFunction nkiAotFindFunction(struct NKVM *vm, nkuint32_t address)
+{
+    const struct NKAotModule *module = vm->aotModule;
+    nkuint32_t low = 0;
+    nkuint32_t high;
+
+    if(!module) {
+        return NULL;
+    }
+
+    // Binary search for the last chunk starting at or before the
+    // address.
+    high = module->chunkCount;
+    while(low < high) {
+        nkuint32_t middle = low + (high - low) / 2;
+        if(module->chunks[middle].start <= address) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if(low && address < module->chunks[low - 1].end) {
+        return module->chunks[low - 1].function;
+    }
+
+    return NULL;
+}
+
+nkuint32_t nkiAotRun(struct NKVM *vm, nkuint32_t budget)
+{
+    NKAotFunction function;
+
+    if(!vm->aotModule || !budget) {
+        return 0;
+    }
+
+    function = nkiAotFindFunction(
+        vm, vm->currentExecutionContext->instructionPointer);
+
+    return function ? function(vm, budget) : 0;
+}
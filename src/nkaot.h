@@ -0,0 +1,462 @@
+// ----------------------------------------------------------------------
+//
+//        ▐ ▄ ▪   ▐ ▄ ▄ •▄  ▄▄▄· .▄▄ · ▪
+//       •█▌▐███ •█▌▐██▌▄▌▪▐█ ▀█ ▐█ ▀. ██
+//       ▐█▐▐▌▐█·▐█▐▐▌▐▀▀▄·▄█▀▀█ ▄▀▀▀█▄▐█·
+//       ██▐█▌▐█▌██▐█▌▐█.█▌▐█ ▪▐▌▐█▄▪▐█▐█▌
+//       ▀▀ █▪▀▀▀▀▀ █▪·▀  ▀ ▀  ▀  ▀▀▀▀ ▀▀▀
+//
+// ----------------------------------------------------------------------
+//
+//   Ninkasi 0.01
+//
+//   By Kiri "ExpiredPopsicle" Jolly
+//     https://expiredpopsicle.com
+//     https://intoxicoding.com
+//     expiredpopsicle@gmail.com
+//
+// ----------------------------------------------------------------------
+//
+//   Copyright (c) 2017 Kiri Jolly
+//
+//   Permission is hereby granted, free of charge, to any person
+//   obtaining a copy of this software and associated documentation files
+//   (the "Software"), to deal in the Software without restriction,
+//   including without limitation the rights to use, copy, modify, merge,
+//   publish, distribute, sublicense, and/or sell copies of the Software,
+//   and to permit persons to whom the Software is furnished to do so,
+//   subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be
+//   included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+//   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+//   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+//   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+//   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+//   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//   SOFTWARE.
+//
+// -------------------------- END HEADER -------------------------------------
+
+// Ahead-of-time compiled bytecode. The ninkasi_aot tool (src/aot/)
+// turns a serialized VM image into C source with one function per
+// script function (plus one for the top-level code). Each of those
+// calls the regular opcode functions directly, in bytecode order,
+// with gotos for branches whose targets are known, so there's no
+// opcode fetch or dispatch between instructions.
+//
+// The generated functions work on the same VM state the interpreter
+// uses, and keep the instruction pointer up to date the whole time,
+// so they can be entered and left at any instruction. Serialized VMs,
+// coroutines, instruction count limits and garbage collection all
+// behave exactly the same as they do when interpreting.
+//
+// A hosting application links the generated file in and hands the
+// module to nkxVmLoadAotModule(). The module only gets used if the
+// VM's bytecode matches the image it was generated from. After that,
+// whenever execution lands on an address covered by the module (a
+// CALL into a function, a branch, a return, or the start of an
+// iteration), the matching C function runs until control leaves it.
+
+#ifndef NINKASI_AOT_H
+#define NINKASI_AOT_H
+
+#include "nktypes.h"
+
+struct NKVM;
+
+/// Generated function for one chunk of bytecode. Runs at most budget
+/// instructions starting at the current instruction pointer, and
+/// returns the number of instructions run. Returns early when the
+/// instruction pointer leaves the chunk, the execution context
+/// changes, an error occurs, or the end instruction is reached.
+typedef nkuint32_t (*NKAotFunction)(struct NKVM *vm, nkuint32_t budget);
+
+struct NKAotChunk
+{
+    /// Range of instruction addresses covered, [start, end).
+    nkuint32_t start;
+    nkuint32_t end;
+
+    NKAotFunction function;
+};
+
+struct NKAotModule
+{
+    /// Number of instruction words in the image this module was
+    /// generated from, and nkiAotChecksumInstructions() of them.
+    nkuint32_t instructionCount;
+    nkuint32_t instructionChecksum;
+
+    /// Chunks, sorted by address and not overlapping.
+    nkuint32_t chunkCount;
+    const struct NKAotChunk *chunks;
+};
+
+/// Checksum the first instructionCount instruction words, with
+/// quickened opcodes counted as the generic ones they came from.
+/// Returns NK_INVALID_VALUE if the VM doesn't have that many.
+nkuint32_t nkiAotChecksumInstructions(
+    struct NKVM *vm, nkuint32_t instructionCount);
+
+/// Start using a module, if it matches the VM's bytecode. NULL
+/// unloads the current module.
+nkbool nkiAotLoadModule(struct NKVM *vm, const struct NKAotModule *module);
+
+/// Drop the current module if the bytecode doesn't match it anymore.
+/// Call this whenever the instructions get replaced or added to.
+void nkiAotRevalidate(struct NKVM *vm);
+
+/// Find the generated function covering an address, or NULL.
+NKAotFunction nkiAotFindFunction(struct NKVM *vm, nkuint32_t address);
+
+/// Run generated code from the current instruction pointer, if there
+/// is any for it. Returns the number of instructions run, which is
+/// zero if there was nothing to run.
+nkuint32_t nkiAotRun(struct NKVM *vm, nkuint32_t budget);
+
+// ----------------------------------------------------------------------
+// Macros used by the generated code. Each generated function looks
+// like this:
+//
+//   static nkuint32_t name(struct NKVM *vm, nkuint32_t budget)
+//   {
+//       NK_AOT_BEGIN()
+//           NK_AOT_CASE(10) NK_AOT_CASE(12) ...
+//       NK_AOT_DISPATCH()
+//       NK_AOT_PUSH_INT(10, 12)
+//       NK_AOT_JZ(12, 14, 30)
+//       ...
+//       NK_AOT_FINISH(40)
+//   }
+//
+// Every instruction gets a label and a case in the switch, so the
+// function can start (or continue after an unexpected jump) anywhere.
+//
+// Like the threaded dispatch loop (nkdisp.c), the stack size and
+// pointers live in local variables. The common int and float cases
+// and stack and variable access are done inline, with operands baked
+// in as constants. Everything else, including the unusual cases for
+// the inline instructions, goes through the regular opcode function
+// with the VM state written back.
+
+#define NK_AOT_SAVE(address)                                            \
+    do {                                                                \
+        context->instructionPointer = (address);                        \
+        context->stack.size = stackSize;                                \
+    } while(0)
+
+#define NK_AOT_LOAD()                                                   \
+    do {                                                                \
+        context = vm->currentExecutionContext;                          \
+        stackValues = context->stack.values;                            \
+        stackSize = context->stack.size;                                \
+        stackCapacity = context->stack.capacity;                        \
+        stackMask = context->stack.indexMask;                           \
+    } while(0)
+
+#define NK_AOT_BEGIN()                                                  \
+    struct NKVMExecutionContext *context;                               \
+    struct NKValue *stackValues;                                        \
+    nkuint32_t stackSize;                                               \
+    nkuint32_t stackCapacity;                                           \
+    nkuint32_t stackMask;                                               \
+    nkuint32_t aotExecuted = 0;                                         \
+    NK_AOT_LOAD();                                                      \
+    (void)stackValues;                                                  \
+    (void)stackCapacity;                                                \
+    (void)stackMask;                                                    \
+  nkAot_dispatch:                                                       \
+    switch(context->instructionPointer) {
+
+#define NK_AOT_CASE(address) case (address): goto nkAot_##address;
+
+#define NK_AOT_DISPATCH()                                               \
+    default:                                                            \
+        return aotExecuted;                                             \
+    }
+
+// Start of every instruction. Counts it against the budget and the
+// garbage collection countdown the same way nkiVmIterate() does.
+#define NK_AOT_TICK(address)                                            \
+  nkAot_##address:                                                      \
+    if(aotExecuted >= budget) {                                         \
+        NK_AOT_SAVE(address);                                           \
+        return aotExecuted;                                             \
+    }                                                                   \
+    aotExecuted++;                                                      \
+    if(!--vm->gcInfo.gcCountdown) {                                     \
+        NK_AOT_SAVE(address);                                           \
+        if(!nkiVmGcCountdownExpired(vm)) {                              \
+            return aotExecuted;                                         \
+        }                                                               \
+        NK_AOT_LOAD();                                                  \
+    }
+
+// Run the opcode function for an instruction that's already been
+// counted. Leaves if that changed execution contexts or raised an
+// error, and goes back through the switch if the instruction pointer
+// didn't end up at next or target.
+#define NK_AOT_CALL_BRANCH(address, next, target, opcodeFunction)       \
+    do {                                                                \
+        NK_AOT_SAVE(address);                                           \
+        opcodeFunction(vm);                                             \
+        vm->currentExecutionContext->instructionPointer++;              \
+        if(vm->currentExecutionContext != context ||                    \
+            vm->errorState.firstError ||                                \
+            vm->errorState.allocationFailure)                           \
+        {                                                               \
+            return aotExecuted;                                         \
+        }                                                               \
+        NK_AOT_LOAD();                                                  \
+        if(context->instructionPointer == (target)) {                   \
+            goto nkAot_##target;                                        \
+        }                                                               \
+        if(context->instructionPointer != (next)) {                     \
+            goto nkAot_dispatch;                                        \
+        }                                                               \
+    } while(0)
+
+#define NK_AOT_CALL(address, next, opcodeFunction)                      \
+    do {                                                                \
+        NK_AOT_SAVE(address);                                           \
+        opcodeFunction(vm);                                             \
+        vm->currentExecutionContext->instructionPointer++;              \
+        if(vm->currentExecutionContext != context ||                    \
+            vm->errorState.firstError ||                                \
+            vm->errorState.allocationFailure)                           \
+        {                                                               \
+            return aotExecuted;                                         \
+        }                                                               \
+        NK_AOT_LOAD();                                                  \
+        if(context->instructionPointer != (next)) {                     \
+            goto nkAot_dispatch;                                        \
+        }                                                               \
+    } while(0)
+
+// Get a stack slot from a LOAD_LOCAL-style operand.
+#define NK_AOT_SLOT(index)                                              \
+    (&stackValues[                                                      \
+        ((index) >= 0 ? (nkuint32_t)(index) : stackSize + (index)) &    \
+        stackMask])
+
+/// Anything without an inline version.
+#define NK_AOT_OP(address, next, opcodeFunction)                        \
+    NK_AOT_TICK(address)                                                \
+    NK_AOT_CALL(address, next, opcodeFunction);
+
+/// The end instruction. Stop here without running it, and let the
+/// caller handle it the same way it would when interpreting.
+#define NK_AOT_END(address)                                             \
+  nkAot_##address:                                                      \
+    NK_AOT_SAVE(address);                                               \
+    return aotExecuted;
+
+/// Falling off the end of the function.
+#define NK_AOT_FINISH(address)                                          \
+    NK_AOT_SAVE(address);                                               \
+    goto nkAot_dispatch;
+
+/// PUSHLITERAL_*. The literal comes from the instruction stream.
+#define NK_AOT_PUSH(address, next, valueType, field, operandField, opcodeFunction) \
+    NK_AOT_TICK(address)                                                \
+    if(stackSize != stackCapacity) {                                    \
+        stackValues[stackSize].type = (valueType);                      \
+        stackValues[stackSize].field =                                  \
+            vm->instructions[(address) + 1].operandField;               \
+        stackSize++;                                                    \
+    } else {                                                            \
+        NK_AOT_CALL(address, next, opcodeFunction);                     \
+    }
+
+#define NK_AOT_POP(address, next)                                       \
+    NK_AOT_TICK(address)                                                \
+    if(stackSize) {                                                     \
+        stackSize--;                                                    \
+    } else {                                                            \
+        NK_AOT_CALL(address, next, nkiOpcode_pop);                      \
+    }
+
+#define NK_AOT_LOAD_LOCAL(address, next, index)                         \
+    NK_AOT_TICK(address)                                                \
+    if(stackSize != stackCapacity) {                                    \
+        stackValues[stackSize] = *NK_AOT_SLOT(index);                   \
+        stackSize++;                                                    \
+    } else {                                                            \
+        NK_AOT_CALL(address, next, nkiOpcode_loadLocal);                \
+    }
+
+#define NK_AOT_STORE_LOCAL(address, next, index)                        \
+    NK_AOT_TICK(address)                                                \
+    if(stackSize) {                                                     \
+        *NK_AOT_SLOT(index) = stackValues[stackSize - 1];               \
+    } else {                                                            \
+        NK_AOT_CALL(address, next, nkiOpcode_storeLocal);               \
+    }
+
+#define NK_AOT_POP_LOCAL(address, next, index)                          \
+    NK_AOT_TICK(address)                                                \
+    if(stackSize) {                                                     \
+        *NK_AOT_SLOT(index) = stackValues[stackSize - 1];               \
+        stackSize--;                                                    \
+    } else {                                                            \
+        NK_AOT_CALL(address, next, nkiOpcode_popLocal);                 \
+    }
+
+#define NK_AOT_MOVE_LOCAL(address, next, dstIndex, srcIndex)            \
+    NK_AOT_TICK(address)                                                \
+    *NK_AOT_SLOT(dstIndex) = *NK_AOT_SLOT(srcIndex);
+
+#define NK_AOT_LOAD_STATIC(address, next, index)                        \
+    NK_AOT_TICK(address)                                                \
+    if(stackSize != stackCapacity) {                                    \
+        stackValues[stackSize] =                                        \
+            vm->staticSpace[(index) & vm->staticAddressMask];           \
+        stackSize++;                                                    \
+    } else {                                                            \
+        NK_AOT_CALL(address, next, nkiOpcode_loadStatic);               \
+    }
+
+#define NK_AOT_STORE_STATIC(address, next, index)                       \
+    NK_AOT_TICK(address)                                                \
+    if(stackSize) {                                                     \
+        vm->staticSpace[(index) & vm->staticAddressMask] =              \
+            stackValues[stackSize - 1];                                 \
+    } else {                                                            \
+        NK_AOT_CALL(address, next, nkiOpcode_storeStatic);              \
+    }
+
+#define NK_AOT_POP_STATIC(address, next, index)                         \
+    NK_AOT_TICK(address)                                                \
+    if(stackSize) {                                                     \
+        vm->staticSpace[(index) & vm->staticAddressMask] =              \
+            stackValues[stackSize - 1];                                 \
+        stackSize--;                                                    \
+    } else {                                                            \
+        NK_AOT_CALL(address, next, nkiOpcode_popStatic);                \
+    }
+
+/// ADD, SUBTRACT, MULTIPLY, and their quickened versions.
+#define NK_AOT_ARITHMETIC(address, next, op, opcodeFunction)            \
+    NK_AOT_TICK(address)                                                \
+    if(stackSize >= 2 &&                                                \
+        stackValues[stackSize - 2].type == NK_VALUETYPE_INT &&          \
+        stackValues[stackSize - 1].type == NK_VALUETYPE_INT)            \
+    {                                                                   \
+        stackValues[stackSize - 2].intData =                            \
+            stackValues[stackSize - 2].intData op                       \
+            stackValues[stackSize - 1].intData;                         \
+        stackSize--;                                                    \
+    } else if(stackSize >= 2 &&                                         \
+        stackValues[stackSize - 2].type == NK_VALUETYPE_FLOAT &&        \
+        stackValues[stackSize - 1].type == NK_VALUETYPE_FLOAT)          \
+    {                                                                   \
+        stackValues[stackSize - 2].floatData =                          \
+            stackValues[stackSize - 2].floatData op                     \
+            stackValues[stackSize - 1].floatData;                       \
+        stackSize--;                                                    \
+    } else {                                                            \
+        NK_AOT_CALL(address, next, opcodeFunction);                     \
+    }
+
+/// ADD_LITERAL.
+#define NK_AOT_ADD_LITERAL(address, next, value)                        \
+    NK_AOT_TICK(address)                                                \
+    if(stackSize &&                                                     \
+        stackValues[stackSize - 1].type == NK_VALUETYPE_INT)            \
+    {                                                                   \
+        stackValues[stackSize - 1].intData += (value);                  \
+    } else {                                                            \
+        NK_AOT_CALL(address, next, nkiOpcode_addLiteral);               \
+    }
+
+/// ADD3, SUBTRACT3, MULTIPLY3.
+#define NK_AOT_ARITHMETIC3(address, next, op, dstIndex, index1, index2, opcodeFunction) \
+    NK_AOT_TICK(address)                                                \
+    if(NK_AOT_SLOT(index1)->type == NK_VALUETYPE_INT &&                 \
+        NK_AOT_SLOT(index2)->type == NK_VALUETYPE_INT)                  \
+    {                                                                   \
+        NK_AOT_SLOT(dstIndex)->intData =                                \
+            NK_AOT_SLOT(index1)->intData op NK_AOT_SLOT(index2)->intData; \
+        NK_AOT_SLOT(dstIndex)->type = NK_VALUETYPE_INT;                 \
+    } else if(NK_AOT_SLOT(index1)->type == NK_VALUETYPE_FLOAT &&        \
+        NK_AOT_SLOT(index2)->type == NK_VALUETYPE_FLOAT)                \
+    {                                                                   \
+        NK_AOT_SLOT(dstIndex)->floatData =                              \
+            NK_AOT_SLOT(index1)->floatData op NK_AOT_SLOT(index2)->floatData; \
+        NK_AOT_SLOT(dstIndex)->type = NK_VALUETYPE_FLOAT;               \
+    } else {                                                            \
+        NK_AOT_CALL(address, next, opcodeFunction);                     \
+    }
+
+// Runs fastPath with aotComparison set to the same -1/0/1 result
+// nkiValueCompare() would give for the top two stack values, if
+// they're both ints or both floats. Otherwise runs slowPath.
+#define NK_AOT_COMPARISON(fastPath, slowPath)                           \
+    if(stackSize >= 2 &&                                                \
+        stackValues[stackSize - 2].type == NK_VALUETYPE_INT &&          \
+        stackValues[stackSize - 1].type == NK_VALUETYPE_INT)            \
+    {                                                                   \
+        nkint32_t aotComparison =                                       \
+            stackValues[stackSize - 2].intData >                        \
+            stackValues[stackSize - 1].intData ? 1 :                    \
+            (stackValues[stackSize - 2].intData ==                      \
+                stackValues[stackSize - 1].intData ? 0 : -1);           \
+        fastPath;                                                       \
+    } else if(stackSize >= 2 &&                                         \
+        stackValues[stackSize - 2].type == NK_VALUETYPE_FLOAT &&        \
+        stackValues[stackSize - 1].type == NK_VALUETYPE_FLOAT)          \
+    {                                                                   \
+        nkint32_t aotComparison =                                       \
+            stackValues[stackSize - 2].floatData >                      \
+            stackValues[stackSize - 1].floatData ? 1 :                  \
+            (stackValues[stackSize - 2].floatData ==                    \
+                stackValues[stackSize - 1].floatData ? 0 : -1);         \
+        fastPath;                                                       \
+    } else {                                                            \
+        slowPath;                                                       \
+    }
+
+/// GREATERTHAN, LESSTHAN, etc., and their quickened versions. test
+/// is an expression using aotComparison.
+#define NK_AOT_COMPARE(address, next, test, opcodeFunction)             \
+    NK_AOT_TICK(address)                                                \
+    NK_AOT_COMPARISON(                                                  \
+        stackSize--;                                                    \
+        stackValues[stackSize - 1].type = NK_VALUETYPE_INT;             \
+        stackValues[stackSize - 1].intData = (test),                    \
+        NK_AOT_CALL(address, next, opcodeFunction))
+
+/// Fused comparison and JZ, with a target inside the function.
+#define NK_AOT_COMPARE_JZ(address, next, target, test, opcodeFunction) \
+    NK_AOT_TICK(address)                                                \
+    NK_AOT_COMPARISON(                                                  \
+        stackSize -= 2;                                                 \
+        if(!(test)) {                                                   \
+            goto nkAot_##target;                                        \
+        },                                                              \
+        NK_AOT_CALL_BRANCH(address, next, target, opcodeFunction))
+
+/// Wide JZ, with a target inside the function.
+#define NK_AOT_JZ(address, next, target)                                \
+    NK_AOT_TICK(address)                                                \
+    if(stackSize &&                                                     \
+        stackValues[stackSize - 1].type == NK_VALUETYPE_INT)            \
+    {                                                                   \
+        stackSize--;                                                    \
+        if(!stackValues[stackSize].intData) {                           \
+            goto nkAot_##target;                                        \
+        }                                                               \
+    } else {                                                            \
+        NK_AOT_CALL_BRANCH(address, next, target, nkiOpcode_jzWide);    \
+    }
+
+/// JUMP, with a target inside the function.
+#define NK_AOT_JUMP(address, target)                                    \
+    NK_AOT_TICK(address)                                                \
+    goto nkAot_##target;
+
+#endif // NINKASI_AOT_H
@@ -60,10 +60,14 @@
 #include "nkopcode.h"
 #include "nkexpr.h"
 #include "nkopt.h"
+#include "nkpeep.h"
 #include "nktoken.h"
 #include "nkdbg.h"
 #include "nkerror.h"
 #include "nkdynstr.h"
+#include "nkjit.h"
+#include "nkaot.h"
+#include "nkpool.h"
 #include "nkvm.h"
 #include "nkcompil.h"
 #include "nkstring.h"
@@ -76,5 +80,6 @@
 #include "nktable.h"
 #include "nkcorout.h"
 #include "nkfse.h"
+#include "nkdisp.h"
 
 #endif // NINKASI_COMMON_H
@@ -83,6 +83,12 @@ void nkiCompilerAddInstruction(
             nkiCompilerStackOffsetTable[inst->opcode & (NK_OPCODE_PADDEDCOUNT - 1)];
     }
 
+    // Keep track of how deep the stack gets for the function's
+    // maxStackDepth.
+    if(cs->context && cs->context->stackFrameOffset > cs->maxStackFrameOffset) {
+        cs->maxStackFrameOffset = cs->context->stackFrameOffset;
+    }
+
     cs->instructionWriteIndex++;
 }
 
@@ -180,8 +186,8 @@ void nkiCompilerPopContext(struct NKCompilerState *cs)
                 // new set of instructions here. (Assuming there's
                 // anything to pop.)
                 if(popCount) {
-                    nkiCompilerEmitPushLiteralInt(cs, popCount, nkfalse);
-                    nkiCompilerAddInstructionSimple(cs, NK_OP_POPN, nkfalse);
+                    nkiCompilerEmitWideInstruction(
+                        cs, NK_OP_DISCARD, popCount, nkfalse);
                 }
 
             // }
@@ -211,6 +217,25 @@ void nkiCompilerEmitPushLiteralInt(struct NKCompilerState *cs, nkint32_t value,
     nkiCompilerAddInstruction(cs, &inst, nkfalse);
 }
 
+void nkiCompilerEmitWideInstruction(
+    struct NKCompilerState *cs,
+    enum NKOpcode opcode,
+    nkint32_t operand,
+    nkbool adjustStackFrame)
+{
+    struct NKInstruction inst;
+
+    // Add instruction.
+    nkiMemset(&inst, 0, sizeof(inst));
+    inst.opcode = opcode;
+    nkiCompilerAddInstruction(cs, &inst, adjustStackFrame);
+
+    // Add operand.
+    nkiMemset(&inst, 0, sizeof(inst));
+    inst.opData_int = operand;
+    nkiCompilerAddInstruction(cs, &inst, nkfalse);
+}
+
 void nkiCompilerEmitPushLiteralFunctionId(
     struct NKCompilerState *cs, NKVMInternalFunctionID functionId, nkbool adjustStackFrame)
 {
@@ -242,16 +267,11 @@ void nkiCompilerEmitPushLiteralFloat(struct NKCompilerState *cs, float value, nk
     nkiCompilerAddInstruction(cs, &inst, nkfalse);
 }
 
-void nkiCompilerEmitPushLiteralString(struct NKCompilerState *cs, const char *str, nkbool adjustStackFrame)
+// Add a string table entry as an operand for the last instruction.
+static void nkiCompilerAddStringOperand(struct NKCompilerState *cs, const char *str)
 {
     struct NKInstruction inst;
 
-    // Add instruction.
-    nkiMemset(&inst, 0, sizeof(inst));
-    inst.opcode = NK_OP_PUSHLITERAL_STRING;
-    nkiCompilerAddInstruction(cs, &inst, adjustStackFrame);
-
-    // Add string table entry data as op parameter.
     nkiMemset(&inst, 0, sizeof(inst));
     inst.opData_string =
         nkiVmStringTableFindOrAddString(
@@ -269,6 +289,39 @@ void nkiCompilerEmitPushLiteralString(struct NKCompilerState *cs, const char *st
     }
 }
 
+void nkiCompilerEmitPushLiteralString(struct NKCompilerState *cs, const char *str, nkbool adjustStackFrame)
+{
+    struct NKInstruction inst;
+
+    // Add instruction.
+    nkiMemset(&inst, 0, sizeof(inst));
+    inst.opcode = NK_OP_PUSHLITERAL_STRING;
+    nkiCompilerAddInstruction(cs, &inst, adjustStackFrame);
+
+    // Add string table entry data as op parameter.
+    nkiCompilerAddStringOperand(cs, str);
+}
+
+void nkiCompilerEmitObjectFieldConst(
+    struct NKCompilerState *cs,
+    enum NKOpcode opcode,
+    const char *key,
+    nkbool adjustStackFrame)
+{
+    struct NKInstruction inst;
+
+    nkiMemset(&inst, 0, sizeof(inst));
+    inst.opcode = opcode;
+    nkiCompilerAddInstruction(cs, &inst, adjustStackFrame);
+
+    nkiCompilerAddStringOperand(cs, key);
+
+    // Empty inline cache.
+    nkiMemset(&inst, 0, sizeof(inst));
+    inst.opData_int = (nkint32_t)NK_INVALID_VALUE;
+    nkiCompilerAddInstruction(cs, &inst, nkfalse);
+}
+
 void nkiCompilerEmitPushNil(struct NKCompilerState *cs, nkbool adjustStackFrame)
 {
     nkiCompilerAddInstructionSimple(cs, NK_OP_PUSHNIL, adjustStackFrame);
@@ -354,8 +407,8 @@ struct NKCompilerStateContextVariable *nkiCompilerAddVariable(
 
         // Set the global variable's initial value.
         if(emitInitCode) {
-            nkiCompilerEmitPushLiteralInt(cs, var->position, nktrue);
-            nkiCompilerAddInstructionSimple(cs, NK_OP_STATICPOKE, nktrue);
+            nkiCompilerEmitWideInstruction(
+                cs, NK_OP_STORE_STATIC, var->position, nktrue);
             nkiCompilerAddInstructionSimple(cs, NK_OP_POP, nktrue);
         }
 
@@ -708,6 +761,8 @@ nkbool nkiCompilerCompileFunctionDefinition(
     struct NKCompilerStateContext *searchContext;
     struct NKCompilerStateContextVariable *varTmp;
     nkuint32_t functionArgumentCount = 0;
+    nkuint32_t savedMaxStackFrameOffset = cs->maxStackFrameOffset;
+    nkuint32_t entryStackFrameOffset;
 
     NKVMInternalFunctionID functionId;
     struct NKVMFunction *functionObject;
@@ -756,9 +811,8 @@ nkbool nkiCompilerCompileFunctionDefinition(
     // start programs at instruction 0 and not worry about
     // functions in the middle. If declared at global scope, this
     // will only happen once per function so whatever.
-    nkiCompilerEmitPushLiteralInt(cs, 0, nkfalse);
-    skipOffset = cs->instructionWriteIndex - 1;
-    nkiCompilerAddInstructionSimple(cs, NK_OP_JUMP_RELATIVE, nkfalse);
+    skipOffset = cs->instructionWriteIndex;
+    nkiCompilerEmitWideInstruction(cs, NK_OP_JUMP, 0, nkfalse);
 
     // This context is different from the ones we'd normally push/pop,
     // because it's parented to the global context. So we're going to
@@ -849,6 +903,10 @@ nkbool nkiCompilerCompileFunctionDefinition(
     }
     cs->context->stackFrameOffset++;
 
+    // Start counting stack depth for this function.
+    entryStackFrameOffset = cs->context->stackFrameOffset;
+    cs->maxStackFrameOffset = entryStackFrameOffset;
+
     // The CALL instruction will push this onto the stack
     // automatically.
     varTmp = nkiCompilerAddVariable(cs, "_returnPointer", nktrue, nktrue);
@@ -883,11 +941,18 @@ nkbool nkiCompilerCompileFunctionDefinition(
     }
     nkiCompilerEmitReturn(cs);
 
+    // Store the stack depth. stackFrameOffset doesn't count a few
+    // short-lived values (the return pointer, argument counts pushed
+    // right before a CALL, the context count for RETURN), so leave
+    // some room for those.
+    functionObject->maxStackDepth =
+        cs->maxStackFrameOffset - entryStackFrameOffset + 4;
+    cs->maxStackFrameOffset = savedMaxStackFrameOffset;
+
     // Go back and fix up our relative jump that skips this
     // function now that we know how long it is.
     if(cs->vm->instructions) {
-        cs->vm->instructions[skipOffset].opData_int =
-            cs->instructionWriteIndex - skipOffset - 2;
+        nkiCompilerModifyJump(cs, skipOffset, cs->instructionWriteIndex);
     }
 
     // Restore the "real" context back to the parent.
@@ -1140,6 +1205,12 @@ void nkiCompilerPartiallyFinalize(
         nkiCompilerAddInstructionSimple(cs, NK_OP_END, nkfalse);
         cs->instructionWriteIndex = oldWriteIndex;
     }
+
+#if NK_JIT
+    // Any native code is out of date now.
+    nkiJitReset(cs->vm);
+#endif
+    nkiAotRevalidate(cs->vm);
 }
 
 void nkiCompilerFinalize(
@@ -1164,9 +1235,23 @@ void nkiCompilerFinalize(
         nkiCompilerPopContext(cs);
     }
 
+    // Optimize the finished bytecode. Skip this if compilation
+    // failed, because the instruction stream might not be complete.
+    if((cs->options & (NK_COMPILER_OPTION_PEEPHOLE | NK_COMPILER_OPTION_FRAMESLOTS)) &&
+        !nkiVmHasErrors(cs->vm))
+    {
+        cs->vm->peepholeRemovedCount +=
+            nkiCompilerPeepholeOptimize(cs, cs->options);
+    }
+
     // Add a final "END" instruction.
     nkiCompilerAddInstructionSimple(cs, NK_OP_END, nktrue);
 
+#if NK_JIT
+    nkiJitReset(cs->vm);
+#endif
+    nkiAotRevalidate(cs->vm);
+
     nkiFree(cs->vm, cs);
 }
 
@@ -1217,8 +1302,8 @@ nkbool nkiCompilerCompileScript(
 nkuint32_t nkiCompilerEmitJump(struct NKCompilerState *cs, nkuint32_t target)
 {
     nkuint32_t instructionWriteIndex = cs->instructionWriteIndex;
-    nkiCompilerEmitPushLiteralInt(cs, (target - instructionWriteIndex) - 3, nktrue);
-    nkiCompilerAddInstructionSimple(cs, NK_OP_JUMP_RELATIVE, nktrue);
+    nkiCompilerEmitWideInstruction(
+        cs, NK_OP_JUMP, (target - instructionWriteIndex) - 2, nktrue);
     return instructionWriteIndex;
 }
 
@@ -1226,8 +1311,8 @@ nkuint32_t nkiCompilerEmitJump(struct NKCompilerState *cs, nkuint32_t target)
 nkuint32_t nkiCompilerEmitJumpIfZero(struct NKCompilerState *cs, nkuint32_t target)
 {
     nkuint32_t instructionWriteIndex = cs->instructionWriteIndex;
-    nkiCompilerEmitPushLiteralInt(cs, (target - instructionWriteIndex) - 3, nktrue);
-    nkiCompilerAddInstructionSimple(cs, NK_OP_JUMP_IF_ZERO, nktrue);
+    nkiCompilerEmitWideInstruction(
+        cs, NK_OP_JZ, (target - instructionWriteIndex) - 2, nktrue);
     return instructionWriteIndex;
 }
 
@@ -1238,21 +1323,18 @@ struct NKInstruction *nkiCompilerGetInstruction(struct NKCompilerState *cs, nkui
 
 void nkiCompilerModifyJump(
     struct NKCompilerState *cs,
-    nkuint32_t pushLiteralBeforeJumpAddress,
+    nkuint32_t jumpAddress,
     nkuint32_t target)
 {
-    struct NKInstruction *pushLitInst =
-        nkiCompilerGetInstruction(cs, pushLiteralBeforeJumpAddress);
     struct NKInstruction *jumpInst =
-        nkiCompilerGetInstruction(cs, pushLiteralBeforeJumpAddress + 2);
+        nkiCompilerGetInstruction(cs, jumpAddress);
 
-    assert(pushLitInst->opcode == NK_OP_PUSHLITERAL_INT);
     assert(
-        jumpInst->opcode == NK_OP_JUMP_RELATIVE ||
-        jumpInst->opcode == NK_OP_JUMP_IF_ZERO);
+        jumpInst->opcode == NK_OP_JUMP ||
+        jumpInst->opcode == NK_OP_JZ);
 
-    nkiCompilerGetInstruction(cs, pushLiteralBeforeJumpAddress + 1)->opData_int =
-        (target - pushLiteralBeforeJumpAddress) - 3;
+    nkiCompilerGetInstruction(cs, jumpAddress + 1)->opData_int =
+        (target - jumpAddress) - 2;
 }
 
 nkbool nkiCompilerCompileIfStatement(struct NKCompilerState *cs)
@@ -1273,7 +1355,7 @@ nkbool nkiCompilerCompileIfStatement(struct NKCompilerState *cs)
         return nkfalse;
     }
 
-    // Add the NK_OP_JUMP_IF_ZERO, and save the literal address so we can
+    // Add the NK_OP_JZ, and save the jump address so we can
     // fill it in after we know how much we're going to have to skip.
     skipAddressWritePtr = nkiCompilerEmitJumpIfZero(cs, 0);
 
@@ -1303,9 +1385,8 @@ nkbool nkiCompilerCompileIfStatement(struct NKCompilerState *cs)
         // go back and modify it after the inner code is complete.
         skipAddressWritePtrElse = nkiCompilerEmitJump(cs, 0);
 
-        // Increase our skip amount to account for the
-        // NK_OP_PUSHLITERAL_INT and NK_OP_JUMP_RELATIVE we added to skip
-        // past the "else" clause.
+        // Increase our skip amount to account for the NK_OP_JUMP we
+        // added to skip past the "else" clause.
         nkiCompilerModifyJump(cs, skipAddressWritePtr, cs->instructionWriteIndex);
 
         // Generate code to execute if test fails.
@@ -1374,7 +1455,7 @@ nkbool nkiCompilerCompileWhileStatement(struct NKCompilerState *cs)
         return nkfalse;
     }
 
-    // Add the NK_OP_JUMP_IF_ZERO, and save the literal address so we can
+    // Add the NK_OP_JZ, and save the jump address so we can
     // fill it in after we know how much we're going to have to skip.
     skipAddressWritePtr = nkiCompilerEmitJumpIfZero(cs, 0);
 
@@ -1618,8 +1699,8 @@ nkbool nkiCompilerCompileBreakStatement(struct NKCompilerState *cs)
 
     // Pop off every context's data between the break statement and
     // the loop context.
-    nkiCompilerEmitPushLiteralInt(cs, contextLevel - loopContextLevel, nkfalse);
-    nkiCompilerAddInstructionSimple(cs, NK_OP_POPN, nkfalse);
+    nkiCompilerEmitWideInstruction(
+        cs, NK_OP_DISCARD, contextLevel - loopContextLevel, nkfalse);
 
     {
         nkuint32_t jumpFixup = nkiCompilerEmitJump(cs, 0);
@@ -99,6 +99,13 @@ struct NKCompilerState
     nkuint32_t recursionCount;
 
     nkuint32_t staticVariableCount;
+
+    // Deepest stackFrameOffset seen so far in the function being
+    // compiled. Becomes the function's maxStackDepth.
+    nkuint32_t maxStackFrameOffset;
+
+    // NKCompilerOption flags.
+    nkuint32_t options;
 };
 
 extern nkint32_t nkiCompilerStackOffsetTable[NK_OPCODE_PADDEDCOUNT];
@@ -198,7 +205,24 @@ void nkiCompilerEmitPushLiteralFloat(struct NKCompilerState *cs, float value, nk
 void nkiCompilerEmitPushLiteralString(struct NKCompilerState *cs, const char *str, nkbool adjustStackFrame);
 void nkiCompilerEmitPushLiteralFunctionId(
     struct NKCompilerState *cs, NKVMInternalFunctionID functionId, nkbool adjustStackFrame);
+
+/// Emit a wide instruction (opcode followed by an inline operand
+/// word). Stack frame adjustment uses the opcode's normal entry in
+/// the stack offset table.
+void nkiCompilerEmitWideInstruction(
+    struct NKCompilerState *cs,
+    enum NKOpcode opcode,
+    nkint32_t operand,
+    nkbool adjustStackFrame);
 void nkiCompilerEmitPushNil(struct NKCompilerState *cs, nkbool adjustStackFrame);
+
+/// Emit one of the *_CONST field instructions, with a string literal
+/// key operand and an empty inline cache operand.
+void nkiCompilerEmitObjectFieldConst(
+    struct NKCompilerState *cs,
+    enum NKOpcode opcode,
+    const char *key,
+    nkbool adjustStackFrame);
 void nkiCompilerEmitReturn(struct NKCompilerState *cs);
 
 /// Emit a jump instruction. Return value is the index of the jump
@@ -214,7 +238,7 @@ nkuint32_t nkiCompilerEmitJumpIfZero(struct NKCompilerState *cs, nkuint32_t targ
 /// Go back and fix up a jump address with a new target.
 void nkiCompilerModifyJump(
     struct NKCompilerState *cs,
-    nkuint32_t pushLiteralBeforeJumpAddress,
+    nkuint32_t jumpAddress,
     nkuint32_t target);
 
 // ----------------------------------------------------------------------
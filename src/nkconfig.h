@@ -44,4 +44,40 @@
 #ifndef NINKASI_VMCONFIG_H
 #define NINKASI_VMCONFIG_H
 
+// Threaded instruction dispatch. This uses the "labels as values"
+// (computed goto) extension that GCC and Clang support, so it's only
+// turned on by default for those compilers. Everything else
+// (including the Watcom/DOS builds) uses the portable nkiVmIterate()
+// loop. Define this to 0 to force the portable loop everywhere.
+#ifndef NK_THREADED_DISPATCH
+#  if defined(__GNUC__) && !defined(__DOS__)
+#    define NK_THREADED_DISPATCH 1
+#  else
+#    define NK_THREADED_DISPATCH 0
+#  endif
+#endif
+
+// Baseline JIT (see nkjit.h). Off unless NK_JIT is defined to 1
+// (./configure --enable-jit). Only x86-64 Linux with threaded
+// dispatch is supported, so it's quietly turned off anywhere else.
+#ifndef NK_JIT
+#  define NK_JIT 0
+#endif
+#if NK_JIT && (!NK_THREADED_DISPATCH || !defined(__x86_64__) || !defined(__linux__))
+#  undef NK_JIT
+#  define NK_JIT 0
+#endif
+
+// Number of calls to a function, or backwards branches to the same
+// instruction, before the JIT compiles it.
+#ifndef NK_JIT_HOT_THRESHOLD
+#  define NK_JIT_HOT_THRESHOLD 50
+#endif
+
+// Size of the JIT's code buffer, per VM. Once it fills up, nothing
+// else gets compiled.
+#ifndef NK_JIT_CODE_SIZE
+#  define NK_JIT_CODE_SIZE (1024 * 1024)
+#endif
+
 #endif // NINKASI_VMCONFIG_H
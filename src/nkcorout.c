@@ -98,8 +98,9 @@ void nkiCoroutineLibrary_coroutineSerializeData(
     // matters because it means we have to allocate a new object to
     // store stuff in.
     if(!context) {
-        context = (struct NKVMExecutionContext *)nkiMalloc(
-            vm, sizeof(struct NKVMExecutionContext));
+        context = (struct NKVMExecutionContext *)nkiMallocCategory(
+            vm, sizeof(struct NKVMExecutionContext),
+            NK_MEMORY_CATEGORY_COROUTINES);
 
         nkiMemset(context, 0, sizeof(*context));
 
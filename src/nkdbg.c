@@ -190,7 +190,7 @@ void nkiDbgDumpState(struct NKVM *vm, const char *script, FILE *stream)
         // checking.
         nkuint32_t *bucketTracker = (nkuint32_t *)nkiMallocArray(
             vm, sizeof(nkuint32_t), vm->stringTable.capacity);
-        for(i = 0; i < nkiVmStringHashTableSize; i++) {
+        for(i = 0; i < vm->stringsByHashSize; i++) {
             struct NKVMString *str = vm->stringsByHash[i];
             while(str) {
                 bucketTracker[str->stringTableIndex] = i;
@@ -202,13 +202,14 @@ void nkiDbgDumpState(struct NKVM *vm, const char *script, FILE *stream)
     fprintf(stream, "  strings:\n");
     for(i = 0; i < vm->stringTable.capacity; i++) {
         if(vm->stringTable.stringTable[i]) {
+            const char *data = nkiVmStringGetData(vm, vm->stringTable.stringTable[i]);
             fprintf(stream, "    string " NK_PRINTF_UINT32 ":\n", i);
             fprintf(stream, "      stringTableIndex: " NK_PRINTF_UINT32 "\n", vm->stringTable.stringTable[i]->stringTableIndex);
             fprintf(stream, "      dontGC:           " NK_PRINTF_UINT32 "\n", (nkuint32_t)(vm->stringTable.stringTable[i]->dontGC ? 1 : 0));
-            fprintf(stream, "      hash:             " NK_PRINTF_UINT32 "\n", vm->stringTable.stringTable[i]->hash);
-            fprintf(stream, "      data:             %s\n", vm->stringTable.stringTable[i]->str);
+            fprintf(stream, "      hash:             " NK_PRINTF_UINT32 "\n", nkiVmStringGetHash(vm, vm->stringTable.stringTable[i]));
+            fprintf(stream, "      data:             %s\n", data);
             fprintf(stream, "      lastGCPass:       " NK_PRINTF_UINT32 "\n", vm->stringTable.stringTable[i]->lastGCPass);
-            nkiDbgDumpRaw(stream, vm->stringTable.stringTable[i]->str, nkiStrlen(vm->stringTable.stringTable[i]->str));
+            nkiDbgDumpRaw(stream, (void *)data, vm->stringTable.stringTable[i]->length);
             fprintf(stream, "\n");
         }
     }
@@ -246,24 +247,35 @@ void nkiDbgDumpState(struct NKVM *vm, const char *script, FILE *stream)
             fprintf(stream, "      lastGCPass: " NK_PRINTF_UINT32 "\n", ob->lastGCPass);
             fprintf(stream, "      size: " NK_PRINTF_UINT32 "\n", ob->size);
             fprintf(stream, "      external handles: " NK_PRINTF_UINT32 "\n", ob->externalHandleCount);
-            fprintf(stream, "      hashbuckets:\n");
+            fprintf(stream, "      arrayCapacity: " NK_PRINTF_UINT32 "\n", ob->arrayCapacity);
+            fprintf(stream, "      arrayCount: " NK_PRINTF_UINT32 "\n", ob->arrayCount);
+            fprintf(stream, "      array:\n");
             {
                 nkuint32_t n;
-                for(n = 0; n < nkiVMObjectHashBucketCount; n++) {
+                for(n = 0; n < ob->arrayCapacity; n++) {
+                    if(!nkiVmObjectArraySlotIsEmpty(&ob->arrayPart[n])) {
+                        fprintf(stream, "        " NK_PRINTF_UINT32 ": ", n);
+                        nkiValueDump(vm, &ob->arrayPart[n], stream);
+                        fprintf(stream, "\n");
+                    }
+                }
+            }
+            fprintf(stream, "      fieldCapacity: " NK_PRINTF_UINT32 "\n", ob->fieldCapacity);
+            fprintf(stream, "      fields:\n");
+            {
+                nkuint32_t n;
+                for(n = 0; n < ob->fieldCapacity; n++) {
                     // FIXME: Output values here in a deterministic
-                    // order, instead of just however they showed up
-                    // in the list?
-                    struct NKVMObjectElement *el = ob->hashBuckets[n];
-                    if(el) {
+                    // order, instead of just however they ended up
+                    // in the table?
+                    struct NKVMObjectElement *el = &ob->fields[n];
+                    if(!nkiVmObjectSlotIsEmpty(el)) {
                         fprintf(stream, "        " NK_PRINTF_UINT32 ":\n", n);
-                        while(el) {
-                            fprintf(stream, "          key: ");
-                            nkiValueDump(vm, &el->key, stream);
-                            fprintf(stream, "\n          value: ");
-                            nkiValueDump(vm, &el->value, stream);
-                            fprintf(stream, "\n");
-                            el = el->next;
-                        }
+                        fprintf(stream, "          key: ");
+                        nkiValueDump(vm, &el->key, stream);
+                        fprintf(stream, "\n          value: ");
+                        nkiValueDump(vm, &el->value, stream);
+                        fprintf(stream, "\n");
                     }
                 }
             }
@@ -282,6 +294,7 @@ void nkiDbgDumpState(struct NKVM *vm, const char *script, FILE *stream)
         fprintf(stream, "  " NK_PRINTF_UINT32 ":\n", i);
         fprintf(stream, "    argumentCount: " NK_PRINTF_UINT32 "\n", vm->functionTable[i].argumentCount);
         fprintf(stream, "    firstInstructionIndex: " NK_PRINTF_UINT32 "\n", vm->functionTable[i].firstInstructionIndex);
+        fprintf(stream, "    maxStackDepth: " NK_PRINTF_UINT32 "\n", vm->functionTable[i].maxStackDepth);
         fprintf(stream, "    externalFunctionId: " NK_PRINTF_UINT32 "\n", vm->functionTable[i].externalFunctionId.id);
     }
 
@@ -296,7 +309,9 @@ void nkiDbgDumpState(struct NKVM *vm, const char *script, FILE *stream)
         fprintf(stream, "    argumentCount: " NK_PRINTF_UINT32 "\n", vm->externalFunctionTable[i].argumentCount);
         fprintf(stream, "    argTypes: " NK_PRINTF_UINT32 "\n", vm->externalFunctionTable[i].argumentCount);
 
-        if(vm->externalFunctionTable[i].argumentCount != NK_INVALID_VALUE) {
+        if(vm->externalFunctionTable[i].argumentCount != NK_INVALID_VALUE &&
+            vm->externalFunctionTable[i].argTypes)
+        {
             nkuint32_t n;
             for(n = 0; n < vm->externalFunctionTable[i].argumentCount; n++) {
 
@@ -340,11 +355,24 @@ void nkiDbgDumpState(struct NKVM *vm, const char *script, FILE *stream)
     fprintf(stream, "  gcCountdown: " NK_PRINTF_UINT32 "\n", vm->gcInfo.gcCountdown);
     fprintf(stream, "  gcNewObjectInterval: " NK_PRINTF_UINT32 "\n", vm->gcInfo.gcNewObjectInterval);
     fprintf(stream, "  gcNewObjectCountdown: " NK_PRINTF_UINT32 "\n", vm->gcInfo.gcNewObjectCountdown);
+    fprintf(stream, "  gcIncrementalBudget: " NK_PRINTF_UINT32 "\n", vm->gcInfo.gcIncrementalBudget);
+    fprintf(stream, "  gcPhase: " NK_PRINTF_UINT32 "\n", vm->gcState.phase);
 
     // TODO: Memory limits (even if not serialized).
 
     // Check allocations? Same number?
     fprintf(stream, "Current memory usage: " NK_PRINTF_UINT32 "\n", vm->currentMemoryUsage);
+    fprintf(stream, "Peak memory usage: " NK_PRINTF_UINT32 "\n", vm->peakMemoryUsage);
+
+    // Breakdown by category (current/peak).
+    fprintf(stream, "Memory usage by category:\n");
+    for(i = 0; i < NK_MEMORY_CATEGORY_COUNT; i++) {
+        fprintf(
+            stream, "  %s: " NK_PRINTF_UINT32 " / " NK_PRINTF_UINT32 "\n",
+            nkiMemCategoryGetName((enum NKMemoryCategory)i),
+            vm->categoryMemoryUsage[i],
+            vm->categoryPeakMemoryUsage[i]);
+    }
 }
 
 void nkiCheckStringTableHoles(struct NKVM *vm)
@@ -376,7 +404,7 @@ void nkiCheckStringTableHoles(struct NKVM *vm)
             }
         }
 
-        for(n = 0; n < nkiVmStringHashTableSize; n++) {
+        for(n = 0; n < vm->stringsByHashSize; n++) {
 
             struct NKVMString *str = vm->stringsByHash[n];
 
@@ -398,7 +426,7 @@ void nkiVmStringTableDump(struct NKVM *vm)
     printf("String table dump...\n");
 
     printf("  Hash table...\n");
-    for(i = 0; i < nkiVmStringHashTableSize  ; i++) {
+    for(i = 0; i < vm->stringsByHashSize; i++) {
         struct NKVMString *str = vm->stringsByHash[i];
         printf("    %.2x\n", i);
         while(str) {
@@ -411,7 +439,7 @@ void nkiVmStringTableDump(struct NKVM *vm)
     for(i = 0; i < table->capacity; i++) {
         struct NKVMString *str = table->stringTable[i];
         printf("    %.2x\n", i);
-        printf("      %s\n", str ? str->str : "<null>");
+        printf("      %s\n", str ? nkiVmStringGetData(vm, str) : "<null>");
     }
 }
 
@@ -423,21 +451,27 @@ void nkiVmObjectTableDump(struct NKVM *vm)
         if(vm->objectTable.objectTable[index]) {
 
             struct NKVMObject *ob = vm->objectTable.objectTable[index];
-            nkuint32_t bucket;
+            nkuint32_t slot;
 
             printf("%4u ", index);
             printf("Object\n");
 
-            for(bucket = 0; bucket < nkiVMObjectHashBucketCount; bucket++) {
-                struct NKVMObjectElement *el = ob->hashBuckets[bucket];
-                printf("      Hash bucket %u\n", bucket);
-                while(el) {
-                    printf("        ");
+            for(slot = 0; slot < ob->arrayCapacity; slot++) {
+                if(!nkiVmObjectArraySlotIsEmpty(&ob->arrayPart[slot])) {
+                    printf("      Array %u: ", slot);
+                    nkiValueDump(vm, &ob->arrayPart[slot], stdout);
+                    printf("\n");
+                }
+            }
+
+            for(slot = 0; slot < ob->fieldCapacity; slot++) {
+                struct NKVMObjectElement *el = &ob->fields[slot];
+                if(!nkiVmObjectSlotIsEmpty(el)) {
+                    printf("      Slot %u: ", slot);
                     nkiValueDump(vm, &el->key, stdout);
                     printf(" = ");
                     nkiValueDump(vm, &el->value, stdout);
                     printf("\n");
-                    el = el->next;
                 }
             }
             printf("\n");
@@ -487,7 +521,7 @@ nkbool nkiValueDump(
 
         case NK_VALUETYPE_STRING: {
             const char *str = nkiVmStringTableGetStringById(
-                &vm->stringTable,
+                vm,
                 value->stringTableEntry);
             char escapedBuf[80];
             if(!str) str = "<bad id>";
@@ -625,6 +659,11 @@ void nkiDbgDumpListing(struct NKVM *vm, const char *script, FILE *stream)
     char lineBuf[80];
     char paramBuf[80];
 
+    if(vm->peepholeRemovedCount) {
+        fprintf(stream, "Peephole optimizer removed " NK_PRINTF_UINT32 " instructions.\n",
+            vm->peepholeRemovedCount);
+    }
+
     if(vm->instructions) {
         for(i = 0; i <= vm->instructionAddressMask; i++) {
 
@@ -657,11 +696,42 @@ void nkiDbgDumpListing(struct NKVM *vm, const char *script, FILE *stream)
                 i++;
                 sprintf(paramBuf, " %u", maybeParams->opData_functionId.id);
             } else if(vm->instructions[i].opcode == NK_OP_PUSHLITERAL_STRING) {
-                const char *str = nkiVmStringTableGetStringById(&vm->stringTable, maybeParams->opData_string);
+                const char *str = nkiVmStringTableGetStringById(vm, maybeParams->opData_string);
                 i++;
                 sprintf(paramBuf, " %d:\"", maybeParams->opData_string);
                 nkiDbgAppendEscaped(sizeof(paramBuf), paramBuf, str ? str : "<bad string>");
                 nkiDbgAppendLine(sizeof(paramBuf), paramBuf, "\"");
+            } else if(nkiVmOpcodeHasInlineCache(opcode)) {
+                // Key string and inline cache.
+                const char *str = nkiVmStringTableGetStringById(vm, maybeParams->opData_string);
+                char slotBuf[24];
+                sprintf(paramBuf, " %d:\"", maybeParams->opData_string);
+                nkiDbgAppendEscaped(sizeof(paramBuf), paramBuf, str ? str : "<bad string>");
+                sprintf(slotBuf, "\" (slot %d)",
+                    vm->instructions[(i + 2) & vm->instructionAddressMask].opData_int);
+                nkiDbgAppendLine(sizeof(paramBuf), paramBuf, slotBuf);
+                i += 2;
+            } else if(vm->instructions[i].opcode == NK_OP_JUMP ||
+                vm->instructions[i].opcode == NK_OP_JZ ||
+                (vm->instructions[i].opcode >= NK_OP_GREATERTHAN_JZ &&
+                    vm->instructions[i].opcode <= NK_OP_NOTEQUAL_JZ))
+            {
+                // Show the absolute target along with the offset.
+                sprintf(paramBuf, " %d (" NK_PRINTF_UINT32 ")",
+                    maybeParams->opData_int,
+                    (nkuint32_t)(i + 2 + maybeParams->opData_int));
+                i++;
+            } else if(nkiVmGetOpcodeOperandCount(opcode)) {
+                // Wide instructions.
+                nkuint32_t operandCount = nkiVmGetOpcodeOperandCount(opcode);
+                paramBuf[0] = 0;
+                while(operandCount--) {
+                    char operandBuf[16];
+                    i++;
+                    sprintf(operandBuf, " %d",
+                        vm->instructions[i & vm->instructionAddressMask].opData_int);
+                    nkiDbgAppendLine(sizeof(paramBuf), paramBuf, operandBuf);
+                }
             } else {
                 paramBuf[0] = 0;
             }
@@ -0,0 +1,1154 @@
+// ----------------------------------------------------------------------
+//
+//        ▐ ▄ ▪   ▐ ▄ ▄ •▄  ▄▄▄· .▄▄ · ▪
+//       •█▌▐███ •█▌▐██▌▄▌▪▐█ ▀█ ▐█ ▀. ██
+//       ▐█▐▐▌▐█·▐█▐▐▌▐▀▀▄·▄█▀▀█ ▄▀▀▀█▄▐█·
+//       ██▐█▌▐█▌██▐█▌▐█.█▌▐█ ▪▐▌▐█▄▪▐█▐█▌
+//       ▀▀ █▪▀▀▀▀▀ █▪·▀  ▀ ▀  ▀  ▀▀▀▀ ▀▀▀
+//
+// ----------------------------------------------------------------------
+//
+//   Ninkasi 0.01
+//
+//   By Kiri "ExpiredPopsicle" Jolly
+//     https://expiredpopsicle.com
+//     https://intoxicoding.com
+//     expiredpopsicle@gmail.com
+//
+// ----------------------------------------------------------------------
+//
+//   Copyright (c) 2017 Kiri Jolly
+//
+//   Permission is hereby granted, free of charge, to any person
+//   obtaining a copy of this software and associated documentation files
+//   (the "Software"), to deal in the Software without restriction,
+//   including without limitation the rights to use, copy, modify, merge,
+//   publish, distribute, sublicense, and/or sell copies of the Software,
+//   and to permit persons to whom the Software is furnished to do so,
+//   subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be
+//   included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+//   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+//   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+//   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+//   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+//   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//   SOFTWARE.
+//
+// -------------------------- END HEADER -------------------------------------
+
+#include "nkcommon.h"
+
+#if NK_THREADED_DISPATCH
+
+// Copy the values we keep in local variables back into the VM, so
+// that opcode functions, the garbage collector, and anything else
+// outside of this loop can see them.
+#define NK_DISPATCH_SAVE()                                      \
+    do {                                                        \
+        context->instructionPointer = ip;                       \
+        context->stack.size = stackSize;                        \
+    } while(0)
+
+// Reload everything we keep in local variables. Needed after calling
+// anything that might have switched execution contexts, reallocated
+// the stack, or moved the instruction pointer.
+#define NK_DISPATCH_LOAD()                                      \
+    do {                                                        \
+        context = vm->currentExecutionContext;                  \
+        stackValues = context->stack.values;                    \
+        stackSize = context->stack.size;                        \
+        stackCapacity = context->stack.capacity;                \
+        stackMask = context->stack.indexMask;                   \
+        instructions = vm->instructions;                        \
+        instructionMask = vm->instructionAddressMask;           \
+        ip = context->instructionPointer;                       \
+    } while(0)
+
+// Jump straight to the handler for the instruction at ip.
+#define NK_DISPATCH_NEXT()                                      \
+    goto *dispatchTable[                                        \
+        instructions[ip & instructionMask].opcode &             \
+        (NK_OPCODE_PADDEDCOUNT - 1)]
+
+// Count a straight run of instructions against the caller's budget
+// and the garbage collection countdown. This may run a garbage
+// collection pass. If the instruction count limit has been reached,
+// we stop here, without executing the current instruction.
+#define NK_DISPATCH_ACCOUNT(runLength)                          \
+    do {                                                        \
+        nkuint32_t accountRunLength = (runLength);              \
+        executed += accountRunLength;                           \
+        if(accountRunLength < vm->gcInfo.gcCountdown) {         \
+            vm->gcInfo.gcCountdown -= accountRunLength;         \
+        } else {                                                \
+            NK_DISPATCH_SAVE();                                 \
+            if(!nkiVmDispatchCountdown(vm, accountRunLength)) { \
+                return executed;                                \
+            }                                                   \
+            NK_DISPATCH_LOAD();                                 \
+        }                                                       \
+    } while(0)
+
+// Done with a branch or call. Bail out on errors or once the budget
+// is used up, otherwise start a new straight run of instructions
+// wherever we ended up.
+#define NK_DISPATCH_CHECK()                                     \
+    do {                                                        \
+        if(vm->errorState.firstError ||                         \
+            vm->errorState.allocationFailure ||                 \
+            executed >= count)                                  \
+        {                                                       \
+            NK_DISPATCH_SAVE();                                 \
+            return executed;                                    \
+        }                                                       \
+        NK_DISPATCH_NATIVE();                                   \
+        runStart = ip;                                          \
+        NK_DISPATCH_NEXT();                                     \
+    } while(0)
+
+// With the JIT, every branch target gets checked for native code,
+// and backwards branches count towards compiling it. Without it, only
+// VMs with ahead-of-time compiled code (nkaot.h) need to look.
+#if NK_JIT
+#define NK_DISPATCH_NATIVE() goto dispatch_native
+#else
+#define NK_DISPATCH_NATIVE()                                    \
+    do {                                                        \
+        if(vm->aotModule) {                                     \
+            goto dispatch_native;                               \
+        }                                                       \
+    } while(0)
+#endif
+
+// Compare the top two stack values, for ints or floats only, and
+// put the result in the local variable "comparison". Produces the
+// same -1/0/1 result that nkiValueCompare() would. Doesn't modify
+// the stack.
+#define NK_DISPATCH_GET_COMPARISON()                                    \
+    do {                                                                \
+        struct NKValue *in1;                                            \
+        struct NKValue *in2;                                            \
+        if(stackSize < 2) {                                             \
+            goto dispatch_generic;                                      \
+        }                                                               \
+        in2 = &stackValues[stackSize - 1];                              \
+        in1 = &stackValues[stackSize - 2];                              \
+        if(in1->type == NK_VALUETYPE_INT &&                             \
+            in2->type == NK_VALUETYPE_INT)                              \
+        {                                                               \
+            comparison =                                                \
+                in1->intData > in2->intData ? 1 :                       \
+                (in1->intData == in2->intData ? 0 : -1);                \
+        } else if(in1->type == NK_VALUETYPE_FLOAT &&                    \
+            in2->type == NK_VALUETYPE_FLOAT)                            \
+        {                                                               \
+            comparison =                                                \
+                in1->floatData > in2->floatData ? 1 :                   \
+                (in1->floatData == in2->floatData ? 0 : -1);            \
+        } else {                                                        \
+            goto dispatch_generic;                                      \
+        }                                                               \
+    } while(0)
+
+// Two-operand comparison on the top two stack values, replacing them
+// with the result. Quickens the instruction into the int or float
+// version for next time.
+#define NK_DISPATCH_COMPARE(test, intOpcode, floatOpcode)               \
+    do {                                                                \
+        nkint32_t comparison;                                           \
+        NK_DISPATCH_GET_COMPARISON();                                   \
+        instructions[ip & instructionMask].opcode =                     \
+            stackValues[stackSize - 1].type == NK_VALUETYPE_INT ?       \
+            (intOpcode) : (floatOpcode);                                \
+        stackSize--;                                                    \
+        stackValues[stackSize - 1].type = NK_VALUETYPE_INT;             \
+        stackValues[stackSize - 1].intData = (test);                    \
+        ip++;                                                           \
+        NK_DISPATCH_NEXT();                                             \
+    } while(0)
+
+// Fused comparison and JZ. Pops both values and jumps if the
+// comparison is false.
+#define NK_DISPATCH_COMPARE_JZ(test)                                    \
+    do {                                                                \
+        nkint32_t comparison;                                           \
+        NK_DISPATCH_GET_COMPARISON();                                   \
+        NK_DISPATCH_ACCOUNT(ip - runStart + 1);                         \
+        stackSize -= 2;                                                 \
+        if(!(test)) {                                                   \
+            ip += instructions[(ip + 1) & instructionMask].opData_int;  \
+        }                                                               \
+        ip += 2;                                                        \
+        NK_DISPATCH_CHECK();                                            \
+    } while(0)
+
+// Two-operand arithmetic on the top two stack values, when both are
+// ints or both are floats. Quickens the instruction into the int or
+// float version for next time.
+#define NK_DISPATCH_ARITHMETIC(op, intOpcode, floatOpcode)              \
+    do {                                                                \
+        struct NKValue *in1;                                            \
+        struct NKValue *in2;                                            \
+        if(stackSize < 2) {                                             \
+            goto dispatch_generic;                                      \
+        }                                                               \
+        in2 = &stackValues[stackSize - 1];                              \
+        in1 = &stackValues[stackSize - 2];                              \
+        if(in1->type == NK_VALUETYPE_INT &&                             \
+            in2->type == NK_VALUETYPE_INT)                              \
+        {                                                               \
+            in1->intData = in1->intData op in2->intData;                \
+            instructions[ip & instructionMask].opcode = (intOpcode);    \
+        } else if(in1->type == NK_VALUETYPE_FLOAT &&                    \
+            in2->type == NK_VALUETYPE_FLOAT)                            \
+        {                                                               \
+            in1->floatData = in1->floatData op in2->floatData;          \
+            instructions[ip & instructionMask].opcode = (floatOpcode);  \
+        } else {                                                        \
+            goto dispatch_generic;                                      \
+        }                                                               \
+        stackSize--;                                                    \
+        ip++;                                                           \
+        NK_DISPATCH_NEXT();                                             \
+    } while(0)
+
+// Quickened arithmetic. Anything other than the expected types goes
+// to the opcode function, which will de-quicken the instruction.
+#define NK_DISPATCH_QUICK_ARITHMETIC(valueType, field, op)              \
+    do {                                                                \
+        struct NKValue *in1;                                            \
+        struct NKValue *in2;                                            \
+        if(stackSize < 2) {                                             \
+            goto dispatch_generic;                                      \
+        }                                                               \
+        in2 = &stackValues[stackSize - 1];                              \
+        in1 = &stackValues[stackSize - 2];                              \
+        if(in1->type != (valueType) || in2->type != (valueType)) {      \
+            goto dispatch_generic;                                      \
+        }                                                               \
+        in1->field = in1->field op in2->field;                          \
+        stackSize--;                                                    \
+        ip++;                                                           \
+        NK_DISPATCH_NEXT();                                             \
+    } while(0)
+
+// Quickened comparison.
+#define NK_DISPATCH_QUICK_COMPARE(valueType, field, test)               \
+    do {                                                                \
+        struct NKValue *in1;                                            \
+        struct NKValue *in2;                                            \
+        nkint32_t comparison;                                           \
+        if(stackSize < 2) {                                             \
+            goto dispatch_generic;                                      \
+        }                                                               \
+        in2 = &stackValues[stackSize - 1];                              \
+        in1 = &stackValues[stackSize - 2];                              \
+        if(in1->type != (valueType) || in2->type != (valueType)) {      \
+            goto dispatch_generic;                                      \
+        }                                                               \
+        comparison =                                                    \
+            in1->field > in2->field ? 1 :                               \
+            (in1->field == in2->field ? 0 : -1);                        \
+        in1->type = NK_VALUETYPE_INT;                                   \
+        in1->intData = (test);                                          \
+        stackSize--;                                                    \
+        ip++;                                                           \
+        NK_DISPATCH_NEXT();                                             \
+    } while(0)
+
+// Get a stack slot from a LOAD_LOCAL-style operand.
+#define NK_DISPATCH_SLOT(operandIndex)                                  \
+    (&stackValues[                                                      \
+        ((instructions[(ip + (operandIndex)) & instructionMask].opData_int >= 0) ? \
+            (nkuint32_t)instructions[(ip + (operandIndex)) & instructionMask].opData_int : \
+            stackSize + instructions[(ip + (operandIndex)) & instructionMask].opData_int) & \
+        stackMask])
+
+// Three-address arithmetic on frame slots, for two ints or two
+// floats.
+#define NK_DISPATCH_ARITHMETIC3(op)                                     \
+    do {                                                                \
+        struct NKValue *dst = NK_DISPATCH_SLOT(1);                      \
+        struct NKValue *in1 = NK_DISPATCH_SLOT(2);                      \
+        struct NKValue *in2 = NK_DISPATCH_SLOT(3);                      \
+        if(in1->type == NK_VALUETYPE_INT &&                             \
+            in2->type == NK_VALUETYPE_INT)                              \
+        {                                                               \
+            dst->intData = in1->intData op in2->intData;                \
+            dst->type = NK_VALUETYPE_INT;                               \
+        } else if(in1->type == NK_VALUETYPE_FLOAT &&                    \
+            in2->type == NK_VALUETYPE_FLOAT)                            \
+        {                                                               \
+            dst->floatData = in1->floatData op in2->floatData;          \
+            dst->type = NK_VALUETYPE_FLOAT;                             \
+        } else {                                                        \
+            goto dispatch_generic;                                      \
+        }                                                               \
+        ip += 4;                                                        \
+        runStart += 3;                                                  \
+        NK_DISPATCH_NEXT();                                             \
+    } while(0)
+
+// Slow path for NK_DISPATCH_ACCOUNT(). Also used by the JIT.
+nkbool nkiVmDispatchCountdown(
+    struct NKVM *vm, nkuint32_t runLength)
+{
+    while(vm->gcInfo.gcCountdown && runLength >= vm->gcInfo.gcCountdown) {
+        runLength -= vm->gcInfo.gcCountdown;
+        if(!nkiVmGcCountdownExpired(vm)) {
+            return nkfalse;
+        }
+    }
+
+    vm->gcInfo.gcCountdown -= runLength;
+    return nktrue;
+}
+
+// Inline cache check for the *_CONST field instructions. Returns the
+// field if objectValue is an object with keyString in the slot the
+// cache remembers, or NULL if we have to take the slow path.
+static struct NKValue *nkiDispatchCachedField(
+    struct NKVM *vm, const struct NKValue *objectValue,
+    nkuint32_t keyString, nkint32_t cachedSlot, nkbool forWrite)
+{
+    struct NKVMObject *ob;
+    nkuint32_t slot = (nkuint32_t)cachedSlot;
+
+    if(objectValue->type != NK_VALUETYPE_OBJECTID) {
+        return NULL;
+    }
+
+    ob = nkiVmObjectTableGetEntryById(&vm->objectTable, objectValue->objectId);
+    if(!ob || !nkiVmObjectSlotHasStringKey(ob, slot, keyString)) {
+        return NULL;
+    }
+
+    if(forWrite) {
+        nkiVmGcObjectBarrier(vm, ob);
+    }
+
+    return &ob->fields[slot].value;
+}
+
+nkuint32_t nkiVmIterateThreaded(struct NKVM *vm, nkuint32_t count)
+{
+    static void *dispatchTable[NK_OPCODE_PADDEDCOUNT];
+    static nkbool dispatchTableReady = nkfalse;
+
+    struct NKVMExecutionContext *context;
+    struct NKValue *stackValues;
+    nkuint32_t stackSize;
+    nkuint32_t stackCapacity;
+    nkuint32_t stackMask;
+    struct NKInstruction *instructions;
+    nkuint32_t instructionMask;
+    nkuint32_t ip;
+
+    // First instruction of the current straight run, minus any
+    // operand words inside the run. ip - runStart + 1 is the number of
+    // instructions in the run so far, including the current one.
+    nkuint32_t runStart;
+
+    nkuint32_t executed = 0;
+
+    if(!dispatchTableReady) {
+
+        nkuint32_t i;
+
+        // Anything without an inline version goes through the opcode
+        // function table.
+        for(i = 0; i < NK_OPCODE_PADDEDCOUNT; i++) {
+            dispatchTable[i] = &&dispatch_generic;
+        }
+
+        dispatchTable[NK_OP_NOP]                    = &&op_nop;
+        dispatchTable[NK_OP_END]                    = &&op_end;
+        dispatchTable[NK_OP_ADD]                    = &&op_add;
+        dispatchTable[NK_OP_SUBTRACT]               = &&op_subtract;
+        dispatchTable[NK_OP_MULTIPLY]               = &&op_multiply;
+        dispatchTable[NK_OP_PUSHLITERAL_INT]        = &&op_pushLiteral_int;
+        dispatchTable[NK_OP_PUSHLITERAL_FLOAT]      = &&op_pushLiteral_float;
+        dispatchTable[NK_OP_PUSHLITERAL_STRING]     = &&op_pushLiteral_string;
+        dispatchTable[NK_OP_PUSHLITERAL_FUNCTIONID] = &&op_pushLiteral_functionId;
+        dispatchTable[NK_OP_PUSHNIL]                = &&op_pushNil;
+        dispatchTable[NK_OP_POP]                    = &&op_pop;
+        dispatchTable[NK_OP_POPN]                   = &&op_popN;
+        dispatchTable[NK_OP_STACKPEEK]              = &&op_stackPeek;
+        dispatchTable[NK_OP_STACKPOKE]              = &&op_stackPoke;
+        dispatchTable[NK_OP_STATICPEEK]             = &&op_staticPeek;
+        dispatchTable[NK_OP_STATICPOKE]             = &&op_staticPoke;
+        dispatchTable[NK_OP_JUMP_RELATIVE]          = &&op_jumpRelative;
+        dispatchTable[NK_OP_JUMP_IF_ZERO]           = &&op_jz;
+        dispatchTable[NK_OP_GREATERTHAN]            = &&op_gt;
+        dispatchTable[NK_OP_LESSTHAN]               = &&op_lt;
+        dispatchTable[NK_OP_GREATERTHANOREQUAL]     = &&op_ge;
+        dispatchTable[NK_OP_LESSTHANOREQUAL]        = &&op_le;
+        dispatchTable[NK_OP_EQUAL]                  = &&op_eq;
+        dispatchTable[NK_OP_NOTEQUAL]               = &&op_ne;
+        dispatchTable[NK_OP_NOT]                    = &&op_not;
+        dispatchTable[NK_OP_LOAD_LOCAL]             = &&op_loadLocal;
+        dispatchTable[NK_OP_STORE_LOCAL]            = &&op_storeLocal;
+        dispatchTable[NK_OP_LOAD_STATIC]            = &&op_loadStatic;
+        dispatchTable[NK_OP_STORE_STATIC]           = &&op_storeStatic;
+        dispatchTable[NK_OP_JUMP]                   = &&op_jump;
+        dispatchTable[NK_OP_JZ]                     = &&op_jzWide;
+        dispatchTable[NK_OP_DISCARD]                = &&op_discard;
+        dispatchTable[NK_OP_GREATERTHAN_JZ]         = &&op_gtJz;
+        dispatchTable[NK_OP_LESSTHAN_JZ]            = &&op_ltJz;
+        dispatchTable[NK_OP_GREATERTHANOREQUAL_JZ]  = &&op_geJz;
+        dispatchTable[NK_OP_LESSTHANOREQUAL_JZ]     = &&op_leJz;
+        dispatchTable[NK_OP_EQUAL_JZ]               = &&op_eqJz;
+        dispatchTable[NK_OP_NOTEQUAL_JZ]            = &&op_neJz;
+        dispatchTable[NK_OP_ADD_LOCALS]             = &&op_addLocals;
+        dispatchTable[NK_OP_ADD_LITERAL]            = &&op_addLiteral;
+        dispatchTable[NK_OP_ADD_INT]                = &&op_addInt;
+        dispatchTable[NK_OP_ADD_FLOAT]              = &&op_addFloat;
+        dispatchTable[NK_OP_SUBTRACT_INT]           = &&op_subtractInt;
+        dispatchTable[NK_OP_SUBTRACT_FLOAT]         = &&op_subtractFloat;
+        dispatchTable[NK_OP_MULTIPLY_INT]           = &&op_multiplyInt;
+        dispatchTable[NK_OP_MULTIPLY_FLOAT]         = &&op_multiplyFloat;
+        dispatchTable[NK_OP_GREATERTHAN_INT]        = &&op_gtInt;
+        dispatchTable[NK_OP_GREATERTHAN_FLOAT]      = &&op_gtFloat;
+        dispatchTable[NK_OP_LESSTHAN_INT]           = &&op_ltInt;
+        dispatchTable[NK_OP_LESSTHAN_FLOAT]         = &&op_ltFloat;
+        dispatchTable[NK_OP_GREATERTHANOREQUAL_INT] = &&op_geInt;
+        dispatchTable[NK_OP_GREATERTHANOREQUAL_FLOAT] = &&op_geFloat;
+        dispatchTable[NK_OP_LESSTHANOREQUAL_INT]    = &&op_leInt;
+        dispatchTable[NK_OP_LESSTHANOREQUAL_FLOAT]  = &&op_leFloat;
+        dispatchTable[NK_OP_EQUAL_INT]              = &&op_eqInt;
+        dispatchTable[NK_OP_EQUAL_FLOAT]            = &&op_eqFloat;
+        dispatchTable[NK_OP_NOTEQUAL_INT]           = &&op_neInt;
+        dispatchTable[NK_OP_NOTEQUAL_FLOAT]         = &&op_neFloat;
+        dispatchTable[NK_OP_ADD3]                   = &&op_add3;
+        dispatchTable[NK_OP_SUBTRACT3]              = &&op_subtract3;
+        dispatchTable[NK_OP_MULTIPLY3]              = &&op_multiply3;
+        dispatchTable[NK_OP_ADD3_LITERAL]           = &&op_add3Literal;
+        dispatchTable[NK_OP_MOVE_LOCAL]             = &&op_moveLocal;
+        dispatchTable[NK_OP_POP_LOCAL]              = &&op_popLocal;
+        dispatchTable[NK_OP_POP_STATIC]             = &&op_popStatic;
+        dispatchTable[NK_OP_OBJECTFIELDGET_CONST]   = &&op_objectFieldGetConst;
+        dispatchTable[NK_OP_OBJECTFIELDSET_CONST]   = &&op_objectFieldSetConst;
+        dispatchTable[NK_OP_OBJECTFIELDGET_NOPOP_CONST] = &&op_objectFieldGetConstNoPop;
+
+        dispatchTableReady = nktrue;
+    }
+
+    if(!count || nkiVmHasErrors(vm)) {
+        return 0;
+    }
+
+    NK_DISPATCH_LOAD();
+    runStart = ip;
+    if(vm->aotModule) {
+        goto dispatch_native;
+    }
+    NK_DISPATCH_NEXT();
+
+    // ----------------------------------------------------------------------
+    // Fallback for everything that isn't handled inline. Also handles
+    // the unusual cases (type mismatches, stack growth, errors) for
+    // the inline opcodes. Treated like a branch, because the opcode
+    // function can do anything.
+
+dispatch_generic:
+
+    NK_DISPATCH_ACCOUNT(ip - runStart + 1);
+    NK_DISPATCH_SAVE();
+
+    nkiOpcodeTable[
+        instructions[ip & instructionMask].opcode &
+        (NK_OPCODE_PADDEDCOUNT - 1)](vm);
+    vm->currentExecutionContext->instructionPointer++;
+
+    NK_DISPATCH_LOAD();
+    NK_DISPATCH_CHECK();
+
+    // ----------------------------------------------------------------------
+    // Landed somewhere after a branch or call. Run native code from
+    // here if there is any, ahead-of-time compiled code first. runStart
+    // is still the start of the run that got us here, so if we're at
+    // or before it, this was a backwards branch.
+
+dispatch_native:
+    {
+#if NK_JIT
+        nkbool backwardBranch = ip <= runStart;
+#endif
+
+        for(;;) {
+
+            nkuint32_t nativeCount;
+
+            NK_DISPATCH_SAVE();
+            nativeCount = nkiAotRun(vm, count - executed);
+
+#if NK_JIT
+            if(!nativeCount) {
+                void *entry = nkiJitFindEntry(vm, ip, backwardBranch);
+                if(entry) {
+                    nativeCount = nkiJitRun(vm, entry, count - executed);
+                }
+            }
+#endif
+
+            if(!nativeCount) {
+                break;
+            }
+
+            executed += nativeCount;
+            NK_DISPATCH_LOAD();
+            if(vm->errorState.firstError ||
+                vm->errorState.allocationFailure ||
+                executed >= count)
+            {
+                return executed;
+            }
+
+#if NK_JIT
+            backwardBranch = nkfalse;
+#endif
+        }
+
+        runStart = ip;
+        NK_DISPATCH_NEXT();
+    }
+
+    // ----------------------------------------------------------------------
+    // End of the program. Stop here without executing it, so the
+    // caller can handle it the same way it would without threaded
+    // dispatch.
+
+op_end:
+
+    NK_DISPATCH_ACCOUNT(ip - runStart);
+    NK_DISPATCH_SAVE();
+    return executed;
+
+    // ----------------------------------------------------------------------
+    // Literals and basic stack manipulation.
+
+op_nop:
+
+    ip++;
+    NK_DISPATCH_NEXT();
+
+op_pushLiteral_int:
+
+    if(stackSize == stackCapacity) {
+        goto dispatch_generic;
+    }
+    stackValues[stackSize].type = NK_VALUETYPE_INT;
+    stackValues[stackSize].intData =
+        instructions[(ip + 1) & instructionMask].opData_int;
+    stackSize++;
+    ip += 2;
+    runStart++;
+    NK_DISPATCH_NEXT();
+
+op_pushLiteral_float:
+
+    if(stackSize == stackCapacity) {
+        goto dispatch_generic;
+    }
+    stackValues[stackSize].type = NK_VALUETYPE_FLOAT;
+    stackValues[stackSize].floatData =
+        instructions[(ip + 1) & instructionMask].opData_float;
+    stackSize++;
+    ip += 2;
+    runStart++;
+    NK_DISPATCH_NEXT();
+
+op_pushLiteral_string:
+
+    if(stackSize == stackCapacity) {
+        goto dispatch_generic;
+    }
+    stackValues[stackSize].type = NK_VALUETYPE_STRING;
+    stackValues[stackSize].stringTableEntry =
+        instructions[(ip + 1) & instructionMask].opData_string;
+    stackSize++;
+    ip += 2;
+    runStart++;
+    NK_DISPATCH_NEXT();
+
+op_pushLiteral_functionId:
+
+    if(stackSize == stackCapacity) {
+        goto dispatch_generic;
+    }
+    stackValues[stackSize].type = NK_VALUETYPE_FUNCTIONID;
+    stackValues[stackSize].functionId =
+        instructions[(ip + 1) & instructionMask].opData_functionId;
+    stackSize++;
+    ip += 2;
+    runStart++;
+    NK_DISPATCH_NEXT();
+
+op_pushNil:
+
+    if(stackSize == stackCapacity) {
+        goto dispatch_generic;
+    }
+    stackValues[stackSize].type = NK_VALUETYPE_NIL;
+    stackSize++;
+    ip++;
+    NK_DISPATCH_NEXT();
+
+op_pop:
+
+    if(!stackSize) {
+        goto dispatch_generic;
+    }
+    stackSize--;
+    ip++;
+    NK_DISPATCH_NEXT();
+
+op_popN:
+
+    if(!stackSize ||
+        stackValues[stackSize - 1].type != NK_VALUETYPE_INT ||
+        (nkuint32_t)stackValues[stackSize - 1].intData > stackSize - 1)
+    {
+        goto dispatch_generic;
+    }
+    stackSize -= 1 + (nkuint32_t)stackValues[stackSize - 1].intData;
+    ip++;
+    NK_DISPATCH_NEXT();
+
+    // ----------------------------------------------------------------------
+    // Variable access.
+
+op_stackPeek:
+    {
+        struct NKValue *top;
+        if(!stackSize) {
+            goto dispatch_generic;
+        }
+        top = &stackValues[stackSize - 1];
+        if(top->type != NK_VALUETYPE_INT) {
+            goto dispatch_generic;
+        }
+
+        // The index gets replaced with the value it points to.
+        if(top->intData >= 0) {
+            *top = stackValues[(nkuint32_t)top->intData & stackMask];
+        } else {
+            *top = stackValues[
+                ((stackSize - 1) + top->intData) & stackMask];
+        }
+
+        ip++;
+        NK_DISPATCH_NEXT();
+    }
+
+op_stackPoke:
+    {
+        nkint32_t index;
+        if(!stackSize ||
+            stackValues[stackSize - 1].type != NK_VALUETYPE_INT)
+        {
+            goto dispatch_generic;
+        }
+        index = stackValues[stackSize - 1].intData;
+        stackSize--;
+
+        if(index >= 0) {
+            stackValues[(nkuint32_t)index & stackMask] =
+                stackValues[(stackSize - 1) & stackMask];
+        } else {
+            stackValues[(stackSize + index) & stackMask] =
+                stackValues[(stackSize - 1) & stackMask];
+        }
+
+        ip++;
+        NK_DISPATCH_NEXT();
+    }
+
+op_staticPeek:
+    {
+        struct NKValue *top;
+        if(!stackSize) {
+            goto dispatch_generic;
+        }
+        top = &stackValues[stackSize - 1];
+        if(top->type != NK_VALUETYPE_INT) {
+            goto dispatch_generic;
+        }
+        *top = vm->staticSpace[top->intData & vm->staticAddressMask];
+        ip++;
+        NK_DISPATCH_NEXT();
+    }
+
+op_staticPoke:
+    {
+        nkint32_t index;
+        if(!stackSize ||
+            stackValues[stackSize - 1].type != NK_VALUETYPE_INT)
+        {
+            goto dispatch_generic;
+        }
+        index = stackValues[stackSize - 1].intData;
+        stackSize--;
+        vm->staticSpace[index & vm->staticAddressMask] =
+            stackValues[(stackSize - 1) & stackMask];
+        ip++;
+        NK_DISPATCH_NEXT();
+    }
+
+    // ----------------------------------------------------------------------
+    // Wide variable access. Operands come from the next instruction
+    // word.
+
+op_loadLocal:
+    {
+        nkint32_t index;
+        if(stackSize == stackCapacity) {
+            goto dispatch_generic;
+        }
+        index = instructions[(ip + 1) & instructionMask].opData_int;
+        if(index >= 0) {
+            stackValues[stackSize] =
+                stackValues[(nkuint32_t)index & stackMask];
+        } else {
+            stackValues[stackSize] =
+                stackValues[(stackSize + index) & stackMask];
+        }
+        stackSize++;
+        ip += 2;
+        runStart++;
+        NK_DISPATCH_NEXT();
+    }
+
+op_storeLocal:
+    {
+        nkint32_t index;
+        if(!stackSize) {
+            goto dispatch_generic;
+        }
+        index = instructions[(ip + 1) & instructionMask].opData_int;
+        if(index >= 0) {
+            stackValues[(nkuint32_t)index & stackMask] =
+                stackValues[stackSize - 1];
+        } else {
+            stackValues[(stackSize + index) & stackMask] =
+                stackValues[stackSize - 1];
+        }
+        ip += 2;
+        runStart++;
+        NK_DISPATCH_NEXT();
+    }
+
+op_loadStatic:
+
+    if(stackSize == stackCapacity) {
+        goto dispatch_generic;
+    }
+    stackValues[stackSize] = vm->staticSpace[
+        instructions[(ip + 1) & instructionMask].opData_int &
+        vm->staticAddressMask];
+    stackSize++;
+    ip += 2;
+    runStart++;
+    NK_DISPATCH_NEXT();
+
+op_storeStatic:
+
+    if(!stackSize) {
+        goto dispatch_generic;
+    }
+    vm->staticSpace[
+        instructions[(ip + 1) & instructionMask].opData_int &
+        vm->staticAddressMask] = stackValues[stackSize - 1];
+    ip += 2;
+    runStart++;
+    NK_DISPATCH_NEXT();
+
+op_discard:
+    {
+        nkuint32_t discardCount =
+            instructions[(ip + 1) & instructionMask].opData_int;
+        if(discardCount > stackSize) {
+            goto dispatch_generic;
+        }
+        stackSize -= discardCount;
+        ip += 2;
+        runStart++;
+        NK_DISPATCH_NEXT();
+    }
+
+    // ----------------------------------------------------------------------
+    // Branches.
+
+op_jumpRelative:
+
+    if(!stackSize ||
+        stackValues[stackSize - 1].type != NK_VALUETYPE_INT)
+    {
+        goto dispatch_generic;
+    }
+    NK_DISPATCH_ACCOUNT(ip - runStart + 1);
+    stackSize--;
+    ip += stackValues[stackSize].intData;
+    ip++;
+    NK_DISPATCH_CHECK();
+
+op_jz:
+
+    if(stackSize < 2 ||
+        stackValues[stackSize - 1].type != NK_VALUETYPE_INT ||
+        stackValues[stackSize - 2].type != NK_VALUETYPE_INT)
+    {
+        goto dispatch_generic;
+    }
+    NK_DISPATCH_ACCOUNT(ip - runStart + 1);
+    stackSize -= 2;
+    if(stackValues[stackSize].intData == 0) {
+        ip += stackValues[stackSize + 1].intData;
+    }
+    ip++;
+    NK_DISPATCH_CHECK();
+
+op_jump:
+
+    NK_DISPATCH_ACCOUNT(ip - runStart + 1);
+    ip += instructions[(ip + 1) & instructionMask].opData_int + 2;
+    NK_DISPATCH_CHECK();
+
+op_jzWide:
+
+    if(!stackSize ||
+        stackValues[stackSize - 1].type != NK_VALUETYPE_INT)
+    {
+        goto dispatch_generic;
+    }
+    NK_DISPATCH_ACCOUNT(ip - runStart + 1);
+    stackSize--;
+    if(stackValues[stackSize].intData == 0) {
+        ip += instructions[(ip + 1) & instructionMask].opData_int;
+    }
+    ip += 2;
+    NK_DISPATCH_CHECK();
+
+op_gtJz:
+    NK_DISPATCH_COMPARE_JZ(comparison == 1);
+
+op_ltJz:
+    NK_DISPATCH_COMPARE_JZ(comparison == -1);
+
+op_geJz:
+    NK_DISPATCH_COMPARE_JZ(comparison == 0 || comparison == 1);
+
+op_leJz:
+    NK_DISPATCH_COMPARE_JZ(comparison == 0 || comparison == -1);
+
+op_eqJz:
+    NK_DISPATCH_COMPARE_JZ(comparison == 0);
+
+op_neJz:
+    NK_DISPATCH_COMPARE_JZ(comparison != 0);
+
+    // ----------------------------------------------------------------------
+    // Math and comparisons.
+
+op_add:
+    NK_DISPATCH_ARITHMETIC(+, NK_OP_ADD_INT, NK_OP_ADD_FLOAT);
+
+op_subtract:
+    NK_DISPATCH_ARITHMETIC(-, NK_OP_SUBTRACT_INT, NK_OP_SUBTRACT_FLOAT);
+
+op_multiply:
+    NK_DISPATCH_ARITHMETIC(*, NK_OP_MULTIPLY_INT, NK_OP_MULTIPLY_FLOAT);
+
+op_gt:
+    NK_DISPATCH_COMPARE(comparison == 1,
+        NK_OP_GREATERTHAN_INT, NK_OP_GREATERTHAN_FLOAT);
+
+op_lt:
+    NK_DISPATCH_COMPARE(comparison == -1,
+        NK_OP_LESSTHAN_INT, NK_OP_LESSTHAN_FLOAT);
+
+op_ge:
+    NK_DISPATCH_COMPARE(comparison == 0 || comparison == 1,
+        NK_OP_GREATERTHANOREQUAL_INT, NK_OP_GREATERTHANOREQUAL_FLOAT);
+
+op_le:
+    NK_DISPATCH_COMPARE(comparison == 0 || comparison == -1,
+        NK_OP_LESSTHANOREQUAL_INT, NK_OP_LESSTHANOREQUAL_FLOAT);
+
+op_eq:
+    NK_DISPATCH_COMPARE(comparison == 0,
+        NK_OP_EQUAL_INT, NK_OP_EQUAL_FLOAT);
+
+op_ne:
+    NK_DISPATCH_COMPARE(comparison != 0,
+        NK_OP_NOTEQUAL_INT, NK_OP_NOTEQUAL_FLOAT);
+
+    // ----------------------------------------------------------------------
+    // Quickened math and comparisons.
+
+op_addInt:
+    NK_DISPATCH_QUICK_ARITHMETIC(NK_VALUETYPE_INT, intData, +);
+
+op_addFloat:
+    NK_DISPATCH_QUICK_ARITHMETIC(NK_VALUETYPE_FLOAT, floatData, +);
+
+op_subtractInt:
+    NK_DISPATCH_QUICK_ARITHMETIC(NK_VALUETYPE_INT, intData, -);
+
+op_subtractFloat:
+    NK_DISPATCH_QUICK_ARITHMETIC(NK_VALUETYPE_FLOAT, floatData, -);
+
+op_multiplyInt:
+    NK_DISPATCH_QUICK_ARITHMETIC(NK_VALUETYPE_INT, intData, *);
+
+op_multiplyFloat:
+    NK_DISPATCH_QUICK_ARITHMETIC(NK_VALUETYPE_FLOAT, floatData, *);
+
+op_gtInt:
+    NK_DISPATCH_QUICK_COMPARE(NK_VALUETYPE_INT, intData, comparison == 1);
+
+op_gtFloat:
+    NK_DISPATCH_QUICK_COMPARE(NK_VALUETYPE_FLOAT, floatData, comparison == 1);
+
+op_ltInt:
+    NK_DISPATCH_QUICK_COMPARE(NK_VALUETYPE_INT, intData, comparison == -1);
+
+op_ltFloat:
+    NK_DISPATCH_QUICK_COMPARE(NK_VALUETYPE_FLOAT, floatData, comparison == -1);
+
+op_geInt:
+    NK_DISPATCH_QUICK_COMPARE(NK_VALUETYPE_INT, intData, comparison == 0 || comparison == 1);
+
+op_geFloat:
+    NK_DISPATCH_QUICK_COMPARE(NK_VALUETYPE_FLOAT, floatData, comparison == 0 || comparison == 1);
+
+op_leInt:
+    NK_DISPATCH_QUICK_COMPARE(NK_VALUETYPE_INT, intData, comparison == 0 || comparison == -1);
+
+op_leFloat:
+    NK_DISPATCH_QUICK_COMPARE(NK_VALUETYPE_FLOAT, floatData, comparison == 0 || comparison == -1);
+
+op_eqInt:
+    NK_DISPATCH_QUICK_COMPARE(NK_VALUETYPE_INT, intData, comparison == 0);
+
+op_eqFloat:
+    NK_DISPATCH_QUICK_COMPARE(NK_VALUETYPE_FLOAT, floatData, comparison == 0);
+
+op_neInt:
+    NK_DISPATCH_QUICK_COMPARE(NK_VALUETYPE_INT, intData, comparison != 0);
+
+op_neFloat:
+    NK_DISPATCH_QUICK_COMPARE(NK_VALUETYPE_FLOAT, floatData, comparison != 0);
+
+op_not:
+
+    if(!stackSize ||
+        stackValues[stackSize - 1].type != NK_VALUETYPE_INT)
+    {
+        goto dispatch_generic;
+    }
+    stackValues[stackSize - 1].intData =
+        !stackValues[stackSize - 1].intData;
+    ip++;
+    NK_DISPATCH_NEXT();
+
+    // ----------------------------------------------------------------------
+    // Arithmetic superinstructions.
+
+op_addLocals:
+    {
+        nkint32_t index1;
+        nkint32_t index2;
+        struct NKValue *in1;
+        struct NKValue *in2;
+
+        if(stackSize == stackCapacity) {
+            goto dispatch_generic;
+        }
+
+        // Both indices are relative to the stack before the push.
+        index1 = instructions[(ip + 1) & instructionMask].opData_int;
+        index2 = instructions[(ip + 2) & instructionMask].opData_int;
+        in1 = &stackValues[
+            (index1 >= 0 ? (nkuint32_t)index1 : stackSize + index1) & stackMask];
+        in2 = &stackValues[
+            (index2 >= 0 ? (nkuint32_t)index2 : stackSize + index2) & stackMask];
+
+        if(in1->type == NK_VALUETYPE_INT &&
+            in2->type == NK_VALUETYPE_INT)
+        {
+            stackValues[stackSize].intData = in1->intData + in2->intData;
+            stackValues[stackSize].type = NK_VALUETYPE_INT;
+        } else if(in1->type == NK_VALUETYPE_FLOAT &&
+            in2->type == NK_VALUETYPE_FLOAT)
+        {
+            stackValues[stackSize].floatData = in1->floatData + in2->floatData;
+            stackValues[stackSize].type = NK_VALUETYPE_FLOAT;
+        } else {
+            goto dispatch_generic;
+        }
+
+        stackSize++;
+        ip += 3;
+        runStart += 2;
+        NK_DISPATCH_NEXT();
+    }
+
+op_addLiteral:
+
+    if(!stackSize ||
+        stackValues[stackSize - 1].type != NK_VALUETYPE_INT)
+    {
+        goto dispatch_generic;
+    }
+    stackValues[stackSize - 1].intData +=
+        instructions[(ip + 1) & instructionMask].opData_int;
+    ip += 2;
+    runStart++;
+    NK_DISPATCH_NEXT();
+
+    // ----------------------------------------------------------------------
+    // Frame slot instructions.
+
+op_add3:
+    NK_DISPATCH_ARITHMETIC3(+);
+
+op_subtract3:
+    NK_DISPATCH_ARITHMETIC3(-);
+
+op_multiply3:
+    NK_DISPATCH_ARITHMETIC3(*);
+
+op_add3Literal:
+    {
+        struct NKValue *dst = NK_DISPATCH_SLOT(1);
+        struct NKValue *in1 = NK_DISPATCH_SLOT(2);
+        if(in1->type != NK_VALUETYPE_INT) {
+            goto dispatch_generic;
+        }
+        dst->intData = in1->intData +
+            instructions[(ip + 3) & instructionMask].opData_int;
+        dst->type = NK_VALUETYPE_INT;
+        ip += 4;
+        runStart += 3;
+        NK_DISPATCH_NEXT();
+    }
+
+op_moveLocal:
+
+    *NK_DISPATCH_SLOT(1) = *NK_DISPATCH_SLOT(2);
+    ip += 3;
+    runStart += 2;
+    NK_DISPATCH_NEXT();
+
+op_popLocal:
+
+    if(!stackSize) {
+        goto dispatch_generic;
+    }
+    *NK_DISPATCH_SLOT(1) = stackValues[stackSize - 1];
+    stackSize--;
+    ip += 2;
+    runStart++;
+    NK_DISPATCH_NEXT();
+
+op_popStatic:
+
+    if(!stackSize) {
+        goto dispatch_generic;
+    }
+    vm->staticSpace[
+        instructions[(ip + 1) & instructionMask].opData_int &
+        vm->staticAddressMask] = stackValues[stackSize - 1];
+    stackSize--;
+    ip += 2;
+    runStart++;
+    NK_DISPATCH_NEXT();
+
+    // Constant key field access. These only handle inline cache hits
+    // themselves. Misses, removals, and errors go through the opcode
+    // functions, which also fill in the cache.
+
+op_objectFieldGetConst:
+    {
+        struct NKValue *field;
+
+        if(!stackSize) {
+            goto dispatch_generic;
+        }
+
+        field = nkiDispatchCachedField(
+            vm, &stackValues[stackSize - 1],
+            instructions[(ip + 1) & instructionMask].opData_string,
+            instructions[(ip + 2) & instructionMask].opData_int,
+            nkfalse);
+        if(!field) {
+            goto dispatch_generic;
+        }
+
+        stackValues[stackSize - 1] = *field;
+        ip += 3;
+        runStart += 2;
+        NK_DISPATCH_NEXT();
+    }
+
+op_objectFieldGetConstNoPop:
+    {
+        struct NKValue *field;
+
+        if(!stackSize || stackSize == stackCapacity) {
+            goto dispatch_generic;
+        }
+
+        field = nkiDispatchCachedField(
+            vm, &stackValues[stackSize - 1],
+            instructions[(ip + 1) & instructionMask].opData_string,
+            instructions[(ip + 2) & instructionMask].opData_int,
+            nkfalse);
+        if(!field) {
+            goto dispatch_generic;
+        }
+
+        stackValues[stackSize] = *field;
+        stackSize++;
+        ip += 3;
+        runStart += 2;
+        NK_DISPATCH_NEXT();
+    }
+
+op_objectFieldSetConst:
+    {
+        struct NKValue *field;
+
+        // Setting something to nil removes it, so leave that to the
+        // opcode function.
+        if(stackSize < 2 ||
+            stackValues[stackSize - 2].type == NK_VALUETYPE_NIL)
+        {
+            goto dispatch_generic;
+        }
+
+        field = nkiDispatchCachedField(
+            vm, &stackValues[stackSize - 1],
+            instructions[(ip + 1) & instructionMask].opData_string,
+            instructions[(ip + 2) & instructionMask].opData_int,
+            nktrue);
+        if(!field) {
+            goto dispatch_generic;
+        }
+
+        // Pop the object and leave the value.
+        *field = stackValues[stackSize - 2];
+        stackSize--;
+        ip += 3;
+        runStart += 2;
+        NK_DISPATCH_NEXT();
+    }
+}
+
+#endif // NK_THREADED_DISPATCH
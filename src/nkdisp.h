@@ -0,0 +1,86 @@
+// ----------------------------------------------------------------------
+//
+//        ▐ ▄ ▪   ▐ ▄ ▄ •▄  ▄▄▄· .▄▄ · ▪
+//       •█▌▐███ •█▌▐██▌▄▌▪▐█ ▀█ ▐█ ▀. ██
+//       ▐█▐▐▌▐█·▐█▐▐▌▐▀▀▄·▄█▀▀█ ▄▀▀▀█▄▐█·
+//       ██▐█▌▐█▌██▐█▌▐█.█▌▐█ ▪▐▌▐█▄▪▐█▐█▌
+//       ▀▀ █▪▀▀▀▀▀ █▪·▀  ▀ ▀  ▀  ▀▀▀▀ ▀▀▀
+//
+// ----------------------------------------------------------------------
+//
+//   Ninkasi 0.01
+//
+//   By Kiri "ExpiredPopsicle" Jolly
+//     https://expiredpopsicle.com
+//     https://intoxicoding.com
+//     expiredpopsicle@gmail.com
+//
+// ----------------------------------------------------------------------
+//
+//   Copyright (c) 2017 Kiri Jolly
+//
+//   Permission is hereby granted, free of charge, to any person
+//   obtaining a copy of this software and associated documentation files
+//   (the "Software"), to deal in the Software without restriction,
+//   including without limitation the rights to use, copy, modify, merge,
+//   publish, distribute, sublicense, and/or sell copies of the Software,
+//   and to permit persons to whom the Software is furnished to do so,
+//   subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be
+//   included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+//   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+//   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+//   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+//   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+//   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//   SOFTWARE.
+//
+// -------------------------- END HEADER -------------------------------------
+
+// Threaded instruction dispatch. This is a faster alternative to
+// calling nkiVmIterate() in a loop. Each opcode handler jumps
+// directly to the next one through a table of label addresses
+// instead of returning to a central loop, and the common opcodes are
+// handled inline instead of through the opcode function table.
+//
+// Instruction counting, periodic garbage collection, and error
+// checking only happen at branches, calls, and anything else that
+// falls back to the opcode function table. Straight runs of inline
+// opcodes cannot raise errors (they fall back to the regular opcode
+// functions whenever anything looks unusual), so nothing is missed.
+//
+// This depends on a compiler extension, so it's only available when
+// NK_THREADED_DISPATCH is set (see nkconfig.h). nkiVmIterate() is
+// still the portable version.
+
+#ifndef NINKASI_DISPATCH_H
+#define NINKASI_DISPATCH_H
+
+#include "nkconfig.h"
+#include "nktypes.h"
+
+struct NKVM;
+
+#if NK_THREADED_DISPATCH
+
+/// Run instructions until at least count instructions have executed,
+/// an error occurs, or the instruction pointer reaches an end
+/// instruction. The end instruction itself is not executed. Because
+/// the count is only checked at branches and calls, this may run
+/// slightly past count. Returns the number of instructions actually
+/// executed.
+nkuint32_t nkiVmIterateThreaded(struct NKVM *vm, nkuint32_t count);
+
+/// Count a straight run of instructions against the garbage
+/// collection countdown when it's about to expire, possibly more than
+/// once for a very long run. Returns nkfalse if the instruction count
+/// limit was reached.
+nkbool nkiVmDispatchCountdown(struct NKVM *vm, nkuint32_t runLength);
+
+#endif // NK_THREADED_DISPATCH
+
+#endif // NINKASI_DISPATCH_H
@@ -90,9 +90,7 @@ void nkiDynStrAppendInt32(struct NKDynString *dynStr, nkint32_t value)
 {
     // +1 for terminator, +1 for '-'.
     char tmp[NK_PRINTF_INTCHARSNEED + 1];
-    sprintf(tmp,
-        NK_PRINTF_INT32,
-        value);
+    nkiFormatInt32(tmp, value);
     nkiDynStrAppend(dynStr, tmp);
 }
 
@@ -100,9 +98,7 @@ void nkiDynStrAppendUint32(struct NKDynString *dynStr, nkuint32_t value)
 {
     // +1 for terminator, +1 for '-'.
     char tmp[NK_PRINTF_UINTCHARSNEED + 1];
-    sprintf(tmp,
-        NK_PRINTF_UINT32,
-        value);
+    nkiFormatUint32(tmp, value);
     nkiDynStrAppend(dynStr, tmp);
 }
 
@@ -111,7 +107,7 @@ void nkiDynStrAppendFloat(struct NKDynString *dynStr, float value)
     // +1 for terminator, +1 for '-', +1 for '.'.
     // +a lot because float.
     char tmp[NK_PRINTF_FLOATCHARSNEEDED + 1];
-    sprintf(tmp, "%f", value);
+    nkiFormatFloat(tmp, value);
     nkiDynStrAppend(dynStr, tmp);
 }
 
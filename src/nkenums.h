@@ -57,6 +57,20 @@ enum NKValueType
     NK_VALUETYPE_NIL,
 };
 
+// Signatures for typed native functions. See
+// nkxVmSetupTypedExternalFunction() and the NKVMTypedFunction*
+// pointer types in nktypes.h.
+enum NKTypedFunctionSignature
+{
+    NK_TYPEDFUNCTION_INT_INT,           // int(int)
+    NK_TYPEDFUNCTION_INT_INT_INT,       // int(int, int)
+    NK_TYPEDFUNCTION_FLOAT_FLOAT,       // float(float)
+    NK_TYPEDFUNCTION_FLOAT_FLOAT_FLOAT, // float(float, float)
+    NK_TYPEDFUNCTION_VOID_OBJECT,       // void(object)
+
+    NK_TYPEDFUNCTION_COUNT
+};
+
 enum NKOpcode
 {
     // Leave this at zero so we can memset() sections of code to zero
@@ -124,10 +138,80 @@ enum NKOpcode
 
     NK_OP_LEN,
 
+    // Wide instructions. These read their operand from the following
+    // instruction word (like the PUSHLITERAL_* instructions do)
+    // instead of popping it off the stack.
+    NK_OP_LOAD_LOCAL,
+    NK_OP_STORE_LOCAL,
+    NK_OP_LOAD_STATIC,
+    NK_OP_STORE_STATIC,
+    NK_OP_JUMP,
+    NK_OP_JZ,
+    NK_OP_DISCARD,
+
+    // Superinstructions. These are only generated by the peephole
+    // optimizer (nkpeep.c), which fuses common instruction sequences
+    // into them. Each of the comparison+JZ ones behaves like the
+    // comparison followed by a wide JZ.
+    NK_OP_GREATERTHAN_JZ,
+    NK_OP_LESSTHAN_JZ,
+    NK_OP_GREATERTHANOREQUAL_JZ,
+    NK_OP_LESSTHANOREQUAL_JZ,
+    NK_OP_EQUAL_JZ,
+    NK_OP_NOTEQUAL_JZ,
+    NK_OP_ADD_LOCALS,
+    NK_OP_ADD_LITERAL,
+
+    // Quickened instructions. The interpreter rewrites generic
+    // arithmetic and comparison instructions into these at runtime
+    // once it sees what types they're operating on.
+    NK_OP_ADD_INT,
+    NK_OP_ADD_FLOAT,
+    NK_OP_SUBTRACT_INT,
+    NK_OP_SUBTRACT_FLOAT,
+    NK_OP_MULTIPLY_INT,
+    NK_OP_MULTIPLY_FLOAT,
+    NK_OP_GREATERTHAN_INT,
+    NK_OP_GREATERTHAN_FLOAT,
+    NK_OP_LESSTHAN_INT,
+    NK_OP_LESSTHAN_FLOAT,
+    NK_OP_GREATERTHANOREQUAL_INT,
+    NK_OP_GREATERTHANOREQUAL_FLOAT,
+    NK_OP_LESSTHANOREQUAL_INT,
+    NK_OP_LESSTHANOREQUAL_FLOAT,
+    NK_OP_EQUAL_INT,
+    NK_OP_EQUAL_FLOAT,
+    NK_OP_NOTEQUAL_INT,
+    NK_OP_NOTEQUAL_FLOAT,
+
+    // Frame slot instructions. These are generated by the bytecode
+    // optimizer (nkpeep.c) when NK_COMPILER_OPTION_FRAMESLOTS is set,
+    // and operate directly on local variable slots without going
+    // through the top of the stack. Slot operands work like
+    // LOAD_LOCAL operands, relative to the stack size before the
+    // instruction executes.
+    NK_OP_ADD3,           // dst, src1, src2
+    NK_OP_SUBTRACT3,      // dst, src1, src2
+    NK_OP_MULTIPLY3,      // dst, src1, src2
+    NK_OP_ADD3_LITERAL,   // dst, src, int literal
+    NK_OP_MOVE_LOCAL,     // dst, src
+    NK_OP_POP_LOCAL,      // dst (slot relative to the size before the pop)
+    NK_OP_POP_STATIC,     // static address
+
+    // Field access with a string literal key, like "foo.bar". These
+    // work like OBJECTFIELDGET, OBJECTFIELDSET, and
+    // OBJECTFIELDGET_NOPOP, except that the key is the first operand
+    // instead of being on the stack. The second operand is an inline
+    // cache holding the field table slot the key was last found in.
+    // The interpreter rewrites it as it runs.
+    NK_OP_OBJECTFIELDGET_CONST,       // key string, cached slot
+    NK_OP_OBJECTFIELDSET_CONST,       // key string, cached slot
+    NK_OP_OBJECTFIELDGET_NOPOP_CONST, // key string, cached slot
+
     NK_OPCODE_REALCOUNT,
 
     // This must be a power of two.
-    NK_OPCODE_PADDEDCOUNT = 64
+    NK_OPCODE_PADDEDCOUNT = 128
 };
 
 enum NKTokenType
@@ -196,5 +280,74 @@ enum NKTokenType
     NK_TOKENTYPE_INVALID,
 };
 
+/// Compiler option flags for nkxCompilerSetOptions(). These can be
+/// OR'd together.
+enum NKCompilerOption
+{
+    /// Run the peephole optimizer over the generated bytecode when
+    /// the compiler is finalized. This fuses common instruction
+    /// sequences into superinstructions and removes redundant stack
+    /// cleanup.
+    NK_COMPILER_OPTION_PEEPHOLE = 1,
+
+    /// Convert simple statements that only work on local variables
+    /// (like "a = b + c;" or "++i;") into three-address instructions
+    /// that operate directly on stack frame slots. Also applied when
+    /// the compiler is finalized.
+    NK_COMPILER_OPTION_FRAMESLOTS = 2
+};
+
+/// Categories for memory usage accounting. Every VM allocation is
+/// counted against exactly one of these. See
+/// nkxVmGetCategoryMemoryUsage().
+enum NKMemoryCategory
+{
+    /// Anything not covered below, including the compiler, errors,
+    /// and VM bookkeeping.
+    NK_MEMORY_CATEGORY_MISC,
+
+    /// String records, string data, and the string intern table.
+    NK_MEMORY_CATEGORY_STRINGS,
+
+    /// Object records.
+    NK_MEMORY_CATEGORY_OBJECTS,
+
+    /// Object field tables and array parts.
+    NK_MEMORY_CATEGORY_OBJECTELEMENTS,
+
+    /// Object and string table slots and holes.
+    NK_MEMORY_CATEGORY_TABLES,
+
+    /// Value stacks, for the main context and coroutines alike.
+    NK_MEMORY_CATEGORY_STACKS,
+
+    /// Coroutine execution contexts (not including their stacks).
+    NK_MEMORY_CATEGORY_COROUTINES,
+
+    /// The compiled program: instructions, static variables, and the
+    /// function table.
+    NK_MEMORY_CATEGORY_PROGRAM,
+
+    /// Garbage collector work lists.
+    NK_MEMORY_CATEGORY_GC,
+
+    /// Memory allocated by the hosting application through
+    /// nkxMalloc() and friends, usually external data.
+    NK_MEMORY_CATEGORY_EXTERNAL,
+
+    NK_MEMORY_CATEGORY_COUNT
+};
+
+// Phases of an incremental garbage collection. See
+// nkiVmGarbageCollectStep(). The order matters.
+enum NKGCPhase
+{
+    NK_GC_PHASE_IDLE,
+    NK_GC_PHASE_MARK,
+    NK_GC_PHASE_ATOMIC,
+    NK_GC_PHASE_SWEEPSTRINGS,
+    NK_GC_PHASE_SWEEPOBJECTS
+};
+
 #endif // NINKASI_ENUMS_H
 
@@ -742,18 +742,16 @@ nkbool nkiCompilerEmitFetchVariable(
 
         // Positive values for global variables (absolute stack
         // position).
-        nkiCompilerEmitPushLiteralInt(cs, var->position, nktrue);
-        nkiCompilerAddInstructionSimple(
-            cs, NK_OP_STATICPEEK, nkfalse);
+        nkiCompilerEmitWideInstruction(
+            cs, NK_OP_LOAD_STATIC, var->position, nktrue);
 
     } else {
 
         // Negative values for local variables (stack position -
         // value).
         nkint32_t fetchStackPos = var->position - cs->context->stackFrameOffset;
-        nkiCompilerEmitPushLiteralInt(cs, fetchStackPos, nktrue);
-        nkiCompilerAddInstructionSimple(
-            cs, NK_OP_STACKPEEK, nkfalse);
+        nkiCompilerEmitWideInstruction(
+            cs, NK_OP_LOAD_LOCAL, fetchStackPos, nktrue);
 
     }
 
@@ -776,16 +774,16 @@ nkbool nkiCompilerExpressionEmitSetVariable(
 
         // Positive values for global variables (absolute stack
         // position).
-        nkiCompilerEmitPushLiteralInt(cs, var->position, nktrue);
-        nkiCompilerAddInstructionSimple(cs, NK_OP_STATICPOKE, nktrue);
+        nkiCompilerEmitWideInstruction(
+            cs, NK_OP_STORE_STATIC, var->position, nktrue);
 
     } else {
 
         // Negative values for local variables (stack position -
         // value).
-        nkiCompilerEmitPushLiteralInt(cs,
+        nkiCompilerEmitWideInstruction(
+            cs, NK_OP_STORE_LOCAL,
             var->position - cs->context->stackFrameOffset, nktrue);
-        nkiCompilerAddInstructionSimple(cs, NK_OP_STACKPOKE, nktrue);
     }
 
     return nktrue;
@@ -793,6 +791,14 @@ nkbool nkiCompilerExpressionEmitSetVariable(
 
 nkbool nkiCompilerEmitExpression(struct NKCompilerState *cs, struct NKExpressionAstNode *node);
 
+// True if the key for an index-into operation is a string literal
+// (including "foo.bar" syntax), so we can use the *_CONST field
+// instructions and their inline caches.
+static nkbool nkiCompilerIsConstantFieldKey(struct NKExpressionAstNode *keyNode)
+{
+    return keyNode && keyNode->opOrValue->type == NK_TOKENTYPE_STRING;
+}
+
 nkbool nkiCompilerEmitExpressionAssignment(struct NKCompilerState *cs, struct NKExpressionAstNode *node)
 {
     if(!nkiCompilerPushRecursion(cs)) {
@@ -834,9 +840,15 @@ nkbool nkiCompilerEmitExpressionAssignment(struct NKCompilerState *cs, struct NK
 
             // Emit the thing we're going to assign to.
             nkiCompilerEmitExpression(cs, node->children[0]->children[0]); // Object id
-            nkiCompilerEmitExpression(cs, node->children[0]->children[1]); // Index
 
-            nkiCompilerAddInstructionSimple(cs, NK_OP_OBJECTFIELDSET, nktrue);
+            if(nkiCompilerIsConstantFieldKey(node->children[0]->children[1])) {
+                nkiCompilerEmitObjectFieldConst(
+                    cs, NK_OP_OBJECTFIELDSET_CONST,
+                    node->children[0]->children[1]->opOrValue->str, nktrue);
+            } else {
+                nkiCompilerEmitExpression(cs, node->children[0]->children[1]); // Index
+                nkiCompilerAddInstructionSimple(cs, NK_OP_OBJECTFIELDSET, nktrue);
+            }
         } break;
 
         default: {
@@ -881,6 +893,29 @@ nkbool nkiCompilerEmitExpression(struct NKCompilerState *cs, struct NKExpression
         return nkiCompilerEmitExpressionAssignment(cs, node);
     }
 
+    // Index-into with a constant key only needs the object on the
+    // stack. The key goes in the instruction.
+    if((node->opOrValue->type == NK_TOKENTYPE_BRACKET_OPEN ||
+            node->opOrValue->type == NK_TOKENTYPE_INDEXINTO_NOPOP) &&
+        nkiCompilerIsConstantFieldKey(node->children[1]))
+    {
+        if(node->children[0]) {
+            if(!nkiCompilerEmitExpression(cs, node->children[0])) {
+                nkiCompilerPopRecursion(cs);
+                return nkfalse;
+            }
+        }
+
+        nkiCompilerEmitObjectFieldConst(
+            cs,
+            node->opOrValue->type == NK_TOKENTYPE_BRACKET_OPEN ?
+            NK_OP_OBJECTFIELDGET_CONST : NK_OP_OBJECTFIELDGET_NOPOP_CONST,
+            node->children[1]->opOrValue->str, nktrue);
+
+        nkiCompilerPopRecursion(cs);
+        return nktrue;
+    }
+
     // Emit children.
     for(i = 0; i < 2; i++) {
         if(node->children[i]) {
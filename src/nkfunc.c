@@ -50,10 +50,11 @@ struct NKVMFunction *nkiVmCreateFunction(
         functionId->id = vm->functionCount++;
     }
 
-    vm->functionTable = (struct NKVMFunction *)nkiReallocArray(
+    vm->functionTable = (struct NKVMFunction *)nkiReallocArrayCategory(
         vm,
         vm->functionTable,
-        sizeof(struct NKVMFunction), vm->functionCount);
+        sizeof(struct NKVMFunction), vm->functionCount,
+        NK_MEMORY_CATEGORY_PROGRAM);
 
     nkiMemset(
         &vm->functionTable[vm->functionCount - 1], 0,
@@ -130,7 +131,9 @@ void nkiVmCallFunction(
         while(vm->currentExecutionContext->instructionPointer != NK_UINT_MAX &&
             !vm->errorState.firstError)
         {
-            nkiVmIterate(vm);
+            if(!nkiAotRun(vm, NK_UINT_MAX)) {
+                nkiVmIterate(vm);
+            }
         }
 
         // Save return value.
@@ -201,6 +204,9 @@ NKVMExternalFunctionID nkiVmRegisterExternalFunctionNoSearch(
     funcEntry->argumentCount = NK_INVALID_VALUE;
     funcEntry->argTypes = NULL;
     funcEntry->argExternalTypes = NULL;
+    funcEntry->typedSignature = NK_INVALID_VALUE;
+    funcEntry->typedFunction = NULL;
+    funcEntry->typedArgumentKey = 0;
 
     {
         NKVMExternalFunctionID ret;
@@ -209,6 +215,113 @@ NKVMExternalFunctionID nkiVmRegisterExternalFunctionNoSearch(
     }
 }
 
+nkbool nkiVmSetTypedExternalFunction(
+    struct NKVM *vm,
+    NKVMExternalFunctionID externalFunctionId,
+    enum NKTypedFunctionSignature signature,
+    NKVMTypedFunction func)
+{
+    struct NKVMExternalFunction *funcEntry;
+    nkuint32_t argumentCount;
+    nkuint32_t argumentKey;
+
+    if(externalFunctionId.id >= vm->externalFunctionCount) {
+        nkiAddError(vm, "Tried to set up a bad external function as a typed function.");
+        return nkfalse;
+    }
+
+    switch(signature) {
+
+        case NK_TYPEDFUNCTION_INT_INT:
+            argumentCount = 1;
+            argumentKey = NK_TYPED_ARGUMENT_KEY(0, NK_VALUETYPE_INT);
+            break;
+
+        case NK_TYPEDFUNCTION_INT_INT_INT:
+            argumentCount = 2;
+            argumentKey =
+                NK_TYPED_ARGUMENT_KEY(0, NK_VALUETYPE_INT) |
+                NK_TYPED_ARGUMENT_KEY(1, NK_VALUETYPE_INT);
+            break;
+
+        case NK_TYPEDFUNCTION_FLOAT_FLOAT:
+            argumentCount = 1;
+            argumentKey = NK_TYPED_ARGUMENT_KEY(0, NK_VALUETYPE_FLOAT);
+            break;
+
+        case NK_TYPEDFUNCTION_FLOAT_FLOAT_FLOAT:
+            argumentCount = 2;
+            argumentKey =
+                NK_TYPED_ARGUMENT_KEY(0, NK_VALUETYPE_FLOAT) |
+                NK_TYPED_ARGUMENT_KEY(1, NK_VALUETYPE_FLOAT);
+            break;
+
+        case NK_TYPEDFUNCTION_VOID_OBJECT:
+            argumentCount = 1;
+            argumentKey = NK_TYPED_ARGUMENT_KEY(0, NK_VALUETYPE_OBJECTID);
+            break;
+
+        default:
+            nkiAddError(vm, "Bad typed function signature.");
+            return nkfalse;
+    }
+
+    funcEntry = &vm->externalFunctionTable[externalFunctionId.id];
+    funcEntry->argumentCount = argumentCount;
+    funcEntry->typedSignature = signature;
+    funcEntry->typedFunction = func;
+    funcEntry->typedArgumentKey = argumentKey;
+
+    return nktrue;
+}
+
+void nkiVmCallTypedExternalFunction(
+    struct NKVM *vm,
+    struct NKVMExternalFunction *func,
+    struct NKValue *arguments,
+    struct NKValue *returnValue)
+{
+    switch(func->typedSignature) {
+
+        case NK_TYPEDFUNCTION_INT_INT:
+            nkiValueSetInt(
+                vm, returnValue,
+                ((NKVMTypedFunctionIntInt)func->typedFunction)(
+                    vm, arguments[0].intData));
+            break;
+
+        case NK_TYPEDFUNCTION_INT_INT_INT:
+            nkiValueSetInt(
+                vm, returnValue,
+                ((NKVMTypedFunctionIntIntInt)func->typedFunction)(
+                    vm, arguments[0].intData, arguments[1].intData));
+            break;
+
+        case NK_TYPEDFUNCTION_FLOAT_FLOAT:
+            nkiValueSetFloat(
+                vm, returnValue,
+                ((NKVMTypedFunctionFloatFloat)func->typedFunction)(
+                    vm, arguments[0].floatData));
+            break;
+
+        case NK_TYPEDFUNCTION_FLOAT_FLOAT_FLOAT:
+            nkiValueSetFloat(
+                vm, returnValue,
+                ((NKVMTypedFunctionFloatFloatFloat)func->typedFunction)(
+                    vm, arguments[0].floatData, arguments[1].floatData));
+            break;
+
+        case NK_TYPEDFUNCTION_VOID_OBJECT:
+            ((NKVMTypedFunctionVoidObject)func->typedFunction)(
+                vm, &arguments[0]);
+            break;
+
+        default:
+            nkiAddError(vm, "Bad typed function signature.");
+            break;
+    }
+}
+
 NKVMInternalFunctionID nkiVmGetOrCreateInternalFunctionForExternalFunction(
     struct NKVM *vm, NKVMExternalFunctionID externalFunctionId)
 {
@@ -44,6 +44,7 @@
 #ifndef NINKASI_FUNCTION_H
 #define NINKASI_FUNCTION_H
 
+#include "nkconfig.h"
 #include "nkvalue.h"
 #include "nkx.h"
 #include "nkfuncid.h"
@@ -57,8 +58,20 @@ struct NKVMFunction
     nkuint32_t argumentCount;
     nkuint32_t firstInstructionIndex;
 
+    /// Number of stack slots the function's code may need on top of
+    /// what's on the stack when it starts (arguments, argument count,
+    /// and return pointer). Worked out by the compiler, so the whole
+    /// frame can be reserved once by NK_OP_CALL.
+    nkuint32_t maxStackDepth;
+
     /// ID of the C function callback to use.
     NKVMExternalFunctionID externalFunctionId;
+
+#if NK_JIT
+    /// Number of calls so far, for finding hot functions. Not
+    /// serialized.
+    nkuint32_t callCount;
+#endif
 };
 
 /// Native C function record.
@@ -88,8 +101,23 @@ struct NKVMExternalFunction
 
     enum NKValueType *argTypes;
     NKVMExternalDataTypeID *argExternalTypes;
+
+    /// NKTypedFunctionSignature for functions set up with
+    /// nkxVmSetupTypedExternalFunction(), or NK_INVALID_VALUE for
+    /// normal callbacks. Typed functions are called through
+    /// typedFunction instead of CFunctionCallback.
+    nkuint32_t typedSignature;
+    NKVMTypedFunction typedFunction;
+
+    /// Argument types for typed functions, packed by
+    /// NK_TYPED_ARGUMENT_KEY(), so checking every argument is a single
+    /// comparison.
+    nkuint32_t typedArgumentKey;
 };
 
+/// Pack the type of argument n into a typed function argument key.
+#define NK_TYPED_ARGUMENT_KEY(n, type) ((nkuint32_t)(type) << ((n) * 4))
+
 // ----------------------------------------------------------------------
 // External function interface
 
@@ -118,6 +146,23 @@ NKVMExternalFunctionID nkiVmRegisterExternalFunctionNoSearch(
 NKVMInternalFunctionID nkiVmGetOrCreateInternalFunctionForExternalFunction(
     struct NKVM *vm, NKVMExternalFunctionID externalFunctionId);
 
+/// Set up an already-registered external function as a typed
+/// function. Returns nkfalse (with an error set) for a bad signature.
+nkbool nkiVmSetTypedExternalFunction(
+    struct NKVM *vm,
+    NKVMExternalFunctionID externalFunctionId,
+    enum NKTypedFunctionSignature signature,
+    NKVMTypedFunction func);
+
+/// Call a typed external function with arguments that have already
+/// been checked against its typedArgumentKey, and box the result into
+/// returnValue.
+void nkiVmCallTypedExternalFunction(
+    struct NKVM *vm,
+    struct NKVMExternalFunction *func,
+    struct NKValue *arguments,
+    struct NKValue *returnValue);
+
 // ----------------------------------------------------------------------
 // Compiler helpers
 
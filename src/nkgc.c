@@ -42,6 +42,24 @@
 // -------------------------- END HEADER -------------------------------------
 
 // Garbage collector implementation.
+//
+// Collections can happen all at once (nkiVmGarbageCollect()), or in
+// steps interleaved with execution (nkiVmGarbageCollectStep()). For
+// incremental collections:
+//
+// - Marking works through the open list a bit at a time. Field
+//   stores into objects that are already marked go through
+//   nkiVmGcObjectBarrier(), which puts the object back on the open
+//   list.
+//
+// - Stacks, statics, and objects with external handles get no
+//   barriers. Instead they get marked again in the atomic step at the
+//   end of marking, along with anything that has a gcMarkCallback
+//   (including coroutines and their stacks).
+//
+// - Sweeping happens a chunk of the string and object tables at a
+//   time. Anything created or found again during the sweep gets
+//   marked so it doesn't get swept up.
 
 #include "nkcommon.h"
 
@@ -51,14 +69,6 @@ struct NKVMValueGCEntry
     struct NKVMValueGCEntry *next;
 };
 
-struct NKVMGCState
-{
-    struct NKVM *vm;
-    nkuint32_t currentGCPass;
-    struct NKVMValueGCEntry *openList;
-    struct NKVMValueGCEntry *closedList; // We'll keep this just for re-using allocations.
-};
-
 struct NKVMValueGCEntry *nkiVmGcStateMakeEntry(struct NKVMGCState *state)
 {
     struct NKVMValueGCEntry *ret = NULL;
@@ -67,8 +77,8 @@ struct NKVMValueGCEntry *nkiVmGcStateMakeEntry(struct NKVMGCState *state)
         ret = state->closedList;
         state->closedList = ret->next;
     } else {
-        ret = (struct NKVMValueGCEntry *)nkiMalloc(
-            state->vm, sizeof(struct NKVMValueGCEntry));
+        ret = (struct NKVMValueGCEntry *)nkiPoolMalloc(
+            state->vm, sizeof(struct NKVMValueGCEntry), NK_MEMORY_CATEGORY_GC);
     }
 
     ret->next = state->openList;
@@ -132,11 +142,39 @@ void nkiVmGarbageCollect_markValue(
     }
 }
 
+// Run an object's external type gcMarkCallback, if it has one.
+// Returns nktrue if there was one to run.
+static nkbool nkiVmGarbageCollect_runMarkCallback(
+    struct NKVMGCState *gcState,
+    struct NKVMObject *ob)
+{
+    struct NKVM *vm = gcState->vm;
+
+    if(ob->externalDataType.id != NK_INVALID_VALUE &&
+        ob->externalDataType.id < vm->externalTypeCount)
+    {
+        NKVMExternalObjectGCMarkCallback callback =
+            vm->externalTypes[ob->externalDataType.id].gcMarkCallback;
+
+        if(callback) {
+            struct NKValue val;
+            nkiMemset(&val, 0, sizeof(val));
+            val.type = NK_VALUETYPE_OBJECTID;
+            val.objectId = ob->objectTableIndex;
+
+            callback(vm, &val, ob->externalData, gcState);
+            return nktrue;
+        }
+    }
+
+    return nkfalse;
+}
+
 void nkiVmGarbageCollect_markObject(
     struct NKVMGCState *gcState,
     struct NKVMObject *ob)
 {
-    nkuint32_t bucket;
+    nkuint32_t i;
 
     // Did we already get this one?
     if(ob->lastGCPass == gcState->currentGCPass) {
@@ -144,47 +182,38 @@ void nkiVmGarbageCollect_markObject(
     }
 
     ob->lastGCPass = gcState->currentGCPass;
+    gcState->workDone += 1 + ob->arrayCapacity + ob->fieldCapacity;
 
-    // Iterate through all the hash buckets on this object.
-    for(bucket = 0; bucket < nkiVMObjectHashBucketCount; bucket++) {
-
-        // Iterate through the elements inside the hash bucket.
-        struct NKVMObjectElement *el = ob->hashBuckets[bucket];
-        while(el) {
-
-            // Iterate between key and value for this element.
-            nkuint32_t k;
-            for(k = 0; k < 2; k++) {
-                struct NKValue *v = k ? &el->value : &el->key;
-                nkiVmGarbageCollect_markValue(gcState, v);
-            }
+    // Iterate through all the fields on this object. Keys in the
+    // array part are just ints, so only the values need marking.
+    for(i = 0; i < ob->arrayCapacity; i++) {
+        if(!nkiVmObjectArraySlotIsEmpty(&ob->arrayPart[i])) {
+            nkiVmGarbageCollect_markValue(gcState, &ob->arrayPart[i]);
+        }
+    }
+    for(i = 0; i < ob->fieldCapacity; i++) {
 
-            el = el->next;
+        struct NKVMObjectElement *el = &ob->fields[i];
+        if(!nkiVmObjectSlotIsEmpty(el)) {
+            nkiVmGarbageCollect_markValue(gcState, &el->key);
+            nkiVmGarbageCollect_markValue(gcState, &el->value);
         }
     }
 
     // Execute any callbacks for marking stuff so that externally
-    // associated data can be checked.
-    if(ob->externalDataType.id != NK_INVALID_VALUE) {
-
-        struct NKVM *vm = gcState->vm;
-
-        if(ob->externalDataType.id < vm->externalTypeCount) {
-
-            NKVMExternalObjectGCMarkCallback callback =
-                vm->externalTypes[ob->externalDataType.id].gcMarkCallback;
-
-            if(callback) {
-                struct NKValue val;
-                nkiMemset(&val, 0, sizeof(val));
-                val.type = NK_VALUETYPE_OBJECTID;
-                val.objectId = ob->objectTableIndex;
+    // associated data can be checked. Incremental collections have
+    // to do it again in the atomic step.
+    if(nkiVmGarbageCollect_runMarkCallback(gcState, ob) &&
+        gcState->phase == NK_GC_PHASE_MARK)
+    {
+        struct NKVMValueGCEntry *entry = nkiVmGcStateMakeEntry(gcState);
 
-                callback(vm, &val, ob->externalData, gcState);
-            }
-        }
+        // nkiVmGcStateMakeEntry() put it on the open list.
+        gcState->openList = entry->next;
+        entry->object = ob;
+        entry->next = gcState->rescanList;
+        gcState->rescanList = entry;
     }
-
 }
 
 void nkiVmGarbageCollect_markReferenced(
@@ -200,6 +229,12 @@ void nkiVmGarbageCollect_markReferenced(
 
         currentEntry->next = gcState->closedList;
         gcState->closedList = currentEntry;
+
+        // Incremental collections stop when they've done enough for
+        // one step.
+        if(gcState->workDone >= gcState->stepBudget) {
+            break;
+        }
     }
 }
 
@@ -213,14 +248,13 @@ void nkiVmGarbageCollect_markStack(
         nkiVmGarbageCollect_markValue(
             gcState, &values[i]);
     }
+    gcState->workDone += stack->size;
 }
 
-void nkiVmGarbageCollect(struct NKVM *vm)
+static void nkiVmGarbageCollect_markRoots(
+    struct NKVMGCState *gcState)
 {
-    struct NKVMGCState gcState;
-    nkiMemset(&gcState, 0, sizeof(gcState));
-    gcState.currentGCPass = ++vm->gcInfo.lastGCPass;
-    gcState.vm = vm;
+    struct NKVM *vm = gcState->vm;
 
     // Iterate through objects with external handles.
     {
@@ -228,7 +262,7 @@ void nkiVmGarbageCollect(struct NKVM *vm)
         for(ob = vm->objectsWithExternalHandles; ob;
             ob = ob->nextObjectWithExternalHandles)
         {
-            nkiVmGarbageCollect_markObject(&gcState, ob);
+            nkiVmGarbageCollect_markObject(gcState, ob);
         }
     }
 
@@ -236,10 +270,10 @@ void nkiVmGarbageCollect(struct NKVM *vm)
 
     // We need to mark the root stack first, because there is no
     // coroutine object that corresponds to it.
-    nkiVmGarbageCollect_markStack(&gcState, &vm->rootExecutionContext.stack);
+    nkiVmGarbageCollect_markStack(gcState, &vm->rootExecutionContext.stack);
 
     // Mark the current context stack.
-    nkiVmGarbageCollect_markValue(&gcState,
+    nkiVmGarbageCollect_markValue(gcState,
         &vm->currentExecutionContext->coroutineObject);
 
     // Iterate through the current static space.
@@ -249,14 +283,151 @@ void nkiVmGarbageCollect(struct NKVM *vm)
         while(1) {
 
             nkiVmGarbageCollect_markValue(
-                &gcState, &values[i]);
+                gcState, &values[i]);
 
             if(i == vm->staticAddressMask) {
                 break;
             }
             i++;
         }
+        gcState->workDone += vm->staticAddressMask + 1;
+    }
+}
+
+static void nkiVmGarbageCollect_freeEntryList(
+    struct NKVM *vm,
+    struct NKVMValueGCEntry **list)
+{
+    while(*list) {
+        struct NKVMValueGCEntry *next = (*list)->next;
+        nkiPoolFree(vm, *list);
+        *list = next;
     }
+}
+
+void nkiVmGarbageCollectCancel(struct NKVM *vm)
+{
+    struct NKVMGCState *gcState = &vm->gcState;
+
+    nkiVmGarbageCollect_freeEntryList(vm, &gcState->openList);
+    nkiVmGarbageCollect_freeEntryList(vm, &gcState->closedList);
+    nkiVmGarbageCollect_freeEntryList(vm, &gcState->rescanList);
+
+    gcState->phase = NK_GC_PHASE_IDLE;
+    gcState->sweepPosition = 0;
+    gcState->sweepStringLink = NULL;
+}
+
+void nkiVmGarbageCollect_barrier(struct NKVM *vm, struct NKVMObject *ob)
+{
+    struct NKVMGCState *gcState = &vm->gcState;
+    struct NKVMValueGCEntry *entry;
+
+    // Unmark it and put it back on the open list so it gets scanned
+    // again. It stays unmarked until then, so further stores into it
+    // don't come back here.
+    ob->lastGCPass = gcState->currentGCPass - 1;
+    entry = nkiVmGcStateMakeEntry(gcState);
+    entry->object = ob;
+}
+
+nkbool nkiVmGarbageCollectStep(struct NKVM *vm)
+{
+    struct NKVMGCState *gcState = &vm->gcState;
+
+    gcState->workDone = 0;
+
+    if(gcState->phase == NK_GC_PHASE_IDLE) {
+
+        gcState->vm = vm;
+        gcState->currentGCPass = ++vm->gcInfo.lastGCPass;
+        gcState->stepBudget = vm->gcInfo.gcIncrementalBudget ?
+            vm->gcInfo.gcIncrementalBudget : NK_UINT_MAX;
+        gcState->phase = NK_GC_PHASE_MARK;
+
+        nkiVmGarbageCollect_markRoots(gcState);
+    }
+
+    if(gcState->phase == NK_GC_PHASE_MARK) {
+
+        nkiVmGarbageCollect_markReferenced(gcState);
+        if(gcState->openList) {
+            return nkfalse;
+        }
+
+        // Atomic step. Everything that could have changed without a
+        // barrier gets marked again, and then we finish marking in
+        // one go.
+        gcState->phase = NK_GC_PHASE_ATOMIC;
+        nkiVmGarbageCollect_markRoots(gcState);
+
+        while(gcState->rescanList) {
+            struct NKVMValueGCEntry *entry = gcState->rescanList;
+            gcState->rescanList = entry->next;
+            nkiVmGarbageCollect_runMarkCallback(gcState, entry->object);
+            entry->next = gcState->closedList;
+            gcState->closedList = entry;
+        }
+
+        while(gcState->openList) {
+            nkiVmGarbageCollect_markReferenced(gcState);
+            gcState->workDone = 0;
+        }
+
+        // The entries aren't needed for sweeping.
+        nkiVmGarbageCollect_freeEntryList(vm, &gcState->closedList);
+
+        gcState->phase = NK_GC_PHASE_SWEEPSTRINGS;
+        gcState->sweepPosition = 0;
+        gcState->sweepStringLink = NULL;
+    }
+
+    if(gcState->phase == NK_GC_PHASE_SWEEPSTRINGS) {
+
+        // Delete unmarked strings.
+        if(!nkiVmStringTableCleanOldStringsStep(vm, gcState)) {
+            return nkfalse;
+        }
+
+        gcState->phase = NK_GC_PHASE_SWEEPOBJECTS;
+        gcState->sweepPosition = 0;
+    }
+
+    if(gcState->phase == NK_GC_PHASE_SWEEPOBJECTS) {
+
+        // Delete unmarked (and not externally-referenced) objects.
+        if(!nkiVmObjectTableCleanOldObjectsStep(vm, gcState)) {
+            return nkfalse;
+        }
+
+        gcState->phase = NK_GC_PHASE_IDLE;
+    }
+
+    return nktrue;
+}
+
+void nkiVmGarbageCollectFinish(struct NKVM *vm)
+{
+    while(vm->gcState.phase != NK_GC_PHASE_IDLE) {
+        vm->gcState.stepBudget = NK_UINT_MAX;
+        nkiVmGarbageCollectStep(vm);
+    }
+}
+
+void nkiVmGarbageCollect(struct NKVM *vm)
+{
+    struct NKVMGCState gcState;
+
+    // Anything marked so far by an incremental collection will just
+    // get marked again.
+    nkiVmGarbageCollectCancel(vm);
+
+    nkiMemset(&gcState, 0, sizeof(gcState));
+    gcState.currentGCPass = ++vm->gcInfo.lastGCPass;
+    gcState.vm = vm;
+    gcState.stepBudget = NK_UINT_MAX;
+
+    nkiVmGarbageCollect_markRoots(&gcState);
 
     // Now go and mark everything that the things in the open list
     // reference.
@@ -272,14 +443,5 @@ void nkiVmGarbageCollect(struct NKVM *vm)
 
     // Clean up.
     assert(!gcState.openList);
-    {
-        nkuint32_t count = 0;
-        while(gcState.closedList) {
-            struct NKVMValueGCEntry *next = gcState.closedList->next;
-            nkiFree(vm, gcState.closedList);
-            gcState.closedList = next;
-            count++;
-        }
-    }
+    nkiVmGarbageCollect_freeEntryList(vm, &gcState.closedList);
 }
-
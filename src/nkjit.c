@@ -0,0 +1,1585 @@
+// ----------------------------------------------------------------------
+//
+//        ▐ ▄ ▪   ▐ ▄ ▄ •▄  ▄▄▄· .▄▄ · ▪
+//       •█▌▐███ •█▌▐██▌▄▌▪▐█ ▀█ ▐█ ▀. ██
+//       ▐█▐▐▌▐█·▐█▐▐▌▐▀▀▄·▄█▀▀█ ▄▀▀▀█▄▐█·
+//       ██▐█▌▐█▌██▐█▌▐█.█▌▐█ ▪▐▌▐█▄▪▐█▐█▌
+//       ▀▀ █▪▀▀▀▀▀ █▪·▀  ▀ ▀  ▀  ▀▀▀▀ ▀▀▀
+//
+// ----------------------------------------------------------------------
+//
+//   Ninkasi 0.01
+//
+//   By Kiri "ExpiredPopsicle" Jolly
+//     https://expiredpopsicle.com
+//     https://intoxicoding.com
+//     expiredpopsicle@gmail.com
+//
+// ----------------------------------------------------------------------
+//
+//   Copyright (c) 2017 Kiri Jolly
+//
+//   Permission is hereby granted, free of charge, to any person
+//   obtaining a copy of this software and associated documentation files
+//   (the "Software"), to deal in the Software without restriction,
+//   including without limitation the rights to use, copy, modify, merge,
+//   publish, distribute, sublicense, and/or sell copies of the Software,
+//   and to permit persons to whom the Software is furnished to do so,
+//   subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be
+//   included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+//   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+//   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+//   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+//   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+//   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//   SOFTWARE.
+//
+// -------------------------- END HEADER -------------------------------------
+
+#include "nkcommon.h"
+
+#if NK_JIT
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Signature of the entry trampoline at the start of the code buffer.
+typedef nkuint32_t (*NKJitEntryCall)(
+    struct NKVM *vm, nkuint32_t budget, void *target);
+
+// Signature of the C functions that native code calls back into.
+typedef nkuint32_t (*NKJitHelper)(struct NKVM *vm, nkuint32_t argument);
+
+// Registers. Native code keeps the VM in rbx, the current execution
+// context in r12, the stack values in r13, the stack size in r14d,
+// and the remaining instruction budget in r15. rax, rcx, rdx, rsi,
+// and xmm0 are scratch.
+#define NK_JIT_RAX 0
+#define NK_JIT_RCX 1
+#define NK_JIT_RDX 2
+#define NK_JIT_RSI 6
+
+// Condition codes, for jcc and setcc.
+#define NK_JIT_CC_B  0x2
+#define NK_JIT_CC_AE 0x3
+#define NK_JIT_CC_E  0x4
+#define NK_JIT_CC_NE 0x5
+#define NK_JIT_CC_BE 0x6
+#define NK_JIT_CC_A  0x7
+#define NK_JIT_CC_P  0xa
+#define NK_JIT_CC_NP 0xb
+#define NK_JIT_CC_L  0xc
+#define NK_JIT_CC_GE 0xd
+#define NK_JIT_CC_LE 0xe
+#define NK_JIT_CC_G  0xf
+
+// Not a condition. Used for unconditional jumps.
+#define NK_JIT_ALWAYS 0x10
+
+// Per-address flags used while compiling a region.
+#define NK_JIT_FLAG_INREGION 0x1
+#define NK_JIT_FLAG_LEADER   0x2
+
+// Arithmetic operation selectors for nkiJitEmitArithmetic().
+#define NK_JIT_ARITH_ADD 0
+#define NK_JIT_ARITH_SUB 1
+#define NK_JIT_ARITH_MUL 2
+
+// Upper bound on the number of instructions in one region, so a
+// single hot loop in a huge script doesn't compile everything
+// reachable from it.
+#define NK_JIT_MAX_REGION 4096
+
+// Upper bound on the number of inline slow path checks in one
+// instruction.
+#define NK_JIT_MAX_SLOWPATCHES 8
+
+struct NKJitFixup
+{
+    nkuint32_t position;
+    nkuint32_t target;
+};
+
+struct NKJitCompiler
+{
+    struct NKVM *vm;
+    struct NKJitState *jit;
+    nkuint32_t pos;
+    nkbool overflow;
+
+    nkuint32_t mask;
+    nkuint8_t *flags;
+    nkuint32_t *labels;
+
+    struct NKJitFixup *fixups;
+    nkuint32_t fixupCount;
+    nkuint32_t fixupCapacity;
+
+    // Jumps to the current instruction's slow path.
+    nkuint32_t slowPatches[NK_JIT_MAX_SLOWPATCHES];
+    nkuint32_t slowPatchCount;
+};
+
+// ----------------------------------------------------------------------
+// Helpers called from native code
+
+// Run the regular opcode function for the instruction at address,
+// with the VM state already written back. Returns non-zero if native
+// code can carry on with the next instruction, or zero if it needs
+// to return to the interpreter.
+static nkuint32_t nkiJitCallOpcode(struct NKVM *vm, nkuint32_t address)
+{
+    struct NKVMExecutionContext *context = vm->currentExecutionContext;
+    nkuint32_t opcode =
+        vm->instructions[address & vm->instructionAddressMask].opcode &
+        (NK_OPCODE_PADDEDCOUNT - 1);
+
+    nkiOpcodeTable[opcode](vm);
+    vm->currentExecutionContext->instructionPointer++;
+
+    return !nkiVmHasErrors(vm) &&
+        vm->currentExecutionContext == context &&
+        ((context->instructionPointer ^
+            (address + 1 + nkiVmGetOpcodeOperandCount(opcode))) &
+            vm->instructionAddressMask) == 0;
+}
+
+// Garbage collection and instruction limits for a basic block, when
+// the countdown runs out.
+static nkuint32_t nkiJitCountdown(struct NKVM *vm, nkuint32_t runLength)
+{
+    return nkiVmDispatchCountdown(vm, runLength);
+}
+
+// ----------------------------------------------------------------------
+// Machine code output
+
+static void nkiJitEmit8(struct NKJitCompiler *jc, nkuint32_t value)
+{
+    if(jc->pos >= jc->jit->codeSize) {
+        jc->overflow = nktrue;
+        return;
+    }
+    jc->jit->code[jc->pos++] = (unsigned char)value;
+}
+
+static void nkiJitEmit32(struct NKJitCompiler *jc, nkuint32_t value)
+{
+    nkiJitEmit8(jc, value & 0xff);
+    nkiJitEmit8(jc, (value >> 8) & 0xff);
+    nkiJitEmit8(jc, (value >> 16) & 0xff);
+    nkiJitEmit8(jc, (value >> 24) & 0xff);
+}
+
+static void nkiJitEmitBytes(
+    struct NKJitCompiler *jc, const void *data, nkuint32_t size)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    nkuint32_t i;
+    for(i = 0; i < size; i++) {
+        nkiJitEmit8(jc, bytes[i]);
+    }
+}
+
+// ModRM byte (plus displacement) for [base + disp]. Only used with
+// rax, rcx, rdx, and rsi as the base, which don't need a SIB byte.
+static void nkiJitEmitModRM(
+    struct NKJitCompiler *jc, nkuint32_t reg,
+    nkuint32_t base, nkuint32_t disp)
+{
+    if(disp) {
+        nkiJitEmit8(jc, 0x40 | (reg << 3) | base);
+        nkiJitEmit8(jc, disp);
+    } else {
+        nkiJitEmit8(jc, (reg << 3) | base);
+    }
+}
+
+// Write a rel32 at position that lands on target.
+static void nkiJitPatch(
+    struct NKJitCompiler *jc, nkuint32_t position, nkuint32_t target)
+{
+    nkuint32_t rel = target - (position + 4);
+    if(position + 4 > jc->jit->codeSize) {
+        jc->overflow = nktrue;
+        return;
+    }
+    jc->jit->code[position]     = rel & 0xff;
+    jc->jit->code[position + 1] = (rel >> 8) & 0xff;
+    jc->jit->code[position + 2] = (rel >> 16) & 0xff;
+    jc->jit->code[position + 3] = (rel >> 24) & 0xff;
+}
+
+// Emit a jmp or jcc with a rel32 to be filled in later. Returns the
+// position of the rel32.
+static nkuint32_t nkiJitEmitJump(
+    struct NKJitCompiler *jc, nkuint32_t condition)
+{
+    if(condition == NK_JIT_ALWAYS) {
+        nkiJitEmit8(jc, 0xe9);
+    } else {
+        nkiJitEmit8(jc, 0x0f);
+        nkiJitEmit8(jc, 0x80 | condition);
+    }
+    nkiJitEmit32(jc, 0);
+    return jc->pos - 4;
+}
+
+static void nkiJitPatchHere(struct NKJitCompiler *jc, nkuint32_t position)
+{
+    nkiJitPatch(jc, position, jc->pos);
+}
+
+// Jump to a bytecode address. Resolved once the whole region has been
+// emitted.
+static void nkiJitEmitBranch(
+    struct NKJitCompiler *jc, nkuint32_t condition, nkuint32_t target)
+{
+    nkuint32_t position = nkiJitEmitJump(jc, condition);
+
+    if(jc->fixupCount == jc->fixupCapacity) {
+        struct NKJitFixup *newFixups;
+        nkuint32_t newCapacity = jc->fixupCapacity ? jc->fixupCapacity * 2 : 64;
+        newFixups = (struct NKJitFixup *)realloc(
+            jc->fixups, newCapacity * sizeof(struct NKJitFixup));
+        if(!newFixups) {
+            jc->overflow = nktrue;
+            return;
+        }
+        jc->fixups = newFixups;
+        jc->fixupCapacity = newCapacity;
+    }
+
+    jc->fixups[jc->fixupCount].position = position;
+    jc->fixups[jc->fixupCount].target = target & jc->mask;
+    jc->fixupCount++;
+}
+
+// Jump to the current instruction's slow path.
+static void nkiJitEmitSlowBranch(
+    struct NKJitCompiler *jc, nkuint32_t condition)
+{
+    if(jc->slowPatchCount == NK_JIT_MAX_SLOWPATCHES) {
+        jc->overflow = nktrue;
+        return;
+    }
+    jc->slowPatches[jc->slowPatchCount++] = nkiJitEmitJump(jc, condition);
+}
+
+// ----------------------------------------------------------------------
+// VM state
+
+// mov dword [r12 + instructionPointer], address
+// mov [r12 + stack.size], r14d
+static void nkiJitEmitSaveState(
+    struct NKJitCompiler *jc, nkuint32_t address)
+{
+    nkiJitEmit8(jc, 0x41); nkiJitEmit8(jc, 0xc7);
+    nkiJitEmit8(jc, 0x44); nkiJitEmit8(jc, 0x24);
+    nkiJitEmit8(jc, offsetof(struct NKVMExecutionContext, instructionPointer));
+    nkiJitEmit32(jc, address);
+
+    nkiJitEmit8(jc, 0x45); nkiJitEmit8(jc, 0x89);
+    nkiJitEmit8(jc, 0x74); nkiJitEmit8(jc, 0x24);
+    nkiJitEmit8(jc, offsetof(struct NKVMExecutionContext, stack.size));
+}
+
+// mov r13, [r12 + stack.values]
+// mov r14d, [r12 + stack.size]
+static void nkiJitEmitLoadState(struct NKJitCompiler *jc)
+{
+    nkiJitEmit8(jc, 0x4d); nkiJitEmit8(jc, 0x8b);
+    nkiJitEmit8(jc, 0x6c); nkiJitEmit8(jc, 0x24);
+    nkiJitEmit8(jc, offsetof(struct NKVMExecutionContext, stack.values));
+
+    nkiJitEmit8(jc, 0x45); nkiJitEmit8(jc, 0x8b);
+    nkiJitEmit8(jc, 0x74); nkiJitEmit8(jc, 0x24);
+    nkiJitEmit8(jc, offsetof(struct NKVMExecutionContext, stack.size));
+}
+
+// Leave native code, with the VM state written back for address.
+static void nkiJitEmitExit(struct NKJitCompiler *jc, nkuint32_t address)
+{
+    nkiJitEmitSaveState(jc, address);
+    nkiJitPatch(jc, nkiJitEmitJump(jc, NK_JIT_ALWAYS), jc->jit->exitOffset);
+}
+
+// Call a helper with the VM state already saved. Leaves native code
+// if it returns zero, otherwise reloads the stack.
+static void nkiJitEmitCallHelper(
+    struct NKJitCompiler *jc, NKJitHelper helper, nkuint32_t argument)
+{
+    // mov rdi, rbx
+    nkiJitEmit8(jc, 0x48); nkiJitEmit8(jc, 0x89); nkiJitEmit8(jc, 0xdf);
+
+    // mov esi, argument
+    nkiJitEmit8(jc, 0xbe);
+    nkiJitEmit32(jc, argument);
+
+    // mov rax, helper
+    nkiJitEmit8(jc, 0x48); nkiJitEmit8(jc, 0xb8);
+    nkiJitEmitBytes(jc, &helper, sizeof(helper));
+
+    // call rax
+    nkiJitEmit8(jc, 0xff); nkiJitEmit8(jc, 0xd0);
+
+    // test eax, eax
+    // jz exit
+    nkiJitEmit8(jc, 0x85); nkiJitEmit8(jc, 0xc0);
+    nkiJitPatch(jc, nkiJitEmitJump(jc, NK_JIT_CC_E), jc->jit->exitOffset);
+
+    nkiJitEmitLoadState(jc);
+}
+
+// Count a basic block of runLength instructions against the budget
+// and the garbage collection countdown, before executing any of it.
+static void nkiJitEmitBlockHeader(
+    struct NKJitCompiler *jc, nkuint32_t address, nkuint32_t runLength)
+{
+    nkuint32_t gcCountdownOffset =
+        offsetof(struct NKVM, gcInfo) +
+        offsetof(struct NKGarbageCollectionInfo, gcCountdown);
+    nkuint32_t budgetLeft;
+    nkuint32_t countdownFast;
+    nkuint32_t countdownDone;
+
+    // cmp r15, 0
+    // jg budgetLeft
+    nkiJitEmit8(jc, 0x49); nkiJitEmit8(jc, 0x83);
+    nkiJitEmit8(jc, 0xff); nkiJitEmit8(jc, 0x00);
+    budgetLeft = nkiJitEmitJump(jc, NK_JIT_CC_G);
+    nkiJitEmitExit(jc, address);
+    nkiJitPatchHere(jc, budgetLeft);
+
+    // mov eax, [rbx + gcCountdown]
+    // cmp eax, runLength
+    // ja countdownFast
+    nkiJitEmit8(jc, 0x8b); nkiJitEmit8(jc, 0x83);
+    nkiJitEmit32(jc, gcCountdownOffset);
+    nkiJitEmit8(jc, 0x3d);
+    nkiJitEmit32(jc, runLength);
+    countdownFast = nkiJitEmitJump(jc, NK_JIT_CC_A);
+
+    nkiJitEmitSaveState(jc, address);
+    nkiJitEmitCallHelper(jc, nkiJitCountdown, runLength);
+    countdownDone = nkiJitEmitJump(jc, NK_JIT_ALWAYS);
+
+    // sub eax, runLength
+    // mov [rbx + gcCountdown], eax
+    nkiJitPatchHere(jc, countdownFast);
+    nkiJitEmit8(jc, 0x2d);
+    nkiJitEmit32(jc, runLength);
+    nkiJitEmit8(jc, 0x89); nkiJitEmit8(jc, 0x83);
+    nkiJitEmit32(jc, gcCountdownOffset);
+
+    // sub r15, runLength
+    nkiJitPatchHere(jc, countdownDone);
+    nkiJitEmit8(jc, 0x49); nkiJitEmit8(jc, 0x81); nkiJitEmit8(jc, 0xef);
+    nkiJitEmit32(jc, runLength);
+}
+
+// ----------------------------------------------------------------------
+// Stack and variable access
+
+// reg = &stack.values[stack.size + offset], for offset -2..0.
+static void nkiJitEmitStackAddress(
+    struct NKJitCompiler *jc, nkuint32_t reg, nkint32_t offset)
+{
+    // lea reg, [r13 + r14 * 8 + offset * 8]
+    nkiJitEmit8(jc, 0x4b); nkiJitEmit8(jc, 0x8d);
+    nkiJitEmit8(jc, 0x44 | (reg << 3)); nkiJitEmit8(jc, 0xf5);
+    nkiJitEmit8(jc, (nkuint32_t)(offset * 8) & 0xff);
+}
+
+// reg = address of a LOAD_LOCAL-style stack slot.
+static void nkiJitEmitSlotAddress(
+    struct NKJitCompiler *jc, nkuint32_t reg, nkint32_t index)
+{
+    if(index >= 0) {
+        // mov reg32, index
+        nkiJitEmit8(jc, 0xb8 | reg);
+        nkiJitEmit32(jc, (nkuint32_t)index);
+    } else {
+        // lea reg32, [r14 + index]
+        nkiJitEmit8(jc, 0x41); nkiJitEmit8(jc, 0x8d);
+        nkiJitEmit8(jc, 0x86 | (reg << 3));
+        nkiJitEmit32(jc, (nkuint32_t)index);
+    }
+
+    // and reg32, [r12 + stack.indexMask]
+    nkiJitEmit8(jc, 0x41); nkiJitEmit8(jc, 0x23);
+    nkiJitEmit8(jc, 0x44 | (reg << 3)); nkiJitEmit8(jc, 0x24);
+    nkiJitEmit8(jc, offsetof(struct NKVMExecutionContext, stack.indexMask));
+
+    // lea reg, [r13 + reg * 8]
+    nkiJitEmit8(jc, 0x49); nkiJitEmit8(jc, 0x8d);
+    nkiJitEmit8(jc, 0x44 | (reg << 3)); nkiJitEmit8(jc, 0xc5 | (reg << 3));
+    nkiJitEmit8(jc, 0x00);
+}
+
+// rcx = address of a static variable.
+static void nkiJitEmitStaticAddress(
+    struct NKJitCompiler *jc, nkint32_t index)
+{
+    nkuint32_t offset =
+        ((nkuint32_t)index & jc->vm->staticAddressMask) *
+        sizeof(struct NKValue);
+
+    // mov rcx, [rbx + staticSpace]
+    nkiJitEmit8(jc, 0x48); nkiJitEmit8(jc, 0x8b); nkiJitEmit8(jc, 0x8b);
+    nkiJitEmit32(jc, offsetof(struct NKVM, staticSpace));
+
+    // add rcx, offset
+    if(offset) {
+        nkiJitEmit8(jc, 0x48); nkiJitEmit8(jc, 0x81); nkiJitEmit8(jc, 0xc1);
+        nkiJitEmit32(jc, offset);
+    }
+}
+
+// Copy a whole value from [src] to [dst] through rsi.
+static void nkiJitEmitCopyValue(
+    struct NKJitCompiler *jc, nkuint32_t dst, nkuint32_t src)
+{
+    nkiJitEmit8(jc, 0x48); nkiJitEmit8(jc, 0x8b);
+    nkiJitEmitModRM(jc, NK_JIT_RSI, src, 0);
+    nkiJitEmit8(jc, 0x48); nkiJitEmit8(jc, 0x89);
+    nkiJitEmitModRM(jc, NK_JIT_RSI, dst, 0);
+}
+
+// Slow path if the stack has fewer than count values.
+static void nkiJitEmitNeedValues(struct NKJitCompiler *jc, nkuint32_t count)
+{
+    // cmp r14d, count
+    nkiJitEmit8(jc, 0x41); nkiJitEmit8(jc, 0x81); nkiJitEmit8(jc, 0xfe);
+    nkiJitEmit32(jc, count);
+    nkiJitEmitSlowBranch(jc, NK_JIT_CC_B);
+}
+
+// Slow path if the stack is full.
+static void nkiJitEmitNeedSpace(struct NKJitCompiler *jc)
+{
+    // cmp r14d, [r12 + stack.capacity]
+    nkiJitEmit8(jc, 0x45); nkiJitEmit8(jc, 0x3b);
+    nkiJitEmit8(jc, 0x74); nkiJitEmit8(jc, 0x24);
+    nkiJitEmit8(jc, offsetof(struct NKVMExecutionContext, stack.capacity));
+    nkiJitEmitSlowBranch(jc, NK_JIT_CC_AE);
+}
+
+static void nkiJitEmitStackGrow(struct NKJitCompiler *jc)
+{
+    // inc r14d
+    nkiJitEmit8(jc, 0x41); nkiJitEmit8(jc, 0xff); nkiJitEmit8(jc, 0xc6);
+}
+
+static void nkiJitEmitStackShrink(struct NKJitCompiler *jc, nkuint32_t count)
+{
+    if(count == 1) {
+        // dec r14d
+        nkiJitEmit8(jc, 0x41); nkiJitEmit8(jc, 0xff); nkiJitEmit8(jc, 0xce);
+    } else if(count) {
+        // sub r14d, count
+        nkiJitEmit8(jc, 0x41); nkiJitEmit8(jc, 0x81); nkiJitEmit8(jc, 0xee);
+        nkiJitEmit32(jc, count);
+    }
+}
+
+// Branch if the value at [reg] is (or isn't) a given type.
+static nkuint32_t nkiJitEmitTypeTest(
+    struct NKJitCompiler *jc, nkuint32_t reg,
+    enum NKValueType type, nkuint32_t condition)
+{
+    // cmp dword [reg], type
+    nkiJitEmit8(jc, 0x83);
+    nkiJitEmitModRM(jc, 7, reg, 0);
+    nkiJitEmit8(jc, type);
+    return nkiJitEmitJump(jc, condition);
+}
+
+static void nkiJitEmitTypeCheck(
+    struct NKJitCompiler *jc, nkuint32_t reg, enum NKValueType type)
+{
+    // cmp dword [reg], type
+    // jne slow
+    nkiJitEmit8(jc, 0x83);
+    nkiJitEmitModRM(jc, 7, reg, 0);
+    nkiJitEmit8(jc, type);
+    nkiJitEmitSlowBranch(jc, NK_JIT_CC_NE);
+}
+
+// mov dword [reg], type
+static void nkiJitEmitSetType(
+    struct NKJitCompiler *jc, nkuint32_t reg, enum NKValueType type)
+{
+    nkiJitEmit8(jc, 0xc7);
+    nkiJitEmitModRM(jc, 0, reg, 0);
+    nkiJitEmit32(jc, type);
+}
+
+// ----------------------------------------------------------------------
+// Math and comparisons
+
+// [dst] = [in1] op [in2], for two ints and/or two floats, depending on
+// what's allowed. Anything else goes to the slow path.
+static void nkiJitEmitArithmetic(
+    struct NKJitCompiler *jc, nkuint32_t operation,
+    nkbool allowInt, nkbool allowFloat,
+    nkuint32_t dst, nkuint32_t in1, nkuint32_t in2)
+{
+    nkuint32_t notInt = 0;
+    nkuint32_t done = 0;
+
+    if(allowInt) {
+
+        if(allowFloat) {
+            notInt = nkiJitEmitTypeTest(jc, in1, NK_VALUETYPE_INT, NK_JIT_CC_NE);
+        } else {
+            nkiJitEmitTypeCheck(jc, in1, NK_VALUETYPE_INT);
+        }
+        nkiJitEmitTypeCheck(jc, in2, NK_VALUETYPE_INT);
+
+        // mov esi, [in1 + 4]
+        nkiJitEmit8(jc, 0x8b);
+        nkiJitEmitModRM(jc, NK_JIT_RSI, in1, 4);
+
+        // add/sub/imul esi, [in2 + 4]
+        if(operation == NK_JIT_ARITH_ADD) {
+            nkiJitEmit8(jc, 0x03);
+        } else if(operation == NK_JIT_ARITH_SUB) {
+            nkiJitEmit8(jc, 0x2b);
+        } else {
+            nkiJitEmit8(jc, 0x0f); nkiJitEmit8(jc, 0xaf);
+        }
+        nkiJitEmitModRM(jc, NK_JIT_RSI, in2, 4);
+
+        // mov [dst + 4], esi
+        nkiJitEmit8(jc, 0x89);
+        nkiJitEmitModRM(jc, NK_JIT_RSI, dst, 4);
+        nkiJitEmitSetType(jc, dst, NK_VALUETYPE_INT);
+
+        if(allowFloat) {
+            done = nkiJitEmitJump(jc, NK_JIT_ALWAYS);
+            nkiJitPatchHere(jc, notInt);
+        }
+    }
+
+    if(allowFloat) {
+
+        nkiJitEmitTypeCheck(jc, in1, NK_VALUETYPE_FLOAT);
+        nkiJitEmitTypeCheck(jc, in2, NK_VALUETYPE_FLOAT);
+
+        // movss xmm0, [in1 + 4]
+        nkiJitEmit8(jc, 0xf3); nkiJitEmit8(jc, 0x0f); nkiJitEmit8(jc, 0x10);
+        nkiJitEmitModRM(jc, 0, in1, 4);
+
+        // addss/subss/mulss xmm0, [in2 + 4]
+        nkiJitEmit8(jc, 0xf3); nkiJitEmit8(jc, 0x0f);
+        nkiJitEmit8(jc,
+            operation == NK_JIT_ARITH_ADD ? 0x58 :
+            (operation == NK_JIT_ARITH_SUB ? 0x5c : 0x59));
+        nkiJitEmitModRM(jc, 0, in2, 4);
+
+        // movss [dst + 4], xmm0
+        nkiJitEmit8(jc, 0xf3); nkiJitEmit8(jc, 0x0f); nkiJitEmit8(jc, 0x11);
+        nkiJitEmitModRM(jc, 0, dst, 4);
+        nkiJitEmitSetType(jc, dst, NK_VALUETYPE_FLOAT);
+
+        if(allowInt) {
+            nkiJitPatchHere(jc, done);
+        }
+    }
+}
+
+// Compare [in1] and [in2] and leave 0 or 1 in eax. The float
+// conditions are picked so that NaNs give the same results as the
+// interpreter's -1/0/1 comparison. floatCondition2 is combined with
+// floatCondition using "and" if floatAnd is set, or "or" otherwise,
+// unless it's NK_JIT_ALWAYS.
+static void nkiJitEmitComparison(
+    struct NKJitCompiler *jc,
+    nkbool allowInt, nkbool allowFloat,
+    nkuint32_t intCondition,
+    nkuint32_t floatCondition, nkuint32_t floatCondition2, nkbool floatAnd)
+{
+    nkuint32_t notInt = 0;
+    nkuint32_t done = 0;
+
+    if(allowInt) {
+
+        if(allowFloat) {
+            notInt = nkiJitEmitTypeTest(jc, NK_JIT_RDX, NK_VALUETYPE_INT, NK_JIT_CC_NE);
+        } else {
+            nkiJitEmitTypeCheck(jc, NK_JIT_RDX, NK_VALUETYPE_INT);
+        }
+        nkiJitEmitTypeCheck(jc, NK_JIT_RCX, NK_VALUETYPE_INT);
+
+        // mov esi, [rdx + 4]
+        // cmp esi, [rcx + 4]
+        // setcc al
+        nkiJitEmit8(jc, 0x8b);
+        nkiJitEmitModRM(jc, NK_JIT_RSI, NK_JIT_RDX, 4);
+        nkiJitEmit8(jc, 0x3b);
+        nkiJitEmitModRM(jc, NK_JIT_RSI, NK_JIT_RCX, 4);
+        nkiJitEmit8(jc, 0x0f); nkiJitEmit8(jc, 0x90 | intCondition);
+        nkiJitEmit8(jc, 0xc0);
+
+        if(allowFloat) {
+            done = nkiJitEmitJump(jc, NK_JIT_ALWAYS);
+            nkiJitPatchHere(jc, notInt);
+        }
+    }
+
+    if(allowFloat) {
+
+        nkiJitEmitTypeCheck(jc, NK_JIT_RDX, NK_VALUETYPE_FLOAT);
+        nkiJitEmitTypeCheck(jc, NK_JIT_RCX, NK_VALUETYPE_FLOAT);
+
+        // movss xmm0, [rdx + 4]
+        // ucomiss xmm0, [rcx + 4]
+        // setcc al
+        nkiJitEmit8(jc, 0xf3); nkiJitEmit8(jc, 0x0f); nkiJitEmit8(jc, 0x10);
+        nkiJitEmitModRM(jc, 0, NK_JIT_RDX, 4);
+        nkiJitEmit8(jc, 0x0f); nkiJitEmit8(jc, 0x2e);
+        nkiJitEmitModRM(jc, 0, NK_JIT_RCX, 4);
+        nkiJitEmit8(jc, 0x0f); nkiJitEmit8(jc, 0x90 | floatCondition);
+        nkiJitEmit8(jc, 0xc0);
+
+        if(floatCondition2 != NK_JIT_ALWAYS) {
+            // setcc cl
+            // and/or al, cl
+            nkiJitEmit8(jc, 0x0f); nkiJitEmit8(jc, 0x90 | floatCondition2);
+            nkiJitEmit8(jc, 0xc1);
+            nkiJitEmit8(jc, floatAnd ? 0x20 : 0x08);
+            nkiJitEmit8(jc, 0xc8);
+        }
+
+        if(allowInt) {
+            nkiJitPatchHere(jc, done);
+        }
+    }
+
+    // movzx eax, al
+    nkiJitEmit8(jc, 0x0f); nkiJitEmit8(jc, 0xb6); nkiJitEmit8(jc, 0xc0);
+}
+
+// Comparison of the top two stack values. With a jump target, this is
+// one of the fused compare-and-JZ instructions. Otherwise the result
+// replaces the two values.
+static void nkiJitEmitStackComparison(
+    struct NKJitCompiler *jc, enum NKOpcode op,
+    nkbool jumpIfFalse, nkuint32_t target)
+{
+    nkbool allowInt = nktrue;
+    nkbool allowFloat = nktrue;
+    nkuint32_t intCondition;
+    nkuint32_t floatCondition;
+    nkuint32_t floatCondition2 = NK_JIT_ALWAYS;
+    nkbool floatAnd = nkfalse;
+
+    switch(op) {
+
+        case NK_OP_GREATERTHAN_INT:
+        case NK_OP_LESSTHAN_INT:
+        case NK_OP_GREATERTHANOREQUAL_INT:
+        case NK_OP_LESSTHANOREQUAL_INT:
+        case NK_OP_EQUAL_INT:
+        case NK_OP_NOTEQUAL_INT:
+            allowFloat = nkfalse;
+            break;
+
+        case NK_OP_GREATERTHAN_FLOAT:
+        case NK_OP_LESSTHAN_FLOAT:
+        case NK_OP_GREATERTHANOREQUAL_FLOAT:
+        case NK_OP_LESSTHANOREQUAL_FLOAT:
+        case NK_OP_EQUAL_FLOAT:
+        case NK_OP_NOTEQUAL_FLOAT:
+            allowInt = nkfalse;
+            break;
+
+        default:
+            break;
+    }
+
+    switch(op) {
+
+        case NK_OP_GREATERTHAN:
+        case NK_OP_GREATERTHAN_INT:
+        case NK_OP_GREATERTHAN_FLOAT:
+        case NK_OP_GREATERTHAN_JZ:
+            intCondition = NK_JIT_CC_G;
+            floatCondition = NK_JIT_CC_A;
+            break;
+
+        case NK_OP_LESSTHAN:
+        case NK_OP_LESSTHAN_INT:
+        case NK_OP_LESSTHAN_FLOAT:
+        case NK_OP_LESSTHAN_JZ:
+            intCondition = NK_JIT_CC_L;
+            floatCondition = NK_JIT_CC_B;
+            break;
+
+        case NK_OP_GREATERTHANOREQUAL:
+        case NK_OP_GREATERTHANOREQUAL_INT:
+        case NK_OP_GREATERTHANOREQUAL_FLOAT:
+        case NK_OP_GREATERTHANOREQUAL_JZ:
+            intCondition = NK_JIT_CC_GE;
+            floatCondition = NK_JIT_CC_AE;
+            break;
+
+        case NK_OP_LESSTHANOREQUAL:
+        case NK_OP_LESSTHANOREQUAL_INT:
+        case NK_OP_LESSTHANOREQUAL_FLOAT:
+        case NK_OP_LESSTHANOREQUAL_JZ:
+            intCondition = NK_JIT_CC_LE;
+            floatCondition = NK_JIT_CC_BE;
+            break;
+
+        case NK_OP_EQUAL:
+        case NK_OP_EQUAL_INT:
+        case NK_OP_EQUAL_FLOAT:
+        case NK_OP_EQUAL_JZ:
+            intCondition = NK_JIT_CC_E;
+            floatCondition = NK_JIT_CC_E;
+            floatCondition2 = NK_JIT_CC_NP;
+            floatAnd = nktrue;
+            break;
+
+        default:
+            intCondition = NK_JIT_CC_NE;
+            floatCondition = NK_JIT_CC_NE;
+            floatCondition2 = NK_JIT_CC_P;
+            break;
+    }
+
+    nkiJitEmitNeedValues(jc, 2);
+    nkiJitEmitStackAddress(jc, NK_JIT_RDX, -2);
+    nkiJitEmitStackAddress(jc, NK_JIT_RCX, -1);
+    nkiJitEmitComparison(
+        jc, allowInt, allowFloat,
+        intCondition, floatCondition, floatCondition2, floatAnd);
+
+    if(jumpIfFalse) {
+
+        nkiJitEmitStackShrink(jc, 2);
+
+        // test eax, eax
+        // jz target
+        nkiJitEmit8(jc, 0x85); nkiJitEmit8(jc, 0xc0);
+        nkiJitEmitBranch(jc, NK_JIT_CC_E, target);
+
+    } else {
+
+        // mov [rdx + 4], eax
+        nkiJitEmitSetType(jc, NK_JIT_RDX, NK_VALUETYPE_INT);
+        nkiJitEmit8(jc, 0x89);
+        nkiJitEmitModRM(jc, NK_JIT_RAX, NK_JIT_RDX, 4);
+        nkiJitEmitStackShrink(jc, 1);
+    }
+}
+
+// ----------------------------------------------------------------------
+// Instructions
+
+// True for instructions that have an inline version. Everything else
+// always goes through nkiJitCallOpcode(), and might leave native code.
+static nkbool nkiJitOpcodeIsInline(enum NKOpcode op)
+{
+    switch(op) {
+        case NK_OP_NOP:
+        case NK_OP_END:
+        case NK_OP_ADD:
+        case NK_OP_SUBTRACT:
+        case NK_OP_MULTIPLY:
+        case NK_OP_PUSHLITERAL_INT:
+        case NK_OP_PUSHLITERAL_FLOAT:
+        case NK_OP_PUSHLITERAL_STRING:
+        case NK_OP_PUSHLITERAL_FUNCTIONID:
+        case NK_OP_PUSHNIL:
+        case NK_OP_POP:
+        case NK_OP_GREATERTHAN:
+        case NK_OP_LESSTHAN:
+        case NK_OP_GREATERTHANOREQUAL:
+        case NK_OP_LESSTHANOREQUAL:
+        case NK_OP_EQUAL:
+        case NK_OP_NOTEQUAL:
+        case NK_OP_NOT:
+        case NK_OP_LOAD_LOCAL:
+        case NK_OP_STORE_LOCAL:
+        case NK_OP_LOAD_STATIC:
+        case NK_OP_STORE_STATIC:
+        case NK_OP_JUMP:
+        case NK_OP_JZ:
+        case NK_OP_DISCARD:
+        case NK_OP_GREATERTHAN_JZ:
+        case NK_OP_LESSTHAN_JZ:
+        case NK_OP_GREATERTHANOREQUAL_JZ:
+        case NK_OP_LESSTHANOREQUAL_JZ:
+        case NK_OP_EQUAL_JZ:
+        case NK_OP_NOTEQUAL_JZ:
+        case NK_OP_ADD_LOCALS:
+        case NK_OP_ADD_LITERAL:
+        case NK_OP_ADD_INT:
+        case NK_OP_ADD_FLOAT:
+        case NK_OP_SUBTRACT_INT:
+        case NK_OP_SUBTRACT_FLOAT:
+        case NK_OP_MULTIPLY_INT:
+        case NK_OP_MULTIPLY_FLOAT:
+        case NK_OP_GREATERTHAN_INT:
+        case NK_OP_GREATERTHAN_FLOAT:
+        case NK_OP_LESSTHAN_INT:
+        case NK_OP_LESSTHAN_FLOAT:
+        case NK_OP_GREATERTHANOREQUAL_INT:
+        case NK_OP_GREATERTHANOREQUAL_FLOAT:
+        case NK_OP_LESSTHANOREQUAL_INT:
+        case NK_OP_LESSTHANOREQUAL_FLOAT:
+        case NK_OP_EQUAL_INT:
+        case NK_OP_EQUAL_FLOAT:
+        case NK_OP_NOTEQUAL_INT:
+        case NK_OP_NOTEQUAL_FLOAT:
+        case NK_OP_ADD3:
+        case NK_OP_SUBTRACT3:
+        case NK_OP_MULTIPLY3:
+        case NK_OP_ADD3_LITERAL:
+        case NK_OP_MOVE_LOCAL:
+        case NK_OP_POP_LOCAL:
+        case NK_OP_POP_STATIC:
+            return nktrue;
+        default:
+            return nkfalse;
+    }
+}
+
+// True for instructions that jump to a fixed target from their
+// operand.
+static nkbool nkiJitOpcodeIsBranch(enum NKOpcode op)
+{
+    switch(op) {
+        case NK_OP_JUMP:
+        case NK_OP_JZ:
+        case NK_OP_GREATERTHAN_JZ:
+        case NK_OP_LESSTHAN_JZ:
+        case NK_OP_GREATERTHANOREQUAL_JZ:
+        case NK_OP_LESSTHANOREQUAL_JZ:
+        case NK_OP_EQUAL_JZ:
+        case NK_OP_NOTEQUAL_JZ:
+            return nktrue;
+        default:
+            return nkfalse;
+    }
+}
+
+// True for instructions that never continue on to the next one from
+// native code.
+static nkbool nkiJitOpcodeIsTerminator(enum NKOpcode op)
+{
+    return op == NK_OP_JUMP || op == NK_OP_END || op == NK_OP_RETURN;
+}
+
+static enum NKOpcode nkiJitGetOpcode(
+    struct NKJitCompiler *jc, nkuint32_t address)
+{
+    return (enum NKOpcode)(
+        jc->vm->instructions[address & jc->mask].opcode &
+        (NK_OPCODE_PADDEDCOUNT - 1));
+}
+
+static nkint32_t nkiJitGetOperand(
+    struct NKJitCompiler *jc, nkuint32_t address, nkuint32_t n)
+{
+    return jc->vm->instructions[(address + n) & jc->mask].opData_int;
+}
+
+static nkuint32_t nkiJitGetNext(
+    struct NKJitCompiler *jc, nkuint32_t address)
+{
+    return (address + 1 +
+        nkiVmGetOpcodeOperandCount(nkiJitGetOpcode(jc, address))) &
+        jc->mask;
+}
+
+static void nkiJitEmitInstruction(
+    struct NKJitCompiler *jc, nkuint32_t address)
+{
+    enum NKOpcode op = nkiJitGetOpcode(jc, address);
+    nkuint32_t done = 0;
+    nkuint32_t i;
+
+    jc->slowPatchCount = 0;
+
+    switch(op) {
+
+        case NK_OP_NOP:
+            break;
+
+        case NK_OP_END:
+            // Let the interpreter handle the end of the program.
+            nkiJitEmitExit(jc, address);
+            break;
+
+        case NK_OP_PUSHLITERAL_INT:
+        case NK_OP_PUSHLITERAL_FLOAT:
+        case NK_OP_PUSHLITERAL_STRING:
+        case NK_OP_PUSHLITERAL_FUNCTIONID:
+            nkiJitEmitNeedSpace(jc);
+            nkiJitEmitStackAddress(jc, NK_JIT_RAX, 0);
+            nkiJitEmitSetType(jc, NK_JIT_RAX,
+                op == NK_OP_PUSHLITERAL_INT ? NK_VALUETYPE_INT :
+                (op == NK_OP_PUSHLITERAL_FLOAT ? NK_VALUETYPE_FLOAT :
+                    (op == NK_OP_PUSHLITERAL_STRING ? NK_VALUETYPE_STRING :
+                        NK_VALUETYPE_FUNCTIONID)));
+            // mov dword [rax + 4], operand
+            nkiJitEmit8(jc, 0xc7);
+            nkiJitEmitModRM(jc, 0, NK_JIT_RAX, 4);
+            nkiJitEmit32(jc, (nkuint32_t)nkiJitGetOperand(jc, address, 1));
+            nkiJitEmitStackGrow(jc);
+            break;
+
+        case NK_OP_PUSHNIL:
+            nkiJitEmitNeedSpace(jc);
+            nkiJitEmitStackAddress(jc, NK_JIT_RAX, 0);
+            nkiJitEmitSetType(jc, NK_JIT_RAX, NK_VALUETYPE_NIL);
+            nkiJitEmitStackGrow(jc);
+            break;
+
+        case NK_OP_POP:
+            nkiJitEmitNeedValues(jc, 1);
+            nkiJitEmitStackShrink(jc, 1);
+            break;
+
+        case NK_OP_DISCARD:
+            nkiJitEmitNeedValues(jc, (nkuint32_t)nkiJitGetOperand(jc, address, 1));
+            nkiJitEmitStackShrink(jc, (nkuint32_t)nkiJitGetOperand(jc, address, 1));
+            break;
+
+        case NK_OP_LOAD_LOCAL:
+            nkiJitEmitNeedSpace(jc);
+            nkiJitEmitSlotAddress(jc, NK_JIT_RCX, nkiJitGetOperand(jc, address, 1));
+            nkiJitEmitStackAddress(jc, NK_JIT_RAX, 0);
+            nkiJitEmitCopyValue(jc, NK_JIT_RAX, NK_JIT_RCX);
+            nkiJitEmitStackGrow(jc);
+            break;
+
+        case NK_OP_STORE_LOCAL:
+        case NK_OP_POP_LOCAL:
+            nkiJitEmitNeedValues(jc, 1);
+            nkiJitEmitSlotAddress(jc, NK_JIT_RCX, nkiJitGetOperand(jc, address, 1));
+            nkiJitEmitStackAddress(jc, NK_JIT_RAX, -1);
+            nkiJitEmitCopyValue(jc, NK_JIT_RCX, NK_JIT_RAX);
+            if(op == NK_OP_POP_LOCAL) {
+                nkiJitEmitStackShrink(jc, 1);
+            }
+            break;
+
+        case NK_OP_LOAD_STATIC:
+            nkiJitEmitNeedSpace(jc);
+            nkiJitEmitStaticAddress(jc, nkiJitGetOperand(jc, address, 1));
+            nkiJitEmitStackAddress(jc, NK_JIT_RAX, 0);
+            nkiJitEmitCopyValue(jc, NK_JIT_RAX, NK_JIT_RCX);
+            nkiJitEmitStackGrow(jc);
+            break;
+
+        case NK_OP_STORE_STATIC:
+        case NK_OP_POP_STATIC:
+            nkiJitEmitNeedValues(jc, 1);
+            nkiJitEmitStaticAddress(jc, nkiJitGetOperand(jc, address, 1));
+            nkiJitEmitStackAddress(jc, NK_JIT_RAX, -1);
+            nkiJitEmitCopyValue(jc, NK_JIT_RCX, NK_JIT_RAX);
+            if(op == NK_OP_POP_STATIC) {
+                nkiJitEmitStackShrink(jc, 1);
+            }
+            break;
+
+        case NK_OP_MOVE_LOCAL:
+            nkiJitEmitSlotAddress(jc, NK_JIT_RAX, nkiJitGetOperand(jc, address, 2));
+            nkiJitEmitSlotAddress(jc, NK_JIT_RCX, nkiJitGetOperand(jc, address, 1));
+            nkiJitEmitCopyValue(jc, NK_JIT_RCX, NK_JIT_RAX);
+            break;
+
+        case NK_OP_JUMP:
+            nkiJitEmitBranch(
+                jc, NK_JIT_ALWAYS,
+                address + 2 + nkiJitGetOperand(jc, address, 1));
+            break;
+
+        case NK_OP_JZ:
+            nkiJitEmitNeedValues(jc, 1);
+            nkiJitEmitStackAddress(jc, NK_JIT_RAX, -1);
+            nkiJitEmitTypeCheck(jc, NK_JIT_RAX, NK_VALUETYPE_INT);
+            nkiJitEmitStackShrink(jc, 1);
+            // cmp dword [rax + 4], 0
+            // je target
+            nkiJitEmit8(jc, 0x83);
+            nkiJitEmitModRM(jc, 7, NK_JIT_RAX, 4);
+            nkiJitEmit8(jc, 0x00);
+            nkiJitEmitBranch(
+                jc, NK_JIT_CC_E,
+                address + 2 + nkiJitGetOperand(jc, address, 1));
+            break;
+
+        case NK_OP_GREATERTHAN_JZ:
+        case NK_OP_LESSTHAN_JZ:
+        case NK_OP_GREATERTHANOREQUAL_JZ:
+        case NK_OP_LESSTHANOREQUAL_JZ:
+        case NK_OP_EQUAL_JZ:
+        case NK_OP_NOTEQUAL_JZ:
+            nkiJitEmitStackComparison(
+                jc, op, nktrue,
+                address + 2 + nkiJitGetOperand(jc, address, 1));
+            break;
+
+        case NK_OP_GREATERTHAN:
+        case NK_OP_LESSTHAN:
+        case NK_OP_GREATERTHANOREQUAL:
+        case NK_OP_LESSTHANOREQUAL:
+        case NK_OP_EQUAL:
+        case NK_OP_NOTEQUAL:
+        case NK_OP_GREATERTHAN_INT:
+        case NK_OP_GREATERTHAN_FLOAT:
+        case NK_OP_LESSTHAN_INT:
+        case NK_OP_LESSTHAN_FLOAT:
+        case NK_OP_GREATERTHANOREQUAL_INT:
+        case NK_OP_GREATERTHANOREQUAL_FLOAT:
+        case NK_OP_LESSTHANOREQUAL_INT:
+        case NK_OP_LESSTHANOREQUAL_FLOAT:
+        case NK_OP_EQUAL_INT:
+        case NK_OP_EQUAL_FLOAT:
+        case NK_OP_NOTEQUAL_INT:
+        case NK_OP_NOTEQUAL_FLOAT:
+            nkiJitEmitStackComparison(jc, op, nkfalse, 0);
+            break;
+
+        case NK_OP_ADD:
+        case NK_OP_SUBTRACT:
+        case NK_OP_MULTIPLY:
+        case NK_OP_ADD_INT:
+        case NK_OP_ADD_FLOAT:
+        case NK_OP_SUBTRACT_INT:
+        case NK_OP_SUBTRACT_FLOAT:
+        case NK_OP_MULTIPLY_INT:
+        case NK_OP_MULTIPLY_FLOAT:
+            nkiJitEmitNeedValues(jc, 2);
+            nkiJitEmitStackAddress(jc, NK_JIT_RDX, -2);
+            nkiJitEmitStackAddress(jc, NK_JIT_RCX, -1);
+            nkiJitEmitArithmetic(
+                jc,
+                (op == NK_OP_ADD || op == NK_OP_ADD_INT || op == NK_OP_ADD_FLOAT) ?
+                NK_JIT_ARITH_ADD :
+                ((op == NK_OP_SUBTRACT || op == NK_OP_SUBTRACT_INT ||
+                    op == NK_OP_SUBTRACT_FLOAT) ?
+                    NK_JIT_ARITH_SUB : NK_JIT_ARITH_MUL),
+                op != NK_OP_ADD_FLOAT && op != NK_OP_SUBTRACT_FLOAT &&
+                op != NK_OP_MULTIPLY_FLOAT,
+                op != NK_OP_ADD_INT && op != NK_OP_SUBTRACT_INT &&
+                op != NK_OP_MULTIPLY_INT,
+                NK_JIT_RDX, NK_JIT_RDX, NK_JIT_RCX);
+            nkiJitEmitStackShrink(jc, 1);
+            break;
+
+        case NK_OP_NOT:
+            nkiJitEmitNeedValues(jc, 1);
+            nkiJitEmitStackAddress(jc, NK_JIT_RDX, -1);
+            nkiJitEmitTypeCheck(jc, NK_JIT_RDX, NK_VALUETYPE_INT);
+            // cmp dword [rdx + 4], 0
+            // sete al
+            // movzx eax, al
+            // mov [rdx + 4], eax
+            nkiJitEmit8(jc, 0x83);
+            nkiJitEmitModRM(jc, 7, NK_JIT_RDX, 4);
+            nkiJitEmit8(jc, 0x00);
+            nkiJitEmit8(jc, 0x0f); nkiJitEmit8(jc, 0x94); nkiJitEmit8(jc, 0xc0);
+            nkiJitEmit8(jc, 0x0f); nkiJitEmit8(jc, 0xb6); nkiJitEmit8(jc, 0xc0);
+            nkiJitEmit8(jc, 0x89);
+            nkiJitEmitModRM(jc, NK_JIT_RAX, NK_JIT_RDX, 4);
+            break;
+
+        case NK_OP_ADD_LITERAL:
+            nkiJitEmitNeedValues(jc, 1);
+            nkiJitEmitStackAddress(jc, NK_JIT_RDX, -1);
+            nkiJitEmitTypeCheck(jc, NK_JIT_RDX, NK_VALUETYPE_INT);
+            // add dword [rdx + 4], literal
+            nkiJitEmit8(jc, 0x81);
+            nkiJitEmitModRM(jc, 0, NK_JIT_RDX, 4);
+            nkiJitEmit32(jc, (nkuint32_t)nkiJitGetOperand(jc, address, 1));
+            break;
+
+        case NK_OP_ADD_LOCALS:
+            // Both indices are relative to the stack before the push.
+            nkiJitEmitNeedSpace(jc);
+            nkiJitEmitSlotAddress(jc, NK_JIT_RDX, nkiJitGetOperand(jc, address, 1));
+            nkiJitEmitSlotAddress(jc, NK_JIT_RCX, nkiJitGetOperand(jc, address, 2));
+            nkiJitEmitStackAddress(jc, NK_JIT_RAX, 0);
+            nkiJitEmitArithmetic(
+                jc, NK_JIT_ARITH_ADD, nktrue, nktrue,
+                NK_JIT_RAX, NK_JIT_RDX, NK_JIT_RCX);
+            nkiJitEmitStackGrow(jc);
+            break;
+
+        case NK_OP_ADD3:
+        case NK_OP_SUBTRACT3:
+        case NK_OP_MULTIPLY3:
+            nkiJitEmitSlotAddress(jc, NK_JIT_RAX, nkiJitGetOperand(jc, address, 1));
+            nkiJitEmitSlotAddress(jc, NK_JIT_RDX, nkiJitGetOperand(jc, address, 2));
+            nkiJitEmitSlotAddress(jc, NK_JIT_RCX, nkiJitGetOperand(jc, address, 3));
+            nkiJitEmitArithmetic(
+                jc,
+                op == NK_OP_ADD3 ? NK_JIT_ARITH_ADD :
+                (op == NK_OP_SUBTRACT3 ? NK_JIT_ARITH_SUB : NK_JIT_ARITH_MUL),
+                nktrue, nktrue,
+                NK_JIT_RAX, NK_JIT_RDX, NK_JIT_RCX);
+            break;
+
+        case NK_OP_ADD3_LITERAL:
+            nkiJitEmitSlotAddress(jc, NK_JIT_RAX, nkiJitGetOperand(jc, address, 1));
+            nkiJitEmitSlotAddress(jc, NK_JIT_RDX, nkiJitGetOperand(jc, address, 2));
+            nkiJitEmitTypeCheck(jc, NK_JIT_RDX, NK_VALUETYPE_INT);
+            // mov esi, [rdx + 4]
+            // add esi, literal
+            // mov [rax + 4], esi
+            nkiJitEmit8(jc, 0x8b);
+            nkiJitEmitModRM(jc, NK_JIT_RSI, NK_JIT_RDX, 4);
+            nkiJitEmit8(jc, 0x81); nkiJitEmit8(jc, 0xc6);
+            nkiJitEmit32(jc, (nkuint32_t)nkiJitGetOperand(jc, address, 3));
+            nkiJitEmit8(jc, 0x89);
+            nkiJitEmitModRM(jc, NK_JIT_RSI, NK_JIT_RAX, 4);
+            nkiJitEmitSetType(jc, NK_JIT_RAX, NK_VALUETYPE_INT);
+            break;
+
+        default:
+            // No inline version. Just call the opcode function.
+            nkiJitEmitSaveState(jc, address);
+            nkiJitEmitCallHelper(jc, nkiJitCallOpcode, address);
+            break;
+    }
+
+    // Slow path for the inline version. Let the regular opcode
+    // function deal with it. If it continues on to the next
+    // instruction, so can we.
+    if(jc->slowPatchCount) {
+        done = nkiJitEmitJump(jc, NK_JIT_ALWAYS);
+        for(i = 0; i < jc->slowPatchCount; i++) {
+            nkiJitPatchHere(jc, jc->slowPatches[i]);
+        }
+        nkiJitEmitSaveState(jc, address);
+        nkiJitEmitCallHelper(jc, nkiJitCallOpcode, address);
+        nkiJitPatchHere(jc, done);
+    }
+
+    // Fall through to the next instruction. If it's not the next
+    // thing we're going to emit, jump to it.
+    if(op != NK_OP_JUMP && op != NK_OP_END) {
+        nkuint32_t next = nkiJitGetNext(jc, address);
+        if(!(jc->flags[next] & NK_JIT_FLAG_INREGION) || next <= address) {
+            nkiJitEmitBranch(jc, NK_JIT_ALWAYS, next);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------
+// Regions
+
+// Mark everything reachable from start, up to NK_JIT_MAX_REGION
+// instructions. Stops at anything that's already the start of a block
+// in another region, because we can just jump to that. Returns nkfalse
+// if something doesn't make sense, like a jump into the middle of
+// another instruction.
+static nkbool nkiJitFindRegion(
+    struct NKJitCompiler *jc, nkuint32_t start, nkuint32_t *worklist)
+{
+    nkuint32_t worklistCount = 0;
+    nkuint32_t regionSize = 0;
+    nkuint32_t address;
+    nkuint32_t end = 0;
+    nkbool first = nktrue;
+
+    worklist[worklistCount++] = start;
+    jc->flags[start] = NK_JIT_FLAG_INREGION | NK_JIT_FLAG_LEADER;
+
+    while(worklistCount) {
+
+        nkuint32_t successors[2];
+        nkuint32_t successorCount = 0;
+        nkuint32_t i;
+        enum NKOpcode op;
+
+        address = worklist[--worklistCount];
+        op = nkiJitGetOpcode(jc, address);
+        regionSize++;
+
+        if(!nkiJitOpcodeIsTerminator(op)) {
+            successors[successorCount++] = nkiJitGetNext(jc, address);
+        }
+        if(nkiJitOpcodeIsBranch(op)) {
+            successors[successorCount++] =
+                (address + 2 + nkiJitGetOperand(jc, address, 1)) & jc->mask;
+        }
+
+        for(i = 0; i < successorCount; i++) {
+
+            nkuint32_t successor = successors[i];
+
+            // Jump targets, anything after an instruction that might
+            // leave native code, and anything we have to jump
+            // backwards to, start a new block. These all get entry
+            // points.
+            if(nkiJitOpcodeIsBranch(op) || !nkiJitOpcodeIsInline(op) ||
+                successor <= address)
+            {
+                jc->flags[successor] |= NK_JIT_FLAG_LEADER;
+            }
+
+            if(jc->flags[successor] & NK_JIT_FLAG_INREGION) {
+                continue;
+            }
+            if(jc->jit->entries[successor]) {
+                continue;
+            }
+            if(regionSize + worklistCount >= NK_JIT_MAX_REGION) {
+                continue;
+            }
+
+            jc->flags[successor] |= NK_JIT_FLAG_INREGION;
+            worklist[worklistCount++] = successor;
+        }
+    }
+
+    // Check that no instruction overlaps another one's operands.
+    for(address = 0; address <= jc->mask; address++) {
+        if(jc->flags[address] & NK_JIT_FLAG_INREGION) {
+            if(!first && address < end) {
+                return nkfalse;
+            }
+            end = address + 1 +
+                nkiVmGetOpcodeOperandCount(nkiJitGetOpcode(jc, address));
+            first = nkfalse;
+        }
+    }
+
+    return nktrue;
+}
+
+// Number of instructions in the basic block starting at address.
+static nkuint32_t nkiJitGetBlockLength(
+    struct NKJitCompiler *jc, nkuint32_t address)
+{
+    nkuint32_t length = 1;
+
+    for(;;) {
+
+        enum NKOpcode op = nkiJitGetOpcode(jc, address);
+        nkuint32_t next = nkiJitGetNext(jc, address);
+
+        if(nkiJitOpcodeIsBranch(op) || nkiJitOpcodeIsTerminator(op) ||
+            !(jc->flags[next] & NK_JIT_FLAG_INREGION) ||
+            (jc->flags[next] & NK_JIT_FLAG_LEADER) ||
+            next <= address)
+        {
+            return length;
+        }
+
+        address = next;
+        length++;
+    }
+}
+
+static void nkiJitCompileRegion(struct NKVM *vm, nkuint32_t start)
+{
+    struct NKJitState *jit = &vm->jit;
+    struct NKJitCompiler jc;
+    nkuint32_t *worklist;
+    nkuint32_t address;
+    nkuint32_t i;
+
+    memset(&jc, 0, sizeof(jc));
+    jc.vm = vm;
+    jc.jit = jit;
+    jc.pos = jit->codeUsed;
+    jc.mask = vm->instructionAddressMask;
+
+    jc.flags = (nkuint8_t *)calloc(jit->tableSize, sizeof(nkuint8_t));
+    jc.labels = (nkuint32_t *)malloc(jit->tableSize * sizeof(nkuint32_t));
+    worklist = (nkuint32_t *)malloc(NK_JIT_MAX_REGION * sizeof(nkuint32_t));
+
+    if(jc.flags && jc.labels && worklist &&
+        nkiJitFindRegion(&jc, start, worklist) &&
+        !mprotect(jit->code, jit->codeSize, PROT_READ | PROT_WRITE))
+    {
+        // Emit every instruction in the region, in order.
+        for(address = 0; address < jit->tableSize; address++) {
+            if(jc.flags[address] & NK_JIT_FLAG_INREGION) {
+                jc.labels[address] = jc.pos;
+                if(jc.flags[address] & NK_JIT_FLAG_LEADER) {
+                    nkiJitEmitBlockHeader(
+                        &jc, address, nkiJitGetBlockLength(&jc, address));
+                }
+                nkiJitEmitInstruction(&jc, address);
+            }
+        }
+
+        // Resolve jumps. Anything outside the region either goes to
+        // another region's entry point or back to the interpreter.
+        for(i = 0; i < jc.fixupCount && !jc.overflow; i++) {
+            nkuint32_t target = jc.fixups[i].target;
+            if(jc.flags[target] & NK_JIT_FLAG_INREGION) {
+                nkiJitPatch(&jc, jc.fixups[i].position, jc.labels[target]);
+            } else if(jit->entries[target]) {
+                nkiJitPatch(
+                    &jc, jc.fixups[i].position,
+                    (nkuint32_t)((unsigned char *)jit->entries[target] - jit->code));
+            } else {
+                nkiJitPatchHere(&jc, jc.fixups[i].position);
+                nkiJitEmitExit(&jc, target);
+            }
+        }
+
+        if(jc.overflow) {
+
+            // Out of space. Stop compiling anything else.
+            jit->disabled = nktrue;
+
+        } else {
+
+            jit->codeUsed = jc.pos;
+            for(address = 0; address < jit->tableSize; address++) {
+                if((jc.flags[address] & NK_JIT_FLAG_INREGION) &&
+                    (jc.flags[address] & NK_JIT_FLAG_LEADER))
+                {
+                    jit->entries[address] = jit->code + jc.labels[address];
+                }
+            }
+        }
+
+        if(mprotect(jit->code, jit->codeSize, PROT_READ | PROT_EXEC)) {
+            nkiJitReset(vm);
+            jit->disabled = nktrue;
+        }
+    }
+
+    free(jc.flags);
+    free(jc.labels);
+    free(jc.fixups);
+    free(worklist);
+}
+
+// ----------------------------------------------------------------------
+// Setup
+
+// Allocate the code buffer and emit the entry trampoline and exit
+// sequence.
+static nkbool nkiJitCreateCodeBuffer(struct NKVM *vm)
+{
+    struct NKJitState *jit = &vm->jit;
+    struct NKJitCompiler jc;
+    void *code;
+
+    // All the context fields we touch need to fit in an 8-bit
+    // displacement.
+    if(sizeof(struct NKValue) != 8 ||
+        offsetof(struct NKVMExecutionContext, instructionPointer) > 127)
+    {
+        return nkfalse;
+    }
+
+    code = mmap(
+        NULL, NK_JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(code == MAP_FAILED) {
+        return nkfalse;
+    }
+
+    jit->code = (unsigned char *)code;
+    jit->codeSize = NK_JIT_CODE_SIZE;
+
+    memset(&jc, 0, sizeof(jc));
+    jc.vm = vm;
+    jc.jit = jit;
+
+    // Entry: (vm, budget, target)
+    //   push rbp, rbx, r12, r13, r14, r15
+    //   sub rsp, 8
+    //   mov rbx, rdi
+    //   mov r12, [rbx + currentExecutionContext]
+    //   (load stack)
+    //   mov r15d, esi
+    //   mov [rsp], r15
+    //   jmp rdx
+    nkiJitEmit8(&jc, 0x55);
+    nkiJitEmit8(&jc, 0x53);
+    nkiJitEmit8(&jc, 0x41); nkiJitEmit8(&jc, 0x54);
+    nkiJitEmit8(&jc, 0x41); nkiJitEmit8(&jc, 0x55);
+    nkiJitEmit8(&jc, 0x41); nkiJitEmit8(&jc, 0x56);
+    nkiJitEmit8(&jc, 0x41); nkiJitEmit8(&jc, 0x57);
+    nkiJitEmit8(&jc, 0x48); nkiJitEmit8(&jc, 0x83);
+    nkiJitEmit8(&jc, 0xec); nkiJitEmit8(&jc, 0x08);
+    nkiJitEmit8(&jc, 0x48); nkiJitEmit8(&jc, 0x89); nkiJitEmit8(&jc, 0xfb);
+    nkiJitEmit8(&jc, 0x4c); nkiJitEmit8(&jc, 0x8b); nkiJitEmit8(&jc, 0xa3);
+    nkiJitEmit32(&jc, offsetof(struct NKVM, currentExecutionContext));
+    nkiJitEmitLoadState(&jc);
+    nkiJitEmit8(&jc, 0x41); nkiJitEmit8(&jc, 0x89); nkiJitEmit8(&jc, 0xf7);
+    nkiJitEmit8(&jc, 0x4c); nkiJitEmit8(&jc, 0x89);
+    nkiJitEmit8(&jc, 0x3c); nkiJitEmit8(&jc, 0x24);
+    nkiJitEmit8(&jc, 0xff); nkiJitEmit8(&jc, 0xe2);
+
+    // Exit: returns the number of instructions executed.
+    //   mov rax, [rsp]
+    //   sub rax, r15
+    //   add rsp, 8
+    //   pop r15, r14, r13, r12, rbx, rbp
+    //   ret
+    jit->exitOffset = jc.pos;
+    nkiJitEmit8(&jc, 0x48); nkiJitEmit8(&jc, 0x8b);
+    nkiJitEmit8(&jc, 0x04); nkiJitEmit8(&jc, 0x24);
+    nkiJitEmit8(&jc, 0x4c); nkiJitEmit8(&jc, 0x29); nkiJitEmit8(&jc, 0xf8);
+    nkiJitEmit8(&jc, 0x48); nkiJitEmit8(&jc, 0x83);
+    nkiJitEmit8(&jc, 0xc4); nkiJitEmit8(&jc, 0x08);
+    nkiJitEmit8(&jc, 0x41); nkiJitEmit8(&jc, 0x5f);
+    nkiJitEmit8(&jc, 0x41); nkiJitEmit8(&jc, 0x5e);
+    nkiJitEmit8(&jc, 0x41); nkiJitEmit8(&jc, 0x5d);
+    nkiJitEmit8(&jc, 0x41); nkiJitEmit8(&jc, 0x5c);
+    nkiJitEmit8(&jc, 0x5b);
+    nkiJitEmit8(&jc, 0x5d);
+    nkiJitEmit8(&jc, 0xc3);
+
+    jit->codeUsed = jc.pos;
+    jit->trampolineSize = jc.pos;
+
+    if(mprotect(jit->code, jit->codeSize, PROT_READ | PROT_EXEC)) {
+        munmap(jit->code, jit->codeSize);
+        jit->code = NULL;
+        return nkfalse;
+    }
+
+    return nktrue;
+}
+
+// Get the code buffer and address tables ready. These don't go
+// through the VM's allocator, so that turning the JIT on doesn't
+// change which scripts hit the VM's memory limits.
+static nkbool nkiJitPrepare(struct NKVM *vm)
+{
+    struct NKJitState *jit = &vm->jit;
+
+    if(jit->disabled) {
+        return nkfalse;
+    }
+
+    if(!jit->code && !nkiJitCreateCodeBuffer(vm)) {
+        jit->disabled = nktrue;
+        return nkfalse;
+    }
+
+    if(!jit->entries) {
+        jit->tableSize = vm->instructionAddressMask + 1;
+        jit->instructions = vm->instructions;
+        jit->entries = (void **)calloc(jit->tableSize, sizeof(void *));
+        jit->counters = (nkuint32_t *)calloc(jit->tableSize, sizeof(nkuint32_t));
+        if(!jit->entries || !jit->counters) {
+            nkiJitReset(vm);
+            jit->disabled = nktrue;
+            return nkfalse;
+        }
+    }
+
+    return nktrue;
+}
+
+void nkiJitInit(struct NKVM *vm)
+{
+    nkiMemset(&vm->jit, 0, sizeof(vm->jit));
+}
+
+void nkiJitDestroy(struct NKVM *vm)
+{
+    nkiJitReset(vm);
+    if(vm->jit.code) {
+        munmap(vm->jit.code, vm->jit.codeSize);
+    }
+    nkiJitInit(vm);
+}
+
+void nkiJitReset(struct NKVM *vm)
+{
+    struct NKJitState *jit = &vm->jit;
+    nkuint32_t i;
+
+    free(jit->entries);
+    free(jit->counters);
+    jit->entries = NULL;
+    jit->counters = NULL;
+    jit->instructions = NULL;
+    jit->tableSize = 0;
+    jit->codeUsed = jit->trampolineSize;
+    jit->disabled = nkfalse;
+
+    for(i = 0; i < vm->functionCount; i++) {
+        vm->functionTable[i].callCount = 0;
+    }
+}
+
+// ----------------------------------------------------------------------
+// Running
+
+void *nkiJitFindEntry(
+    struct NKVM *vm, nkuint32_t address, nkbool backwardBranch)
+{
+    struct NKJitState *jit = &vm->jit;
+
+    // Instruction buffer moved or resized since the tables were
+    // built.
+    if(jit->entries &&
+        (jit->instructions != vm->instructions ||
+            jit->tableSize != vm->instructionAddressMask + 1))
+    {
+        nkiJitReset(vm);
+    }
+
+    if(!jit->entries) {
+        if(!backwardBranch || !nkiJitPrepare(vm)) {
+            return NULL;
+        }
+    }
+
+    address &= vm->instructionAddressMask;
+
+    if(backwardBranch && !jit->entries[address] &&
+        ++jit->counters[address] == NK_JIT_HOT_THRESHOLD)
+    {
+        nkiJitCompileRegion(vm, address);
+    }
+
+    return jit->entries[address];
+}
+
+void nkiJitCountCall(struct NKVM *vm, struct NKVMFunction *function)
+{
+    if(++function->callCount == NK_JIT_HOT_THRESHOLD) {
+
+        nkuint32_t address =
+            function->firstInstructionIndex & vm->instructionAddressMask;
+
+        if(vm->jit.entries &&
+            (vm->jit.instructions != vm->instructions ||
+                vm->jit.tableSize != vm->instructionAddressMask + 1))
+        {
+            nkiJitReset(vm);
+        }
+
+        if(nkiJitPrepare(vm) && !vm->jit.entries[address]) {
+            nkiJitCompileRegion(vm, address);
+        }
+    }
+}
+
+nkuint32_t nkiJitRun(struct NKVM *vm, void *entry, nkuint32_t budget)
+{
+    NKJitEntryCall call;
+    void *trampoline = vm->jit.code;
+    memcpy(&call, &trampoline, sizeof(call));
+    return call(vm, budget, entry);
+}
+
+#endif // NK_JIT
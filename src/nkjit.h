@@ -0,0 +1,135 @@
+// ----------------------------------------------------------------------
+//
+//        ▐ ▄ ▪   ▐ ▄ ▄ •▄  ▄▄▄· .▄▄ · ▪
+//       •█▌▐███ •█▌▐██▌▄▌▪▐█ ▀█ ▐█ ▀. ██
+//       ▐█▐▐▌▐█·▐█▐▐▌▐▀▀▄·▄█▀▀█ ▄▀▀▀█▄▐█·
+//       ██▐█▌▐█▌██▐█▌▐█.█▌▐█ ▪▐▌▐█▄▪▐█▐█▌
+//       ▀▀ █▪▀▀▀▀▀ █▪·▀  ▀ ▀  ▀  ▀▀▀▀ ▀▀▀
+//
+// ----------------------------------------------------------------------
+//
+//   Ninkasi 0.01
+//
+//   By Kiri "ExpiredPopsicle" Jolly
+//     https://expiredpopsicle.com
+//     https://intoxicoding.com
+//     expiredpopsicle@gmail.com
+//
+// ----------------------------------------------------------------------
+//
+//   Copyright (c) 2017 Kiri Jolly
+//
+//   Permission is hereby granted, free of charge, to any person
+//   obtaining a copy of this software and associated documentation files
+//   (the "Software"), to deal in the Software without restriction,
+//   including without limitation the rights to use, copy, modify, merge,
+//   publish, distribute, sublicense, and/or sell copies of the Software,
+//   and to permit persons to whom the Software is furnished to do so,
+//   subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be
+//   included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+//   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+//   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+//   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+//   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+//   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//   SOFTWARE.
+//
+// -------------------------- END HEADER -------------------------------------
+
+// Baseline JIT. Hot regions of bytecode get translated into x86-64
+// machine code that works on the same VM state the interpreter uses
+// (stack, static space, instruction pointer), so execution can move
+// between native code and the interpreter at any region boundary.
+//
+// A region starts at the first instruction of a function that has
+// been called NK_JIT_HOT_THRESHOLD times, or at the target of a
+// backwards branch (a loop) that has been taken that many times, and
+// covers everything reachable from there. The common int and float
+// operations, stack and variable access, and branches are done
+// inline. Everything else calls the regular opcode function, and
+// leaves native code if that moved the instruction pointer anywhere
+// unexpected (calls, returns, coroutines) or raised an error.
+//
+// Instruction counts (instructionsLeftBeforeTimeout) and garbage
+// collection are handled at the start of every basic block, with the
+// VM state fully written back, the same way the threaded dispatch
+// loop handles them at branches.
+//
+// This is only available when NK_JIT is set (see nkconfig.h). It's
+// off by default, and needs threaded dispatch, GCC or Clang, and
+// x86-64 Linux.
+
+#ifndef NINKASI_JIT_H
+#define NINKASI_JIT_H
+
+#include "nkconfig.h"
+#include "nktypes.h"
+
+struct NKVM;
+struct NKVMFunction;
+
+#if NK_JIT
+
+struct NKJitState
+{
+    /// Executable code buffer. Starts with the entry trampoline, then
+    /// compiled regions one after another.
+    unsigned char *code;
+    nkuint32_t codeSize;
+    nkuint32_t codeUsed;
+
+    /// Size of the trampoline and exit sequence at the start of the
+    /// code buffer. Resetting throws away everything after this.
+    nkuint32_t trampolineSize;
+
+    /// Offset of the shared exit sequence in the code buffer.
+    nkuint32_t exitOffset;
+
+    /// Native entry point for each instruction address that starts a
+    /// basic block in a compiled region, or NULL.
+    void **entries;
+
+    /// Backwards branch counts for each instruction address.
+    nkuint32_t *counters;
+
+    /// Instruction buffer and size that the tables above were built
+    /// for.
+    struct NKInstruction *instructions;
+    nkuint32_t tableSize;
+
+    /// Set if the code buffer couldn't be allocated or has filled
+    /// up. Nothing more gets compiled until the next reset.
+    nkbool disabled;
+};
+
+void nkiJitInit(struct NKVM *vm);
+void nkiJitDestroy(struct NKVM *vm);
+
+/// Throw away all compiled code. Must be done whenever the
+/// instruction buffer or static space changes (compilation,
+/// deserialization), and never while native code is running.
+void nkiJitReset(struct NKVM *vm);
+
+/// Find the native entry point for an instruction address, or NULL
+/// if there isn't one. If backwardBranch is set, this counts towards
+/// compiling a region starting at the address.
+void *nkiJitFindEntry(
+    struct NKVM *vm, nkuint32_t address, nkbool backwardBranch);
+
+/// Count a call to a script function, and compile it once it's hot.
+void nkiJitCountCall(struct NKVM *vm, struct NKVMFunction *function);
+
+/// Run native code starting at an entry point from nkiJitFindEntry(),
+/// until it leaves the compiled region, something needs the
+/// interpreter, or about budget instructions have executed. Returns
+/// the number of instructions executed.
+nkuint32_t nkiJitRun(struct NKVM *vm, void *entry, nkuint32_t budget);
+
+#endif // NK_JIT
+
+#endif // NINKASI_JIT_H
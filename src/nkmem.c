@@ -100,9 +100,31 @@ static nkuint32_t nkiMemGetAllocCount(struct NKVM *vm)
 }
 #endif // NK_EXTRA_FANCY_LEAK_TRACKING_LINUX
 
+static const char *nkiMemCategoryNames[NK_MEMORY_CATEGORY_COUNT] = {
+    "misc",
+    "strings",
+    "objects",
+    "objectElements",
+    "tables",
+    "stacks",
+    "coroutines",
+    "program",
+    "gc",
+    "external"
+};
+
+const char *nkiMemCategoryGetName(enum NKMemoryCategory category)
+{
+    if((nkuint32_t)category < NK_MEMORY_CATEGORY_COUNT) {
+        return nkiMemCategoryNames[category];
+    }
+    return NULL;
+}
+
 void *nkiMalloc_real(
     const char *filename, const char *function,
-    int lineNumber, struct NKVM *vm, nkuint32_t size)
+    int lineNumber, struct NKVM *vm, nkuint32_t size,
+    enum NKMemoryCategory category)
 {
 #if NK_MALLOC_FAILURE_TEST_MODE
     if(nkiMemFailRate) {
@@ -156,13 +178,23 @@ void *nkiMalloc_real(
             vm->allocationCount++;
 #endif // NK_EXTRA_FANCY_LEAK_TRACKING_LINUX
 
+            assert((nkuint32_t)category < NK_MEMORY_CATEGORY_COUNT);
+
             header->size = size;
+            header->category = category;
             header->vm = vm;
-            vm->currentMemoryUsage += size + sizeof(struct NKMemoryHeader);
+            vm->currentMemoryUsage += newChunkSize;
+            vm->categoryMemoryUsage[category] += newChunkSize;
 
             if(vm->peakMemoryUsage < vm->currentMemoryUsage) {
                 vm->peakMemoryUsage = vm->currentMemoryUsage;
             }
+            if(vm->categoryPeakMemoryUsage[category] <
+                vm->categoryMemoryUsage[category])
+            {
+                vm->categoryPeakMemoryUsage[category] =
+                    vm->categoryMemoryUsage[category];
+            }
 
             // Add us to the allocation list.
             header->prevAllocationPtr = &vm->allocations;
@@ -230,6 +262,8 @@ void nkiFree(struct NKVM *vm, void *data)
     if(data) {
         struct NKMemoryHeader *header = (struct NKMemoryHeader*)data - 1;
         vm->currentMemoryUsage -= header->size + sizeof(struct NKMemoryHeader);
+        vm->categoryMemoryUsage[header->category] -=
+            header->size + sizeof(struct NKMemoryHeader);
 
 #if NK_EXTRA_FANCY_LEAK_TRACKING_LINUX
         vm->allocationCount--;
@@ -253,14 +287,30 @@ void nkiFree(struct NKVM *vm, void *data)
 #endif // NK_EXTRA_FANCY_LEAK_TRACKING_LINUX
 }
 
+static enum NKMemoryCategory nkiMemGetCategory(void *data)
+{
+    if(data) {
+        return (enum NKMemoryCategory)
+            ((struct NKMemoryHeader*)data - 1)->category;
+    }
+    return NK_MEMORY_CATEGORY_MISC;
+}
+
 void *nkiRealloc(struct NKVM *vm, void *data, nkuint32_t size)
+{
+    return nkiReallocCategory(vm, data, size, nkiMemGetCategory(data));
+}
+
+void *nkiReallocCategory(
+    struct NKVM *vm, void *data, nkuint32_t size,
+    enum NKMemoryCategory category)
 {
     if(!data) {
-        return nkiMalloc(vm, size);
+        return nkiMallocCategory(vm, size, category);
     } else {
         struct NKMemoryHeader *header = (struct NKMemoryHeader*)data - 1;
         nkuint32_t copySize = size < header->size ? size : header->size;
-        void *newData = nkiMalloc(vm, size);
+        void *newData = nkiMallocCategory(vm, size, category);
         if(newData) {
             nkiMemcpy(newData, data, copySize);
         }
@@ -271,11 +321,17 @@ void *nkiRealloc(struct NKVM *vm, void *data, nkuint32_t size)
 }
 
 char *nkiStrdup(struct NKVM *vm, const char *str)
+{
+    return nkiStrdupCategory(vm, str, NK_MEMORY_CATEGORY_MISC);
+}
+
+char *nkiStrdupCategory(
+    struct NKVM *vm, const char *str, enum NKMemoryCategory category)
 {
     if(str) {
         nkuint32_t len = nkiStrlen(str) + 1;
         if(len) {
-            char *copyData = (char*)nkiMalloc(vm, len);
+            char *copyData = (char*)nkiMallocCategory(vm, len, category);
             if(copyData) {
                 nkiStrcpy(copyData, str);
                 return copyData;
@@ -288,7 +344,9 @@ char *nkiStrdup(struct NKVM *vm, const char *str)
 // Thanks AFL! There were so many bugs caused by integer overflows
 // when we tried to allocate some number of objects that I made this
 // function to wrap all of them safely.
-void *nkiMallocArray(struct NKVM *vm, nkuint32_t size, nkuint32_t count)
+void *nkiMallocArrayCategory(
+    struct NKVM *vm, nkuint32_t size, nkuint32_t count,
+    enum NKMemoryCategory category)
 {
     if(count >= ~(nkuint32_t)0 / size) {
         nkiErrorStateSetAllocationFailFlag(vm);
@@ -297,11 +355,19 @@ void *nkiMallocArray(struct NKVM *vm, nkuint32_t size, nkuint32_t count)
         return NULL;
     }
 
-    return nkiMalloc(vm, size * count);
+    return nkiMallocCategory(vm, size * count, category);
 }
 
 // Thanks AFL! Looks like we needed one for realloc, too.
 void *nkiReallocArray(struct NKVM *vm, void *data, nkuint32_t size, nkuint32_t count)
+{
+    return nkiReallocArrayCategory(
+        vm, data, size, count, nkiMemGetCategory(data));
+}
+
+void *nkiReallocArrayCategory(
+    struct NKVM *vm, void *data, nkuint32_t size, nkuint32_t count,
+    enum NKMemoryCategory category)
 {
     if(count >= ~(nkuint32_t)0 / size) {
         nkiErrorStateSetAllocationFailFlag(vm);
@@ -310,7 +376,7 @@ void *nkiReallocArray(struct NKVM *vm, void *data, nkuint32_t size, nkuint32_t c
         return NULL;
     }
 
-    return nkiRealloc(vm, data, size * count);
+    return nkiReallocCategory(vm, data, size * count, category);
 }
 
 void nkiDumpLeakData(struct NKVM *vm)
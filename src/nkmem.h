@@ -67,6 +67,11 @@
 struct NKMemoryHeader
 {
     nkuint32_t size;
+
+    // enum NKMemoryCategory. Fits in the padding after size on
+    // 64-bit builds.
+    nkuint32_t category;
+
     struct NKVM *vm;
 
     struct NKMemoryHeader *nextAllocation;
@@ -78,18 +83,43 @@ struct NKMemoryHeader
 };
 
 #if NK_EXTRA_FANCY_LEAK_TRACKING_LINUX
-#define nkiMalloc(vm, size) nkiMalloc_real(__FILE__, __FUNCTION__, __LINE__, vm, size)
+#define nkiMallocCategory(vm, size, category) nkiMalloc_real(__FILE__, __FUNCTION__, __LINE__, vm, size, category)
 #else
-#define nkiMalloc(vm, size) nkiMalloc_real(NULL, NULL, 0, vm, size)
+#define nkiMallocCategory(vm, size, category) nkiMalloc_real(NULL, NULL, 0, vm, size, category)
 #endif
 
-void *nkiMalloc_real(const char *filename, const char *function, int lineNumber, struct NKVM *vm, nkuint32_t size);
+// Allocations that don't say otherwise go into
+// NK_MEMORY_CATEGORY_MISC.
+#define nkiMalloc(vm, size) \
+    nkiMallocCategory(vm, size, NK_MEMORY_CATEGORY_MISC)
+#define nkiMallocArray(vm, size, count) \
+    nkiMallocArrayCategory(vm, size, count, NK_MEMORY_CATEGORY_MISC)
+
+void *nkiMalloc_real(
+    const char *filename, const char *function, int lineNumber,
+    struct NKVM *vm, nkuint32_t size, enum NKMemoryCategory category);
 
-void *nkiMallocArray(struct NKVM *vm, nkuint32_t size, nkuint32_t count);
+void *nkiMallocArrayCategory(
+    struct NKVM *vm, nkuint32_t size, nkuint32_t count,
+    enum NKMemoryCategory category);
 void nkiFree(struct NKVM *vm, void *data);
+
+// nkiRealloc() and nkiReallocArray() keep the category of the
+// original allocation, or use NK_MEMORY_CATEGORY_MISC for NULL.
 void *nkiRealloc(struct NKVM *vm, void *data, nkuint32_t size);
 void *nkiReallocArray(struct NKVM *vm, void *data, nkuint32_t size, nkuint32_t count);
+void *nkiReallocCategory(
+    struct NKVM *vm, void *data, nkuint32_t size,
+    enum NKMemoryCategory category);
+void *nkiReallocArrayCategory(
+    struct NKVM *vm, void *data, nkuint32_t size, nkuint32_t count,
+    enum NKMemoryCategory category);
+
 char *nkiStrdup(struct NKVM *vm, const char *str);
+char *nkiStrdupCategory(
+    struct NKVM *vm, const char *str, enum NKMemoryCategory category);
+
+const char *nkiMemCategoryGetName(enum NKMemoryCategory category);
 
 void nkiDumpLeakData(struct NKVM *vm);
 
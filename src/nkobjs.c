@@ -51,16 +51,9 @@ void nkiVmObjectTableInit(struct NKVM *vm)
 
 void nkiVmObjectDelete(struct NKVM *vm, struct NKVMObject *ob)
 {
-    nkuint32_t i;
-    for(i = 0; i < nkiVMObjectHashBucketCount; i++) {
-        struct NKVMObjectElement *el = ob->hashBuckets[i];
-        while(el) {
-            struct NKVMObjectElement *next = el->next;
-            nkiFree(vm, el);
-            el = next;
-        }
-    }
-    nkiFree(vm, ob);
+    nkiFree(vm, ob->arrayPart);
+    nkiFree(vm, ob->fields);
+    nkiPoolFree(vm, ob);
 }
 
 void nkiVmObjectTableDestroy(struct NKVM *vm)
@@ -105,8 +98,8 @@ nkuint32_t nkiVmObjectTableCreateObject(
 {
     struct NKVMTable *table = &vm->objectTable;
     nkuint32_t index = NK_INVALID_VALUE;
-    struct NKVMObject *newObject = (struct NKVMObject *)nkiMalloc(
-        vm, sizeof(struct NKVMObject));
+    struct NKVMObject *newObject = (struct NKVMObject *)nkiPoolMalloc(
+        vm, sizeof(struct NKVMObject), NK_MEMORY_CATEGORY_OBJECTS);
 
     index = nkiTableAddEntry(vm, table, newObject);
     nkiVmObjectInit(newObject, index);
@@ -116,10 +109,14 @@ nkuint32_t nkiVmObjectTableCreateObject(
     // the table slot ourselves (which would be disasterous if that
     // index was NK_INVALID_VALUE).
     if(index == NK_INVALID_VALUE) {
-        nkiFree(vm, newObject);
+        nkiPoolFree(vm, newObject);
         return NK_INVALID_VALUE;
     }
 
+    if(nkiVmGcSweeping(vm)) {
+        newObject->lastGCPass = vm->gcState.currentGCPass;
+    }
+
     // Tick the garbage collector so we eventually do another GC pass
     // when we have enough new objects.
     if(vm->gcInfo.gcNewObjectCountdown) {
@@ -198,75 +195,452 @@ void nkiVmObjectTableCleanOldObjects(
     }
 }
 
-void nkiVmObjectClearEntry(
+nkbool nkiVmObjectTableCleanOldObjectsStep(
+    struct NKVM *vm,
+    struct NKVMGCState *gcState)
+{
+    struct NKVMTable *table = &vm->objectTable;
+
+    // Objects created since the sweep started are marked, so the
+    // table growing under us is fine.
+    while(gcState->sweepPosition < table->capacity) {
+
+        struct NKVMObject *ob;
+
+        if(gcState->workDone >= gcState->stepBudget) {
+            return nkfalse;
+        }
+        gcState->workDone++;
+
+        ob = table->objectTable[gcState->sweepPosition];
+        if(ob && ob->lastGCPass != gcState->currentGCPass) {
+            nkiVmObjectTableCleanupObject(vm, gcState->sweepPosition);
+            nkiTableEraseEntry(vm, table, gcState->sweepPosition);
+        }
+
+        gcState->sweepPosition++;
+    }
+
+    return nktrue;
+}
+
+// Number of fields in the field table, as opposed to the array part.
+#define nkiVmObjectHashCount(ob) ((ob)->size - (ob)->arrayCount)
+
+// Turn a key into the form it's stored in, so that keys can be
+// compared by type and payload alone. String keys become the
+// interned copy of the string, and nil keys ignore whatever is in
+// the payload. Returns nkfalse if there's no way the key can be in
+// an object, which is the case for strings that have never been
+// interned when we're not adding anything.
+static nkbool nkiVmObjectCanonicalKey(
+    struct NKVM *vm,
+    struct NKValue *key,
+    struct NKValue *out,
+    nkbool add)
+{
+    out->type_uint = 0;
+    out->type = key->type;
+    out->basicHashValue = key->basicHashValue;
+
+    // Keys loaded from a bad file can have any type at all. Don't let
+    // one pass for an empty slot.
+    if(out->type_uint == nkiVmObjectEmptySlot) {
+        nkiAddError(vm, "Bad object key type.");
+        return nkfalse;
+    }
+
+    if(key->type == NK_VALUETYPE_STRING) {
+        out->stringTableEntry = add ?
+            nkiVmStringTableIntern(vm, key->stringTableEntry) :
+            nkiVmStringTableFindInterned(vm, key->stringTableEntry);
+        if(out->stringTableEntry == NK_INVALID_VALUE) {
+            return nkfalse;
+        }
+    } else if(key->type == NK_VALUETYPE_NIL) {
+        out->basicHashValue = 0;
+    }
+
+    return nktrue;
+}
+
+// Ints, floats, and so on hash to their own bits, which leaves the
+// low bits the same for a lot of common floats. Mix it up a bit
+// before it gets masked down to a slot index.
+static nkuint32_t nkiVmObjectKeyHash(
     struct NKVM *vm,
-    struct NKVMObject *ob,
     struct NKValue *key)
 {
-    struct NKVMObjectElement **obList =
-        &ob->hashBuckets[nkiValueHash(vm, key) & (nkiVMObjectHashBucketCount - 1)];
+    nkuint32_t hash = nkiValueHash(vm, key);
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+// Find the slot holding a canonical key, or the empty slot where it
+// would go. The table needs at least one empty slot, which the load
+// factor guarantees.
+static struct NKVMObjectElement *nkiVmObjectFindSlot(
+    struct NKVMObject *ob,
+    struct NKValue *key,
+    nkuint32_t hash)
+{
+    nkuint32_t mask = ob->fieldCapacity - 1;
+    nkuint32_t i = hash & mask;
+
+    for(;;) {
+        struct NKVMObjectElement *el = &ob->fields[i];
+        if(nkiVmObjectSlotIsEmpty(el) ||
+            (el->key.type_uint == key->type_uint &&
+                el->key.basicHashValue == key->basicHashValue))
+        {
+            return el;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+// Smallest capacity that can hold size fields and still have a
+// quarter of the slots empty.
+static nkuint32_t nkiVmObjectCapacityForSize(nkuint32_t size)
+{
+    nkuint32_t capacity = nkiVmObjectMinFieldCapacity;
+
+    // Stopping at the top bit just means the allocation will fail
+    // instead of this looping forever.
+    while(capacity - capacity / 4 < size && !(capacity & 0x80000000)) {
+        capacity <<= 1;
+    }
 
-    struct NKVMObjectElement **elPtr = obList;
-    while(*elPtr) {
-        if(nkiValueCompare(vm, key, &(*elPtr)->key, nktrue) == 0) {
+    return capacity;
+}
+
+static void nkiVmObjectResizeFields(
+    struct NKVM *vm,
+    struct NKVMObject *ob,
+    nkuint32_t newCapacity)
+{
+    struct NKVMObjectElement *oldFields = ob->fields;
+    nkuint32_t oldCapacity = ob->fieldCapacity;
+    struct NKVMObjectElement *newFields = NULL;
+    nkuint32_t i;
+
+    if(newCapacity) {
+        newFields = (struct NKVMObjectElement *)nkiMallocArrayCategory(
+            vm, sizeof(struct NKVMObjectElement), newCapacity,
+            NK_MEMORY_CATEGORY_OBJECTELEMENTS);
+        nkiMemset(newFields, 0,
+            sizeof(struct NKVMObjectElement) * newCapacity);
+        for(i = 0; i < newCapacity; i++) {
+            newFields[i].key.type_uint = nkiVmObjectEmptySlot;
+        }
+    }
+
+    ob->fields = newFields;
+    ob->fieldCapacity = newCapacity;
+    ob->callableCacheValid = nkfalse;
+
+    for(i = 0; i < oldCapacity; i++) {
+        struct NKVMObjectElement *el = &oldFields[i];
+        if(!nkiVmObjectSlotIsEmpty(el)) {
+            *nkiVmObjectFindSlot(
+                ob, &el->key, nkiVmObjectKeyHash(vm, &el->key)) = *el;
+        }
+    }
+
+    nkiFree(vm, oldFields);
+}
+
+// Take an entry out of the field table. Shift later entries in the
+// same run back into the hole, as long as that doesn't put them
+// before their home slot. This way lookups can always stop at the
+// first empty slot, without any deleted-entry markers. Doesn't touch
+// the size.
+static void nkiVmObjectRemoveSlot(
+    struct NKVM *vm,
+    struct NKVMObject *ob,
+    struct NKVMObjectElement *el)
+{
+    nkuint32_t mask = ob->fieldCapacity - 1;
+    nkuint32_t hole = (nkuint32_t)(el - ob->fields);
+    nkuint32_t i = hole;
+
+    for(;;) {
+        nkuint32_t home;
+        i = (i + 1) & mask;
+        el = &ob->fields[i];
+        if(nkiVmObjectSlotIsEmpty(el)) {
             break;
         }
-        elPtr = &(*elPtr)->next;
+        home = nkiVmObjectKeyHash(vm, &el->key) & mask;
+        if(((i - home) & mask) >= ((i - hole) & mask)) {
+            ob->fields[hole] = *el;
+            hole = i;
+        }
+    }
+
+    ob->fields[hole].key.type_uint = nkiVmObjectEmptySlot;
+    ob->callableCacheValid = nkfalse;
+}
+
+// Resize the array part. When growing, any integer keys from the
+// field table that now fit get moved over. When shrinking, there
+// must not be anything past the new end.
+static void nkiVmObjectResizeArray(
+    struct NKVM *vm,
+    struct NKVMObject *ob,
+    nkuint32_t newCapacity)
+{
+    struct NKValue *newArray = NULL;
+    nkuint32_t oldCapacity = ob->arrayCapacity;
+    nkuint32_t i;
+
+    if(newCapacity) {
+        newArray = (struct NKValue *)nkiMallocArrayCategory(
+            vm, sizeof(struct NKValue), newCapacity,
+            NK_MEMORY_CATEGORY_OBJECTELEMENTS);
+        for(i = 0; i < newCapacity; i++) {
+            newArray[i].type_uint = nkiVmObjectEmptySlot;
+            newArray[i].basicHashValue = 0;
+        }
+        nkiMemcpy(newArray, ob->arrayPart, sizeof(struct NKValue) *
+            (oldCapacity < newCapacity ? oldCapacity : newCapacity));
     }
 
-    if(*elPtr) {
-        struct NKVMObjectElement *el = *elPtr;
-        *elPtr = (*elPtr)->next;
-        nkiFree(vm, el);
+    nkiFree(vm, ob->arrayPart);
+    ob->arrayPart = newArray;
+    ob->arrayCapacity = newCapacity;
 
-        assert(ob->size);
-        ob->size--;
+    for(i = oldCapacity; i < newCapacity && nkiVmObjectHashCount(ob); i++) {
+
+        struct NKValue key;
+        struct NKVMObjectElement *el;
+
+        key.type_uint = 0;
+        key.type = NK_VALUETYPE_INT;
+        key.intData = (nkint32_t)i;
+
+        el = nkiVmObjectFindSlot(ob, &key, nkiVmObjectKeyHash(vm, &key));
+        if(!nkiVmObjectSlotIsEmpty(el)) {
+            newArray[i] = el->value;
+            nkiVmObjectRemoveSlot(vm, ob, el);
+            ob->arrayCount++;
+        }
     }
 }
 
-struct NKValue *nkiVmObjectFindOrAddEntry(
+void nkiVmObjectRebuildFields(
+    struct NKVM *vm,
+    struct NKVMObject *ob)
+{
+    nkuint32_t hashCount = nkiVmObjectHashCount(ob);
+    nkuint32_t arrayCapacity = ob->arrayCapacity;
+
+    // Trim off unused space at the end of the array part.
+    while(arrayCapacity &&
+        nkiVmObjectArraySlotIsEmpty(&ob->arrayPart[arrayCapacity - 1]))
+    {
+        arrayCapacity--;
+    }
+    if(arrayCapacity) {
+        nkuint32_t newCapacity = nkiVmObjectMinArrayCapacity;
+        while(newCapacity < arrayCapacity) {
+            newCapacity <<= 1;
+        }
+        arrayCapacity = newCapacity;
+    }
+    if(arrayCapacity != ob->arrayCapacity) {
+        nkiVmObjectResizeArray(vm, ob, arrayCapacity);
+    }
+
+    nkiVmObjectResizeFields(
+        vm, ob, hashCount ? nkiVmObjectCapacityForSize(hashCount) : 0);
+}
+
+void nkiVmObjectClearEntry(
+    struct NKVM *vm,
+    struct NKVMObject *ob,
+    struct NKValue *key)
+{
+    struct NKValue canonicalKey;
+    struct NKVMObjectElement *el;
+
+    if(key->type == NK_VALUETYPE_INT &&
+        (nkuint32_t)key->intData < ob->arrayCapacity)
+    {
+        struct NKValue *v = &ob->arrayPart[key->intData];
+        if(!nkiVmObjectArraySlotIsEmpty(v)) {
+            v->type_uint = nkiVmObjectEmptySlot;
+            ob->arrayCount--;
+            ob->size--;
+        }
+        return;
+    }
+
+    if(!nkiVmObjectHashCount(ob) ||
+        !nkiVmObjectCanonicalKey(vm, key, &canonicalKey, nkfalse))
+    {
+        return;
+    }
+
+    el = nkiVmObjectFindSlot(
+        ob, &canonicalKey, nkiVmObjectKeyHash(vm, &canonicalKey));
+    if(nkiVmObjectSlotIsEmpty(el)) {
+        return;
+    }
+
+    nkiVmObjectRemoveSlot(vm, ob, el);
+
+    assert(ob->size);
+    ob->size--;
+}
+
+// Field table half of nkiVmObjectFindOrAddEntry(), for keys that
+// don't belong in the array part.
+static struct NKVMObjectElement *nkiVmObjectFindOrAddField(
     struct NKVM *vm,
     struct NKVMObject *ob,
     struct NKValue *key,
     nkbool noAdd)
 {
-    struct NKVMObjectElement **obList =
-        &ob->hashBuckets[nkiValueHash(vm, key) & (nkiVMObjectHashBucketCount - 1)];
+    struct NKValue canonicalKey;
+    struct NKVMObjectElement *el;
+    nkuint32_t hash;
 
-    struct NKVMObjectElement *el = *obList;
-    while(el) {
-        if(nkiValueCompare(vm, key, &el->key, nktrue) == 0) {
-            break;
+    if(!nkiVmObjectCanonicalKey(vm, key, &canonicalKey, !noAdd)) {
+        return NULL;
+    }
+    hash = nkiVmObjectKeyHash(vm, &canonicalKey);
+
+    if(nkiVmObjectHashCount(ob)) {
+        el = nkiVmObjectFindSlot(ob, &canonicalKey, hash);
+        if(!nkiVmObjectSlotIsEmpty(el)) {
+            return el;
         }
-        el = el->next;
     }
 
-    // If we can't find the entry, make a new one.
-    if(!el) {
+    // If we can't find the entry, make a new one. But only add if
+    // we're supposed to.
+    if(noAdd) {
+        return NULL;
+    }
+
+    if(ob->size >= vm->limits.maxFieldsPerObject) {
+        nkiAddError(vm, "Reached object field count limit.");
+        return NULL;
+    }
+
+    if(nkiVmObjectHashCount(ob) + 1 >
+        ob->fieldCapacity - ob->fieldCapacity / 4)
+    {
+        nkiVmObjectResizeFields(
+            vm, ob, nkiVmObjectCapacityForSize(nkiVmObjectHashCount(ob) + 1));
+    }
 
-        // But only add if we're supposed to.
-        if(noAdd) {
-            return NULL;
+    el = nkiVmObjectFindSlot(ob, &canonicalKey, hash);
+    el->key = canonicalKey;
+    nkiMemset(&el->value, 0, sizeof(el->value));
+    ob->size++;
+    ob->callableCacheValid = nkfalse;
+
+    return el;
+}
+
+struct NKValue *nkiVmObjectFindOrAddEntry(
+    struct NKVM *vm,
+    struct NKVMObject *ob,
+    struct NKValue *key,
+    nkbool noAdd)
+{
+    struct NKVMObjectElement *el;
+
+    if(key->type == NK_VALUETYPE_INT) {
+
+        nkuint32_t index = (nkuint32_t)key->intData;
+
+        // Grow the array part for a key just past the end of it, as
+        // long as it's at least half full. Anything sparser than that
+        // is better off in the field table.
+        if(!noAdd && index >= ob->arrayCapacity &&
+            ob->arrayCount >= ob->arrayCapacity / 2)
+        {
+            nkuint32_t newCapacity = ob->arrayCapacity ?
+                ob->arrayCapacity << 1 : nkiVmObjectMinArrayCapacity;
+            if(index < newCapacity) {
+                nkiVmObjectResizeArray(vm, ob, newCapacity);
+            }
         }
 
-        el = (struct NKVMObjectElement *)nkiMalloc(
-            vm, sizeof(struct NKVMObjectElement));
-        nkiMemset(el, 0, sizeof(struct NKVMObjectElement));
-        el->next = *obList;
-        el->key = *key;
-        *obList = el;
+        if(index < ob->arrayCapacity) {
 
-        ob->size++;
-        if(!ob->size || ob->size > vm->limits.maxFieldsPerObject) {
-            ob->size--;
+            struct NKValue *v = &ob->arrayPart[index];
+
+            if(nkiVmObjectArraySlotIsEmpty(v)) {
 
-            nkiAddError(vm, "Reached object field count limit.");
+                if(noAdd) {
+                    return NULL;
+                }
+
+                if(ob->size >= vm->limits.maxFieldsPerObject) {
+                    nkiAddError(vm, "Reached object field count limit.");
+                    return NULL;
+                }
+
+                nkiMemset(v, 0, sizeof(*v));
+                ob->arrayCount++;
+                ob->size++;
+            }
 
-            return NULL;
+            return v;
         }
     }
 
-    return &el->value;
+    el = nkiVmObjectFindOrAddField(vm, ob, key, noAdd);
+    return el ? &el->value : NULL;
+}
+
+nkuint32_t nkiVmObjectFindOrAddFieldSlot(
+    struct NKVM *vm,
+    struct NKVMObject *ob,
+    struct NKValue *key,
+    nkbool noAdd)
+{
+    struct NKVMObjectElement *el;
+
+    // Int keys might belong in the array part, which doesn't have
+    // slots like this.
+    if(key->type == NK_VALUETYPE_INT) {
+        return NK_INVALID_VALUE;
+    }
+
+    el = nkiVmObjectFindOrAddField(vm, ob, key, noAdd);
+    return el ? (nkuint32_t)(el - ob->fields) : NK_INVALID_VALUE;
+}
+
+void nkiVmObjectGetCallableFields(
+    struct NKVM *vm,
+    struct NKVMObject *ob,
+    struct NKValue **exec,
+    struct NKValue **data)
+{
+    if(!ob->callableCacheValid) {
+
+        struct NKValue key;
+        nkiMemset(&key, 0, sizeof(key));
+        key.type = NK_VALUETYPE_STRING;
+
+        key.stringTableEntry = vm->internalStrings.exec;
+        ob->callableExec = nkiVmObjectFindOrAddEntry(vm, ob, &key, nktrue);
+
+        key.stringTableEntry = vm->internalStrings.data;
+        ob->callableData = nkiVmObjectFindOrAddEntry(vm, ob, &key, nktrue);
+
+        ob->callableCacheValid = nktrue;
+    }
+
+    *exec = ob->callableExec;
+    *data = ob->callableData;
 }
 
 // ----------------------------------------------------------------------
@@ -479,6 +853,12 @@ struct NKValue *nkiVmObjectFindOrAddEntry_public(
 {
     struct NKVMObject *ob = nkiVmGetObjectFromValue(vm, objectId);
     if(ob) {
+
+        // The caller is probably about to write to this.
+        if(!noAdd) {
+            nkiVmGcObjectBarrier(vm, ob);
+        }
+
         return nkiVmObjectFindOrAddEntry(vm, ob, key, noAdd);
     } else {
         nkiAddError(
@@ -48,25 +48,58 @@
 #include "nktable.h"
 #include "nkvalue.h"
 
-/// Dumb linked-list for key/value pairs inside of an object.
+/// One key/value slot in an object's field table.
 struct NKVMObjectElement
 {
     struct NKValue key;
     struct NKValue value;
-    struct NKVMObjectElement *next;
 };
 
-#define nkiVMObjectHashBucketCount 16
+/// Key type_uint for an unused slot in an object's field table. This
+/// isn't a real value type, so it never matches a key.
+#define nkiVmObjectEmptySlot 0xffffffff
+
+#define nkiVmObjectSlotIsEmpty(el) \
+    ((el)->key.type_uint == nkiVmObjectEmptySlot)
+
+/// Smallest non-empty field table.
+#define nkiVmObjectMinFieldCapacity 4
+
+/// Smallest non-empty array part.
+#define nkiVmObjectMinArrayCapacity 4
+
+/// Same as nkiVmObjectSlotIsEmpty(), but for a value in an object's
+/// array part.
+#define nkiVmObjectArraySlotIsEmpty(v) \
+    ((v)->type_uint == nkiVmObjectEmptySlot)
 
 struct NKVMObject
 {
     nkuint32_t objectTableIndex;
     nkuint32_t lastGCPass;
 
-    // Cached count of number of entries.
+    // Cached count of number of entries, including the ones in the
+    // array part.
     nkuint32_t size;
 
-    struct NKVMObjectElement *hashBuckets[nkiVMObjectHashBucketCount];
+    // Values for integer keys 0 through arrayCapacity - 1, so that
+    // objects used as arrays don't need to hash anything. Unused
+    // slots are marked with nkiVmObjectEmptySlot as their type.
+    // arrayCapacity is zero (with a NULL arrayPart) or a power of
+    // two. Integer keys outside of this range go in the field table
+    // like any other key. arrayCount is the number of slots in use.
+    nkuint32_t arrayCapacity;
+    nkuint32_t arrayCount;
+    struct NKValue *arrayPart;
+
+    // Open-addressed field table, using linear probing, for
+    // everything not in the array part. fieldCapacity is zero (with a
+    // NULL fields) or a power of two, and always leaves at least a
+    // quarter of the slots empty. Keys are stored
+    // in canonical form (see nkiVmObjectFindOrAddEntry()) so they can
+    // be compared directly.
+    nkuint32_t fieldCapacity;
+    struct NKVMObjectElement *fields;
 
     // External handle stuff.
     struct NKVMObject *nextObjectWithExternalHandles;
@@ -75,6 +108,14 @@ struct NKVMObject
 
     NKVMExternalDataTypeID externalDataType;
     void *externalData;
+
+    // Cached "_exec" and "_data" lookups for callable objects. These
+    // point at element values, so assignments to the fields show up
+    // without any help. Adding or removing an element invalidates
+    // them. Not serialized.
+    nkbool callableCacheValid;
+    struct NKValue *callableExec;
+    struct NKValue *callableData;
 };
 
 void nkiVmObjectTableInit(struct NKVM *vm);
@@ -98,12 +139,43 @@ void nkiVmObjectTableCleanOldObjects(
     struct NKVM *vm,
     nkuint32_t lastGCPass);
 
+/// Incremental version of nkiVmObjectTableCleanOldObjects(). Returns
+/// nktrue when it's done. See nkiVmStringTableCleanOldStringsStep().
+nkbool nkiVmObjectTableCleanOldObjectsStep(
+    struct NKVM *vm,
+    struct NKVMGCState *gcState);
+
+/// Find a field on an object, or add a new zeroed one if it doesn't
+/// exist and noAdd is nkfalse. Returns NULL if the field isn't there (or
+/// couldn't be added). Adding fields can move the field table, so
+/// the returned pointer is only good until the next add.
 struct NKValue *nkiVmObjectFindOrAddEntry(
     struct NKVM *vm,
     struct NKVMObject *ob,
     struct NKValue *key,
     nkbool noAdd);
 
+/// Same as nkiVmObjectFindOrAddEntry(), but returns the key's index in
+/// ob->fields instead, or NK_INVALID_VALUE. Int keys always get
+/// NK_INVALID_VALUE, because they might be in the array part. The
+/// index is good until the field table is resized or a field is
+/// removed. Objects that had the same keys added in the same order
+/// have the same table layout, so an index can be reused across them
+/// by checking the key with nkiVmObjectSlotHasStringKey() first. The
+/// inline caches on constant key field instructions rely on this.
+nkuint32_t nkiVmObjectFindOrAddFieldSlot(
+    struct NKVM *vm,
+    struct NKVMObject *ob,
+    struct NKValue *key,
+    nkbool noAdd);
+
+/// True if a (possibly out of range) index into ob->fields holds the
+/// given interned string as its key.
+#define nkiVmObjectSlotHasStringKey(ob, slot, stringIndex)           \
+    ((slot) < (ob)->fieldCapacity &&                                 \
+        (ob)->fields[(slot)].key.type == NK_VALUETYPE_STRING &&      \
+        (ob)->fields[(slot)].key.stringTableEntry == (stringIndex))
+
 nkuint32_t nkiVmObjectGetSize(
     struct NKVM *vm,
     struct NKValue *objectId);
@@ -113,6 +185,24 @@ void nkiVmObjectClearEntry(
     struct NKVMObject *ob,
     struct NKValue *key);
 
+/// Rebuild an object's field table with the smallest capacity that
+/// fits its current fields, and trim unused space off the end of the
+/// array part. This has to happen whenever the hash of a key changes,
+/// which is the case for object IDs when nkshrink.c moves objects
+/// around.
+void nkiVmObjectRebuildFields(
+    struct NKVM *vm,
+    struct NKVMObject *ob);
+
+/// Look up the "_exec" and "_data" fields of a callable object,
+/// using the per-object cache when it's still valid. Either output
+/// may be NULL if the field doesn't exist.
+void nkiVmObjectGetCallableFields(
+    struct NKVM *vm,
+    struct NKVMObject *ob,
+    struct NKValue **exec,
+    struct NKValue **data);
+
 // Internal version of nkxVmObjectAcquireHandle.
 void nkiVmObjectAcquireHandle(struct NKVM *vm, struct NKValue *value);
 
@@ -155,7 +245,8 @@ void nkiVmObjectClearEntry_public(
     struct NKValue *key);
 
 // Wrapper around nkiVmObjectFindOrAddEntry() that gets the object
-// itself based on the objectId value.
+// itself based on the objectId value. The returned pointer is only
+// good until another field is added to the object.
 struct NKValue *nkiVmObjectFindOrAddEntry_public(
     struct NKVM *vm,
     struct NKValue *objectId,
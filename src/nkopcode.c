@@ -43,12 +43,50 @@
 
 #include "nkcommon.h"
 
+// Rewrite the currently executing instruction into a type-specialized
+// version if the top two stack values are both ints or both floats.
+// This has to happen before the generic opcode pops anything.
+static void nkiOpcode_quicken(
+    struct NKVM *vm,
+    enum NKOpcode genericOpcode,
+    enum NKOpcode intOpcode,
+    enum NKOpcode floatOpcode)
+{
+    struct NKVMStack *stack = &vm->currentExecutionContext->stack;
+    struct NKInstruction *inst = &vm->instructions[
+        vm->currentExecutionContext->instructionPointer &
+        vm->instructionAddressMask];
+    enum NKValueType type1;
+    enum NKValueType type2;
+
+    // The generic opcode functions are also used to implement some
+    // superinstructions, so make sure the instruction is really the
+    // generic one before touching it.
+    if(inst->opcode != genericOpcode || stack->size < 2) {
+        return;
+    }
+
+    type1 = stack->values[(stack->size - 2) & stack->indexMask].type;
+    type2 = stack->values[(stack->size - 1) & stack->indexMask].type;
+
+    if(type1 == NK_VALUETYPE_INT && type2 == NK_VALUETYPE_INT) {
+        inst->opcode = intOpcode;
+    } else if(type1 == NK_VALUETYPE_FLOAT && type2 == NK_VALUETYPE_FLOAT) {
+        inst->opcode = floatOpcode;
+    }
+}
+
 void nkiOpcode_add(struct NKVM *vm)
 {
-    struct NKValue *in2  = nkiVmStackPop(vm);
-    struct NKValue *in1  = nkiVmStackPop(vm);
+    struct NKValue *in2;
+    struct NKValue *in1;
+    enum NKValueType type;
 
-    enum NKValueType type = in1->type;
+    nkiOpcode_quicken(vm, NK_OP_ADD, NK_OP_ADD_INT, NK_OP_ADD_FLOAT);
+
+    in2 = nkiVmStackPop(vm);
+    in1 = nkiVmStackPop(vm);
+    type = in1->type;
 
     switch(type) {
 
@@ -70,24 +108,21 @@ void nkiOpcode_add(struct NKVM *vm)
 
         case NK_VALUETYPE_STRING: {
 
-            // Make a new string that is the concatenated values.
-            // Start with a DynString of the first one.
-            struct NKDynString *dynStr =
-                nkiDynStrCreate(vm,
-                    nkiVmStringTableGetStringById(
-                        &vm->stringTable,
-                        in1->stringTableEntry));
-
-            // Append the other one, after conversion to string if
-            // necessary.
-            nkiDynStrAppend(dynStr, nkiValueToString(vm, in2));
-
-            // Push the result.
-            nkiVmStackPushString(
-                vm, dynStr->data);
-
-            // Clean up.
-            nkiDynStrDelete(dynStr);
+            // Make a new string that is the concatenated values,
+            // after converting the second one to a string if
+            // necessary. This doesn't intern the result, and extends
+            // the first string's buffer in place when it can.
+            nkuint32_t leftId = in1->stringTableEntry;
+            nkuint32_t rightLen = 0;
+            const char *right = nkiValueToStringBytes(vm, in2, &rightLen);
+            nkuint32_t resultId = nkiVmStringTableConcat(
+                vm, leftId, right, rightLen);
+
+            if(resultId != NK_INVALID_VALUE) {
+                struct NKValue *result = nkiVmStackPush_internal(vm);
+                result->type = NK_VALUETYPE_STRING;
+                result->stringTableEntry = resultId;
+            }
 
         } break;
 
@@ -154,10 +189,15 @@ void nkiOpcode_nop(struct NKVM *vm)
 
 void nkiOpcode_subtract(struct NKVM *vm)
 {
-    struct NKValue *in2 = nkiVmStackPop(vm);
-    struct NKValue *in1 = nkiVmStackPop(vm);
+    struct NKValue *in2;
+    struct NKValue *in1;
+    enum NKValueType type;
 
-    enum NKValueType type = in1->type;
+    nkiOpcode_quicken(vm, NK_OP_SUBTRACT, NK_OP_SUBTRACT_INT, NK_OP_SUBTRACT_FLOAT);
+
+    in2 = nkiVmStackPop(vm);
+    in1 = nkiVmStackPop(vm);
+    type = in1->type;
 
     switch(type) {
 
@@ -190,10 +230,15 @@ void nkiOpcode_subtract(struct NKVM *vm)
 
 void nkiOpcode_multiply(struct NKVM *vm)
 {
-    struct NKValue *in2 = nkiVmStackPop(vm);
-    struct NKValue *in1 = nkiVmStackPop(vm);
+    struct NKValue *in2;
+    struct NKValue *in1;
+    enum NKValueType type;
 
-    enum NKValueType type = in1->type;
+    nkiOpcode_quicken(vm, NK_OP_MULTIPLY, NK_OP_MULTIPLY_INT, NK_OP_MULTIPLY_FLOAT);
+
+    in2 = nkiVmStackPop(vm);
+    in1 = nkiVmStackPop(vm);
+    type = in1->type;
 
     switch(type) {
 
@@ -488,8 +533,7 @@ void nkiOpcode_call(struct NKVM *vm)
         // field.
         while(functionIdValue && functionIdValue->type == NK_VALUETYPE_OBJECTID) {
 
-            struct NKValue *objectIdValue = functionIdValue;
-            struct NKValue index;
+            struct NKVMObject *ob = nkiVmGetObjectFromValue(vm, functionIdValue);
 
             // FIXME: Make this less arbitrary.
             redirectionCount++;
@@ -500,19 +544,18 @@ void nkiOpcode_call(struct NKVM *vm)
                 return;
             }
 
-            // Check for the function call field.
-            nkxValueSetString(vm, &index, "_exec");
-            functionIdValue = nkiVmObjectFindOrAddEntry_public(
-                vm, objectIdValue, &index, nktrue);
+            if(!ob) {
+                nkiAddError(
+                    vm, "Bad object ID in nkiVmObjectFindOrAddEntry.");
+                return;
+            }
 
-            // Check for the data field.
-            nkxValueSetString(vm, &index, "_data");
-            callableObjectData = nkiVmObjectFindOrAddEntry_public(
-                vm, objectIdValue, &index, nktrue);
+            // Check for the function call and data fields.
+            nkiVmObjectGetCallableFields(
+                vm, ob, &functionIdValue, &callableObjectData);
 
             if(callableObjectData) {
 
-                nkuint32_t i = 0;
                 nkbool overflow = nkfalse;
 
                 NK_CHECK_OVERFLOW_UINT_ADD(argumentCount, 1, argumentCount, overflow);
@@ -520,30 +563,40 @@ void nkiOpcode_call(struct NKVM *vm)
                 if(!overflow) {
 
                     struct NKVMStack *stack = &(vm->currentExecutionContext->stack);
-                    struct NKValue *stackValues;
-                    nkuint32_t stackSize;
-                    nkuint32_t stackMask;
-                    nkuint32_t stackSizeMinusArguments;
+                    nkuint32_t oldStackSize = stack->size;
+                    struct NKValue *firstArgument;
+                    struct NKValue *dst;
+
+                    // The function id, the old arguments, and
+                    // _argumentCount all need to actually be there.
+                    if(argumentCount >= oldStackSize) {
+                        nkiAddError(
+                            vm,
+                            "Stack underflow in callable object call.");
+                        return;
+                    }
 
                     // Make room for the _data contents on the stack.
                     nkiVmStackPush_internal(vm);
+                    if(stack->size == oldStackSize) {
+                        return;
+                    }
 
-                    stackValues = stack->values;
-                    stackSize = stack->size;
-                    stackMask = stack->indexMask;
-                    stackSizeMinusArguments = stackSize - argumentCount - 2;
-
-                    // Shift everything up the stack.
-                    for(i = argumentCount; i >= 1; i--) {
-                        stackValues[(stackSizeMinusArguments + i + 1) & stackMask] =
-                            stackValues[(stackSizeMinusArguments + i) & stackMask];
+                    // The frame sits entirely below stack->size, so
+                    // it's contiguous in memory and we can move the
+                    // old arguments and _argumentCount up one slot
+                    // as a single block instead of masking every
+                    // index.
+                    firstArgument = &stack->values[stack->size - argumentCount - 1];
+                    dst = &stack->values[stack->size - 1];
+                    while(dst != firstArgument) {
+                        *dst = *(dst - 1);
+                        dst--;
                     }
 
                     // Insert the _data contents into the beginning of
                     // the stack.
-                    stackValues[
-                        (stackSize - argumentCount - 1) & stackMask] =
-                        *callableObjectData;
+                    *firstArgument = *callableObjectData;
 
                     // We also have to adjust the _argumentCount
                     // coming into this function, right at the top of
@@ -551,7 +604,7 @@ void nkiOpcode_call(struct NKVM *vm)
                     // won't know how much to pop off when done.
                     nkiValueSetInt(
                         vm,
-                        &stackValues[(stackSize - 1) & stackMask],
+                        &stack->values[stack->size - 1],
                         argumentCount);
 
                 } else {
@@ -623,36 +676,63 @@ void nkiOpcode_call(struct NKVM *vm)
 
         externalFunc = &vm->externalFunctionTable[funcOb->externalFunctionId.id];
 
-        if(!externalFunc->CFunctionCallback) {
+        if(!externalFunc->CFunctionCallback && !externalFunc->typedFunction) {
             nkiAddError(
                 vm,
                 "Tried to call a null native function.");
             return;
         }
 
-        // Fill in important stuff here.
-        data.vm = vm;
-        data.argumentCount = argumentCount;
-        data.arguments = (struct NKValue *)nkiMallocArray(
-            vm, sizeof(struct NKValue), argumentCount);
-
-        // Note: We're not simply giving the function a stack pointer,
-        // because then the called function would have to worry about
-        // the stack index mask and all that crap.
-
-        // Copy arguments over.
+        // The arguments sit right under _argumentCount, and the stack
+        // never wraps around below its size, so as long as they're
+        // all really there they're one contiguous block. The called
+        // function gets a pointer straight to them instead of a copy.
+        // If the function calls back into the VM and the stack has to
+        // grow, the old block is kept around until we're back (see
+        // nkiVmStackGrow()).
         {
-            nkuint32_t i;
-            for(i = 0; i < argumentCount; i++) {
-                data.arguments[i] =
-                    vm->currentExecutionContext->stack.values[
-                        vm->currentExecutionContext->stack.indexMask &
-                        ((vm->currentExecutionContext->stack.size - argumentCount - 1) + i)];
+            struct NKVMStack *stack = &vm->currentExecutionContext->stack;
+
+            if(stack->size < 2 || argumentCount > stack->size - 2) {
+                nkiAddError(
+                    vm,
+                    "Stack underflow in native function call.");
+                return;
             }
+
+            data.vm = vm;
+            data.argumentCount = argumentCount;
+            data.arguments = &stack->values[stack->size - argumentCount - 1];
         }
 
         // Check argument count and types.
-        if(externalFunc->argumentCount != NK_INVALID_VALUE) {
+        if(externalFunc->typedFunction) {
+
+            // Typed functions have fixed argument types, packed into
+            // one number, so they all get checked with a single
+            // comparison.
+            nkuint32_t argumentKey = 0;
+            nkuint32_t i;
+
+            if(externalFunc->argumentCount == argumentCount) {
+                for(i = 0; i < argumentCount; i++) {
+                    argumentKey |= NK_TYPED_ARGUMENT_KEY(i, data.arguments[i].type);
+                }
+            }
+
+            if(externalFunc->argumentCount != argumentCount ||
+                externalFunc->typedArgumentKey != argumentKey)
+            {
+                struct NKDynString *dynStr = nkiDynStrCreate(vm,
+                    "Incorrect argument count or types in call to ");
+                nkiDynStrAppend(dynStr, externalFunc->name);
+                nkiDynStrAppend(dynStr, ".");
+                nkiAddError(vm, dynStr->data);
+                nkiDynStrDelete(dynStr);
+                return;
+            }
+
+        } else if(externalFunc->argumentCount != NK_INVALID_VALUE) {
 
             nkuint32_t i;
 
@@ -664,7 +744,6 @@ void nkiOpcode_call(struct NKVM *vm)
                 nkiDynStrAppend(dynStr, " with an incorrect number of arguments.");
                 nkiAddError(vm, dynStr->data);
                 nkiDynStrDelete(dynStr);
-                nkiFree(vm, data.arguments);
                 return;
             }
 
@@ -690,7 +769,6 @@ void nkiOpcode_call(struct NKVM *vm)
                         nkiDynStrAppend(dynStr, ".");
                         nkiAddError(vm, dynStr->data);
                         nkiDynStrDelete(dynStr);
-                        nkiFree(vm, data.arguments);
                         return;
                     }
 
@@ -715,7 +793,6 @@ void nkiOpcode_call(struct NKVM *vm)
                                 nkiDynStrAppend(dynStr, ".");
                                 nkiAddError(vm, dynStr->data);
                                 nkiDynStrDelete(dynStr);
-                                nkiFree(vm, data.arguments);
                                 return;
                             }
 
@@ -729,7 +806,6 @@ void nkiOpcode_call(struct NKVM *vm)
                             nkiDynStrAppend(dynStr, ".");
                             nkiAddError(vm, dynStr->data);
                             nkiDynStrDelete(dynStr);
-                            nkiFree(vm, data.arguments);
                             return;
                         }
                     }
@@ -738,11 +814,16 @@ void nkiOpcode_call(struct NKVM *vm)
         }
 
         // Actual function call.
-        if(externalFunc->CFunctionCallback) {
+        if(externalFunc->typedFunction) {
+            vm->nativeCallDepth++;
+            nkiVmCallTypedExternalFunction(
+                vm, externalFunc, data.arguments, &data.returnValue);
+            vm->nativeCallDepth--;
+        } else if(externalFunc->CFunctionCallback) {
+            vm->nativeCallDepth++;
             externalFunc->CFunctionCallback(&data);
-            nkiFree(vm, data.arguments);
+            vm->nativeCallDepth--;
         } else {
-            nkiFree(vm, data.arguments);
             nkiAddError(vm, "Attempted to call a C function that doesn't exist.");
         }
 
@@ -756,6 +837,11 @@ void nkiOpcode_call(struct NKVM *vm)
             NK_CATASTROPHE();
         }
 
+        // Nobody's looking at old stack blocks anymore.
+        if(!vm->nativeCallDepth) {
+            nkiVmStackFreeRetiredBlocks(vm);
+        }
+
         // Pop all the arguments.
         nkiVmStackPopN(vm, argumentCount + 2);
 
@@ -775,11 +861,27 @@ void nkiOpcode_call(struct NKVM *vm)
         // printf("Pushed return pointer\n");
         // nkiVmStackDump(vm);
 
+        // Make room for the whole stack frame now, so stack overflows
+        // show up here instead of in the middle of an expression, and
+        // pushes inside the function never have to grow the stack.
+        {
+            struct NKVMStack *stack = &vm->currentExecutionContext->stack;
+            if(stack->capacity - stack->size < funcOb->maxStackDepth &&
+                !nkiVmStackReserve(vm, funcOb->maxStackDepth))
+            {
+                return;
+            }
+        }
+
         // Set the instruction pointer to the saved function object's
         // instruction pointer. Minus one, because the instruction
         // pointer will be incremented when this function returns.
         vm->currentExecutionContext->instructionPointer = funcOb->firstInstructionIndex - 1;
 
+#if NK_JIT
+        nkiJitCountCall(vm, funcOb);
+#endif
+
         // Expected stack state at end...
         //   _returnPointer
         //   _argumentCount
@@ -907,37 +1009,49 @@ nkint32_t nkiOpcode_internal_compare(struct NKVM *vm)
 
 void nkiOpcode_gt(struct NKVM *vm)
 {
-    nkint32_t comparison = nkiOpcode_internal_compare(vm);
+    nkint32_t comparison;
+    nkiOpcode_quicken(vm, NK_OP_GREATERTHAN, NK_OP_GREATERTHAN_INT, NK_OP_GREATERTHAN_FLOAT);
+    comparison = nkiOpcode_internal_compare(vm);
     nkiVmStackPushInt(vm, comparison == 1);
 }
 
 void nkiOpcode_lt(struct NKVM *vm)
 {
-    nkint32_t comparison = nkiOpcode_internal_compare(vm);
+    nkint32_t comparison;
+    nkiOpcode_quicken(vm, NK_OP_LESSTHAN, NK_OP_LESSTHAN_INT, NK_OP_LESSTHAN_FLOAT);
+    comparison = nkiOpcode_internal_compare(vm);
     nkiVmStackPushInt(vm, comparison == -1);
 }
 
 void nkiOpcode_ge(struct NKVM *vm)
 {
-    nkint32_t comparison = nkiOpcode_internal_compare(vm);
+    nkint32_t comparison;
+    nkiOpcode_quicken(vm, NK_OP_GREATERTHANOREQUAL, NK_OP_GREATERTHANOREQUAL_INT, NK_OP_GREATERTHANOREQUAL_FLOAT);
+    comparison = nkiOpcode_internal_compare(vm);
     nkiVmStackPushInt(vm, comparison == 0 || comparison == 1);
 }
 
 void nkiOpcode_le(struct NKVM *vm)
 {
-    nkint32_t comparison = nkiOpcode_internal_compare(vm);
+    nkint32_t comparison;
+    nkiOpcode_quicken(vm, NK_OP_LESSTHANOREQUAL, NK_OP_LESSTHANOREQUAL_INT, NK_OP_LESSTHANOREQUAL_FLOAT);
+    comparison = nkiOpcode_internal_compare(vm);
     nkiVmStackPushInt(vm, comparison == 0 || comparison == -1);
 }
 
 void nkiOpcode_eq(struct NKVM *vm)
 {
-    nkint32_t comparison = nkiOpcode_internal_compare(vm);
+    nkint32_t comparison;
+    nkiOpcode_quicken(vm, NK_OP_EQUAL, NK_OP_EQUAL_INT, NK_OP_EQUAL_FLOAT);
+    comparison = nkiOpcode_internal_compare(vm);
     nkiVmStackPushInt(vm, comparison == 0);
 }
 
 void nkiOpcode_ne(struct NKVM *vm)
 {
-    nkint32_t comparison = nkiOpcode_internal_compare(vm);
+    nkint32_t comparison;
+    nkiOpcode_quicken(vm, NK_OP_NOTEQUAL, NK_OP_NOTEQUAL_INT, NK_OP_NOTEQUAL_FLOAT);
+    comparison = nkiOpcode_internal_compare(vm);
     nkiVmStackPushInt(vm, comparison != 0);
 }
 
@@ -1076,6 +1190,7 @@ void nkiOpcode_objectFieldSet(struct NKVM *vm)
 
         // For non-nil values, set or create the field.
 
+        nkiVmGcObjectBarrier(vm, ob);
         objectValue =
             nkiVmObjectFindOrAddEntry(vm, ob, indexToSet, nkfalse);
 
@@ -1145,8 +1260,9 @@ void nkiOpcode_coroutineCreate(struct NKVM *vm)
     }
 
     executionContext =
-        (struct NKVMExecutionContext*)nkiMalloc(
-            vm, sizeof(struct NKVMExecutionContext));
+        (struct NKVMExecutionContext*)nkiMallocCategory(
+            vm, sizeof(struct NKVMExecutionContext),
+            NK_MEMORY_CATEGORY_COROUTINES);
 
     // Save all the arguments.
     arguments = (struct NKValue *)nkiMallocArray(
@@ -1370,6 +1486,24 @@ void nkiOpcode_len(struct NKVM *vm)
 
         struct NKValue *outptr = nkiVmStackPush_internal(vm);
 
+        if(valueptr->type == NK_VALUETYPE_STRING) {
+
+            // Strings know their own length, so this doesn't need to
+            // look at the contents.
+            struct NKVMString *str = nkiVmStringTableGetEntryById(
+                &vm->stringTable, valueptr->stringTableEntry);
+
+            if(!str) {
+                nkiAddError(vm, "Bad string passed into len().");
+                return;
+            }
+
+            if(outptr) {
+                nkiValueSetInt(vm, outptr, str->length);
+            }
+            return;
+        }
+
         if(valueptr->type != NK_VALUETYPE_OBJECTID) {
             nkiAddError(vm, "Non-object passed into len().");
             return;
@@ -1381,4 +1515,459 @@ void nkiOpcode_len(struct NKVM *vm)
     }
 }
 
+// Read the operand for a wide instruction and move the instruction
+// pointer onto it. The usual instruction pointer increment after the
+// instruction will then skip over it.
+static nkint32_t nkiOpcode_readOperand(struct NKVM *vm)
+{
+    vm->currentExecutionContext->instructionPointer++;
+    return vm->instructions[
+        vm->currentExecutionContext->instructionPointer &
+        vm->instructionAddressMask].opData_int;
+}
+
+// Convert a LOAD_LOCAL/STORE_LOCAL operand into a real stack index.
+static nkuint32_t nkiOpcode_localAddress(struct NKVM *vm, nkint32_t offset)
+{
+    if(offset >= 0) {
+        return offset;
+    }
+    return vm->currentExecutionContext->stack.size + offset;
+}
+
+void nkiOpcode_loadLocal(struct NKVM *vm)
+{
+    nkint32_t offset = nkiOpcode_readOperand(vm);
+
+    // Copy before pushing, because the push can reallocate the
+    // stack.
+    struct NKValue v = *nkiVmStackPeek(
+        vm, nkiOpcode_localAddress(vm, offset));
+
+    *nkiVmStackPush_internal(vm) = v;
+}
+
+void nkiOpcode_storeLocal(struct NKVM *vm)
+{
+    nkint32_t offset = nkiOpcode_readOperand(vm);
+    struct NKValue *vIn = nkiVmStackPeek(vm, (vm->currentExecutionContext->stack.size - 1));
+    struct NKValue *vOut = nkiVmStackPeek(vm, nkiOpcode_localAddress(vm, offset));
+    *vOut = *vIn;
+}
+
+void nkiOpcode_loadStatic(struct NKVM *vm)
+{
+    nkuint32_t staticAddress = nkiOpcode_readOperand(vm) & vm->staticAddressMask;
+    struct NKValue v = vm->staticSpace[staticAddress];
+    *nkiVmStackPush_internal(vm) = v;
+}
+
+void nkiOpcode_storeStatic(struct NKVM *vm)
+{
+    nkuint32_t staticAddress = nkiOpcode_readOperand(vm) & vm->staticAddressMask;
+    struct NKValue *vIn = nkiVmStackPeek(vm, (vm->currentExecutionContext->stack.size - 1));
+    vm->staticSpace[staticAddress] = *vIn;
+}
+
+void nkiOpcode_jump(struct NKVM *vm)
+{
+    nkint32_t offset = nkiOpcode_readOperand(vm);
+    vm->currentExecutionContext->instructionPointer += offset;
+}
+
+void nkiOpcode_jzWide(struct NKVM *vm)
+{
+    nkint32_t offset = nkiOpcode_readOperand(vm);
+    struct NKValue *testValue = nkiVmStackPop(vm);
+
+    if(nkiValueToInt(vm, testValue) == 0) {
+        vm->currentExecutionContext->instructionPointer += offset;
+    }
+}
+
+void nkiOpcode_discard(struct NKVM *vm)
+{
+    nkiVmStackPopN(vm, nkiOpcode_readOperand(vm));
+}
+
+// ----------------------------------------------------------------------
+// Superinstructions. These just do the same thing as the sequence
+// they replaced, so the slow path behaves exactly the same.
+//
+// The generic opcode functions they call may try to quicken the
+// instruction at the instruction pointer, so don't move it onto the
+// operands until after they're done.
+
+// Get an operand without moving the instruction pointer.
+static nkint32_t nkiOpcode_peekOperand(struct NKVM *vm, nkuint32_t index)
+{
+    return vm->instructions[
+        (vm->currentExecutionContext->instructionPointer + index) &
+        vm->instructionAddressMask].opData_int;
+}
+
+static void nkiOpcode_compareAndJump(
+    struct NKVM *vm, void (*compareOp)(struct NKVM *vm))
+{
+    nkint32_t offset = nkiOpcode_peekOperand(vm, 1);
+    struct NKValue *testValue;
+
+    compareOp(vm);
+    testValue = nkiVmStackPop(vm);
+    vm->currentExecutionContext->instructionPointer++;
+
+    if(nkiValueToInt(vm, testValue) == 0) {
+        vm->currentExecutionContext->instructionPointer += offset;
+    }
+}
+
+void nkiOpcode_gtJz(struct NKVM *vm)
+{
+    nkiOpcode_compareAndJump(vm, nkiOpcode_gt);
+}
+
+void nkiOpcode_ltJz(struct NKVM *vm)
+{
+    nkiOpcode_compareAndJump(vm, nkiOpcode_lt);
+}
+
+void nkiOpcode_geJz(struct NKVM *vm)
+{
+    nkiOpcode_compareAndJump(vm, nkiOpcode_ge);
+}
+
+void nkiOpcode_leJz(struct NKVM *vm)
+{
+    nkiOpcode_compareAndJump(vm, nkiOpcode_le);
+}
+
+void nkiOpcode_eqJz(struct NKVM *vm)
+{
+    nkiOpcode_compareAndJump(vm, nkiOpcode_eq);
+}
+
+void nkiOpcode_neJz(struct NKVM *vm)
+{
+    nkiOpcode_compareAndJump(vm, nkiOpcode_ne);
+}
+
+void nkiOpcode_addLocals(struct NKVM *vm)
+{
+    // Both addresses are figured out before we push anything.
+    nkuint32_t address1 = nkiOpcode_localAddress(vm, nkiOpcode_peekOperand(vm, 1));
+    nkuint32_t address2 = nkiOpcode_localAddress(vm, nkiOpcode_peekOperand(vm, 2));
+
+    // Copy before pushing, because the push can reallocate the
+    // stack.
+    struct NKValue v1 = *nkiVmStackPeek(vm, address1);
+    struct NKValue v2 = *nkiVmStackPeek(vm, address2);
+
+    *nkiVmStackPush_internal(vm) = v1;
+    *nkiVmStackPush_internal(vm) = v2;
+    nkiOpcode_add(vm);
 
+    vm->currentExecutionContext->instructionPointer += 2;
+}
+
+void nkiOpcode_addLiteral(struct NKVM *vm)
+{
+    nkiVmStackPushInt(vm, nkiOpcode_peekOperand(vm, 1));
+    nkiOpcode_add(vm);
+
+    vm->currentExecutionContext->instructionPointer++;
+}
+
+// ----------------------------------------------------------------------
+// Quickened instructions. Generic arithmetic and comparison
+// instructions rewrite themselves into these the first time they run
+// with two ints or two floats (see nkiOpcode_quicken()). If one of
+// these sees anything else, it turns itself back into the generic
+// instruction and lets that handle it.
+
+#define NK_QUICKENED_ARITHMETIC(name, genericOpcode, genericFunc, valueType, field, op) \
+    void name(struct NKVM *vm)                                          \
+    {                                                                   \
+        struct NKVMStack *stack = &vm->currentExecutionContext->stack;  \
+        if(stack->size >= 2) {                                          \
+            struct NKValue *in2 =                                       \
+                &stack->values[(stack->size - 1) & stack->indexMask];   \
+            struct NKValue *in1 =                                       \
+                &stack->values[(stack->size - 2) & stack->indexMask];   \
+            if(in1->type == (valueType) && in2->type == (valueType)) {  \
+                in1->field = in1->field op in2->field;                  \
+                stack->size--;                                          \
+                return;                                                 \
+            }                                                           \
+        }                                                               \
+        vm->instructions[                                               \
+            vm->currentExecutionContext->instructionPointer &           \
+            vm->instructionAddressMask].opcode = (genericOpcode);       \
+        genericFunc(vm);                                                \
+    }
+
+#define NK_QUICKENED_COMPARE(name, genericOpcode, genericFunc, valueType, field, test) \
+    void name(struct NKVM *vm)                                          \
+    {                                                                   \
+        struct NKVMStack *stack = &vm->currentExecutionContext->stack;  \
+        if(stack->size >= 2) {                                          \
+            struct NKValue *in2 =                                       \
+                &stack->values[(stack->size - 1) & stack->indexMask];   \
+            struct NKValue *in1 =                                       \
+                &stack->values[(stack->size - 2) & stack->indexMask];   \
+            if(in1->type == (valueType) && in2->type == (valueType)) {  \
+                nkint32_t comparison =                                  \
+                    in1->field > in2->field ? 1 :                       \
+                    (in1->field == in2->field ? 0 : -1);                \
+                in1->type = NK_VALUETYPE_INT;                           \
+                in1->intData = (test);                                  \
+                stack->size--;                                          \
+                return;                                                 \
+            }                                                           \
+        }                                                               \
+        vm->instructions[                                               \
+            vm->currentExecutionContext->instructionPointer &           \
+            vm->instructionAddressMask].opcode = (genericOpcode);       \
+        genericFunc(vm);                                                \
+    }
+
+NK_QUICKENED_ARITHMETIC(nkiOpcode_addInt,        NK_OP_ADD,      nkiOpcode_add,      NK_VALUETYPE_INT,   intData,   +)
+NK_QUICKENED_ARITHMETIC(nkiOpcode_addFloat,      NK_OP_ADD,      nkiOpcode_add,      NK_VALUETYPE_FLOAT, floatData, +)
+NK_QUICKENED_ARITHMETIC(nkiOpcode_subtractInt,   NK_OP_SUBTRACT, nkiOpcode_subtract, NK_VALUETYPE_INT,   intData,   -)
+NK_QUICKENED_ARITHMETIC(nkiOpcode_subtractFloat, NK_OP_SUBTRACT, nkiOpcode_subtract, NK_VALUETYPE_FLOAT, floatData, -)
+NK_QUICKENED_ARITHMETIC(nkiOpcode_multiplyInt,   NK_OP_MULTIPLY, nkiOpcode_multiply, NK_VALUETYPE_INT,   intData,   *)
+NK_QUICKENED_ARITHMETIC(nkiOpcode_multiplyFloat, NK_OP_MULTIPLY, nkiOpcode_multiply, NK_VALUETYPE_FLOAT, floatData, *)
+
+NK_QUICKENED_COMPARE(nkiOpcode_gtInt,   NK_OP_GREATERTHAN,        nkiOpcode_gt, NK_VALUETYPE_INT,   intData,   comparison == 1)
+NK_QUICKENED_COMPARE(nkiOpcode_gtFloat, NK_OP_GREATERTHAN,        nkiOpcode_gt, NK_VALUETYPE_FLOAT, floatData, comparison == 1)
+NK_QUICKENED_COMPARE(nkiOpcode_ltInt,   NK_OP_LESSTHAN,           nkiOpcode_lt, NK_VALUETYPE_INT,   intData,   comparison == -1)
+NK_QUICKENED_COMPARE(nkiOpcode_ltFloat, NK_OP_LESSTHAN,           nkiOpcode_lt, NK_VALUETYPE_FLOAT, floatData, comparison == -1)
+NK_QUICKENED_COMPARE(nkiOpcode_geInt,   NK_OP_GREATERTHANOREQUAL, nkiOpcode_ge, NK_VALUETYPE_INT,   intData,   comparison == 0 || comparison == 1)
+NK_QUICKENED_COMPARE(nkiOpcode_geFloat, NK_OP_GREATERTHANOREQUAL, nkiOpcode_ge, NK_VALUETYPE_FLOAT, floatData, comparison == 0 || comparison == 1)
+NK_QUICKENED_COMPARE(nkiOpcode_leInt,   NK_OP_LESSTHANOREQUAL,    nkiOpcode_le, NK_VALUETYPE_INT,   intData,   comparison == 0 || comparison == -1)
+NK_QUICKENED_COMPARE(nkiOpcode_leFloat, NK_OP_LESSTHANOREQUAL,    nkiOpcode_le, NK_VALUETYPE_FLOAT, floatData, comparison == 0 || comparison == -1)
+NK_QUICKENED_COMPARE(nkiOpcode_eqInt,   NK_OP_EQUAL,              nkiOpcode_eq, NK_VALUETYPE_INT,   intData,   comparison == 0)
+NK_QUICKENED_COMPARE(nkiOpcode_eqFloat, NK_OP_EQUAL,              nkiOpcode_eq, NK_VALUETYPE_FLOAT, floatData, comparison == 0)
+NK_QUICKENED_COMPARE(nkiOpcode_neInt,   NK_OP_NOTEQUAL,           nkiOpcode_ne, NK_VALUETYPE_INT,   intData,   comparison != 0)
+NK_QUICKENED_COMPARE(nkiOpcode_neFloat, NK_OP_NOTEQUAL,           nkiOpcode_ne, NK_VALUETYPE_FLOAT, floatData, comparison != 0)
+
+// ----------------------------------------------------------------------
+// Frame slot instructions. The slow paths push everything and run the
+// generic instruction, so they behave exactly like the sequences they
+// replaced. As with the superinstructions, the instruction pointer
+// stays put until the generic instruction is done.
+
+static void nkiOpcode_arithmetic3(
+    struct NKVM *vm, void (*arithmeticOp)(struct NKVM *vm),
+    nkbool literal)
+{
+    // Figure out all the slots before pushing anything.
+    nkuint32_t dstAddress = nkiOpcode_localAddress(vm, nkiOpcode_peekOperand(vm, 1));
+    nkuint32_t srcAddress = nkiOpcode_localAddress(vm, nkiOpcode_peekOperand(vm, 2));
+    struct NKValue v1 = *nkiVmStackPeek(vm, srcAddress);
+    struct NKValue v2;
+
+    if(literal) {
+        v2.type = NK_VALUETYPE_INT;
+        v2.intData = nkiOpcode_peekOperand(vm, 3);
+    } else {
+        v2 = *nkiVmStackPeek(vm,
+            nkiOpcode_localAddress(vm, nkiOpcode_peekOperand(vm, 3)));
+    }
+
+    *nkiVmStackPush_internal(vm) = v1;
+    *nkiVmStackPush_internal(vm) = v2;
+    arithmeticOp(vm);
+
+    *nkiVmStackPeek(vm, dstAddress) =
+        *nkiVmStackPeek(vm, vm->currentExecutionContext->stack.size - 1);
+    nkiVmStackPop(vm);
+
+    vm->currentExecutionContext->instructionPointer += 3;
+}
+
+void nkiOpcode_add3(struct NKVM *vm)
+{
+    nkiOpcode_arithmetic3(vm, nkiOpcode_add, nkfalse);
+}
+
+void nkiOpcode_subtract3(struct NKVM *vm)
+{
+    nkiOpcode_arithmetic3(vm, nkiOpcode_subtract, nkfalse);
+}
+
+void nkiOpcode_multiply3(struct NKVM *vm)
+{
+    nkiOpcode_arithmetic3(vm, nkiOpcode_multiply, nkfalse);
+}
+
+void nkiOpcode_add3Literal(struct NKVM *vm)
+{
+    nkiOpcode_arithmetic3(vm, nkiOpcode_add, nktrue);
+}
+
+void nkiOpcode_moveLocal(struct NKVM *vm)
+{
+    nkuint32_t dstAddress = nkiOpcode_localAddress(vm, nkiOpcode_readOperand(vm));
+    nkuint32_t srcAddress = nkiOpcode_localAddress(vm, nkiOpcode_readOperand(vm));
+    *nkiVmStackPeek(vm, dstAddress) = *nkiVmStackPeek(vm, srcAddress);
+}
+
+void nkiOpcode_popLocal(struct NKVM *vm)
+{
+    nkiOpcode_storeLocal(vm);
+    nkiVmStackPop(vm);
+}
+
+void nkiOpcode_popStatic(struct NKVM *vm)
+{
+    nkiOpcode_storeStatic(vm);
+    nkiVmStackPop(vm);
+}
+
+// ----------------------------------------------------------------------
+// Constant key field access
+
+// Read both operands of a *_CONST field instruction. Returns the
+// inline cache word.
+static struct NKInstruction *nkiOpcode_readFieldConstOperands(
+    struct NKVM *vm, nkuint32_t *keyString)
+{
+    *keyString = (nkuint32_t)nkiOpcode_readOperand(vm);
+    nkiOpcode_readOperand(vm);
+    return &vm->instructions[
+        vm->currentExecutionContext->instructionPointer &
+        vm->instructionAddressMask];
+}
+
+// Find (or add) a field with a constant string key. If the key is in
+// the slot the cache remembers, we don't have to hash anything.
+// Otherwise do a normal lookup and remember where the key was for
+// next time.
+static struct NKValue *nkiOpcode_findFieldConst(
+    struct NKVM *vm, struct NKVMObject *ob,
+    nkuint32_t keyString, struct NKInstruction *cache,
+    nkbool noAdd)
+{
+    nkuint32_t slot = (nkuint32_t)cache->opData_int;
+    struct NKValue key;
+
+    if(nkiVmObjectSlotHasStringKey(ob, slot, keyString)) {
+        return &ob->fields[slot].value;
+    }
+
+    nkiMemset(&key, 0, sizeof(key));
+    key.type = NK_VALUETYPE_STRING;
+    key.stringTableEntry = keyString;
+
+    slot = nkiVmObjectFindOrAddFieldSlot(vm, ob, &key, noAdd);
+    if(slot == NK_INVALID_VALUE) {
+        return NULL;
+    }
+
+    cache->opData_int = (nkint32_t)slot;
+    return &ob->fields[slot].value;
+}
+
+static void nkiOpcode_objectFieldGetConst_internal(
+    struct NKVM *vm, nkbool popObject)
+{
+    nkuint32_t keyString;
+    struct NKInstruction *cache =
+        nkiOpcode_readFieldConstOperands(vm, &keyString);
+    struct NKValue *objectToGet;
+    struct NKValue *output;
+    struct NKValue *objectValue;
+    struct NKVMObject *ob;
+
+    if(popObject) {
+        objectToGet = nkiVmStackPop(vm);
+    } else {
+        objectToGet = nkiVmStackPeek(vm, vm->currentExecutionContext->stack.size - 1);
+    }
+
+    if(objectToGet->type != NK_VALUETYPE_OBJECTID) {
+        nkiAddError(
+            vm,
+            "Attempted to get a field on a value that is not an object.");
+        return;
+    }
+
+    ob = nkiVmObjectTableGetEntryById(&vm->objectTable, objectToGet->objectId);
+
+    if(!ob) {
+        nkiAddError(
+            vm,
+            "Bad object id in nkiOpcode_objectFieldGetConst.");
+        return;
+    }
+
+    objectValue = nkiOpcode_findFieldConst(vm, ob, keyString, cache, nktrue);
+
+    output = nkiVmStackPush_internal(vm);
+
+    if(objectValue) {
+        *output = *objectValue;
+    } else {
+        output->type = NK_VALUETYPE_NIL;
+        output->basicHashValue = 0;
+    }
+}
+
+void nkiOpcode_objectFieldGetConst(struct NKVM *vm)
+{
+    nkiOpcode_objectFieldGetConst_internal(vm, nktrue);
+}
+
+void nkiOpcode_objectFieldGetConst_noPop(struct NKVM *vm)
+{
+    nkiOpcode_objectFieldGetConst_internal(vm, nkfalse);
+}
+
+void nkiOpcode_objectFieldSetConst(struct NKVM *vm)
+{
+    nkuint32_t keyString;
+    struct NKInstruction *cache =
+        nkiOpcode_readFieldConstOperands(vm, &keyString);
+    struct NKValue *objectToSet = nkiVmStackPop(vm);
+    struct NKValue *valueToSet  = nkiVmStackPop(vm);
+    struct NKValue *objectValue;
+    struct NKVMObject *ob;
+
+    if(objectToSet->type != NK_VALUETYPE_OBJECTID) {
+        nkiAddError(
+            vm,
+            "Attempted to set a field on a value that is not an object.");
+        return;
+    }
+
+    ob = nkiVmObjectTableGetEntryById(&vm->objectTable, objectToSet->objectId);
+
+    if(!ob) {
+        nkiAddError(
+            vm,
+            "Bad object id in nkiOpcode_objectFieldSetConst.");
+        return;
+    }
+
+    if(valueToSet->type == NK_VALUETYPE_NIL) {
+
+        // For nil, we actually want to remove a field.
+        struct NKValue key;
+        nkiMemset(&key, 0, sizeof(key));
+        key.type = NK_VALUETYPE_STRING;
+        key.stringTableEntry = keyString;
+        nkiVmObjectClearEntry(vm, ob, &key);
+
+    } else {
+
+        nkiVmGcObjectBarrier(vm, ob);
+        objectValue = nkiOpcode_findFieldConst(vm, ob, keyString, cache, nkfalse);
+
+        if(objectValue) {
+            *objectValue = *valueToSet;
+        }
+    }
+
+    // Leave the assigned value on the stack.
+    *nkiVmStackPush_internal(vm) = *valueToSet;
+}
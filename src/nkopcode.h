@@ -151,4 +151,119 @@ void nkiOpcode_coroutineIsFinished(struct NKVM *vm);
 // len().
 void nkiOpcode_len(struct NKVM *vm);
 
+// ----------------------------------------------------------------------
+// Wide instructions. These all read an operand from the instruction
+// word after the opcode, instead of popping it off the stack.
+
+/// Push a copy of a stack value. Negative operands are relative to
+/// the top of the stack. Equivalent to PUSHLITERAL_INT + STACKPEEK.
+void nkiOpcode_loadLocal(struct NKVM *vm);
+
+/// Copy the top of the stack into a stack slot, leaving it on the
+/// stack. Equivalent to PUSHLITERAL_INT + STACKPOKE.
+void nkiOpcode_storeLocal(struct NKVM *vm);
+
+/// Push a copy of a static value. Equivalent to PUSHLITERAL_INT +
+/// STATICPEEK.
+void nkiOpcode_loadStatic(struct NKVM *vm);
+
+/// Copy the top of the stack into a static slot, leaving it on the
+/// stack. Equivalent to PUSHLITERAL_INT + STATICPOKE.
+void nkiOpcode_storeStatic(struct NKVM *vm);
+
+/// Relative jump. The offset is relative to the instruction after
+/// the operand.
+void nkiOpcode_jump(struct NKVM *vm);
+
+/// Pop a value and do a relative jump if it's zero. The offset is
+/// relative to the instruction after the operand.
+void nkiOpcode_jzWide(struct NKVM *vm);
+
+/// Pop some number of values off the stack. Equivalent to
+/// PUSHLITERAL_INT + POPN.
+void nkiOpcode_discard(struct NKVM *vm);
+
+// ----------------------------------------------------------------------
+// Superinstructions generated by the peephole optimizer.
+
+/// Comparison followed by a wide JZ. Pops both values and jumps if
+/// the comparison is false.
+void nkiOpcode_gtJz(struct NKVM *vm);
+void nkiOpcode_ltJz(struct NKVM *vm);
+void nkiOpcode_geJz(struct NKVM *vm);
+void nkiOpcode_leJz(struct NKVM *vm);
+void nkiOpcode_eqJz(struct NKVM *vm);
+void nkiOpcode_neJz(struct NKVM *vm);
+
+/// Two LOAD_LOCALs followed by an ADD. Both operands are relative to
+/// the stack size before anything is pushed.
+void nkiOpcode_addLocals(struct NKVM *vm);
+
+/// PUSHLITERAL_INT followed by an ADD.
+void nkiOpcode_addLiteral(struct NKVM *vm);
+
+// ----------------------------------------------------------------------
+// Quickened (type-specialized) instructions. Generic instructions
+// rewrite themselves into these when they see two ints or two floats,
+// and these rewrite themselves back when they see anything else.
+
+void nkiOpcode_addInt(struct NKVM *vm);
+void nkiOpcode_addFloat(struct NKVM *vm);
+void nkiOpcode_subtractInt(struct NKVM *vm);
+void nkiOpcode_subtractFloat(struct NKVM *vm);
+void nkiOpcode_multiplyInt(struct NKVM *vm);
+void nkiOpcode_multiplyFloat(struct NKVM *vm);
+void nkiOpcode_gtInt(struct NKVM *vm);
+void nkiOpcode_gtFloat(struct NKVM *vm);
+void nkiOpcode_ltInt(struct NKVM *vm);
+void nkiOpcode_ltFloat(struct NKVM *vm);
+void nkiOpcode_geInt(struct NKVM *vm);
+void nkiOpcode_geFloat(struct NKVM *vm);
+void nkiOpcode_leInt(struct NKVM *vm);
+void nkiOpcode_leFloat(struct NKVM *vm);
+void nkiOpcode_eqInt(struct NKVM *vm);
+void nkiOpcode_eqFloat(struct NKVM *vm);
+void nkiOpcode_neInt(struct NKVM *vm);
+void nkiOpcode_neFloat(struct NKVM *vm);
+
+// ----------------------------------------------------------------------
+// Frame slot instructions. See NK_COMPILER_OPTION_FRAMESLOTS.
+
+/// dst = src1 + src2, for three local slots. Equivalent to
+/// LOAD_LOCAL, LOAD_LOCAL, ADD, STORE_LOCAL, POP.
+void nkiOpcode_add3(struct NKVM *vm);
+
+/// dst = src1 - src2.
+void nkiOpcode_subtract3(struct NKVM *vm);
+
+/// dst = src1 * src2.
+void nkiOpcode_multiply3(struct NKVM *vm);
+
+/// dst = src + literal. Equivalent to LOAD_LOCAL, PUSHLITERAL_INT,
+/// ADD, STORE_LOCAL, POP.
+void nkiOpcode_add3Literal(struct NKVM *vm);
+
+/// dst = src. Equivalent to LOAD_LOCAL, STORE_LOCAL, POP.
+void nkiOpcode_moveLocal(struct NKVM *vm);
+
+/// Pop the top of the stack into a local slot. Equivalent to
+/// STORE_LOCAL, POP.
+void nkiOpcode_popLocal(struct NKVM *vm);
+
+/// Pop the top of the stack into a static slot. Equivalent to
+/// STORE_STATIC, POP.
+void nkiOpcode_popStatic(struct NKVM *vm);
+
+/// OBJECTFIELDGET with the key as an operand, followed by an inline
+/// cache operand.
+void nkiOpcode_objectFieldGetConst(struct NKVM *vm);
+
+/// OBJECTFIELDSET with the key as an operand, followed by an inline
+/// cache operand.
+void nkiOpcode_objectFieldSetConst(struct NKVM *vm);
+
+/// OBJECTFIELDGET_NOPOP with the key as an operand, followed by an
+/// inline cache operand.
+void nkiOpcode_objectFieldGetConst_noPop(struct NKVM *vm);
+
 #endif // NINKASI_OPCODE_H
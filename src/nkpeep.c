@@ -0,0 +1,561 @@
+// ----------------------------------------------------------------------
+//
+//        ▐ ▄ ▪   ▐ ▄ ▄ •▄  ▄▄▄· .▄▄ · ▪
+//       •█▌▐███ •█▌▐██▌▄▌▪▐█ ▀█ ▐█ ▀. ██
+//       ▐█▐▐▌▐█·▐█▐▐▌▐▀▀▄·▄█▀▀█ ▄▀▀▀█▄▐█·
+//       ██▐█▌▐█▌██▐█▌▐█.█▌▐█ ▪▐▌▐█▄▪▐█▐█▌
+//       ▀▀ █▪▀▀▀▀▀ █▪·▀  ▀ ▀  ▀  ▀▀▀▀ ▀▀▀
+//
+// ----------------------------------------------------------------------
+//
+//   Ninkasi 0.01
+//
+//   By Kiri "ExpiredPopsicle" Jolly
+//     https://expiredpopsicle.com
+//     https://intoxicoding.com
+//     expiredpopsicle@gmail.com
+//
+// ----------------------------------------------------------------------
+//
+//   Copyright (c) 2017 Kiri Jolly
+//
+//   Permission is hereby granted, free of charge, to any person
+//   obtaining a copy of this software and associated documentation files
+//   (the "Software"), to deal in the Software without restriction,
+//   including without limitation the rights to use, copy, modify, merge,
+//   publish, distribute, sublicense, and/or sell copies of the Software,
+//   and to permit persons to whom the Software is furnished to do so,
+//   subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be
+//   included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+//   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+//   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+//   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+//   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+//   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//   SOFTWARE.
+//
+// -------------------------- END HEADER -------------------------------------
+
+#include "nkcommon.h"
+
+// The peephole optimizer works on the finished instruction stream
+// instead of the AST, so it can see across statement boundaries
+// (like the cleanup at the end of nested contexts). It copies
+// everything into a new buffer, fusing instructions as it goes, while
+// keeping a table of where every old instruction ended up. Jumps are
+// written out with their absolute targets in the old layout, and
+// fixed up at the end once the new layout is known.
+//
+// With NK_COMPILER_OPTION_FRAMESLOTS, statements that only move
+// values between local variables (and the top of the stack) are turned
+// into three-address instructions that work on stack frame slots
+// directly, like a register machine would. These are matched against
+// the unfused instructions, so they're checked first.
+//
+// Anything that can be the target of a jump (or a function entry
+// point, or the start of a source line) is a barrier. Sequences are
+// never fused across a barrier, because something might jump into the
+// middle of them.
+
+static enum NKOpcode nkiPeepholeGetOpcode(
+    struct NKVM *vm, nkuint32_t address)
+{
+    return (enum NKOpcode)(vm->instructions[address].opcode &
+        (NK_OPCODE_PADDEDCOUNT - 1));
+}
+
+static nkint32_t nkiPeepholeGetOperand(
+    struct NKVM *vm, nkuint32_t address)
+{
+    return vm->instructions[address + 1].opData_int;
+}
+
+static nkbool nkiPeepholeIsJump(enum NKOpcode opcode)
+{
+    switch(opcode) {
+        case NK_OP_JUMP:
+        case NK_OP_JZ:
+        case NK_OP_GREATERTHAN_JZ:
+        case NK_OP_LESSTHAN_JZ:
+        case NK_OP_GREATERTHANOREQUAL_JZ:
+        case NK_OP_LESSTHANOREQUAL_JZ:
+        case NK_OP_EQUAL_JZ:
+        case NK_OP_NOTEQUAL_JZ:
+            return nktrue;
+        default:
+            return nkfalse;
+    }
+}
+
+// Get the fused comparison+JZ version of a comparison opcode, or
+// NK_OP_NOP if there isn't one.
+static enum NKOpcode nkiPeepholeGetCompareJz(enum NKOpcode opcode)
+{
+    switch(opcode) {
+        case NK_OP_GREATERTHAN:        return NK_OP_GREATERTHAN_JZ;
+        case NK_OP_LESSTHAN:           return NK_OP_LESSTHAN_JZ;
+        case NK_OP_GREATERTHANOREQUAL: return NK_OP_GREATERTHANOREQUAL_JZ;
+        case NK_OP_LESSTHANOREQUAL:    return NK_OP_LESSTHANOREQUAL_JZ;
+        case NK_OP_EQUAL:              return NK_OP_EQUAL_JZ;
+        case NK_OP_NOTEQUAL:           return NK_OP_NOTEQUAL_JZ;
+        default:                       return NK_OP_NOP;
+    }
+}
+
+struct NKPeepholeState
+{
+    struct NKVM *vm;
+
+    // NKCompilerOption flags.
+    nkuint32_t options;
+
+    // Size of the original instruction stream.
+    nkuint32_t inputCount;
+
+    // One entry per input address. Non-zero if something might jump
+    // there.
+    nkuint8_t *barriers;
+
+    // Input address to output address.
+    nkuint32_t *addressMap;
+
+    struct NKInstruction *output;
+    nkuint32_t outputCount;
+};
+
+static void nkiPeepholeEmit(
+    struct NKPeepholeState *state, enum NKOpcode opcode)
+{
+    nkiMemset(&state->output[state->outputCount], 0, sizeof(struct NKInstruction));
+    state->output[state->outputCount++].opcode = opcode;
+}
+
+static void nkiPeepholeEmitOperand(
+    struct NKPeepholeState *state, nkint32_t operand)
+{
+    nkiMemset(&state->output[state->outputCount], 0, sizeof(struct NKInstruction));
+    state->output[state->outputCount++].opData_int = operand;
+}
+
+// Check that the instruction at address exists, isn't a barrier, and
+// is the expected opcode.
+static nkbool nkiPeepholeCanFuse(
+    struct NKPeepholeState *state,
+    nkuint32_t address,
+    enum NKOpcode opcode)
+{
+    return address < state->inputCount &&
+        !state->barriers[address] &&
+        nkiPeepholeGetOpcode(state->vm, address) == opcode;
+}
+
+// Find everything that can be jumped to. Returns nkfalse if the
+// instruction stream has something we can't safely relocate.
+static nkbool nkiPeepholeFindBarriers(struct NKPeepholeState *state)
+{
+    struct NKVM *vm = state->vm;
+    nkuint32_t i;
+
+    for(i = 0; i < state->inputCount; ) {
+
+        enum NKOpcode opcode = nkiPeepholeGetOpcode(vm, i);
+
+        // The old-style jumps pop their offset off the stack, so we
+        // can't tell where they go.
+        if(opcode == NK_OP_JUMP_RELATIVE ||
+            opcode == NK_OP_JUMP_IF_ZERO ||
+            opcode >= NK_OPCODE_REALCOUNT)
+        {
+            return nkfalse;
+        }
+
+        if(nkiPeepholeIsJump(opcode)) {
+            nkuint32_t target = i + 2 + nkiPeepholeGetOperand(vm, i);
+            if(target > state->inputCount) {
+                return nkfalse;
+            }
+            state->barriers[target] = 1;
+        }
+
+        i += 1 + nkiVmGetOpcodeOperandCount(opcode);
+    }
+
+    // Operands must not hang off the end.
+    if(i != state->inputCount) {
+        return nkfalse;
+    }
+
+    for(i = 0; i < vm->functionCount; i++) {
+        if(vm->functionTable[i].externalFunctionId.id == NK_INVALID_VALUE &&
+            vm->functionTable[i].firstInstructionIndex <= state->inputCount)
+        {
+            state->barriers[vm->functionTable[i].firstInstructionIndex] = 1;
+        }
+    }
+
+    for(i = 0; i < vm->positionMarkerCount; i++) {
+        if(vm->positionMarkerList[i].instructionIndex <= state->inputCount) {
+            state->barriers[vm->positionMarkerList[i].instructionIndex] = 1;
+        }
+    }
+
+    return nktrue;
+}
+
+// Fuse a run of POPs and DISCARDs into a single instruction. Returns
+// the input address after the run.
+static nkuint32_t nkiPeepholeFusePops(
+    struct NKPeepholeState *state,
+    nkuint32_t address,
+    nkuint32_t *removedCount)
+{
+    struct NKVM *vm = state->vm;
+    nkuint32_t total = 0;
+    nkuint32_t instructionCount = 0;
+
+    while(address < state->inputCount &&
+        (instructionCount == 0 || !state->barriers[address]))
+    {
+        enum NKOpcode opcode = nkiPeepholeGetOpcode(vm, address);
+
+        if(opcode == NK_OP_POP) {
+            total++;
+            state->addressMap[address] = state->outputCount;
+            address++;
+        } else if(opcode == NK_OP_DISCARD) {
+            total += nkiPeepholeGetOperand(vm, address);
+            state->addressMap[address] = state->outputCount;
+            address += 2;
+        } else {
+            break;
+        }
+
+        instructionCount++;
+    }
+
+    // A DISCARD of zero can go away completely.
+    if(total == 0) {
+        *removedCount += instructionCount;
+    } else if(total == 1) {
+        nkiPeepholeEmit(state, NK_OP_POP);
+        *removedCount += instructionCount - 1;
+    } else {
+        nkiPeepholeEmit(state, NK_OP_DISCARD);
+        nkiPeepholeEmitOperand(state, total);
+        *removedCount += instructionCount - 1;
+    }
+
+    return address;
+}
+
+// Convert a LOAD_LOCAL/STORE_LOCAL operand that was relative to the
+// stack with one extra value on it, so it's relative to the stack
+// without that value. Absolute (positive) addresses don't change.
+static nkint32_t nkiPeepholeUnstackSlot(nkint32_t slot)
+{
+    return slot < 0 ? slot + 1 : slot;
+}
+
+static enum NKOpcode nkiPeepholeGetArithmetic3(enum NKOpcode opcode)
+{
+    switch(opcode) {
+        case NK_OP_ADD:      return NK_OP_ADD3;
+        case NK_OP_SUBTRACT: return NK_OP_SUBTRACT3;
+        case NK_OP_MULTIPLY: return NK_OP_MULTIPLY3;
+        default:             return NK_OP_NOP;
+    }
+}
+
+// Try to turn the instructions at address into a frame slot
+// instruction. Returns the input address after whatever was
+// replaced, or address itself if nothing was.
+//
+// A slot operand of -1 for the second value of a pair can't be
+// expressed once the first value isn't pushed anymore, because it
+// refers to the first value itself. Those get left alone.
+static nkuint32_t nkiPeepholeRewriteFrameSlots(
+    struct NKPeepholeState *state,
+    nkuint32_t address,
+    nkuint32_t *removedCount)
+{
+    struct NKVM *vm = state->vm;
+    enum NKOpcode opcode = nkiPeepholeGetOpcode(vm, address);
+
+    if(opcode == NK_OP_LOAD_LOCAL) {
+
+        nkint32_t src = nkiPeepholeGetOperand(vm, address);
+        nkuint32_t next = address + 2;
+
+        // LOAD_LOCAL, LOAD_LOCAL or PUSHLITERAL_INT, arithmetic,
+        // STORE_LOCAL, POP.
+        if(next + 5 < state->inputCount &&
+            (nkiPeepholeCanFuse(state, next, NK_OP_LOAD_LOCAL) ||
+                nkiPeepholeCanFuse(state, next, NK_OP_PUSHLITERAL_INT)) &&
+            !state->barriers[next + 2] &&
+            nkiPeepholeGetArithmetic3(nkiPeepholeGetOpcode(vm, next + 2)) != NK_OP_NOP &&
+            nkiPeepholeCanFuse(state, next + 3, NK_OP_STORE_LOCAL) &&
+            nkiPeepholeCanFuse(state, next + 5, NK_OP_POP) &&
+            nkiPeepholeGetOperand(vm, next + 3) != -1)
+        {
+            nkbool literal =
+                nkiPeepholeGetOpcode(vm, next) == NK_OP_PUSHLITERAL_INT;
+            enum NKOpcode arithmetic =
+                nkiPeepholeGetArithmetic3(nkiPeepholeGetOpcode(vm, next + 2));
+            nkint32_t src2 = nkiPeepholeGetOperand(vm, next);
+
+            if(literal ? arithmetic == NK_OP_ADD3 : src2 != -1) {
+
+                nkiPeepholeEmit(state, literal ? NK_OP_ADD3_LITERAL : arithmetic);
+                nkiPeepholeEmitOperand(state,
+                    nkiPeepholeUnstackSlot(nkiPeepholeGetOperand(vm, next + 3)));
+                nkiPeepholeEmitOperand(state, src);
+                nkiPeepholeEmitOperand(state,
+                    literal ? src2 : nkiPeepholeUnstackSlot(src2));
+
+                state->addressMap[next] = state->addressMap[address];
+                state->addressMap[next + 2] = state->addressMap[address];
+                state->addressMap[next + 3] = state->addressMap[address];
+                state->addressMap[next + 5] = state->addressMap[address];
+                *removedCount += 4;
+                return next + 6;
+            }
+        }
+
+        // LOAD_LOCAL, STORE_LOCAL, POP.
+        if(nkiPeepholeCanFuse(state, next, NK_OP_STORE_LOCAL) &&
+            nkiPeepholeCanFuse(state, next + 2, NK_OP_POP) &&
+            nkiPeepholeGetOperand(vm, next) != -1)
+        {
+            nkiPeepholeEmit(state, NK_OP_MOVE_LOCAL);
+            nkiPeepholeEmitOperand(state,
+                nkiPeepholeUnstackSlot(nkiPeepholeGetOperand(vm, next)));
+            nkiPeepholeEmitOperand(state, src);
+
+            state->addressMap[next] = state->addressMap[address];
+            state->addressMap[next + 2] = state->addressMap[address];
+            *removedCount += 2;
+            return next + 3;
+        }
+    }
+
+    // STORE_LOCAL or STORE_STATIC, POP.
+    if((opcode == NK_OP_STORE_LOCAL || opcode == NK_OP_STORE_STATIC) &&
+        nkiPeepholeCanFuse(state, address + 2, NK_OP_POP))
+    {
+        nkiPeepholeEmit(state,
+            opcode == NK_OP_STORE_LOCAL ? NK_OP_POP_LOCAL : NK_OP_POP_STATIC);
+        nkiPeepholeEmitOperand(state, nkiPeepholeGetOperand(vm, address));
+
+        state->addressMap[address + 2] = state->addressMap[address];
+        *removedCount += 1;
+        return address + 3;
+    }
+
+    return address;
+}
+
+// Try to fuse the instructions at address into a superinstruction.
+// Returns the input address after whatever was replaced, or address
+// itself if nothing was.
+static nkuint32_t nkiPeepholeRewriteFused(
+    struct NKPeepholeState *state,
+    nkuint32_t address,
+    nkuint32_t *removedCount)
+{
+    struct NKVM *vm = state->vm;
+    enum NKOpcode opcode = nkiPeepholeGetOpcode(vm, address);
+    nkuint32_t next = address + 1 + nkiVmGetOpcodeOperandCount(opcode);
+
+    // Comparison followed by JZ.
+    if(nkiPeepholeGetCompareJz(opcode) != NK_OP_NOP &&
+        nkiPeepholeCanFuse(state, next, NK_OP_JZ))
+    {
+        state->addressMap[next] = state->outputCount;
+        nkiPeepholeEmit(state, nkiPeepholeGetCompareJz(opcode));
+        nkiPeepholeEmitOperand(state,
+            next + 2 + nkiPeepholeGetOperand(vm, next));
+        (*removedCount)++;
+        return next + 2;
+    }
+
+    // Two LOAD_LOCALs and an ADD. The second LOAD_LOCAL was relative
+    // to the stack after the first one pushed something, so adjust it
+    // to be relative to the stack before.
+    if(opcode == NK_OP_LOAD_LOCAL &&
+        nkiPeepholeCanFuse(state, next, NK_OP_LOAD_LOCAL) &&
+        nkiPeepholeCanFuse(state, next + 2, NK_OP_ADD) &&
+        nkiPeepholeGetOperand(vm, next) != -1)
+    {
+        state->addressMap[next] = state->outputCount;
+        state->addressMap[next + 2] = state->outputCount;
+        nkiPeepholeEmit(state, NK_OP_ADD_LOCALS);
+        nkiPeepholeEmitOperand(state, nkiPeepholeGetOperand(vm, address));
+        nkiPeepholeEmitOperand(state,
+            nkiPeepholeUnstackSlot(nkiPeepholeGetOperand(vm, next)));
+        *removedCount += 2;
+        return next + 3;
+    }
+
+    // Integer literal followed by ADD.
+    if(opcode == NK_OP_PUSHLITERAL_INT &&
+        nkiPeepholeCanFuse(state, next, NK_OP_ADD))
+    {
+        state->addressMap[next] = state->outputCount;
+        nkiPeepholeEmit(state, NK_OP_ADD_LITERAL);
+        nkiPeepholeEmitOperand(state, nkiPeepholeGetOperand(vm, address));
+        (*removedCount)++;
+        return next + 1;
+    }
+
+    // Runs of stack cleanup.
+    if((opcode == NK_OP_POP || opcode == NK_OP_DISCARD) &&
+        (nkiPeepholeCanFuse(state, next, NK_OP_POP) ||
+            nkiPeepholeCanFuse(state, next, NK_OP_DISCARD) ||
+            (opcode == NK_OP_DISCARD && nkiPeepholeGetOperand(vm, address) == 0)))
+    {
+        return nkiPeepholeFusePops(state, address, removedCount);
+    }
+
+    return address;
+}
+
+// Generate the new instruction stream. Jump operands are written as
+// absolute addresses in the old layout.
+static nkuint32_t nkiPeepholeRewrite(struct NKPeepholeState *state)
+{
+    struct NKVM *vm = state->vm;
+    nkuint32_t removedCount = 0;
+    nkuint32_t i = 0;
+
+    while(i < state->inputCount) {
+
+        enum NKOpcode opcode = nkiPeepholeGetOpcode(vm, i);
+        nkuint32_t length = 1 + nkiVmGetOpcodeOperandCount(opcode);
+        nkuint32_t next = i;
+
+        state->addressMap[i] = state->outputCount;
+
+        if(state->options & NK_COMPILER_OPTION_FRAMESLOTS) {
+            next = nkiPeepholeRewriteFrameSlots(state, i, &removedCount);
+        }
+
+        if(next == i && (state->options & NK_COMPILER_OPTION_PEEPHOLE)) {
+            next = nkiPeepholeRewriteFused(state, i, &removedCount);
+        }
+
+        if(next != i) {
+            i = next;
+            continue;
+        }
+
+        // Nothing to fuse here. Just copy it over.
+        nkiMemcpy(&state->output[state->outputCount], &vm->instructions[i],
+            sizeof(struct NKInstruction) * length);
+        if(nkiPeepholeIsJump(opcode)) {
+            state->output[state->outputCount + 1].opData_int =
+                i + length + nkiPeepholeGetOperand(vm, i);
+        }
+        state->outputCount += length;
+        i += length;
+    }
+
+    state->addressMap[state->inputCount] = state->outputCount;
+
+    return removedCount;
+}
+
+// Turn the absolute old-layout jump targets back into relative
+// offsets in the new layout.
+static void nkiPeepholeFixupJumps(struct NKPeepholeState *state)
+{
+    nkuint32_t i;
+
+    for(i = 0; i < state->outputCount; ) {
+
+        enum NKOpcode opcode = (enum NKOpcode)(state->output[i].opcode &
+            (NK_OPCODE_PADDEDCOUNT - 1));
+
+        if(nkiPeepholeIsJump(opcode)) {
+            nkuint32_t oldTarget = state->output[i + 1].opData_int;
+            state->output[i + 1].opData_int =
+                state->addressMap[oldTarget] - (i + 2);
+        }
+
+        i += 1 + nkiVmGetOpcodeOperandCount(opcode);
+    }
+}
+
+nkuint32_t nkiCompilerPeepholeOptimize(
+    struct NKCompilerState *cs,
+    nkuint32_t options)
+{
+    struct NKVM *vm = cs->vm;
+    struct NKPeepholeState state;
+    nkuint32_t removedCount;
+    nkuint32_t i;
+
+    if(!vm->instructions || !cs->instructionWriteIndex) {
+        return 0;
+    }
+
+    nkiMemset(&state, 0, sizeof(state));
+    state.vm = vm;
+    state.options = options;
+    state.inputCount = cs->instructionWriteIndex;
+
+    state.barriers = (nkuint8_t *)nkiMallocArray(
+        vm, sizeof(nkuint8_t), state.inputCount + 1);
+    nkiMemset(state.barriers, 0, state.inputCount + 1);
+
+    if(!nkiPeepholeFindBarriers(&state)) {
+        nkiFree(vm, state.barriers);
+        return 0;
+    }
+
+    state.addressMap = (nkuint32_t *)nkiMallocArray(
+        vm, sizeof(nkuint32_t), state.inputCount + 1);
+    state.output = (struct NKInstruction *)nkiMallocArray(
+        vm, sizeof(struct NKInstruction), state.inputCount);
+
+    removedCount = nkiPeepholeRewrite(&state);
+    nkiPeepholeFixupJumps(&state);
+
+    // Move function entry points and source position markers.
+    for(i = 0; i < vm->functionCount; i++) {
+        if(vm->functionTable[i].externalFunctionId.id == NK_INVALID_VALUE &&
+            vm->functionTable[i].firstInstructionIndex <= state.inputCount)
+        {
+            vm->functionTable[i].firstInstructionIndex =
+                state.addressMap[vm->functionTable[i].firstInstructionIndex];
+        }
+    }
+    for(i = 0; i < vm->positionMarkerCount; i++) {
+        if(vm->positionMarkerList[i].instructionIndex <= state.inputCount) {
+            vm->positionMarkerList[i].instructionIndex =
+                state.addressMap[vm->positionMarkerList[i].instructionIndex];
+        }
+    }
+
+    // Replace the old instructions, and clear out whatever is left
+    // over at the end (including any END the compiler left there).
+    nkiMemcpy(vm->instructions, state.output,
+        sizeof(struct NKInstruction) * state.outputCount);
+    for(i = state.outputCount;
+        i <= state.inputCount && i <= vm->instructionAddressMask;
+        i++)
+    {
+        nkiMemset(&vm->instructions[i], 0, sizeof(struct NKInstruction));
+    }
+    cs->instructionWriteIndex = state.outputCount;
+
+    nkiFree(vm, state.output);
+    nkiFree(vm, state.addressMap);
+    nkiFree(vm, state.barriers);
+
+    return removedCount;
+}
@@ -0,0 +1,278 @@
+// ----------------------------------------------------------------------
+//
+//        ▐ ▄ ▪   ▐ ▄ ▄ •▄  ▄▄▄· .▄▄ · ▪
+//       •█▌▐███ •█▌▐██▌▄▌▪▐█ ▀█ ▐█ ▀. ██
+//       ▐█▐▐▌▐█·▐█▐▐▌▐▀▀▄·▄█▀▀█ ▄▀▀▀█▄▐█·
+//       ██▐█▌▐█▌██▐█▌▐█.█▌▐█ ▪▐▌▐█▄▪▐█▐█▌
+//       ▀▀ █▪▀▀▀▀▀ █▪·▀  ▀ ▀  ▀  ▀▀▀▀ ▀▀▀
+//
+// ----------------------------------------------------------------------
+//
+//   Ninkasi 0.01
+//
+//   By Kiri "ExpiredPopsicle" Jolly
+//     https://expiredpopsicle.com
+//     https://intoxicoding.com
+//     expiredpopsicle@gmail.com
+//
+// ----------------------------------------------------------------------
+//
+//   Copyright (c) 2017 Kiri Jolly
+//
+//   Permission is hereby granted, free of charge, to any person
+//   obtaining a copy of this software and associated documentation files
+//   (the "Software"), to deal in the Software without restriction,
+//   including without limitation the rights to use, copy, modify, merge,
+//   publish, distribute, sublicense, and/or sell copies of the Software,
+//   and to permit persons to whom the Software is furnished to do so,
+//   subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be
+//   included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+//   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+//   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+//   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+//   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+//   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//   SOFTWARE.
+//
+// -------------------------- END HEADER -------------------------------------
+
+
+#include "nkcommon.h"
+
+struct NKVMPoolRecord;
+
+struct NKVMPoolSlab
+{
+    struct NKVMPool *pool;
+
+    // Links for the pool's list of slabs with free records in them.
+    // Full slabs aren't in the list.
+    struct NKVMPoolSlab *nextWithSpace;
+    struct NKVMPoolSlab **prevWithSpacePtr;
+
+    struct NKVMPoolRecord *freeList;
+    nkuint32_t recordCount;
+    nkuint32_t usedCount;
+
+    // Records follow this.
+};
+
+// Header in front of every record.
+struct NKVMPoolRecord
+{
+    // Slab this came from, or NULL for records too big for any size
+    // class, which get their own nkiMalloc() allocation.
+    struct NKVMPoolSlab *slab;
+};
+
+// Free records keep the free list link where the record's data would
+// go. Every size class is at least big enough for it.
+#define nkiPoolNextFree(record) \
+    (*(struct NKVMPoolRecord **)((record) + 1))
+
+static void nkiPoolLinkSlab(
+    struct NKVMPool *pool, struct NKVMPoolSlab *slab)
+{
+    slab->prevWithSpacePtr = &pool->slabsWithSpace;
+    slab->nextWithSpace = pool->slabsWithSpace;
+    if(pool->slabsWithSpace) {
+        pool->slabsWithSpace->prevWithSpacePtr = &slab->nextWithSpace;
+    }
+    pool->slabsWithSpace = slab;
+}
+
+static void nkiPoolUnlinkSlab(struct NKVMPoolSlab *slab)
+{
+    if(slab->nextWithSpace) {
+        slab->nextWithSpace->prevWithSpacePtr = slab->prevWithSpacePtr;
+    }
+    *slab->prevWithSpacePtr = slab->nextWithSpace;
+}
+
+static struct NKVMPoolSlab *nkiPoolAddSlab(
+    struct NKVM *vm, struct NKVMPool *pool, nkuint32_t stride)
+{
+    struct NKVMPoolSlab *slab;
+    char *records;
+    nkuint32_t recordCount;
+    nkuint32_t i;
+
+    // Start small, so VMs that don't do much don't pay for a bunch of
+    // empty records, and double with each slab after that.
+    if(!pool->nextSlabRecordCount) {
+        pool->nextSlabRecordCount = nkiPoolMinSlabRecords;
+    }
+    recordCount = pool->nextSlabRecordCount;
+    if(recordCount * stride * 2 <= nkiPoolMaxSlabSize) {
+        pool->nextSlabRecordCount <<= 1;
+    }
+
+    slab = (struct NKVMPoolSlab *)nkiMallocCategory(
+        vm, sizeof(struct NKVMPoolSlab) + recordCount * stride,
+        (enum NKMemoryCategory)pool->category);
+    records = (char *)(slab + 1);
+
+    slab->pool = pool;
+    slab->recordCount = recordCount;
+    slab->usedCount = 0;
+    slab->freeList = NULL;
+
+    // Build the free list backwards so records get handed out in
+    // address order.
+    for(i = recordCount; i > 0; i--) {
+        struct NKVMPoolRecord *record =
+            (struct NKVMPoolRecord *)(records + (i - 1) * stride);
+        record->slab = slab;
+        nkiPoolNextFree(record) = slab->freeList;
+        slab->freeList = record;
+    }
+
+    nkiPoolLinkSlab(pool, slab);
+    pool->slabCount++;
+    pool->emptySlabCount++;
+
+    return slab;
+}
+
+static void nkiPoolFreeSlab(struct NKVM *vm, struct NKVMPoolSlab *slab)
+{
+    assert(!slab->usedCount);
+    nkiPoolUnlinkSlab(slab);
+    slab->pool->slabCount--;
+    slab->pool->emptySlabCount--;
+    nkiFree(vm, slab);
+}
+
+void nkiPoolInit(struct NKVM *vm)
+{
+    nkuint32_t category;
+    nkuint32_t i;
+
+    nkiMemset(vm->pools, 0, sizeof(vm->pools));
+
+    for(category = 0; category < NK_MEMORY_CATEGORY_COUNT; category++) {
+        for(i = 0; i < nkiPoolSizeClassCount; i++) {
+            vm->pools[category][i].category = category;
+        }
+    }
+}
+
+void nkiPoolShrink(struct NKVM *vm)
+{
+    nkuint32_t category;
+    nkuint32_t i;
+
+    for(category = 0; category < NK_MEMORY_CATEGORY_COUNT; category++) {
+        for(i = 0; i < nkiPoolSizeClassCount; i++) {
+            struct NKVMPool *pool = &vm->pools[category][i];
+            struct NKVMPoolSlab *slab = pool->slabsWithSpace;
+            while(slab && pool->emptySlabCount) {
+                struct NKVMPoolSlab *next = slab->nextWithSpace;
+                if(!slab->usedCount) {
+                    nkiPoolFreeSlab(vm, slab);
+                }
+                slab = next;
+            }
+        }
+    }
+}
+
+void nkiPoolDestroy(struct NKVM *vm)
+{
+    nkiPoolShrink(vm);
+}
+
+void *nkiPoolMalloc(
+    struct NKVM *vm, nkuint32_t size, enum NKMemoryCategory category)
+{
+    struct NKVMPool *pool;
+    struct NKVMPoolSlab *slab;
+    struct NKVMPoolRecord *record;
+    nkuint32_t sizeClass;
+
+    if(!size) {
+        return NULL;
+    }
+
+    if(size > nkiPoolMaxRecordSize) {
+
+        if(size > (~(nkuint32_t)0) - sizeof(struct NKVMPoolRecord)) {
+            nkiErrorStateSetAllocationFailFlag(vm);
+            NK_CATASTROPHE();
+            assert(0);
+            return NULL;
+        }
+
+        record = (struct NKVMPoolRecord *)nkiMallocCategory(
+            vm, size + sizeof(struct NKVMPoolRecord), category);
+        record->slab = NULL;
+        return record + 1;
+    }
+
+    sizeClass = (size - 1) / nkiPoolSizeClassGranularity;
+    assert((nkuint32_t)category < NK_MEMORY_CATEGORY_COUNT);
+    pool = &vm->pools[category][sizeClass];
+
+    slab = pool->slabsWithSpace;
+    if(!slab) {
+        slab = nkiPoolAddSlab(
+            vm, pool,
+            sizeof(struct NKVMPoolRecord) +
+            (sizeClass + 1) * nkiPoolSizeClassGranularity);
+    }
+
+    record = slab->freeList;
+    slab->freeList = nkiPoolNextFree(record);
+
+    if(!slab->usedCount) {
+        pool->emptySlabCount--;
+    }
+    slab->usedCount++;
+    if(slab->usedCount == slab->recordCount) {
+        nkiPoolUnlinkSlab(slab);
+    }
+
+    return record + 1;
+}
+
+void nkiPoolFree(struct NKVM *vm, void *data)
+{
+    struct NKVMPoolRecord *record;
+    struct NKVMPoolSlab *slab;
+    struct NKVMPool *pool;
+
+    if(!data) {
+        return;
+    }
+
+    record = (struct NKVMPoolRecord *)data - 1;
+    slab = record->slab;
+
+    if(!slab) {
+        nkiFree(vm, record);
+        return;
+    }
+
+    pool = slab->pool;
+
+    if(slab->usedCount == slab->recordCount) {
+        nkiPoolLinkSlab(pool, slab);
+    }
+
+    nkiPoolNextFree(record) = slab->freeList;
+    slab->freeList = record;
+    slab->usedCount--;
+
+    // Only keep one empty slab around.
+    if(!slab->usedCount) {
+        pool->emptySlabCount++;
+        if(pool->emptySlabCount > 1) {
+            nkiPoolFreeSlab(vm, slab);
+        }
+    }
+}
@@ -0,0 +1,132 @@
+// ----------------------------------------------------------------------
+//
+//        ▐ ▄ ▪   ▐ ▄ ▄ •▄  ▄▄▄· .▄▄ · ▪
+//       •█▌▐███ •█▌▐██▌▄▌▪▐█ ▀█ ▐█ ▀. ██
+//       ▐█▐▐▌▐█·▐█▐▐▌▐▀▀▄·▄█▀▀█ ▄▀▀▀█▄▐█·
+//       ██▐█▌▐█▌██▐█▌▐█.█▌▐█ ▪▐▌▐█▄▪▐█▐█▌
+//       ▀▀ █▪▀▀▀▀▀ █▪·▀  ▀ ▀  ▀  ▀▀▀▀ ▀▀▀
+//
+// ----------------------------------------------------------------------
+//
+//   Ninkasi 0.01
+//
+//   By Kiri "ExpiredPopsicle" Jolly
+//     https://expiredpopsicle.com
+//     https://intoxicoding.com
+//     expiredpopsicle@gmail.com
+//
+// ----------------------------------------------------------------------
+//
+//   Copyright (c) 2017 Kiri Jolly
+//
+//   Permission is hereby granted, free of charge, to any person
+//   obtaining a copy of this software and associated documentation files
+//   (the "Software"), to deal in the Software without restriction,
+//   including without limitation the rights to use, copy, modify, merge,
+//   publish, distribute, sublicense, and/or sell copies of the Software,
+//   and to permit persons to whom the Software is furnished to do so,
+//   subject to the following conditions:
+//
+//   The above copyright notice and this permission notice shall be
+//   included in all copies or substantial portions of the Software.
+//
+//   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+//   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+//   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+//   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+//   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+//   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+//   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+//   SOFTWARE.
+//
+// -------------------------- END HEADER -------------------------------------
+
+
+// ----------------------------------------------------------------------
+// Slab allocator for small VM records.
+// ----------------------------------------------------------------------
+//
+// Objects, strings, table holes, and the like are small, all the
+// same size (or close to it), and there are a lot of them. Instead of
+// making a separate nkiMalloc() call (with its own header and
+// allocation list entry) for each one, we carve them out of larger
+// slabs, one set of slabs per size class. Slabs themselves come from
+// nkiMalloc(), so they count against the memory limit like anything
+// else, and get freed in the catastrophic failure cleanup along with
+// everything else.
+//
+// Records only have to remember which slab they came from, so the
+// per-record overhead is a single pointer.
+//
+// Each memory category gets its own set of slabs, so that usage
+// accounting stays exact at the nkiMalloc() level.
+
+#ifndef NINKASI_POOL_H
+#define NINKASI_POOL_H
+
+#include "nktypes.h"
+#include "nkenums.h"
+
+struct NKVM;
+struct NKVMPoolSlab;
+
+/// Record sizes get rounded up to a multiple of this.
+#define nkiPoolSizeClassGranularity 16
+
+/// Number of size classes. Anything bigger than
+/// nkiPoolSizeClassCount * nkiPoolSizeClassGranularity bytes gets its
+/// own allocation.
+#define nkiPoolSizeClassCount 8
+
+#define nkiPoolMaxRecordSize \
+    (nkiPoolSizeClassCount * nkiPoolSizeClassGranularity)
+
+/// Number of records in a size class's first slab. Each new slab
+/// doubles this, up to nkiPoolMaxSlabSize bytes. It doesn't go back
+/// down when slabs are freed, so a VM that churns through a lot of
+/// short-lived records doesn't keep making tiny slabs after every GC
+/// pass.
+#define nkiPoolMinSlabRecords 8
+
+#define nkiPoolMaxSlabSize 8192
+
+/// All the slabs for one size class.
+struct NKVMPool
+{
+    /// enum NKMemoryCategory for this pool's slabs.
+    nkuint32_t category;
+
+    /// Slabs with at least one free record.
+    struct NKVMPoolSlab *slabsWithSpace;
+
+    nkuint32_t slabCount;
+
+    /// Number of records to put in the next new slab.
+    nkuint32_t nextSlabRecordCount;
+
+    /// Number of slabs with nothing allocated from them. We keep one
+    /// of these around so that a single record being allocated and
+    /// freed over and over right at the edge of a slab doesn't keep
+    /// allocating and freeing a whole slab.
+    nkuint32_t emptySlabCount;
+};
+
+void nkiPoolInit(struct NKVM *vm);
+
+/// Free any empty slabs. Slabs that still have records allocated from
+/// them will show up as leaks.
+void nkiPoolDestroy(struct NKVM *vm);
+
+/// Free empty slabs, including the spare ones we'd normally keep.
+void nkiPoolShrink(struct NKVM *vm);
+
+/// Allocate a record. Fails the same way nkiMalloc() does. Anything
+/// allocated here must be freed with nkiPoolFree(), NOT nkiFree(), and
+/// can't be used with nkiRealloc().
+void *nkiPoolMalloc(
+    struct NKVM *vm, nkuint32_t size, enum NKMemoryCategory category);
+
+/// Free a record from nkiPoolMalloc(). NULL is fine.
+void nkiPoolFree(struct NKVM *vm, void *data);
+
+#endif // NINKASI_POOL_H
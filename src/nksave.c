@@ -62,15 +62,15 @@
         NKI_SERIALIZE_DATA(&(val), sizeof(tmp));    \
     } while(0)
 
-nkbool nkiSerializeString_save(
+nkbool nkiSerializeBytes_save(
     struct NKVM *vm,
     NKVMSerializationWriter writer,
     void *userdata,
-    const char *str)
+    const char *str,
+    nkuint32_t len)
 {
     nkbool writeMode = nktrue;
 
-    nkuint32_t len = nkiStrlen(str);
     if(len >= NK_UINT_MAX) {
         nkiAddError(vm, "String too long to serialize.");
         return nkfalse;
@@ -85,6 +85,16 @@ nkbool nkiSerializeString_save(
     return nktrue;
 }
 
+nkbool nkiSerializeString_save(
+    struct NKVM *vm,
+    NKVMSerializationWriter writer,
+    void *userdata,
+    const char *str)
+{
+    return nkiSerializeBytes_save(
+        vm, writer, userdata, str, nkiStrlen(str));
+}
+
 nkbool nkiSerializeString_loadInPlace(
     struct NKVM *vm,
     NKVMSerializationWriter writer,
@@ -112,11 +122,12 @@ nkbool nkiSerializeString_loadInPlace(
     return nktrue;
 }
 
-nkbool nkiSerializeString_load(
+nkbool nkiSerializeBytes_load(
     struct NKVM *vm,
     NKVMSerializationWriter writer,
     void *userdata,
-    char **outData)
+    char **outData,
+    nkuint32_t *outLen)
 {
     nkbool writeMode = nkfalse;
     nkuint32_t len = 0;
@@ -137,10 +148,22 @@ nkbool nkiSerializeString_load(
     }
 
     (*outData)[len] = 0;
+    *outLen = len;
 
     return nktrue;
 }
 
+nkbool nkiSerializeString_load(
+    struct NKVM *vm,
+    NKVMSerializationWriter writer,
+    void *userdata,
+    char **outData)
+{
+    nkuint32_t len;
+    return nkiSerializeBytes_load(
+        vm, writer, userdata, outData, &len);
+}
+
 #define NKI_SERIALIZE_STRING(str)                                       \
     if(writeMode) {                                                     \
         NKI_WRAPSERIALIZE(nkiSerializeString_save(vm, writer, userdata, (str))); \
@@ -150,6 +173,17 @@ nkbool nkiSerializeString_load(
         (str) = outData;                                                \
     }
 
+// Same as NKI_SERIALIZE_STRING, but the data may contain zero bytes,
+// so the length is passed in when writing and set when reading.
+#define NKI_SERIALIZE_BYTES(str, len)                                   \
+    if(writeMode) {                                                     \
+        NKI_WRAPSERIALIZE(nkiSerializeBytes_save(vm, writer, userdata, (str), (len))); \
+    } else {                                                            \
+        char *outData = NULL;                                           \
+        NKI_WRAPSERIALIZE(nkiSerializeBytes_load(vm, writer, userdata, &outData, &(len))); \
+        (str) = outData;                                                \
+    }
+
 nkbool nkiSerializeErrorState(
     struct NKVM *vm, NKVMSerializationWriter writer,
     void *userdata, nkbool writeMode)
@@ -239,16 +273,27 @@ nkbool nkiSerializeObject(
     NKI_SERIALIZE_BASIC(nkuint32_t, object->lastGCPass);
     NKI_SERIALIZE_BASIC(NKVMExternalDataTypeID, object->externalDataType);
 
-    // Serialize all hash buckets.
+    // Serialize all fields. The array part gets written out just like
+    // the rest, with ints for the keys, and loading puts it back
+    // together.
     if(writeMode) {
 
         nkuint32_t n;
-        for(n = 0; n < nkiVMObjectHashBucketCount; n++) {
-            struct NKVMObjectElement *el = object->hashBuckets[n];
-            while(el) {
+        for(n = 0; n < object->arrayCapacity; n++) {
+            if(!nkiVmObjectArraySlotIsEmpty(&object->arrayPart[n])) {
+                struct NKValue key;
+                nkiMemset(&key, 0, sizeof(key));
+                key.type = NK_VALUETYPE_INT;
+                key.intData = (nkint32_t)n;
+                NKI_SERIALIZE_BASIC(struct NKValue, key);
+                NKI_SERIALIZE_BASIC(struct NKValue, object->arrayPart[n]);
+            }
+        }
+        for(n = 0; n < object->fieldCapacity; n++) {
+            struct NKVMObjectElement *el = &object->fields[n];
+            if(!nkiVmObjectSlotIsEmpty(el)) {
                 NKI_SERIALIZE_BASIC(struct NKValue, el->key);
                 NKI_SERIALIZE_BASIC(struct NKValue, el->value);
-                el = el->next;
             }
         }
 
@@ -315,8 +360,9 @@ nkbool nkiSerializeObjectTable(
         vm->objectTable.objectTable = NULL;
 
         vm->objectTable.objectTable =
-            (struct NKVMObject **)nkiMallocArray(
-                vm, sizeof(struct NKVMObject *), capacity);
+            (struct NKVMObject **)nkiMallocArrayCategory(
+                vm, sizeof(struct NKVMObject *), capacity,
+                NK_MEMORY_CATEGORY_TABLES);
         nkiMemset(
             vm->objectTable.objectTable, 0,
             sizeof(struct NKVMObject *) * capacity);
@@ -327,7 +373,7 @@ nkbool nkiSerializeObjectTable(
         while(vm->objectTable.tableHoles) {
             struct NKVMTableHole *hole = vm->objectTable.tableHoles;
             vm->objectTable.tableHoles = hole->next;
-            nkiFree(vm, hole);
+            nkiPoolFree(vm, hole);
         }
     }
 
@@ -366,21 +412,21 @@ nkbool nkiSerializeObjectTable(
 
             // Juggle allocated objects after the dumb serialization
             // wrapper that would return without deallocating.
-            object = (struct NKVMObject *)nkiMalloc(
-                vm, sizeof(struct NKVMObject));
+            object = (struct NKVMObject *)nkiPoolMalloc(
+                vm, sizeof(struct NKVMObject), NK_MEMORY_CATEGORY_OBJECTS);
             nkiVmObjectInit(object, index);
 
             // Thanks AFL! Holy crap I'm an idiot for letting this one
             // slide by.
             if(index >= vm->objectTable.capacity) {
                 nkiAddError(vm, "Object index exceeds object table capacity.");
-                nkiFree(vm, object);
+                nkiPoolFree(vm, object);
                 return nkfalse;
             }
 
             if(vm->objectTable.objectTable[index]) {
                 nkiAddError(vm, "Tried to load two object into the same location.");
-                nkiFree(vm, object);
+                nkiPoolFree(vm, object);
                 return nkfalse;
             }
 
@@ -406,8 +452,9 @@ nkbool nkiSerializeObjectTable(
         for(i = 0; i < vm->objectTable.capacity; i++) {
             if(!vm->objectTable.objectTable[i]) {
                 struct NKVMTableHole *hole =
-                    (struct NKVMTableHole *)nkiMalloc(
-                        vm, sizeof(struct NKVMTableHole));
+                    (struct NKVMTableHole *)nkiPoolMalloc(
+                        vm, sizeof(struct NKVMTableHole),
+                        NK_MEMORY_CATEGORY_TABLES);
                 hole->next = vm->objectTable.tableHoles;
                 hole->index = i;
                 vm->objectTable.tableHoles = hole;
@@ -442,8 +489,9 @@ nkbool nkiSerializeStringTable(
         }
 
         vm->stringTable.stringTable =
-            (struct NKVMString **)nkiMallocArray(
-                vm, sizeof(struct NKVMString*), vm->stringTable.capacity);
+            (struct NKVMString **)nkiMallocArrayCategory(
+                vm, sizeof(struct NKVMString*), vm->stringTable.capacity,
+                NK_MEMORY_CATEGORY_TABLES);
 
         // Note: Memset takes a size_t here, which on 64-bit bit can
         // take higher values than our nkuint32_t type passed into
@@ -480,11 +528,15 @@ nkbool nkiSerializeStringTable(
             nkuint32_t i;
             for(i = 0; i < vm->stringTable.capacity; i++) {
                 if(vm->stringTable.stringTable[i]) {
-                    char *strTmp = vm->stringTable.stringTable[i]->str;
+                    char *strTmp = (char *)nkiVmStringGetData(
+                        vm, vm->stringTable.stringTable[i]);
+                    nkuint32_t strLen = vm->stringTable.stringTable[i]->length;
+                    nkbool interned = !vm->stringTable.stringTable[i]->buffer;
                     NKI_SERIALIZE_BASIC(nkuint32_t, i);
-                    NKI_SERIALIZE_STRING(strTmp);
+                    NKI_SERIALIZE_BYTES(strTmp, strLen);
                     NKI_SERIALIZE_BASIC(nkuint32_t, vm->stringTable.stringTable[i]->lastGCPass);
                     NKI_SERIALIZE_BASIC(nkbool, vm->stringTable.stringTable[i]->dontGC);
+                    NKI_SERIALIZE_BASIC(nkbool, interned);
                 }
             }
 
@@ -496,13 +548,15 @@ nkbool nkiSerializeStringTable(
             while(vm->stringTable.tableHoles) {
                 struct NKVMTableHole *hole = vm->stringTable.tableHoles;
                 vm->stringTable.tableHoles = hole->next;
-                nkiFree(vm, hole);
+                nkiPoolFree(vm, hole);
             }
 
             for(n = 0; n < actualCount; n++) {
 
                 nkuint32_t index = 0;
                 char *tmpStr = NULL;
+                nkuint32_t stringLen = 0;
+                nkbool interned = nktrue;
 
                 NKI_SERIALIZE_BASIC(nkuint32_t, index);
                 if(index >= vm->stringTable.capacity) {
@@ -510,9 +564,8 @@ nkbool nkiSerializeStringTable(
                     return nkfalse;
                 }
 
-                NKI_SERIALIZE_STRING(tmpStr);
+                NKI_SERIALIZE_BYTES(tmpStr, stringLen);
                 {
-                    nkuint32_t stringLen = nkiStrlen(tmpStr);
                     nkuint32_t structAndPaddingSize = sizeof(*vm->stringTable.stringTable[index]) + 1;
                     nkuint32_t size = stringLen + structAndPaddingSize;
 
@@ -532,35 +585,60 @@ nkbool nkiSerializeStringTable(
 
                     // Allocate new string entry.
                     vm->stringTable.stringTable[index] =
-                        (struct NKVMString *)nkiMalloc(vm, size);
+                        (struct NKVMString *)nkiPoolMalloc(
+                            vm, size, NK_MEMORY_CATEGORY_STRINGS);
 
                     // Clear it out.
                     nkiMemset(vm->stringTable.stringTable[index], 0, size);
 
                     // Copy the string data in.
-                    nkiMemcpy(vm->stringTable.stringTable[index]->str, tmpStr, nkiStrlen(tmpStr) + 1);
+                    nkiMemcpy(vm->stringTable.stringTable[index]->str, tmpStr, stringLen + 1);
 
                     // Free the string we loaded from the file.
                     nkiFree(vm, tmpStr);
 
                     NKI_SERIALIZE_BASIC(nkuint32_t, vm->stringTable.stringTable[index]->lastGCPass);
                     NKI_SERIALIZE_BASIC(nkbool, vm->stringTable.stringTable[index]->dontGC);
+                    NKI_SERIALIZE_BASIC(nkbool, interned);
 
                     // Fix up some data.
                     vm->stringTable.stringTable[index]->stringTableIndex = index;
+                    vm->stringTable.stringTable[index]->length = stringLen;
                     vm->stringTable.stringTable[index]->hash =
-                        nkiStringHash(vm->stringTable.stringTable[index]->str);
-
-                    // Add a hash table entry for this string.
-                    {
-                        const nkuint32_t hashMask = nkiVmStringHashTableSize - 1;
-                        struct NKVMString *hashBucket =
-                            vm->stringsByHash[
-                                vm->stringTable.stringTable[index]->hash & hashMask];
-                        vm->stringTable.stringTable[index]->nextInHashBucket = hashBucket;
-                        vm->stringsByHash[
-                            vm->stringTable.stringTable[index]->hash & hashMask] =
-                            vm->stringTable.stringTable[index];
+                        nkiStringHashBytes(
+                            vm->stringTable.stringTable[index]->str, stringLen);
+                    vm->stringTable.stringTable[index]->hashValid = nktrue;
+
+                    if(interned) {
+
+                        // Add a hash table entry for this string.
+                        nkiVmStringTableAddToHash(
+                            vm, vm->stringTable.stringTable[index]);
+
+                    } else {
+
+                        // Strings that weren't interned may have the
+                        // same contents as one that was, and object
+                        // keys only match the interned one. So put
+                        // these back in the buffered list instead of
+                        // the hash table.
+                        struct NKVMString *str = vm->stringTable.stringTable[index];
+                        struct NKVMStringBuffer *buffer;
+                        char *data = (char *)nkiMallocCategory(
+                            vm, stringLen + 1, NK_MEMORY_CATEGORY_STRINGS);
+                        nkiMemcpy(data, str->str, stringLen + 1);
+
+                        buffer = (struct NKVMStringBuffer *)nkiPoolMalloc(
+                            vm, sizeof(struct NKVMStringBuffer),
+                            NK_MEMORY_CATEGORY_STRINGS);
+                        buffer->data = data;
+                        buffer->length = stringLen;
+                        buffer->capacity = stringLen + 1;
+                        buffer->refCount = 1;
+
+                        str->buffer = buffer;
+                        str->nextInHashBucket = vm->bufferedStrings;
+                        vm->bufferedStrings = str;
                     }
                 }
 
@@ -573,14 +651,15 @@ nkbool nkiSerializeStringTable(
                 while(vm->stringTable.tableHoles) {
                     struct NKVMTableHole *hole = vm->stringTable.tableHoles;
                     vm->stringTable.tableHoles = hole->next;
-                    nkiFree(vm, hole);
+                    nkiPoolFree(vm, hole);
                 }
 
                 for(i = 0; i < vm->stringTable.capacity; i++) {
                     if(!vm->stringTable.stringTable[i]) {
                         struct NKVMTableHole *newHole =
-                            (struct NKVMTableHole *)nkiMalloc(
-                                vm, sizeof(struct NKVMTableHole));
+                            (struct NKVMTableHole *)nkiPoolMalloc(
+                                vm, sizeof(struct NKVMTableHole),
+                                NK_MEMORY_CATEGORY_TABLES);
                         newHole->index = i;
                         newHole->next = vm->stringTable.tableHoles;
                         vm->stringTable.tableHoles = newHole;
@@ -637,10 +716,11 @@ nkbool nkiSerializeInstructions(struct NKVM *vm, NKVMSerializationWriter writer,
         nkiFree(vm, vm->instructions);
 
         // Thanks AFL!
-        vm->instructions = (struct NKInstruction *)nkiMallocArray(
+        vm->instructions = (struct NKInstruction *)nkiMallocArrayCategory(
             vm,
             sizeof(struct NKInstruction),
-            vm->instructionAddressMask + 1);
+            vm->instructionAddressMask + 1,
+            NK_MEMORY_CATEGORY_PROGRAM);
 
         nkiMemset(vm->instructions, 0, sizeof(struct NKInstruction) * (vm->instructionAddressMask + 1));
     }
@@ -680,8 +760,9 @@ nkbool nkiSerializeStatics(struct NKVM *vm, NKVMSerializationWriter writer, void
         nkiFree(vm, vm->staticSpace);
         // Set to NULL first in case nkiMallocArray throws an error.
         vm->staticSpace = NULL;
-        vm->staticSpace = (struct NKValue *)nkiMallocArray(
-            vm, sizeof(struct NKValue), vm->staticAddressMask + 1);
+        vm->staticSpace = (struct NKValue *)nkiMallocArrayCategory(
+            vm, sizeof(struct NKValue), vm->staticAddressMask + 1,
+            NK_MEMORY_CATEGORY_PROGRAM);
     }
 
     // Read/write the static space.
@@ -845,9 +926,9 @@ nkbool nkiSerializeFunctionTable_inner(
         if(!writeMode) {
 
             struct NKVMFunction *newTable =
-                (struct NKVMFunction *)nkiMallocArray(
+                (struct NKVMFunction *)nkiMallocArrayCategory(
                     vm, sizeof(struct NKVMFunction),
-                    tmpFunctionCount);
+                    tmpFunctionCount, NK_MEMORY_CATEGORY_PROGRAM);
 
             if(!newTable) {
                 return nkfalse;
@@ -864,6 +945,7 @@ nkbool nkiSerializeFunctionTable_inner(
 
         NKI_SERIALIZE_BASIC(nkuint32_t, vm->functionTable[i].argumentCount);
         NKI_SERIALIZE_BASIC(nkuint32_t, vm->functionTable[i].firstInstructionIndex);
+        NKI_SERIALIZE_BASIC(nkuint32_t, vm->functionTable[i].maxStackDepth);
         NKI_SERIALIZE_BASIC(NKVMExternalFunctionID, vm->functionTable[i].externalFunctionId);
 
         // Remap external function ID.
@@ -1447,10 +1529,15 @@ nkbool nkiSerializeExecutionContext(
 //   3   - Coroutines added
 //   4   - '.' object call changed to '->'.
 //   5   - Coroutine "is_finished" instruction added.
+//   6   - Wide instructions with inline operands added.
+//   7   - Quickened instructions added. Opcode mask widened to 128.
+//   8   - Per-function maximum stack depth added.
+//   9   - Flag for interned strings added to the string table.
+//   10  - Constant key field instructions with inline caches added.
 
-#define NKI_VERSION 5
+#define NKI_VERSION 10
 
-nkbool nkiVmSerialize(struct NKVM *vm, NKVMSerializationWriter writer, void *userdata, nkbool writeMode)
+nkbool nkiVmSerializeCode(struct NKVM *vm, NKVMSerializationWriter writer, void *userdata, nkbool writeMode)
 {
     // Serialize format marker.
     {
@@ -1474,9 +1561,23 @@ nkbool nkiVmSerialize(struct NKVM *vm, NKVMSerializationWriter writer, void *use
         }
     }
 
+#if NK_JIT
+    // Loading replaces the instructions and static space, so throw
+    // away any native code built from the old ones.
+    if(!writeMode) {
+        nkiJitReset(vm);
+    }
+#endif
+
     NKI_WRAPSERIALIZE(
         nkiSerializeInstructions(vm, writer, userdata, writeMode));
 
+    // Ahead-of-time compiled code only gets to stay if it matches the
+    // instructions we just loaded.
+    if(!writeMode) {
+        nkiAotRevalidate(vm);
+    }
+
     NKI_WRAPSERIALIZE(
         nkiSerializeErrorState(vm, writer, userdata, writeMode));
 
@@ -1492,6 +1593,9 @@ nkbool nkiVmSerialize(struct NKVM *vm, NKVMSerializationWriter writer, void *use
     // String table.
     NKI_WRAPSERIALIZE(
         nkiSerializeStringTable(vm, writer, userdata, writeMode));
+    if(!writeMode) {
+        nkiVmInitInternalStrings(vm);
+    }
 
     // Garbage collector state. FIXME: Maybe we should just GC before
     // saving and after loading.
@@ -1501,6 +1605,21 @@ nkbool nkiVmSerialize(struct NKVM *vm, NKVMSerializationWriter writer, void *use
     NKI_WRAPSERIALIZE(
         nkiSerializeFunctionTable(vm, writer, userdata, writeMode));
 
+    return nktrue;
+}
+
+nkbool nkiVmSerialize(struct NKVM *vm, NKVMSerializationWriter writer, void *userdata, nkbool writeMode)
+{
+    // Whatever an incremental garbage collection was doing is about
+    // to be thrown out with the rest of the VM's contents. (Saving
+    // in the middle of one is fine. It just saves some garbage.)
+    if(!writeMode) {
+        nkiVmGarbageCollectCancel(vm);
+    }
+
+    NKI_WRAPSERIALIZE(
+        nkiVmSerializeCode(vm, writer, userdata, writeMode));
+
     // Serialize object table and objects. This MUST happen after the
     // functions, because deserialization routines are set up there.
     NKI_WRAPSERIALIZE(
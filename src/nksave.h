@@ -53,6 +53,15 @@ nkbool nkiVmSerialize(
     void *userdata,
     nkbool writeMode);
 
+// Serializes only the leading part of the VM state, up to and
+// including the function table. Enough to inspect the code in an
+// image without the hosting application's types and subsystems.
+nkbool nkiVmSerializeCode(
+    struct NKVM *vm,
+    NKVMSerializationWriter writer,
+    void *userdata,
+    nkbool writeMode);
+
 // Used by coroutine serialization and deserialization.
 nkbool nkiSerializeExecutionContext(
     struct NKVM *vm,
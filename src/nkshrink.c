@@ -43,6 +43,51 @@
 
 #include "nkcommon.h"
 
+// Rewrite references to a moved object or string on every stack:
+// the root stack, and the stacks of all the coroutines, running or
+// not.
+static void nkiVmShrinkRewriteStack(
+    struct NKVMStack *stack, nkuint32_t type,
+    nkuint32_t oldSlot, nkuint32_t newSlot)
+{
+    nkuint32_t i;
+    for(i = 0; i < stack->size; i++) {
+        struct NKValue *v = &stack->values[i];
+        if(v->type != type) {
+            continue;
+        }
+        if(type == NK_VALUETYPE_OBJECTID) {
+            if(v->objectId == oldSlot) {
+                v->objectId = newSlot;
+            }
+        } else if(v->stringTableEntry == oldSlot) {
+            v->stringTableEntry = newSlot;
+        }
+    }
+}
+
+static void nkiVmShrinkRewriteStacks(
+    struct NKVM *vm, nkuint32_t type,
+    nkuint32_t oldSlot, nkuint32_t newSlot)
+{
+    nkuint32_t i;
+
+    nkiVmShrinkRewriteStack(
+        &vm->rootExecutionContext.stack, type, oldSlot, newSlot);
+
+    for(i = 0; i < vm->objectTable.capacity; i++) {
+        struct NKVMObject *ob = vm->objectTable.objectTable[i];
+        if(ob && ob->externalData && ob->externalDataType.id ==
+            vm->internalObjectTypes.coroutine.id)
+        {
+            struct NKVMExecutionContext *context =
+                (struct NKVMExecutionContext *)ob->externalData;
+            nkiVmShrinkRewriteStack(
+                &context->stack, type, oldSlot, newSlot);
+        }
+    }
+}
+
 void nkiVmMoveObject(struct NKVM *vm, nkuint32_t oldSlot, nkuint32_t newSlot)
 {
     assert(vm->objectTable.capacity > newSlot);
@@ -58,13 +103,8 @@ void nkiVmMoveObject(struct NKVM *vm, nkuint32_t oldSlot, nkuint32_t newSlot)
         nkuint32_t i;
 
         // Rewrite all stack references.
-        for(i = 0; i < vm->currentExecutionContext->stack.size; i++) {
-            if(vm->currentExecutionContext->stack.values[i].type == NK_VALUETYPE_OBJECTID) {
-                if(vm->currentExecutionContext->stack.values[i].objectId == oldSlot) {
-                    vm->currentExecutionContext->stack.values[i].objectId = newSlot;
-                }
-            }
-        }
+        nkiVmShrinkRewriteStacks(
+            vm, NK_VALUETYPE_OBJECTID, oldSlot, newSlot);
 
         // Rewrite all static references.
         for(i = 0; i <= vm->staticAddressMask; i++) {
@@ -80,15 +120,26 @@ void nkiVmMoveObject(struct NKVM *vm, nkuint32_t oldSlot, nkuint32_t newSlot)
             struct NKVMObject *ob = vm->objectTable.objectTable[i];
             if(ob) {
                 nkuint32_t k;
-                for(k = 0; k < nkiVMObjectHashBucketCount; k++) {
-                    struct NKVMObjectElement *el;
-                    for(el = ob->hashBuckets[k]; el; el = el->next) {
-                        if(el->key.type == NK_VALUETYPE_OBJECTID && el->key.objectId == oldSlot) {
-                            el->key.objectId = newSlot;
-                        }
-                        if(el->value.type == NK_VALUETYPE_OBJECTID && el->value.objectId == oldSlot) {
-                            el->value.objectId = newSlot;
-                        }
+                for(k = 0; k < ob->arrayCapacity; k++) {
+                    struct NKValue *v = &ob->arrayPart[k];
+                    if(v->type == NK_VALUETYPE_OBJECTID && v->objectId == oldSlot &&
+                        !nkiVmObjectArraySlotIsEmpty(v))
+                    {
+                        v->objectId = newSlot;
+                    }
+                }
+                for(k = 0; k < ob->fieldCapacity; k++) {
+                    struct NKVMObjectElement *el = &ob->fields[k];
+                    if(nkiVmObjectSlotIsEmpty(el)) {
+                        continue;
+                    }
+                    if(el->key.type == NK_VALUETYPE_OBJECTID && el->key.objectId == oldSlot) {
+                        // This changes the key's hash, so the table
+                        // gets rebuilt at the end of nkiVmShrink().
+                        el->key.objectId = newSlot;
+                    }
+                    if(el->value.type == NK_VALUETYPE_OBJECTID && el->value.objectId == oldSlot) {
+                        el->value.objectId = newSlot;
                     }
                 }
             }
@@ -111,13 +162,8 @@ void nkiVmMoveString(struct NKVM *vm, nkuint32_t oldSlot, nkuint32_t newSlot)
     vm->stringTable.stringTable[oldSlot] = NULL;
 
     // Rewrite all stack references.
-    for(i = 0; i < vm->currentExecutionContext->stack.size; i++) {
-        if(vm->currentExecutionContext->stack.values[i].type == NK_VALUETYPE_STRING) {
-            if(vm->currentExecutionContext->stack.values[i].stringTableEntry == oldSlot) {
-                vm->currentExecutionContext->stack.values[i].stringTableEntry = newSlot;
-            }
-        }
-    }
+    nkiVmShrinkRewriteStacks(
+        vm, NK_VALUETYPE_STRING, oldSlot, newSlot);
 
     // Rewrite all static references.
     for(i = 0; i <= vm->staticAddressMask; i++) {
@@ -133,15 +179,26 @@ void nkiVmMoveString(struct NKVM *vm, nkuint32_t oldSlot, nkuint32_t newSlot)
         struct NKVMObject *ob = vm->objectTable.objectTable[i];
         if(ob) {
             nkuint32_t k;
-            for(k = 0; k < nkiVMObjectHashBucketCount; k++) {
-                struct NKVMObjectElement *el;
-                for(el = ob->hashBuckets[k]; el; el = el->next) {
-                    if(el->key.type == NK_VALUETYPE_STRING && el->key.stringTableEntry == oldSlot) {
-                        el->key.stringTableEntry = newSlot;
-                    }
-                    if(el->value.type == NK_VALUETYPE_STRING && el->value.stringTableEntry == oldSlot) {
-                        el->value.stringTableEntry = newSlot;
-                    }
+            for(k = 0; k < ob->arrayCapacity; k++) {
+                struct NKValue *v = &ob->arrayPart[k];
+                if(v->type == NK_VALUETYPE_STRING && v->stringTableEntry == oldSlot &&
+                    !nkiVmObjectArraySlotIsEmpty(v))
+                {
+                    v->stringTableEntry = newSlot;
+                }
+            }
+            for(k = 0; k < ob->fieldCapacity; k++) {
+                struct NKVMObjectElement *el = &ob->fields[k];
+                if(nkiVmObjectSlotIsEmpty(el)) {
+                    continue;
+                }
+                // String hashes come from the contents, so keys can
+                // stay where they are.
+                if(el->key.type == NK_VALUETYPE_STRING && el->key.stringTableEntry == oldSlot) {
+                    el->key.stringTableEntry = newSlot;
+                }
+                if(el->value.type == NK_VALUETYPE_STRING && el->value.stringTableEntry == oldSlot) {
+                    el->value.stringTableEntry = newSlot;
                 }
             }
         }
@@ -187,6 +244,10 @@ void nkiVmShrink(struct NKVM *vm)
         return;
     }
 
+    // Object and string IDs are about to change under any incremental
+    // collection in progress, so get it out of the way.
+    nkiVmGarbageCollectFinish(vm);
+
     // FIXME: I don't think we can actually do the following code
     // reliably. Moving objects around in the object table will mess
     // up references to those objects!
@@ -264,6 +325,14 @@ void nkiVmShrink(struct NKVM *vm)
     // their stacks too.
     for(i = 0; i < vm->objectTable.capacity; i++) {
         struct NKVMObject *ob = vm->objectTable.objectTable[i];
+
+        // Rebuild field tables at the smallest size that fits. Object
+        // IDs used as keys may have changed above, so this also puts
+        // them back where lookups expect them.
+        if(ob) {
+            nkiVmObjectRebuildFields(vm, ob);
+        }
+
         if(ob && ob->externalDataType.id ==
             vm->internalObjectTypes.coroutine.id)
         {
@@ -272,4 +341,7 @@ void nkiVmShrink(struct NKVM *vm)
             nkiVmShrinkStack(vm, &context->stack);
         }
     }
+
+    // Moving things around above probably emptied out some slabs.
+    nkiPoolShrink(vm);
 }
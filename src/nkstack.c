@@ -45,8 +45,8 @@
 
 void nkiVmStackInit(struct NKVM *vm, struct NKVMStack *stack)
 {
-    stack->values = (struct NKValue *)nkiMalloc(
-        vm, sizeof(struct NKValue));
+    stack->values = (struct NKValue *)nkiMallocCategory(
+        vm, sizeof(struct NKValue), NK_MEMORY_CATEGORY_STACKS);
     nkiMemset(stack->values, 0, sizeof(struct NKValue));
     stack->size = 0;
     stack->capacity = 1;
@@ -61,42 +61,47 @@ void nkiVmStackDestroy(struct NKVM *vm, struct NKVMStack *stack)
     }
 }
 
-struct NKValue *nkiVmStackPush_internal(struct NKVM *vm)
+// Grow the stack so it can hold at least minimumCapacity values. The
+// capacity keeps doubling (it must stay a power of two for the index
+// mask), but we only reallocate once.
+static nkbool nkiVmStackGrow(
+    struct NKVM *vm, struct NKVMStack *stack,
+    nkuint32_t minimumCapacity)
 {
-    struct NKVMStack *stack = &vm->currentExecutionContext->stack;
+    nkuint32_t oldStackCapacity = stack->capacity;
+    nkuint32_t newStackCapacity = stack->capacity;
+    nkuint32_t newStackIndexMask = stack->indexMask;
 
     // Make a stack if we don't have one. This can happen with weird
     // binaries.
-    if(!stack->capacity) {
-        stack->values = (struct NKValue *)nkiReallocArray(
-            vm,
-            stack->values,
-            stack->capacity, sizeof(struct NKValue));
-        nkiMemset(stack->values, 0, sizeof(struct NKValue));
-        stack->capacity = 1;
+    if(!newStackCapacity) {
+        newStackCapacity = 1;
+        newStackIndexMask = 0;
     }
 
-    // Grow the stack if necessary.
-    if(stack->size == stack->capacity) {
+    if(!minimumCapacity) {
+        nkiAddError(
+            vm,
+            "Stack ran out of address space.");
+        return nkfalse;
+    }
 
-        nkuint32_t newStackCapacity = stack->capacity;
-        nkuint32_t newStackIndexMask = stack->indexMask;
+    while(newStackCapacity < minimumCapacity) {
 
         // TODO: Add an adjustable stack size limit.
-        if(stack->capacity > 0xffff) {
-
+        if(newStackCapacity > 0xffff) {
             nkiAddError(
                 vm,
                 "Stack overflow.");
-
-            return &stack->values[0];
+            return nkfalse;
         }
 
         // Thanks AFL! Continued attempts to keep pushing stuff to the
         // stack (even though the stack overflow had occurred) would
         // cause the stack size to keep doubling anyway, but without
         // any actual allocation. Now the stack capacity change
-        // happens AFTER the overflow check.
+        // happens AFTER the overflow check, and only gets stored
+        // after the allocation.
         newStackCapacity <<= 1;
 
         // TODO: Make a more reasonable stack space limit than "we ran
@@ -105,29 +110,110 @@ struct NKValue *nkiVmStackPush_internal(struct NKVM *vm)
             nkiAddError(
                 vm,
                 "Stack ran out of address space.");
-            return &stack->values[0];
+            return nkfalse;
         }
 
         if(newStackCapacity > vm->limits.maxStackSize) {
             nkiAddError(
                 vm,
                 "Reached stack capacity limit.");
-            return &stack->values[0];
+            return nkfalse;
         }
 
         newStackIndexMask <<= 1;
         newStackIndexMask |= 1;
+    }
+
+    if(vm->nativeCallDepth) {
+
+        // A native function might still be holding a pointer to its
+        // arguments in the old block (see nkiOpcode_call()), so copy
+        // to a new one and keep the old one alive until it returns.
+        struct NKValue *newValues = (struct NKValue *)nkiMallocArrayCategory(
+            vm, sizeof(struct NKValue), newStackCapacity,
+            NK_MEMORY_CATEGORY_STACKS);
+
+        if(oldStackCapacity) {
+            nkiMemcpy(
+                newValues, stack->values,
+                sizeof(struct NKValue) * oldStackCapacity);
+        }
+
+        vm->retiredStackBlocks = (struct NKValue **)nkiReallocArrayCategory(
+            vm, vm->retiredStackBlocks,
+            sizeof(struct NKValue *), vm->retiredStackBlockCount + 1,
+            NK_MEMORY_CATEGORY_STACKS);
+        vm->retiredStackBlocks[vm->retiredStackBlockCount++] = stack->values;
+
+        stack->values = newValues;
+
+    } else {
+
         stack->values = (struct NKValue *)nkiReallocArray(
             vm,
             stack->values,
             newStackCapacity, sizeof(struct NKValue));
+    }
+
+    stack->capacity = newStackCapacity;
+    stack->indexMask = newStackIndexMask;
 
-        stack->capacity = newStackCapacity;
-        stack->indexMask = newStackIndexMask;
+    nkiMemset(
+        &stack->values[oldStackCapacity], 0,
+        sizeof(struct NKValue) * (newStackCapacity - oldStackCapacity));
 
-        nkiMemset(
-            &stack->values[stack->size], 0,
-            sizeof(struct NKValue) * (stack->capacity - stack->size));
+    return nktrue;
+}
+
+nkbool nkiVmStackReserve(struct NKVM *vm, nkuint32_t count)
+{
+    struct NKVMStack *stack = &vm->currentExecutionContext->stack;
+
+    if(stack->size <= stack->capacity &&
+        count <= stack->capacity - stack->size)
+    {
+        return nktrue;
+    }
+
+    if(count > NK_UINT_MAX - stack->size) {
+        nkiAddError(
+            vm,
+            "Stack overflow.");
+        return nkfalse;
+    }
+
+    return nkiVmStackGrow(vm, stack, stack->size + count);
+}
+
+void nkiVmStackFreeRetiredBlocks(struct NKVM *vm)
+{
+    nkuint32_t i;
+
+    if(!vm->retiredStackBlockCount) {
+        return;
+    }
+
+    for(i = 0; i < vm->retiredStackBlockCount; i++) {
+        nkiFree(vm, vm->retiredStackBlocks[i]);
+    }
+
+    nkiFree(vm, vm->retiredStackBlocks);
+    vm->retiredStackBlocks = NULL;
+    vm->retiredStackBlockCount = 0;
+}
+
+struct NKValue *nkiVmStackPush_internal(struct NKVM *vm)
+{
+    struct NKVMStack *stack = &vm->currentExecutionContext->stack;
+
+    // Calls reserve the whole frame up front (nkiVmStackReserve()),
+    // so inside a function this is just the bounds check. It still
+    // has to be here, because deserialized function records can't be
+    // trusted to have the right depth.
+    if(stack->size >= stack->capacity) {
+        if(!nkiVmStackGrow(vm, stack, stack->size + 1)) {
+            return &stack->values[0];
+        }
     }
 
     {
@@ -86,6 +86,15 @@ void nkiVmStackDestroy(struct NKVM *vm, struct NKVMStack *stack);
 /// fill it in).
 struct NKValue *nkiVmStackPush_internal(struct NKVM *vm);
 
+/// Make sure there is room for count more values without growing the
+/// stack again. Used by function calls to set up the whole frame at
+/// once. Returns nkfalse (with an error set) on stack overflow.
+nkbool nkiVmStackReserve(struct NKVM *vm, nkuint32_t count);
+
+/// Free stack blocks that were replaced while a native function call
+/// was in progress. Only safe once no native calls are running.
+void nkiVmStackFreeRetiredBlocks(struct NKVM *vm);
+
 /// Clear the entire stack. Memory will only be reduced if freeMem is
 /// set to nktrue, but this will cause an extra reallocation and
 /// should NOT be used in places where an allocation error could cause
@@ -43,27 +43,149 @@
 
 #include "nkcommon.h"
 
-nkuint32_t nkiStringHash(const char *in)
+#define NKI_ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+nkuint32_t nkiStringHashBytes(const char *in, nkuint32_t len)
 {
-    nkuint32_t len = nkiStrlen(in);
-    nkuint32_t a = 1;
-    nkuint32_t b = 0;
+    // MurmurHash3 (32-bit), which eats four bytes per step. The words
+    // are put together a byte at a time so this doesn't care about
+    // alignment or endianness, but compilers turn that into a plain
+    // load where they can.
+    const unsigned char *data = (const unsigned char *)in;
+    nkuint32_t blockCount = len / 4;
+    nkuint32_t h = 0x9747b28c;
+    nkuint32_t k;
     nkuint32_t i;
 
-    for(i = 0; i < len; i++) {
-        a = (a + in[i]) % (nkuint32_t)65521;
-        b = (b + a) % (nkuint32_t)65521;
+    for(i = 0; i < blockCount; i++) {
+        k = (nkuint32_t)data[0] |
+            ((nkuint32_t)data[1] << 8) |
+            ((nkuint32_t)data[2] << 16) |
+            ((nkuint32_t)data[3] << 24);
+        data += 4;
+
+        k *= 0xcc9e2d51;
+        k = NKI_ROTL32(k, 15);
+        k *= 0x1b873593;
+
+        h ^= k;
+        h = NKI_ROTL32(h, 13);
+        h = h * 5 + 0xe6546b64;
+    }
+
+    // Leftover bytes.
+    k = 0;
+    switch(len & 3) {
+        case 3:
+            k ^= (nkuint32_t)data[2] << 16;
+            // Fall through.
+        case 2:
+            k ^= (nkuint32_t)data[1] << 8;
+            // Fall through.
+        case 1:
+            k ^= (nkuint32_t)data[0];
+            k *= 0xcc9e2d51;
+            k = NKI_ROTL32(k, 15);
+            k *= 0x1b873593;
+            h ^= k;
     }
 
-    return (b << 16) | a;
+    // Final mix, so the low bits (the ones we use for buckets) depend
+    // on everything.
+    h ^= len;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+
+    return h;
+}
+
+nkuint32_t nkiStringHash(const char *in)
+{
+    return nkiStringHashBytes(in, nkiStrlen(in));
 }
 
 void nkiVmStringTableInit(struct NKVM *vm)
 {
-    nkiMemset(&vm->stringsByHash, 0, sizeof(vm->stringsByHash));
+    // The hash table gets allocated when the first string goes in.
+    vm->stringsByHash = NULL;
+    vm->stringsByHashSize = 0;
+    vm->stringsByHashCount = 0;
+    vm->bufferedStrings = NULL;
     nkiTableInit(vm, &vm->stringTable);
 }
 
+void nkiVmStringTableAddToHash(
+    struct NKVM *vm,
+    struct NKVMString *str)
+{
+    nkuint32_t bucket;
+
+    // Keep the load factor at or under one, so chains stay short no
+    // matter how many strings there are.
+    if(vm->stringsByHashCount >= vm->stringsByHashSize) {
+
+        nkuint32_t newSize = vm->stringsByHashSize ?
+            vm->stringsByHashSize * 2 : nkiVmStringHashTableInitialSize;
+        struct NKVMString **newBuckets;
+        nkuint32_t i;
+
+        if(newSize < vm->stringsByHashSize) {
+            // Can't grow any more. Chains just get longer.
+            newSize = vm->stringsByHashSize;
+        } else {
+
+            newBuckets = (struct NKVMString **)nkiMallocArrayCategory(
+                vm, sizeof(struct NKVMString *), newSize,
+                NK_MEMORY_CATEGORY_STRINGS);
+            nkiMemset(newBuckets, 0, sizeof(struct NKVMString *) * newSize);
+
+            // Rehash everything from the old buckets.
+            for(i = 0; i < vm->stringsByHashSize; i++) {
+                struct NKVMString *cur = vm->stringsByHash[i];
+                while(cur) {
+                    struct NKVMString *next = cur->nextInHashBucket;
+                    nkuint32_t newBucket = cur->hash & (newSize - 1);
+                    cur->nextInHashBucket = newBuckets[newBucket];
+                    newBuckets[newBucket] = cur;
+                    cur = next;
+                }
+            }
+
+            nkiFree(vm, vm->stringsByHash);
+            vm->stringsByHash = newBuckets;
+            vm->stringsByHashSize = newSize;
+        }
+    }
+
+    bucket = str->hash & (vm->stringsByHashSize - 1);
+    str->nextInHashBucket = vm->stringsByHash[bucket];
+    vm->stringsByHash[bucket] = str;
+    vm->stringsByHashCount++;
+}
+
+static void nkiVmStringBufferRelease(
+    struct NKVM *vm,
+    struct NKVMStringBuffer *buffer)
+{
+    assert(buffer->refCount);
+    buffer->refCount--;
+    if(!buffer->refCount) {
+        nkiFree(vm, buffer->data);
+        nkiPoolFree(vm, buffer);
+    }
+}
+
+static void nkiVmStringFree(struct NKVM *vm, struct NKVMString *str)
+{
+    if(str && str->buffer) {
+        nkiVmStringBufferRelease(vm, str->buffer);
+    }
+    nkiPoolFree(vm, str);
+}
+
 void nkiVmStringTableDestroy(struct NKVM *vm)
 {
     struct NKVMTable *table = &vm->stringTable;
@@ -72,15 +194,18 @@ void nkiVmStringTableDestroy(struct NKVM *vm)
     nkuint32_t i;
     if(table && table->stringTable) {
         for(i = 0; i < table->capacity; i++) {
-            nkiFree(vm, table->stringTable[i]);
+            nkiVmStringFree(vm, table->stringTable[i]);
             table->stringTable[i] = NULL;
         }
     }
 
     nkiTableDestroy(vm, table);
 
-    // Zero-out the hash table, just for safety.
-    nkiMemset(vm->stringsByHash, 0, sizeof(vm->stringsByHash));
+    nkiFree(vm, vm->stringsByHash);
+    vm->stringsByHash = NULL;
+    vm->stringsByHashSize = 0;
+    vm->stringsByHashCount = 0;
+    vm->bufferedStrings = NULL;
 }
 
 struct NKVMString *nkiVmStringTableGetEntryById(
@@ -94,61 +219,280 @@ struct NKVMString *nkiVmStringTableGetEntryById(
 }
 
 const char *nkiVmStringTableGetStringById(
-    struct NKVMTable *table,
+    struct NKVM *vm,
     nkuint32_t index)
 {
-    struct NKVMString *vmstr = nkiVmStringTableGetEntryById(table, index);
-    const char *ret = vmstr ? vmstr->str : NULL;
+    struct NKVMString *vmstr = nkiVmStringTableGetEntryById(
+        &vm->stringTable, index);
+    const char *ret = vmstr ? nkiVmStringGetData(vm, vmstr) : NULL;
     return ret;
 }
 
-nkuint32_t nkiVmStringTableFindOrAddString(
+const char *nkiVmStringGetData(
     struct NKVM *vm,
-    const char *str)
+    struct NKVMString *str)
+{
+    struct NKVMStringBuffer *buffer = str->buffer;
+
+    if(!buffer) {
+        return str->str;
+    }
+
+    // Something has been appended past the end of this string, so
+    // there's no terminator where we need one. Give it a buffer of
+    // its own.
+    if(buffer->length != str->length) {
+
+        struct NKVMStringBuffer *newBuffer;
+        char *data;
+
+        data = (char *)nkiMallocCategory(
+            vm, str->length + 1, NK_MEMORY_CATEGORY_STRINGS);
+        nkiMemcpy(data, buffer->data, str->length);
+        data[str->length] = 0;
+
+        newBuffer = (struct NKVMStringBuffer *)nkiPoolMalloc(
+            vm, sizeof(struct NKVMStringBuffer), NK_MEMORY_CATEGORY_STRINGS);
+        newBuffer->data = data;
+        newBuffer->length = str->length;
+        newBuffer->capacity = str->length + 1;
+        newBuffer->refCount = 1;
+
+        str->buffer = newBuffer;
+        nkiVmStringBufferRelease(vm, buffer);
+        buffer = newBuffer;
+    }
+
+    return buffer->data;
+}
+
+nkuint32_t nkiVmStringGetHash(
+    struct NKVM *vm,
+    struct NKVMString *str)
+{
+    if(!str->hashValid) {
+        str->hash = nkiStringHashBytes(
+            nkiVmStringGetData(vm, str), str->length);
+        str->hashValid = nktrue;
+    }
+    return str->hash;
+}
+
+nkuint32_t nkiVmStringTableConcat(
+    struct NKVM *vm,
+    nkuint32_t leftIndex,
+    const char *right,
+    nkuint32_t rightLen)
 {
     struct NKVMTable *table = &vm->stringTable;
-    nkuint32_t hash = nkiStringHash(str);
+    struct NKVMString *left = nkiVmStringTableGetEntryById(table, leftIndex);
+    struct NKVMStringBuffer *buffer;
+    struct NKVMString *newString;
+    nkuint32_t newLen;
+    nkuint32_t index;
+    nkbool overflow = nkfalse;
+
+    if(!left || !right) {
+        nkiAddError(vm, "Bad string in concatenation.");
+        return NK_INVALID_VALUE;
+    }
 
+    buffer = left->buffer;
+
+    // Allocate this first, so an allocation failure can't leave a
+    // buffer with a reference count that's off by one.
+    newString = (struct NKVMString *)nkiPoolMalloc(
+        vm, sizeof(struct NKVMString), NK_MEMORY_CATEGORY_STRINGS);
+    nkiMemset(newString, 0, sizeof(struct NKVMString));
+
+    if(buffer && buffer->length == left->length &&
+        buffer->capacity - buffer->length > rightLen)
     {
-        // See if we have this string already.
-        struct NKVMString *hashBucket =
-            vm->stringsByHash[hash & (nkiVmStringHashTableSize - 1)];
-        struct NKVMString *cur = hashBucket;
+        // The left string is at the end of its buffer and there's
+        // room, so just tack the new part on. Strings using earlier
+        // parts of the buffer still see their own lengths. Note that
+        // right may point into this same buffer, but never past the
+        // old end.
+        nkiMemcpy(buffer->data + buffer->length, right, rightLen);
+        buffer->length += rightLen;
+        buffer->data[buffer->length] = 0;
+        buffer->refCount++;
+        newLen = buffer->length;
+
+    } else {
+
+        const char *leftData;
+        nkuint32_t leftLen;
+        nkuint32_t capacity;
+        char *data;
+
+        leftData = buffer ? buffer->data : left->str;
+        leftLen = left->length;
+
+        NK_CHECK_OVERFLOW_UINT_ADD(leftLen, rightLen, newLen, overflow);
+        if(overflow || newLen == NK_UINT_MAX) {
+            nkiPoolFree(vm, newString);
+            nkiAddError(vm, "String concatenation result is too long.");
+            return NK_INVALID_VALUE;
+        }
+
+        // Leave room to grow, so a string that keeps getting appended
+        // to only gets copied a logarithmic number of times.
+        capacity = newLen + 1;
+        if(newLen < NK_UINT_MAX / 2) {
+            capacity = newLen * 2 + 1;
+        }
+        if(capacity < 16) {
+            capacity = 16;
+        }
+
+        data = (char *)nkiMallocCategory(
+            vm, capacity, NK_MEMORY_CATEGORY_STRINGS);
+        nkiMemcpy(data, leftData, leftLen);
+        nkiMemcpy(data + leftLen, right, rightLen);
+        data[newLen] = 0;
+
+        buffer = (struct NKVMStringBuffer *)nkiPoolMalloc(
+            vm, sizeof(struct NKVMStringBuffer), NK_MEMORY_CATEGORY_STRINGS);
+        buffer->data = data;
+        buffer->length = newLen;
+        buffer->capacity = capacity;
+        buffer->refCount = 1;
+    }
+
+    newString->buffer = buffer;
+    newString->length = newLen;
+    if(nkiVmGcSweeping(vm)) {
+        newString->lastGCPass = vm->gcState.currentGCPass;
+    }
+
+    index = nkiTableAddEntry(vm, table, newString);
+    if(index == NK_INVALID_VALUE) {
+        nkiVmStringFree(vm, newString);
+        return NK_INVALID_VALUE;
+    }
+
+    newString->stringTableIndex = index;
+    newString->nextInHashBucket = vm->bufferedStrings;
+    vm->bufferedStrings = newString;
 
+    return index;
+}
+
+nkuint32_t nkiVmStringTableIntern(
+    struct NKVM *vm,
+    nkuint32_t index)
+{
+    struct NKVMString *str = nkiVmStringTableGetEntryById(
+        &vm->stringTable, index);
+
+    if(!str || !str->buffer) {
+        return index;
+    }
+
+    return nkiVmStringTableFindOrAddBytes(
+        vm, nkiVmStringGetData(vm, str), str->length);
+}
+
+// Search the hash table for a string with the given contents.
+static nkuint32_t nkiVmStringTableFindWithHash(
+    struct NKVM *vm,
+    const char *str,
+    nkuint32_t len,
+    nkuint32_t hash)
+{
+    // Check the hash and length before bothering with the contents.
+    if(vm->stringsByHashSize) {
+        struct NKVMString *cur =
+            vm->stringsByHash[hash & (vm->stringsByHashSize - 1)];
         while(cur) {
-            if(!nkiStrcmp(cur->str, str)) {
+            if(cur->hash == hash && cur->length == len &&
+                !nkiMemcmp(cur->str, str, len))
+            {
+                // This might be a dead string the sweep hasn't
+                // gotten to yet. It's not dead anymore.
+                if(nkiVmGcSweeping(vm)) {
+                    cur->lastGCPass = vm->gcState.currentGCPass;
+                }
                 return cur->stringTableIndex;
             }
             cur = cur->nextInHashBucket;
         }
+    }
 
-        // If we've reached this point, then we don't have the string
-        // yet, so we'll go ahead and make a new entry.
-        {
-            nkuint32_t len = nkiStrlen(str);
+    return NK_INVALID_VALUE;
+}
+
+nkuint32_t nkiVmStringTableFindInterned(
+    struct NKVM *vm,
+    nkuint32_t index)
+{
+    struct NKVMString *str = nkiVmStringTableGetEntryById(
+        &vm->stringTable, index);
 
-            struct NKVMString *newString =
-                (struct NKVMString *)nkiMalloc(
-                    vm, sizeof(struct NKVMString) + len + 1);
+    if(!str || !str->buffer) {
+        return index;
+    }
 
-            nkuint32_t index = nkiTableAddEntry(vm, table, newString);
+    return nkiVmStringTableFindWithHash(
+        vm, nkiVmStringGetData(vm, str), str->length,
+        nkiVmStringGetHash(vm, str));
+}
 
-            if(index == NK_INVALID_VALUE) {
-                nkiFree(vm, newString);
-                return NK_INVALID_VALUE;
-            }
+nkuint32_t nkiVmStringTableFindOrAddString(
+    struct NKVM *vm,
+    const char *str)
+{
+    return nkiVmStringTableFindOrAddBytes(vm, str, nkiStrlen(str));
+}
 
-            newString->stringTableIndex = index;
-            newString->lastGCPass = 0;
-            newString->dontGC = nkfalse;
-            newString->hash = nkiStringHash(str);
-            nkiStrcpy(newString->str, str);
-            newString->nextInHashBucket = hashBucket;
-            vm->stringsByHash[hash & (nkiVmStringHashTableSize - 1)] = newString;
+nkuint32_t nkiVmStringTableFindOrAddBytes(
+    struct NKVM *vm,
+    const char *str,
+    nkuint32_t len)
+{
+    struct NKVMTable *table = &vm->stringTable;
+    nkuint32_t hash = nkiStringHashBytes(str, len);
+    struct NKVMString *newString;
+    nkuint32_t index;
+
+    // See if we have this string already.
+    index = nkiVmStringTableFindWithHash(vm, str, len, hash);
+    if(index != NK_INVALID_VALUE) {
+        return index;
+    }
 
-            return newString->stringTableIndex;
-        }
+    // If we've reached this point, then we don't have the string
+    // yet, so we'll go ahead and make a new entry.
+    if(len >= NK_UINT_MAX - sizeof(struct NKVMString)) {
+        nkiAddError(vm, "String is too long for the string table.");
+        return NK_INVALID_VALUE;
     }
+
+    newString = (struct NKVMString *)nkiPoolMalloc(
+        vm, sizeof(struct NKVMString) + len + 1, NK_MEMORY_CATEGORY_STRINGS);
+
+    index = nkiTableAddEntry(vm, table, newString);
+
+    if(index == NK_INVALID_VALUE) {
+        nkiPoolFree(vm, newString);
+        return NK_INVALID_VALUE;
+    }
+
+    newString->stringTableIndex = index;
+    newString->lastGCPass =
+        nkiVmGcSweeping(vm) ? vm->gcState.currentGCPass : 0;
+    newString->dontGC = nkfalse;
+    newString->hash = hash;
+    newString->hashValid = nktrue;
+    newString->buffer = NULL;
+    newString->length = len;
+    nkiMemcpy(newString->str, str, len);
+    newString->str[len] = 0;
+
+    nkiVmStringTableAddToHash(vm, newString);
+
+    return index;
 }
 
 // VM teardown function. Does not create holes. Use only during VM
@@ -159,56 +503,162 @@ void nkiVmStringTableCleanAllStrings(
     struct NKVMTable *table = &vm->stringTable;
     nkuint32_t i;
 
-    for(i = 0; i < nkiVmStringHashTableSize; i++) {
+    for(i = 0; i < vm->stringsByHashSize; i++) {
 
         struct NKVMString *str = vm->stringsByHash[i];
 
         while(str) {
             struct NKVMString *next = str->nextInHashBucket;
             nkuint32_t index = str->stringTableIndex;
-            nkiFree(vm, str);
+            nkiPoolFree(vm, str);
             str = next;
             table->stringTable[index] = NULL;
         }
+
+        vm->stringsByHash[i] = NULL;
+    }
+    vm->stringsByHashCount = 0;
+
+    while(vm->bufferedStrings) {
+        struct NKVMString *str = vm->bufferedStrings;
+        vm->bufferedStrings = str->nextInHashBucket;
+        table->stringTable[str->stringTableIndex] = NULL;
+        nkiVmStringFree(vm, str);
     }
 }
 
+// Sweep one list of strings (a hash bucket or the buffered string
+// list). Returns NULL if something was wrong with the list, or the
+// link where it stopped otherwise. That's the end of the list unless
+// *budget (if not NULL) ran out first. Adds the number of strings
+// freed to *freedCount.
+static struct NKVMString **nkiVmStringTableCleanOldStringList(
+    struct NKVM *vm,
+    struct NKVMString **list,
+    nkuint32_t lastGCPass,
+    nkuint32_t *freedCount,
+    nkuint32_t *budget)
+{
+    struct NKVMTable *table = &vm->stringTable;
+    struct NKVMString **lastPtr = list;
+    struct NKVMString *str = *list;
+
+    while(str) {
+
+        if(budget) {
+            if(!*budget) {
+                break;
+            }
+            (*budget)--;
+        }
+
+        while(str && (lastGCPass != str->lastGCPass && !str->dontGC)) {
+
+            nkuint32_t index = str->stringTableIndex;
+
+            if(index == NK_INVALID_VALUE) {
+                nkiAddError(vm, "Bad string index in garbage collector.");
+                return NULL;
+            }
+
+            nkiTableEraseEntry(vm, table, index);
+
+            *lastPtr = str->nextInHashBucket;
+            nkiVmStringFree(vm, str);
+            str = *lastPtr;
+            (*freedCount)++;
+        }
+
+        if(str) {
+            lastPtr = &str->nextInHashBucket;
+            str = str->nextInHashBucket;
+        }
+    }
+
+    return lastPtr;
+}
+
 void nkiVmStringTableCleanOldStrings(
     struct NKVM *vm,
     nkuint32_t lastGCPass)
 {
-    struct NKVMTable *table = &vm->stringTable;
     nkuint32_t i;
+    nkuint32_t freedCount = 0;
+    nkuint32_t bufferedFreedCount = 0;
 
-    for(i = 0; i < nkiVmStringHashTableSize; i++) {
+    for(i = 0; i < vm->stringsByHashSize; i++) {
+        if(!nkiVmStringTableCleanOldStringList(
+                vm, &vm->stringsByHash[i], lastGCPass, &freedCount, NULL))
+        {
+            break;
+        }
+    }
 
-        struct NKVMString **lastPtr = &vm->stringsByHash[i];
-        struct NKVMString *str = vm->stringsByHash[i];
+    assert(freedCount <= vm->stringsByHashCount);
+    vm->stringsByHashCount -= freedCount;
 
-        while(str) {
+    nkiVmStringTableCleanOldStringList(
+        vm, &vm->bufferedStrings, lastGCPass, &bufferedFreedCount, NULL);
+}
 
-            while(str && (lastGCPass != str->lastGCPass && !str->dontGC)) {
+nkbool nkiVmStringTableCleanOldStringsStep(
+    struct NKVM *vm,
+    struct NKVMGCState *gcState)
+{
+    nkuint32_t freedCount = 0;
+    nkuint32_t bufferedFreedCount = 0;
+    nkuint32_t budget;
 
-                nkuint32_t index = str->stringTableIndex;
+    if(gcState->workDone >= gcState->stepBudget) {
+        return nkfalse;
+    }
+    budget = gcState->stepBudget - gcState->workDone;
 
-                if(index == NK_INVALID_VALUE) {
-                    nkiAddError(vm, "Bad string index in garbage collector.");
-                    return;
-                }
+    // Hash buckets are short enough to do one at a time. The table
+    // may have been resized since the last step, but it only grows,
+    // and a string that gets skipped is just left for the next
+    // collection.
+    while(gcState->sweepPosition < vm->stringsByHashSize && budget) {
 
-                nkiTableEraseEntry(vm, table, index);
+        budget--;
 
-                *lastPtr = str->nextInHashBucket;
-                nkiFree(vm, str);
-                str = *lastPtr;
-            }
+        if(!nkiVmStringTableCleanOldStringList(
+                vm, &vm->stringsByHash[gcState->sweepPosition],
+                gcState->currentGCPass, &freedCount, NULL))
+        {
+            gcState->sweepPosition = vm->stringsByHashSize;
+            break;
+        }
 
-            if(str) {
-                lastPtr = &str->nextInHashBucket;
-                str = str->nextInHashBucket;
-            }
+        gcState->sweepPosition++;
+    }
+
+    assert(freedCount <= vm->stringsByHashCount);
+    vm->stringsByHashCount -= freedCount;
+
+    // The buffered string list can be long, so this one stops partway
+    // through. New strings only ever go on the front of the list, and
+    // the string that owns the link we stopped at is marked, so the
+    // link stays valid until we come back.
+    if(gcState->sweepPosition >= vm->stringsByHashSize) {
+
+        if(!gcState->sweepStringLink) {
+            gcState->sweepStringLink = &vm->bufferedStrings;
+        }
+
+        gcState->sweepStringLink = nkiVmStringTableCleanOldStringList(
+            vm, gcState->sweepStringLink, gcState->currentGCPass,
+            &bufferedFreedCount, &budget);
+
+        if(!gcState->sweepStringLink || !*gcState->sweepStringLink) {
+            gcState->sweepStringLink = NULL;
+            gcState->workDone = gcState->stepBudget - budget;
+            return nktrue;
         }
     }
+
+    gcState->workDone = gcState->stepBudget - budget;
+    return nkfalse;
 }
 
 nkuint32_t nkiStrlen(const char *str)
@@ -327,3 +777,139 @@ nkint32_t nkiMemcmp(const void *a, const void *b, nkuint32_t len)
     return 0;
 }
 
+
+nkuint32_t nkiFormatUint32(char *buf, nkuint32_t value)
+{
+    char tmp[NK_PRINTF_UINTCHARSNEED + 1];
+    nkuint32_t count = 0;
+    nkuint32_t i;
+
+    // Digits come out backwards.
+    do {
+        tmp[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while(value);
+
+    for(i = 0; i < count; i++) {
+        buf[i] = tmp[count - i - 1];
+    }
+    buf[count] = 0;
+
+    return count;
+}
+
+nkuint32_t nkiFormatInt32(char *buf, nkint32_t value)
+{
+    if(value < 0) {
+        // Negate as unsigned so the most negative value works.
+        buf[0] = '-';
+        return nkiFormatUint32(buf + 1, (nkuint32_t)0 - (nkuint32_t)value) + 1;
+    }
+    return nkiFormatUint32(buf, (nkuint32_t)value);
+}
+
+nkuint32_t nkiFormatFloat(char *buf, float value)
+{
+    nkuint32_t bits = 0;
+    nkuint32_t exponentBits;
+    nkuint32_t mantissa;
+    nkint32_t exponent;
+    nkuint32_t integerPart = 0;
+    char fraction[6] = { 0, 0, 0, 0, 0, 0 };
+    nkuint32_t len = 0;
+    nkuint32_t i;
+
+    // This produces the same thing as sprintf's "%f" for IEEE single
+    // precision floats, using only 32-bit integer math. Anything it
+    // can't do exactly that way (huge numbers, tiny numbers with a
+    // full mantissa, infinity and NaN, weird float formats) goes to
+    // sprintf.
+    if(sizeof(float) != sizeof(nkuint32_t)) {
+        sprintf(buf, "%f", value);
+        return nkiStrlen(buf);
+    }
+
+    nkiMemcpy(&bits, &value, sizeof(bits));
+    exponentBits = (bits >> 23) & 0xff;
+    mantissa = bits & 0x7fffff;
+
+    if(exponentBits == 0xff) {
+        sprintf(buf, "%f", value);
+        return nkiStrlen(buf);
+    }
+
+    // value = mantissa * 2^exponent
+    if(exponentBits) {
+        mantissa |= 0x800000;
+        exponent = (nkint32_t)exponentBits - 150;
+    } else {
+        exponent = -149;
+    }
+
+    if(exponent >= 0) {
+
+        // mantissa < 2^24, so this fits for exponent <= 8.
+        if(exponent > 8) {
+            sprintf(buf, "%f", value);
+            return nkiStrlen(buf);
+        }
+        integerPart = mantissa << exponent;
+
+    } else if(mantissa) {
+
+        nkuint32_t shift = (nkuint32_t)-exponent;
+        nkuint32_t mask;
+        nkuint32_t half;
+        nkuint32_t remainder;
+
+        // Drop trailing zero bits so the fraction has as few bits as
+        // possible. Multiplying it by 10 has to fit in 32 bits.
+        while(shift > 28 && !(mantissa & 1)) {
+            mantissa >>= 1;
+            shift--;
+        }
+        if(shift > 28) {
+            sprintf(buf, "%f", value);
+            return nkiStrlen(buf);
+        }
+
+        mask = ((nkuint32_t)1 << shift) - 1;
+        integerPart = mantissa >> shift;
+        remainder = mantissa & mask;
+
+        for(i = 0; i < 6; i++) {
+            remainder *= 10;
+            fraction[i] = (char)(remainder >> shift);
+            remainder &= mask;
+        }
+
+        // Round to nearest, ties to even, on the exact remainder.
+        half = (nkuint32_t)1 << (shift - 1);
+        if(remainder > half || (remainder == half && (fraction[5] & 1))) {
+            i = 6;
+            while(i > 0) {
+                i--;
+                fraction[i]++;
+                if(fraction[i] < 10) {
+                    break;
+                }
+                fraction[i] = 0;
+                if(i == 0) {
+                    integerPart++;
+                }
+            }
+        }
+    }
+
+    if(bits & 0x80000000) {
+        buf[len++] = '-';
+    }
+    len += nkiFormatUint32(buf + len, integerPart);
+    buf[len++] = '.';
+    for(i = 0; i < 6; i++) {
+        buf[len++] = (char)('0' + fraction[i]);
+    }
+    buf[len] = 0;
+
+    return len;
+}
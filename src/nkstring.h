@@ -47,6 +47,18 @@
 #include "nktypes.h"
 #include "nktable.h"
 
+/// Growable character buffer shared by strings built through
+/// concatenation. Every string using it holds a reference. A string
+/// whose length matches the buffer's length is the one at the end,
+/// and can be extended in place to make the next string.
+struct NKVMStringBuffer
+{
+    char *data;
+    nkuint32_t length;
+    nkuint32_t capacity;
+    nkuint32_t refCount;
+};
+
 struct NKVMString
 {
     struct NKVMString *nextInHashBucket;
@@ -55,6 +67,19 @@ struct NKVMString
     nkbool dontGC;
     nkuint32_t hash;
 
+    // Length in bytes, not counting the terminator. Strings can
+    // contain zero bytes, so always go by this instead of looking for
+    // the terminator.
+    nkuint32_t length;
+
+    // Strings made by nkiVmStringTableConcat() aren't interned. They
+    // live in vm->bufferedStrings instead of the hash table, and
+    // their text is the first length bytes of buffer instead of
+    // str. The hash is computed on demand. NULL buffer for everything
+    // else.
+    struct NKVMStringBuffer *buffer;
+    nkbool hashValid;
+
     // Must be last. We're going to allocate VMStrings with enough
     // extra space that we can treat this array as an
     // arbitrarily-sized one, with the data extending off the end of
@@ -62,7 +87,7 @@ struct NKVMString
     char str[1];
 };
 
-#define nkiVmStringHashTableSize 256
+#define nkiVmStringHashTableInitialSize 256
 #define nkiVmExternalSubsystemHashTableSize 16
 
 void nkiVmStringTableInit(struct NKVM *vm);
@@ -73,13 +98,62 @@ struct NKVMString *nkiVmStringTableGetEntryById(
     nkuint32_t index);
 
 const char *nkiVmStringTableGetStringById(
-    struct NKVMTable *table,
+    struct NKVM *vm,
     nkuint32_t index);
 
 nkuint32_t nkiVmStringTableFindOrAddString(
     struct NKVM *vm,
     const char *str);
 
+/// Same as nkiVmStringTableFindOrAddString(), but for when the length
+/// is already known. The data may contain zero bytes.
+nkuint32_t nkiVmStringTableFindOrAddBytes(
+    struct NKVM *vm,
+    const char *str,
+    nkuint32_t len);
+
+/// Link an interned string into the hash table, growing the table if
+/// it's getting full.
+void nkiVmStringTableAddToHash(
+    struct NKVM *vm,
+    struct NKVMString *str);
+
+/// Get the NUL-terminated contents of a string table entry. For
+/// buffered strings that are no longer at the end of their buffer,
+/// this copies the text out into a buffer of its own first.
+const char *nkiVmStringGetData(
+    struct NKVM *vm,
+    struct NKVMString *str);
+
+/// Get the content hash of a string table entry.
+nkuint32_t nkiVmStringGetHash(
+    struct NKVM *vm,
+    struct NKVMString *str);
+
+/// Make a new string from the string at leftIndex followed by the
+/// rightLen bytes at right. When the left string is at the end of a buffer with room to
+/// spare, the new string shares that buffer and only right gets
+/// copied, so building a string up in a loop is amortized linear.
+/// The result is not interned. Returns NK_INVALID_VALUE on failure.
+nkuint32_t nkiVmStringTableConcat(
+    struct NKVM *vm,
+    nkuint32_t leftIndex,
+    const char *right,
+    nkuint32_t rightLen);
+
+/// Get the ID of the interned version of a string. Returns index
+/// itself for strings that are already interned.
+nkuint32_t nkiVmStringTableIntern(
+    struct NKVM *vm,
+    nkuint32_t index);
+
+/// Same as nkiVmStringTableIntern(), but never adds anything. Returns
+/// NK_INVALID_VALUE if there's no interned string with the same
+/// contents.
+nkuint32_t nkiVmStringTableFindInterned(
+    struct NKVM *vm,
+    nkuint32_t index);
+
 // VM teardown function. Does not create holes. Use only during VM
 // destruction.
 void nkiVmStringTableCleanAllStrings(
@@ -89,7 +163,15 @@ void nkiVmStringTableCleanOldStrings(
     struct NKVM *vm,
     nkuint32_t lastGCPass);
 
+// Incremental version of nkiVmStringTableCleanOldStrings(). Picks up
+// where the last call left off and stops when gcState->workDone
+// reaches gcState->stepBudget. Returns nktrue when it's done.
+nkbool nkiVmStringTableCleanOldStringsStep(
+    struct NKVM *vm,
+    struct NKVMGCState *gcState);
+
 nkuint32_t nkiStringHash(const char *in);
+nkuint32_t nkiStringHashBytes(const char *in, nkuint32_t len);
 
 // A lot of these are simple reimplementations of the standard library
 // versions, just so we don't have to rely on the size of size_t.
@@ -101,5 +183,15 @@ void nkiStrcpy_s(char *dst, const char *src, nkuint32_t len);
 void nkiMemset(void *ptr, nkuint32_t c, nkuint32_t len);
 void nkiMemcpy(void *dst, const void *src, nkuint32_t len);
 nkint32_t nkiMemcmp(const void *a, const void *b, nkuint32_t len);
+
+// Number formatting without going through sprintf. buf must have
+// room for NK_PRINTF_INTCHARSNEED + 1 (or NK_PRINTF_UINTCHARSNEED +
+// 1) characters for the integer versions, and
+// NK_PRINTF_FLOATCHARSNEEDED + 1 for floats. Output matches "%d",
+// "%u" and "%f". Returns the length written, not counting the
+// terminator.
+nkuint32_t nkiFormatInt32(char *buf, nkint32_t value);
+nkuint32_t nkiFormatUint32(char *buf, nkuint32_t value);
+nkuint32_t nkiFormatFloat(char *buf, float value);
 #endif // NINKASI_VMSTRING_H
 
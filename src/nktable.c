@@ -46,13 +46,14 @@
 void nkiTableInit(struct NKVM *vm, struct NKVMTable *table)
 {
     // Create a table of one empty entry.
-    table->data = (void **)nkiMalloc(vm, sizeof(void*));
+    table->data = (void **)nkiMallocCategory(
+        vm, sizeof(void*), NK_MEMORY_CATEGORY_TABLES);
     table->capacity = 1;
     table->data[0] = NULL;
 
     // Create the hole object that goes with the empty space.
-    table->tableHoles = (struct NKVMTableHole *)nkiMalloc(
-        vm, sizeof(struct NKVMTableHole));
+    table->tableHoles = (struct NKVMTableHole *)nkiPoolMalloc(
+        vm, sizeof(struct NKVMTableHole), NK_MEMORY_CATEGORY_TABLES);
     table->tableHoles->index = 0;
     table->tableHoles->next = NULL;
 }
@@ -83,7 +84,7 @@ void nkiTableDestroy(struct NKVM *vm, struct NKVMTable *table)
         struct NKVMTableHole *th = table->tableHoles;
         while(th) {
             struct NKVMTableHole *next = th->next;
-            nkiFree(vm, th);
+            nkiPoolFree(vm, th);
             th = next;
         }
         table->tableHoles = NULL;
@@ -93,8 +94,8 @@ void nkiTableDestroy(struct NKVM *vm, struct NKVMTable *table)
 void nkiTableCreateHole(struct NKVM *vm, struct NKVMTable *table, nkuint32_t holeIndex)
 {
     struct NKVMTableHole *hole =
-        (struct NKVMTableHole *)nkiMalloc(
-            vm, sizeof(struct NKVMTableHole));
+        (struct NKVMTableHole *)nkiPoolMalloc(
+            vm, sizeof(struct NKVMTableHole), NK_MEMORY_CATEGORY_TABLES);
 
     assert(holeIndex < table->capacity);
     assert(table->data[holeIndex] == NULL);
@@ -120,7 +121,7 @@ void nkiTableResetHoles(struct NKVM *vm, struct NKVMTable *table)
     while(table->tableHoles) {
         struct NKVMTableHole *hole = table->tableHoles;
         table->tableHoles = hole->next;
-        nkiFree(vm, hole);
+        nkiPoolFree(vm, hole);
     }
 
     // Recreate all object table holes.
@@ -177,7 +178,7 @@ nkuint32_t nkiTableAddEntry(struct NKVM *vm, struct NKVMTable *table, void *entr
         struct NKVMTableHole *hole = table->tableHoles;
         table->tableHoles = hole->next;
         index = hole->index;
-        nkiFree(vm, hole);
+        nkiPoolFree(vm, hole);
 
     } else {
 
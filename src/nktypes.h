@@ -227,6 +227,17 @@ struct NKCompilerState;
 struct NKVMGCState;
 
 typedef void (*NKVMFunctionCallback)(struct NKVMFunctionCallbackData *data);
+
+// Typed native functions, one for each NKTypedFunctionSignature.
+// These get unboxed arguments and don't have to check types
+// themselves. NKVMTypedFunction is what they get passed around as, so
+// cast to that when registering them.
+typedef void (*NKVMTypedFunction)(void);
+typedef nkint32_t (*NKVMTypedFunctionIntInt)(struct NKVM *vm, nkint32_t a);
+typedef nkint32_t (*NKVMTypedFunctionIntIntInt)(struct NKVM *vm, nkint32_t a, nkint32_t b);
+typedef float (*NKVMTypedFunctionFloatFloat)(struct NKVM *vm, float a);
+typedef float (*NKVMTypedFunctionFloatFloatFloat)(struct NKVM *vm, float a, float b);
+typedef void (*NKVMTypedFunctionVoidObject)(struct NKVM *vm, struct NKValue *object);
 typedef nkbool (*NKVMSerializationWriter)(void *data, nkuint32_t size, void *userdata, nkbool writeMode);
 typedef void (*NKVMSubsystemCleanupCallback)(struct NKVM *vm, void *internalData);
 typedef void (*NKVMSubsystemSerializationCallback)(struct NKVM *vm, void *internalData);
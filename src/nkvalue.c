@@ -173,62 +173,102 @@ float nkiValueToFloat(struct NKVM *vm, struct NKValue *value)
     }
 }
 
-const char *nkiValueToString(struct NKVM *vm, struct NKValue *value)
+void nkiVmValueStringCacheInit(struct NKVM *vm)
 {
-    switch(value->type) {
-
-        case NK_VALUETYPE_STRING:
-            return nkiVmStringTableGetStringById(
-                &vm->stringTable,
-                value->stringTableEntry);
+    nkuint32_t i;
 
-        case NK_VALUETYPE_INT: {
-            struct NKDynString *dynStr = nkiDynStrCreate(vm, "");
-            nkuint32_t id;
-
-            nkiDynStrAppendInt32(dynStr, value->intData);
-
-            id = nkiVmStringTableFindOrAddString(
-                vm, dynStr->data);
-            nkiDynStrDelete(dynStr);
+    // Strings never go in here, so that marks an empty slot.
+    nkiMemset(vm->valueStrings, 0, sizeof(vm->valueStrings));
+    for(i = 0; i < nkiVmValueStringCacheSize; i++) {
+        vm->valueStrings[i].type = NK_VALUETYPE_STRING;
+    }
+    vm->nextValueString = 0;
+}
 
-            return nkiVmStringTableGetStringById(
-                &vm->stringTable,
-                id);
+static struct NKVMValueString *nkiValueToCachedString(
+    struct NKVM *vm, struct NKValue *value)
+{
+    struct NKVMValueString *entry;
+    nkuint32_t bits = value->type == NK_VALUETYPE_NIL ? 0 : value->basicHashValue;
+    nkuint32_t i;
+
+    // Printing or comparing the same few numbers over and over is
+    // common, so check for a previous conversion first.
+    for(i = 0; i < nkiVmValueStringCacheSize; i++) {
+        entry = &vm->valueStrings[i];
+        if(entry->type == value->type_uint && entry->bits == bits) {
+            return entry;
         }
+    }
 
-        case NK_VALUETYPE_FLOAT: {
-            struct NKDynString *dynStr = nkiDynStrCreate(vm, "");
-            nkuint32_t id;
+    // Take the oldest slot.
+    entry = &vm->valueStrings[vm->nextValueString];
+    vm->nextValueString =
+        (vm->nextValueString + 1) & (nkiVmValueStringCacheSize - 1);
 
-            nkiDynStrAppendFloat(dynStr, value->floatData);
+    entry->type = value->type_uint;
+    entry->bits = bits;
 
-            id = nkiVmStringTableFindOrAddString(
-                vm, dynStr->data);
-            nkiDynStrDelete(dynStr);
+    switch(value->type) {
 
-            return nkiVmStringTableGetStringById(
-                &vm->stringTable,
-                id);
-        }
+        case NK_VALUETYPE_INT:
+            entry->length = nkiFormatInt32(entry->str, value->intData);
+            break;
+
+        case NK_VALUETYPE_FLOAT:
+            entry->length = nkiFormatFloat(entry->str, value->floatData);
+            break;
 
         default: {
-            struct NKDynString *dynStr = nkiDynStrCreate(vm, "<");
-            nkuint32_t id;
+            // "<type:hash>". Type names are short, so this always
+            // fits.
+            const char *typeName = nkiValueTypeGetName(value->type);
+            nkuint32_t len = nkiStrlen(typeName);
+            entry->str[0] = '<';
+            nkiMemcpy(entry->str + 1, typeName, len);
+            entry->str[len + 1] = ':';
+            len += 2;
+            len += nkiFormatInt32(entry->str + len, (nkint32_t)nkiValueHash(vm, value));
+            entry->str[len] = '>';
+            entry->str[len + 1] = 0;
+            entry->length = len + 1;
+        } break;
+    }
 
-            nkiDynStrAppend(dynStr, nkiValueTypeGetName(value->type));
-            nkiDynStrAppend(dynStr, ":");
-            nkiDynStrAppendInt32(dynStr, nkiValueHash(vm, value));
-            nkiDynStrAppend(dynStr, ">");
+    return entry;
+}
 
-            id = nkiVmStringTableFindOrAddString(
-                vm, dynStr->data);
-            nkiDynStrDelete(dynStr);
+const char *nkiValueToString(struct NKVM *vm, struct NKValue *value)
+{
+    if(value->type == NK_VALUETYPE_STRING) {
+        return nkiVmStringTableGetStringById(
+            vm,
+            value->stringTableEntry);
+    }
 
-            return nkiVmStringTableGetStringById(
-                &vm->stringTable,
-                id);
+    return nkiValueToCachedString(vm, value)->str;
+}
+
+const char *nkiValueToStringBytes(
+    struct NKVM *vm,
+    struct NKValue *value,
+    nkuint32_t *length)
+{
+    if(value->type == NK_VALUETYPE_STRING) {
+        struct NKVMString *str = nkiVmStringTableGetEntryById(
+            &vm->stringTable, value->stringTableEntry);
+        if(!str) {
+            *length = 0;
+            return NULL;
         }
+        *length = str->length;
+        return nkiVmStringGetData(vm, str);
+    }
+
+    {
+        struct NKVMValueString *entry = nkiValueToCachedString(vm, value);
+        *length = entry->length;
+        return entry->str;
     }
 }
 
@@ -295,8 +335,11 @@ nkint32_t nkiValueCompare(
         } break;
 
         case NK_VALUETYPE_STRING: {
-            const char *other = nkiValueToString(vm, in2);
-            const char *thisData = nkiValueToString(vm, in1);
+            nkuint32_t otherLen;
+            nkuint32_t thisLen;
+            const char *other = nkiValueToStringBytes(vm, in2, &otherLen);
+            const char *thisData = nkiValueToStringBytes(vm, in1, &thisLen);
+            nkint32_t result;
 
             // Thanks AFL!
             if(!other || !thisData) {
@@ -306,11 +349,22 @@ nkint32_t nkiValueCompare(
 
             // Shortcut it if we ended up with two of the same entry
             // in the string table.
-            if(other == thisData) {
+            if(other == thisData && otherLen == thisLen) {
                 return 0;
             }
 
-            return nkiStrcmp(thisData, other);
+            // Compare the common part, then let the shorter string
+            // sort first. Zero bytes are just like any other byte
+            // here.
+            result = nkiMemcmp(
+                thisData, other, thisLen < otherLen ? thisLen : otherLen);
+            if(result) {
+                return result < 0 ? -1 : 1;
+            }
+            if(thisLen == otherLen) {
+                return 0;
+            }
+            return thisLen < otherLen ? -1 : 1;
         } break;
 
         case NK_VALUETYPE_FUNCTIONID: {
@@ -374,7 +428,7 @@ nkuint32_t nkiValueHash(struct NKVM *vm, struct NKValue *value)
                 value->stringTableEntry);
 
             if(vmStr) {
-                ret = vmStr->hash;
+                ret = nkiVmStringGetHash(vm, vmStr);
             } else {
                 ret = 0;
             }
@@ -418,6 +472,21 @@ void nkiValueSetString(struct NKVM *vm, struct NKValue *value, const char *str)
             vm, str ? str : "");
 }
 
+void nkiValueSetStringBytes(
+    struct NKVM *vm,
+    struct NKValue *value,
+    const char *data,
+    nkuint32_t length)
+{
+    // Clear out full 32-bits even on systems where "type" is only 16
+    // bits.
+    value->type_uint = 0;
+    value->type = NK_VALUETYPE_STRING;
+    value->stringTableEntry =
+        nkiVmStringTableFindOrAddBytes(
+            vm, data ? data : "", data ? length : 0);
+}
+
 void nkiValueSetFunction(struct NKVM *vm, struct NKValue *value, NKVMInternalFunctionID id)
 {
     // Clear out full 32-bits even on systems where "type" is only 16
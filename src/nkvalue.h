@@ -97,10 +97,34 @@ nkint32_t nkiValueToInt(struct NKVM *vm, struct NKValue *value);
 float nkiValueToFloat(struct NKVM *vm, struct NKValue *value);
 
 /// Returns a string for a value, possibly converting internally.
-/// Values are only guaranteed to be valid until the next garbage
-/// collection pass.
+/// Strings are only guaranteed to be valid until the next garbage
+/// collection pass. Anything else gets converted into a small
+/// rotating cache instead of the string table, and is only valid
+/// until nkiVmValueStringCacheSize more values have been converted.
 const char *nkiValueToString(struct NKVM *vm, struct NKValue *value);
 
+/// Same as nkiValueToString(), but also gives the length in
+/// bytes. Strings can contain zero bytes, so use this when the whole
+/// string matters.
+const char *nkiValueToStringBytes(
+    struct NKVM *vm,
+    struct NKValue *value,
+    nkuint32_t *length);
+
+#define nkiVmValueStringCacheSize 16
+
+/// One entry in the VM's cache of recent non-string conversions.
+struct NKVMValueString
+{
+    nkuint32_t type;
+    nkuint32_t bits;
+    nkuint32_t length;
+    char str[NK_PRINTF_FLOATCHARSNEEDED + 1];
+};
+
+/// Set up the VM's conversion cache.
+void nkiVmValueStringCacheInit(struct NKVM *vm);
+
 /// The return of this value is like strcmp(). -1 for less, 0 for
 /// equal, 1 for greater-than. Set strictType to nktrue to force a
 /// comparison failure when types differ. You MUST do this for things
@@ -125,6 +149,14 @@ void nkiValueSetFloat(struct NKVM *vm, struct NKValue *value, float floatData);
 /// that entry to the value.
 void nkiValueSetString(struct NKVM *vm, struct NKValue *value, const char *str);
 
+/// Same as nkiValueSetString(), but for a buffer of a known length
+/// that may contain zero bytes.
+void nkiValueSetStringBytes(
+    struct NKVM *vm,
+    struct NKValue *value,
+    const char *data,
+    nkuint32_t length);
+
 /// Write a function ID into an NKValue.
 void nkiValueSetFunction(struct NKVM *vm, struct NKValue *value, NKVMInternalFunctionID id);
 
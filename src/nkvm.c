@@ -46,10 +46,17 @@
 // ----------------------------------------------------------------------
 // Static opcode table setup.
 
-typedef void (*NKVMOpcodeCall)(struct NKVM *vm);
-static NKVMOpcodeCall nkiOpcodeTable[NK_OPCODE_PADDEDCOUNT];
+NKVMOpcodeCall nkiOpcodeTable[NK_OPCODE_PADDEDCOUNT];
 static const char *nkiOpcodeNameTable[NK_OPCODE_PADDEDCOUNT];
 
+// Names of the C functions in nkiOpcodeTable, for tools that generate
+// code calling them (see nkaot.h).
+static const char *nkiOpcodeFunctionNameTable[NK_OPCODE_PADDEDCOUNT];
+
+// Number of operand words that follow each instruction. Zero for
+// almost everything except PUSHLITERAL_* and the wide instructions.
+static nkuint32_t nkiOpcodeOperandCountTable[NK_OPCODE_PADDEDCOUNT];
+
 // Change to the stack offset for each instruction. For example, POP
 // will be -1. PUSHLITERAL_* will be +1. Be aware that some opcodes
 // (like POPN and CALL) will adjust by some dynamic amount that can't
@@ -63,6 +70,7 @@ nkint32_t nkiCompilerStackOffsetTable[NK_OPCODE_PADDEDCOUNT];
     do {                                                                \
         nkiOpcodeNameTable[(x)] = (const char*)#x + nkiStrlen("NK_OP_"); \
         nkiOpcodeTable[(x)] = (y);                                      \
+        nkiOpcodeFunctionNameTable[(x)] = #y;                           \
         nkiCompilerStackOffsetTable[(x)] = (z);                         \
     } while(0);
 
@@ -133,6 +141,86 @@ static void nkiVmInitOpcodeTable(void)
 
     NK_SETUP_OP(NK_OP_LEN,                    nkiOpcode_len,                    0);
 
+    NK_SETUP_OP(NK_OP_LOAD_LOCAL,             nkiOpcode_loadLocal,              1);
+    NK_SETUP_OP(NK_OP_STORE_LOCAL,            nkiOpcode_storeLocal,             0);
+    NK_SETUP_OP(NK_OP_LOAD_STATIC,            nkiOpcode_loadStatic,             1);
+    NK_SETUP_OP(NK_OP_STORE_STATIC,           nkiOpcode_storeStatic,            0);
+    NK_SETUP_OP(NK_OP_JUMP,                   nkiOpcode_jump,                   0);
+    NK_SETUP_OP(NK_OP_JZ,                     nkiOpcode_jzWide,                 -1);
+    NK_SETUP_OP(NK_OP_DISCARD,                nkiOpcode_discard,                0);
+
+    NK_SETUP_OP(NK_OP_GREATERTHAN_JZ,         nkiOpcode_gtJz,                   -2);
+    NK_SETUP_OP(NK_OP_LESSTHAN_JZ,            nkiOpcode_ltJz,                   -2);
+    NK_SETUP_OP(NK_OP_GREATERTHANOREQUAL_JZ,  nkiOpcode_geJz,                   -2);
+    NK_SETUP_OP(NK_OP_LESSTHANOREQUAL_JZ,     nkiOpcode_leJz,                   -2);
+    NK_SETUP_OP(NK_OP_EQUAL_JZ,               nkiOpcode_eqJz,                   -2);
+    NK_SETUP_OP(NK_OP_NOTEQUAL_JZ,            nkiOpcode_neJz,                   -2);
+    NK_SETUP_OP(NK_OP_ADD_LOCALS,             nkiOpcode_addLocals,              1);
+    NK_SETUP_OP(NK_OP_ADD_LITERAL,            nkiOpcode_addLiteral,             0);
+
+    NK_SETUP_OP(NK_OP_ADD_INT,                nkiOpcode_addInt,                 -1);
+    NK_SETUP_OP(NK_OP_ADD_FLOAT,              nkiOpcode_addFloat,               -1);
+    NK_SETUP_OP(NK_OP_SUBTRACT_INT,           nkiOpcode_subtractInt,            -1);
+    NK_SETUP_OP(NK_OP_SUBTRACT_FLOAT,         nkiOpcode_subtractFloat,          -1);
+    NK_SETUP_OP(NK_OP_MULTIPLY_INT,           nkiOpcode_multiplyInt,            -1);
+    NK_SETUP_OP(NK_OP_MULTIPLY_FLOAT,         nkiOpcode_multiplyFloat,          -1);
+    NK_SETUP_OP(NK_OP_GREATERTHAN_INT,        nkiOpcode_gtInt,                  -1);
+    NK_SETUP_OP(NK_OP_GREATERTHAN_FLOAT,      nkiOpcode_gtFloat,                -1);
+    NK_SETUP_OP(NK_OP_LESSTHAN_INT,           nkiOpcode_ltInt,                  -1);
+    NK_SETUP_OP(NK_OP_LESSTHAN_FLOAT,         nkiOpcode_ltFloat,                -1);
+    NK_SETUP_OP(NK_OP_GREATERTHANOREQUAL_INT, nkiOpcode_geInt,                  -1);
+    NK_SETUP_OP(NK_OP_GREATERTHANOREQUAL_FLOAT, nkiOpcode_geFloat,                -1);
+    NK_SETUP_OP(NK_OP_LESSTHANOREQUAL_INT,    nkiOpcode_leInt,                  -1);
+    NK_SETUP_OP(NK_OP_LESSTHANOREQUAL_FLOAT,  nkiOpcode_leFloat,                -1);
+    NK_SETUP_OP(NK_OP_EQUAL_INT,              nkiOpcode_eqInt,                  -1);
+    NK_SETUP_OP(NK_OP_EQUAL_FLOAT,            nkiOpcode_eqFloat,                -1);
+    NK_SETUP_OP(NK_OP_NOTEQUAL_INT,           nkiOpcode_neInt,                  -1);
+    NK_SETUP_OP(NK_OP_NOTEQUAL_FLOAT,         nkiOpcode_neFloat,                -1);
+
+    NK_SETUP_OP(NK_OP_ADD3,                   nkiOpcode_add3,                   0);
+    NK_SETUP_OP(NK_OP_SUBTRACT3,              nkiOpcode_subtract3,              0);
+    NK_SETUP_OP(NK_OP_MULTIPLY3,              nkiOpcode_multiply3,              0);
+    NK_SETUP_OP(NK_OP_ADD3_LITERAL,           nkiOpcode_add3Literal,            0);
+    NK_SETUP_OP(NK_OP_MOVE_LOCAL,             nkiOpcode_moveLocal,              0);
+    NK_SETUP_OP(NK_OP_POP_LOCAL,              nkiOpcode_popLocal,               -1);
+    NK_SETUP_OP(NK_OP_POP_STATIC,             nkiOpcode_popStatic,              -1);
+
+    NK_SETUP_OP(NK_OP_OBJECTFIELDGET_CONST,   nkiOpcode_objectFieldGetConst,    0);
+    NK_SETUP_OP(NK_OP_OBJECTFIELDSET_CONST,   nkiOpcode_objectFieldSetConst,    -1);
+    NK_SETUP_OP(NK_OP_OBJECTFIELDGET_NOPOP_CONST, nkiOpcode_objectFieldGetConst_noPop, 1);
+
+    // Everything that reads an operand from the next instruction
+    // word.
+    nkiOpcodeOperandCountTable[NK_OP_PUSHLITERAL_INT] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_PUSHLITERAL_FLOAT] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_PUSHLITERAL_STRING] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_PUSHLITERAL_FUNCTIONID] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_LOAD_LOCAL] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_STORE_LOCAL] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_LOAD_STATIC] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_STORE_STATIC] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_JUMP] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_JZ] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_DISCARD] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_GREATERTHAN_JZ] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_LESSTHAN_JZ] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_GREATERTHANOREQUAL_JZ] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_LESSTHANOREQUAL_JZ] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_EQUAL_JZ] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_NOTEQUAL_JZ] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_ADD_LOCALS] = 2;
+    nkiOpcodeOperandCountTable[NK_OP_ADD_LITERAL] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_ADD3] = 3;
+    nkiOpcodeOperandCountTable[NK_OP_SUBTRACT3] = 3;
+    nkiOpcodeOperandCountTable[NK_OP_MULTIPLY3] = 3;
+    nkiOpcodeOperandCountTable[NK_OP_ADD3_LITERAL] = 3;
+    nkiOpcodeOperandCountTable[NK_OP_MOVE_LOCAL] = 2;
+    nkiOpcodeOperandCountTable[NK_OP_POP_LOCAL] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_POP_STATIC] = 1;
+    nkiOpcodeOperandCountTable[NK_OP_OBJECTFIELDGET_CONST] = 2;
+    nkiOpcodeOperandCountTable[NK_OP_OBJECTFIELDSET_CONST] = 2;
+    nkiOpcodeOperandCountTable[NK_OP_OBJECTFIELDGET_NOPOP_CONST] = 2;
+
     // Fill in the rest of the opcode table with no-ops. We just want
     // to pad up to a power of two so we can easily mask instructions
     // instead of branching to make sure they're valid.
@@ -140,6 +228,7 @@ static void nkiVmInitOpcodeTable(void)
         nkuint32_t i;
         for(i = NK_OPCODE_REALCOUNT; i < NK_OPCODE_PADDEDCOUNT; i++) {
             nkiOpcodeTable[i] = nkiOpcode_nop;
+            nkiOpcodeFunctionNameTable[i] = "nkiOpcode_nop";
             nkiCompilerStackOffsetTable[i] = 0;
         }
     }
@@ -157,6 +246,58 @@ const char *nkiVmGetOpcodeName(enum NKOpcode op)
     return nkiOpcodeNameTable[op & (NK_OPCODE_PADDEDCOUNT - 1)];
 }
 
+nkuint32_t nkiVmGetOpcodeOperandCount(enum NKOpcode op)
+{
+    return nkiOpcodeOperandCountTable[op & (NK_OPCODE_PADDEDCOUNT - 1)];
+}
+
+const char *nkiVmGetOpcodeFunctionName(enum NKOpcode op)
+{
+    return nkiOpcodeFunctionNameTable[op & (NK_OPCODE_PADDEDCOUNT - 1)];
+}
+
+enum NKOpcode nkiVmGetGenericOpcode(enum NKOpcode op)
+{
+    switch(op) {
+        case NK_OP_ADD_INT:
+        case NK_OP_ADD_FLOAT:
+            return NK_OP_ADD;
+        case NK_OP_SUBTRACT_INT:
+        case NK_OP_SUBTRACT_FLOAT:
+            return NK_OP_SUBTRACT;
+        case NK_OP_MULTIPLY_INT:
+        case NK_OP_MULTIPLY_FLOAT:
+            return NK_OP_MULTIPLY;
+        case NK_OP_GREATERTHAN_INT:
+        case NK_OP_GREATERTHAN_FLOAT:
+            return NK_OP_GREATERTHAN;
+        case NK_OP_LESSTHAN_INT:
+        case NK_OP_LESSTHAN_FLOAT:
+            return NK_OP_LESSTHAN;
+        case NK_OP_GREATERTHANOREQUAL_INT:
+        case NK_OP_GREATERTHANOREQUAL_FLOAT:
+            return NK_OP_GREATERTHANOREQUAL;
+        case NK_OP_LESSTHANOREQUAL_INT:
+        case NK_OP_LESSTHANOREQUAL_FLOAT:
+            return NK_OP_LESSTHANOREQUAL;
+        case NK_OP_EQUAL_INT:
+        case NK_OP_EQUAL_FLOAT:
+            return NK_OP_EQUAL;
+        case NK_OP_NOTEQUAL_INT:
+        case NK_OP_NOTEQUAL_FLOAT:
+            return NK_OP_NOTEQUAL;
+        default:
+            return op;
+    }
+}
+
+nkbool nkiVmOpcodeHasInlineCache(enum NKOpcode op)
+{
+    return op == NK_OP_OBJECTFIELDGET_CONST ||
+        op == NK_OP_OBJECTFIELDSET_CONST ||
+        op == NK_OP_OBJECTFIELDGET_NOPOP_CONST;
+}
+
 // ----------------------------------------------------------------------
 // Init/shutdown
 
@@ -191,11 +332,17 @@ void nkiVmInit(struct NKVM *vm)
     vm->currentMemoryUsage = 0;
     vm->peakMemoryUsage = 0;
     vm->allocations = NULL;
+    nkiMemset(vm->categoryMemoryUsage, 0, sizeof(vm->categoryMemoryUsage));
+    nkiMemset(
+        vm->categoryPeakMemoryUsage, 0,
+        sizeof(vm->categoryPeakMemoryUsage));
 
 #if NK_EXTRA_FANCY_LEAK_TRACKING_LINUX
     vm->allocationCount = 0;
 #endif //NK_EXTRA_FANCY_LEAK_TRACKING_LINUX
 
+    nkiPoolInit(vm);
+
     vm->limits.maxStackSize = NK_UINT_MAX;
     vm->limits.maxFieldsPerObject = NK_UINT_MAX;
     vm->limits.maxAllocatedMemory = NK_UINT_MAX;
@@ -207,23 +354,36 @@ void nkiVmInit(struct NKVM *vm)
 
     nkiVmInitOpcodeTable();
 
+    vm->aotModule = NULL;
+
+    vm->nativeCallDepth = 0;
+    vm->retiredStackBlocks = NULL;
+    vm->retiredStackBlockCount = 0;
+
     nkiErrorStateInit(vm);
     nkiVmInitExecutionContext(vm, &vm->rootExecutionContext);
     vm->currentExecutionContext = &vm->rootExecutionContext;
     vm->currentExecutionContext->coroutineState = NK_COROUTINE_RUNNING;
 
     vm->instructions =
-        (struct NKInstruction *)nkiMalloc(vm, sizeof(struct NKInstruction) * 4);
+        (struct NKInstruction *)nkiMallocCategory(
+            vm, sizeof(struct NKInstruction) * 4,
+            NK_MEMORY_CATEGORY_PROGRAM);
     vm->instructionAddressMask = 0x3;
     nkiMemset(vm->instructions, 0, sizeof(struct NKInstruction) * 4);
 
     nkiVmStringTableInit(vm);
+    nkiVmInitInternalStrings(vm);
+    nkiVmValueStringCacheInit(vm);
 
     vm->gcInfo.lastGCPass = 0;
     vm->gcInfo.gcInterval = 1024;
     vm->gcInfo.gcCountdown = vm->gcInfo.gcInterval;
     vm->gcInfo.gcNewObjectInterval = 256;
     vm->gcInfo.gcNewObjectCountdown = vm->gcInfo.gcNewObjectInterval;
+    vm->gcInfo.gcIncrementalBudget = 0;
+    nkiMemset(&vm->gcState, 0, sizeof(vm->gcState));
+    vm->gcState.vm = vm;
 
     vm->functionCount = 0;
     vm->functionTable = NULL;
@@ -235,8 +395,8 @@ void nkiVmInit(struct NKVM *vm)
 
     // Start with two static values (so our static value mask starts
     // off at 1).
-    vm->staticSpace = (struct NKValue *)nkiMalloc(
-        vm, 2 * sizeof(struct NKValue));
+    vm->staticSpace = (struct NKValue *)nkiMallocCategory(
+        vm, 2 * sizeof(struct NKValue), NK_MEMORY_CATEGORY_PROGRAM);
     nkiMemset(vm->staticSpace, 0, 2 * sizeof(struct NKValue));
     vm->staticAddressMask = 1;
 
@@ -250,6 +410,11 @@ void nkiVmInit(struct NKVM *vm)
 
     vm->positionMarkerList = NULL;
     vm->positionMarkerCount = 0;
+    vm->peepholeRemovedCount = 0;
+
+#if NK_JIT
+    nkiJitInit(vm);
+#endif
 
     nkiMemset(
         &vm->internalObjectTypes, 0,
@@ -259,8 +424,29 @@ void nkiVmInit(struct NKVM *vm)
     nkxCoroutineLibrary_init(vm);
 }
 
+static nkuint32_t nkiVmInternString(struct NKVM *vm, const char *str)
+{
+    nkuint32_t id = nkiVmStringTableFindOrAddString(vm, str);
+    struct NKVMString *entry = nkiVmStringTableGetEntryById(
+        &vm->stringTable, id);
+    if(entry) {
+        entry->dontGC = nktrue;
+    }
+    return id;
+}
+
+void nkiVmInitInternalStrings(struct NKVM *vm)
+{
+    vm->internalStrings.exec = nkiVmInternString(vm, "_exec");
+    vm->internalStrings.data = nkiVmInternString(vm, "_data");
+}
+
 void nkiVmDestroy(struct NKVM *vm)
 {
+#if NK_JIT
+    nkiJitDestroy(vm);
+#endif
+
     // The external data table is still good, regardless of allocation
     // failure status. Make sure we run all of our cleanup functions.
     {
@@ -328,6 +514,7 @@ void nkiVmDestroy(struct NKVM *vm)
         nkiVmDeinitExecutionContext(vm, &vm->rootExecutionContext);
 
         nkiErrorStateDestroy(vm);
+        nkiVmStackFreeRetiredBlocks(vm);
         nkiFree(vm, vm->instructions);
         nkiFree(vm, vm->functionTable);
 
@@ -374,6 +561,10 @@ void nkiVmDestroy(struct NKVM *vm)
         vm->positionMarkerList = NULL;
         vm->positionMarkerCount = 0;
 
+        // Everything allocated from the pools should be gone by now,
+        // so this should take all the slabs with it.
+        nkiPoolDestroy(vm);
+
 #if NK_EXTRA_FANCY_LEAK_TRACKING_LINUX
         nkiDumpLeakData(vm);
 #endif
@@ -387,6 +578,46 @@ void nkiVmDestroy(struct NKVM *vm)
 // ----------------------------------------------------------------------
 // Iteration
 
+nkbool nkiVmGcCountdownExpired(struct NKVM *vm)
+{
+    // Thanks AFL!
+    if(vm->instructionsLeftBeforeTimeout != NK_INVALID_VALUE) {
+        if(vm->instructionsLeftBeforeTimeout < vm->gcInfo.gcInterval) {
+            nkiAddError(vm, "Instruction count limit reached.");
+            vm->instructionsLeftBeforeTimeout = 0;
+            return nkfalse;
+        }
+        vm->instructionsLeftBeforeTimeout -= vm->gcInfo.gcInterval;
+    }
+
+    if(vm->gcState.phase != NK_GC_PHASE_IDLE) {
+
+        // Incremental collection in progress. If we made a whole new
+        // batch of objects before it finished, it's not keeping up,
+        // so give it more to do per step.
+        if(!vm->gcInfo.gcNewObjectCountdown) {
+            if(vm->gcState.stepBudget < NK_UINT_MAX / 2) {
+                vm->gcState.stepBudget *= 2;
+            }
+            vm->gcInfo.gcNewObjectCountdown = vm->gcInfo.gcNewObjectInterval;
+        }
+
+        nkiVmGarbageCollectStep(vm);
+
+    } else if(!vm->gcInfo.gcNewObjectCountdown) {
+
+        if(vm->gcInfo.gcIncrementalBudget) {
+            nkiVmGarbageCollectStep(vm);
+        } else {
+            nkiVmGarbageCollect(vm);
+        }
+        vm->gcInfo.gcNewObjectCountdown = vm->gcInfo.gcNewObjectInterval;
+    }
+    vm->gcInfo.gcCountdown = vm->gcInfo.gcInterval;
+
+    return nktrue;
+}
+
 void nkiVmIterate(struct NKVM *vm)
 {
     const nkuint32_t opcodeMask = (NK_OPCODE_PADDEDCOUNT - 1);
@@ -400,22 +631,9 @@ void nkiVmIterate(struct NKVM *vm)
     // too.
     vm->gcInfo.gcCountdown--;
     if(!vm->gcInfo.gcCountdown) {
-
-        // Thanks AFL!
-        if(vm->instructionsLeftBeforeTimeout != NK_INVALID_VALUE) {
-            if(vm->instructionsLeftBeforeTimeout < vm->gcInfo.gcInterval) {
-                nkiAddError(vm, "Instruction count limit reached.");
-                vm->instructionsLeftBeforeTimeout = 0;
-                return;
-            }
-            vm->instructionsLeftBeforeTimeout -= vm->gcInfo.gcInterval;
-        }
-
-        if(!vm->gcInfo.gcNewObjectCountdown) {
-            nkiVmGarbageCollect(vm);
-            vm->gcInfo.gcNewObjectCountdown = vm->gcInfo.gcNewObjectInterval;
+        if(!nkiVmGcCountdownExpired(vm)) {
+            return;
         }
-        vm->gcInfo.gcCountdown = vm->gcInfo.gcInterval;
     }
 
     // Do the instruction.
@@ -425,11 +643,22 @@ void nkiVmIterate(struct NKVM *vm)
 
 nkbool nkiVmExecuteProgram(struct NKVM *vm)
 {
+#if NK_THREADED_DISPATCH
+    // The threaded loop stops on errors and when it reaches the end
+    // instruction, so one call covers the whole program.
+    nkiVmIterateThreaded(vm, NK_UINT_MAX);
+    if(nkiVmHasErrors(vm)) {
+        return nkfalse;
+    }
+#endif
+
     while(vm->instructions[
             vm->currentExecutionContext->instructionPointer &
             vm->instructionAddressMask].opcode != NK_OP_END)
     {
-        nkiVmIterate(vm);
+        if(!nkiAotRun(vm, NK_UINT_MAX)) {
+            nkiVmIterate(vm);
+        }
 
         if(nkiVmHasErrors(vm)) {
             return nkfalse;
@@ -53,6 +53,7 @@
 #include "nkopcode.h"
 #include "nkstring.h"
 #include "nkfunc.h"
+#include "nkjit.h"
 #include "nkobjs.h"
 
 #include "nktypes.h"
@@ -80,6 +81,42 @@ struct NKGarbageCollectionInfo
     nkuint32_t gcCountdown;
     nkuint32_t gcNewObjectInterval; // TODO: Move to VMLimits, maybe.
     nkuint32_t gcNewObjectCountdown;
+
+    // Work units per incremental collection step, or zero to collect
+    // everything at once. Not serialized, like the limits.
+    nkuint32_t gcIncrementalBudget;
+};
+
+struct NKVMValueGCEntry;
+
+struct NKVMGCState
+{
+    struct NKVM *vm;
+    nkuint32_t currentGCPass;
+    struct NKVMValueGCEntry *openList;
+    struct NKVMValueGCEntry *closedList; // We'll keep this just for re-using allocations.
+
+    // Everything past here is for incremental collections, which keep
+    // this in the VM between steps.
+
+    // enum NKGCPhase.
+    nkuint32_t phase;
+
+    // Objects with a gcMarkCallback. Whatever the callback marks can
+    // change without going through the write barrier (coroutine
+    // stacks, for instance), so these get marked again in the atomic
+    // step.
+    struct NKVMValueGCEntry *rescanList;
+
+    // Work units to do per step, and how much this step has done so
+    // far. Values scanned while marking and strings or table slots
+    // visited while sweeping are one unit each.
+    nkuint32_t stepBudget;
+    nkuint32_t workDone;
+
+    // Where the sweep left off.
+    nkuint32_t sweepPosition;
+    struct NKVMString **sweepStringLink;
 };
 
 struct NKVMExternalSubsystemData
@@ -200,7 +237,10 @@ struct NKVM
 
     // Strings.
     struct NKVMTable stringTable;
-    struct NKVMString *stringsByHash[nkiVmStringHashTableSize];
+    struct NKVMString **stringsByHash;
+    nkuint32_t stringsByHashSize;
+    nkuint32_t stringsByHashCount;
+    struct NKVMString *bufferedStrings;
 
     // Objects.
     struct NKVMTable objectTable;
@@ -212,6 +252,7 @@ struct NKVM
 
     // Garbage collection status.
     struct NKGarbageCollectionInfo gcInfo;
+    struct NKVMGCState gcState;
 
     // External C functions. This is a block that represents every
     // external C function linked to the VM, but separate from the
@@ -240,6 +281,15 @@ struct NKVM
     nkuint32_t allocationCount;
 #endif // NK_EXTRA_FANCY_LEAK_TRACKING_LINUX
 
+    // Per-category breakdown of currentMemoryUsage and the peak of
+    // each category on its own. See enum NKMemoryCategory.
+    nkuint32_t categoryMemoryUsage[NK_MEMORY_CATEGORY_COUNT];
+    nkuint32_t categoryPeakMemoryUsage[NK_MEMORY_CATEGORY_COUNT];
+
+    // Slab allocators for small records, one per memory category and
+    // size class.
+    struct NKVMPool pools[NK_MEMORY_CATEGORY_COUNT][nkiPoolSizeClassCount];
+
     void *(*mallocReplacement)(nkuint32_t size, void *userData);
     void (*freeReplacement)(void *ptr, void *userData);
     void *mallocAndFreeReplacementUserData;
@@ -271,21 +321,75 @@ struct NKVM
     struct NKVMFilePositionMarker *positionMarkerList;
     nkuint32_t positionMarkerCount;
 
+    // Number of instructions removed by the peephole optimizer, for
+    // the debug listing. Not serialized.
+    nkuint32_t peepholeRemovedCount;
+
+#if NK_JIT
+    // Compiled native code. Not serialized.
+    struct NKJitState jit;
+#endif
+
+    // Ahead-of-time compiled code from the hosting application, or
+    // NULL. Not serialized.
+    const struct NKAotModule *aotModule;
+
+    // Number of native function calls in progress. Native functions
+    // see their arguments directly on the stack, so while this is
+    // non-zero, stack blocks replaced by growing the stack go into
+    // retiredStackBlocks instead of being freed. Not serialized.
+    nkuint32_t nativeCallDepth;
+    struct NKValue **retiredStackBlocks;
+    nkuint32_t retiredStackBlockCount;
+
     // Internal data types.
     struct
     {
         NKVMExternalDataTypeID coroutine;
     } internalObjectTypes;
+
+    // Recent conversions of numbers and other non-string values to
+    // strings. See nkiValueToString(). Not serialized.
+    struct NKVMValueString valueStrings[nkiVmValueStringCacheSize];
+    nkuint32_t nextValueString;
+
+    // String table entries for keys the VM looks up on its own, like
+    // the callable object fields. Pinned with dontGC so the IDs stay
+    // put.
+    struct
+    {
+        nkuint32_t exec;
+        nkuint32_t data;
+    } internalStrings;
 };
 
 /// Initialize an already-allocated VM.
 void nkiVmInit(struct NKVM *vm);
 
+/// Intern and pin the strings in vm->internalStrings. Must be redone
+/// whenever the string table is replaced.
+void nkiVmInitInternalStrings(struct NKVM *vm);
+
 /// De-initialize a VM. Does not deallocate the VM structure.
 void nkiVmDestroy(struct NKVM *vm);
 
 const char *nkiVmGetOpcodeName(enum NKOpcode op);
 
+/// Get the number of operand words that follow an instruction in the
+/// instruction stream.
+nkuint32_t nkiVmGetOpcodeOperandCount(enum NKOpcode op);
+
+/// Get the name of the C function that implements an opcode.
+const char *nkiVmGetOpcodeFunctionName(enum NKOpcode op);
+
+/// Get the generic opcode a quickened one was made from. Anything
+/// else comes back unchanged.
+enum NKOpcode nkiVmGetGenericOpcode(enum NKOpcode op);
+
+/// True for instructions whose last operand is an inline cache that
+/// the interpreter rewrites as it runs.
+nkbool nkiVmOpcodeHasInlineCache(enum NKOpcode op);
+
 void nkiVmStaticDump(struct NKVM *vm);
 
 /// Clear and free the source file list. This info isn't really needed
@@ -325,9 +429,56 @@ nkbool nkiVmExecuteProgram(struct NKVM *vm);
 /// counter.
 void nkiVmIterate(struct NKVM *vm);
 
-/// Force a garbage collection pass.
+/// Called when gcInfo.gcCountdown reaches zero. Runs the periodic
+/// garbage collection pass (if enough objects have been created),
+/// handles the instruction count limit, and resets the countdown.
+/// Returns nkfalse if the instruction count limit has been reached,
+/// in which case the next instruction must not be executed.
+nkbool nkiVmGcCountdownExpired(struct NKVM *vm);
+
+/// Opcode function table, indexed by (opcode & (NK_OPCODE_PADDEDCOUNT
+/// - 1)).
+typedef void (*NKVMOpcodeCall)(struct NKVM *vm);
+extern NKVMOpcodeCall nkiOpcodeTable[NK_OPCODE_PADDEDCOUNT];
+
+/// Force a garbage collection pass. This throws away any
+/// incremental collection in progress and does a full one.
 void nkiVmGarbageCollect(struct NKVM *vm);
 
+/// Do one step of an incremental garbage collection, starting one if
+/// none is in progress. Returns nktrue if this step finished the
+/// collection.
+nkbool nkiVmGarbageCollectStep(struct NKVM *vm);
+
+/// Run any incremental collection in progress to completion.
+void nkiVmGarbageCollectFinish(struct NKVM *vm);
+
+/// Throw away any incremental collection in progress without freeing
+/// anything. For when the VM's contents are about to be replaced.
+void nkiVmGarbageCollectCancel(struct NKVM *vm);
+
+/// Write barrier for incremental collection. Call this on an object
+/// before storing a value in it. Objects the collector has already
+/// scanned get scanned again, so the new value doesn't get missed.
+#define nkiVmGcObjectBarrier(vm, ob)                                \
+    do {                                                            \
+        if((vm)->gcState.phase == NK_GC_PHASE_MARK &&               \
+            (ob)->lastGCPass == (vm)->gcState.currentGCPass)        \
+        {                                                           \
+            nkiVmGarbageCollect_barrier((vm), (ob));                \
+        }                                                           \
+    } while(0)
+
+void nkiVmGarbageCollect_barrier(struct NKVM *vm, struct NKVMObject *ob);
+
+/// Whether an incremental collection is sweeping. Objects and strings
+/// that show up during the sweep (new ones, or interned strings that
+/// get found again) have to be marked or they'll get freed. While
+/// marking, they get found from the roots or through the write
+/// barrier like anything else.
+#define nkiVmGcSweeping(vm) \
+    ((vm)->gcState.phase >= NK_GC_PHASE_SWEEPSTRINGS)
+
 /// Call a function inside the VM. This does not do any kind of
 /// iteration control, and will simply keep iterating until the
 /// instruction pointer points to the end of addressable program
@@ -137,7 +137,17 @@ void nkxVmIterate(struct NKVM *vm, nkuint32_t count)
     nkuint32_t i;
 
     NK_SET_FAILURE_RECOVERY_VOID();
-    for(i = 0; i < count; i++) {
+
+#if NK_THREADED_DISPATCH
+    // Run as much as we can through the threaded loop first. It stops
+    // short of the end instruction, so whatever is left of the count
+    // goes through the normal loop below.
+    i = nkiVmIterateThreaded(vm, count);
+#else
+    i = 0;
+#endif
+
+    for(; i < count; i++) {
 
         // Check for end-of-program.
         if(vm->instructions[
@@ -153,12 +163,34 @@ void nkxVmIterate(struct NKVM *vm, nkuint32_t count)
             break;
         }
 
+        // Run ahead-of-time compiled code if we have some for this
+        // address.
+        if(vm->aotModule) {
+            nkuint32_t aotCount = nkiAotRun(vm, count - i);
+            if(aotCount) {
+                i += aotCount - 1;
+                continue;
+            }
+        }
+
         nkiVmIterate(vm);
 
     }
     NK_CLEAR_FAILURE_RECOVERY();
 }
 
+nkbool nkxVmLoadAotModule(
+    struct NKVM *vm,
+    const struct NKAotModule *module)
+{
+    NK_FAILURE_RECOVERY_DECL();
+    nkbool ret;
+    NK_SET_FAILURE_RECOVERY(nkfalse);
+    ret = nkiAotLoadModule(vm, module);
+    NK_CLEAR_FAILURE_RECOVERY();
+    return ret;
+}
+
 void nkxVmGarbageCollect(struct NKVM *vm)
 {
     NK_FAILURE_RECOVERY_DECL();
@@ -167,6 +199,16 @@ void nkxVmGarbageCollect(struct NKVM *vm)
     NK_CLEAR_FAILURE_RECOVERY();
 }
 
+nkbool nkxVmGarbageCollectStep(struct NKVM *vm)
+{
+    nkbool ret;
+    NK_FAILURE_RECOVERY_DECL();
+    NK_SET_FAILURE_RECOVERY(nkfalse);
+    ret = nkiVmGarbageCollectStep(vm);
+    NK_CLEAR_FAILURE_RECOVERY();
+    return ret;
+}
+
 // FIXME: Add max iteration count param.
 void nkxVmCallFunction(
     struct NKVM *vm,
@@ -301,6 +343,19 @@ void nkxCompilerFinalize(
     NK_CLEAR_FAILURE_RECOVERY();
 }
 
+void nkxCompilerSetOptions(
+    struct NKCompilerState *cs,
+    nkuint32_t options)
+{
+    cs->options = options;
+}
+
+nkuint32_t nkxCompilerGetOptions(
+    struct NKCompilerState *cs)
+{
+    return cs->options;
+}
+
 void nkxCompilerPartiallyFinalize(
     struct NKCompilerState *cs)
 {
@@ -347,6 +402,20 @@ const char *nkxValueToString(struct NKVM *vm, struct NKValue *value)
     return ret;
 }
 
+const char *nkxValueToStringBytes(
+    struct NKVM *vm,
+    struct NKValue *value,
+    nkuint32_t *length)
+{
+    NK_FAILURE_RECOVERY_DECL();
+    const char *ret = NULL;
+    *length = 0;
+    NK_SET_FAILURE_RECOVERY(NULL);
+    ret = nkiValueToStringBytes(vm, value, length);
+    NK_CLEAR_FAILURE_RECOVERY();
+    return ret;
+}
+
 nkint32_t nkxValueToInt(struct NKVM *vm, struct NKValue *value)
 {
     NK_FAILURE_RECOVERY_DECL();
@@ -519,6 +588,37 @@ NKVMExternalFunctionID nkxVmSetupExternalFunction(
     return id;
 }
 
+NKVMExternalFunctionID nkxVmSetupTypedExternalFunction(
+    struct NKVM *vm, struct NKCompilerState *cs,
+    const char *name,
+    enum NKTypedFunctionSignature signature,
+    NKVMTypedFunction func,
+    nkbool setupGlobalVariable)
+{
+    // Typed functions don't have a normal callback, so they're
+    // registered (and found again by the compiler) with a NULL one.
+    NKVMExternalFunctionID id = nkxVmRegisterExternalFunction(vm, name, NULL);
+
+    if(id.id == NK_INVALID_VALUE) {
+        return id;
+    }
+
+    {
+        NK_FAILURE_RECOVERY_DECL();
+        NK_SET_FAILURE_RECOVERY(id);
+        if(!nkiVmSetTypedExternalFunction(vm, id, signature, func)) {
+            id.id = NK_INVALID_VALUE;
+        }
+        NK_CLEAR_FAILURE_RECOVERY();
+    }
+
+    if(id.id != NK_INVALID_VALUE && cs && setupGlobalVariable) {
+        nkxCompilerCreateCFunctionVariable(cs, name, NULL);
+    }
+
+    return id;
+}
+
 NKVMExternalFunctionID nkxVmRegisterExternalFunction(
     struct NKVM *vm,
     const char *name,
@@ -739,6 +839,18 @@ nkuint32_t nkxGetGarbageCollectionNewObjectInterval(struct NKVM *vm)
     return vm->gcInfo.gcNewObjectInterval;
 }
 
+void nkxSetGarbageCollectionIncrementalBudget(struct NKVM *vm, nkuint32_t budget)
+{
+    // A collection already in progress keeps the budget it started
+    // with.
+    vm->gcInfo.gcIncrementalBudget = budget;
+}
+
+nkuint32_t nkxGetGarbageCollectionIncrementalBudget(struct NKVM *vm)
+{
+    return vm->gcInfo.gcIncrementalBudget;
+}
+
 void nkxVmShrink(struct NKVM *vm)
 {
     NK_FAILURE_RECOVERY_DECL();
@@ -787,6 +899,18 @@ void nkxValueSetString(struct NKVM *vm, struct NKValue *value, const char *str)
     NK_CLEAR_FAILURE_RECOVERY();
 }
 
+void nkxValueSetStringBytes(
+    struct NKVM *vm,
+    struct NKValue *value,
+    const char *data,
+    nkuint32_t length)
+{
+    NK_FAILURE_RECOVERY_DECL();
+    NK_SET_FAILURE_RECOVERY_VOID();
+    nkiValueSetStringBytes(vm, value, data, length);
+    NK_CLEAR_FAILURE_RECOVERY();
+}
+
 void nkxValueSetNil(struct NKVM *vm, struct NKValue *value)
 {
     value->type = NK_VALUETYPE_NIL;
@@ -1132,6 +1256,30 @@ nkuint32_t nkxVmGetPeakMemoryUsage(struct NKVM *vm)
     return vm->peakMemoryUsage;
 }
 
+nkuint32_t nkxVmGetCategoryMemoryUsage(
+    struct NKVM *vm, enum NKMemoryCategory category)
+{
+    if((nkuint32_t)category < NK_MEMORY_CATEGORY_COUNT) {
+        return vm->categoryMemoryUsage[category];
+    }
+    return 0;
+}
+
+nkuint32_t nkxVmGetCategoryPeakMemoryUsage(
+    struct NKVM *vm, enum NKMemoryCategory category)
+{
+    if((nkuint32_t)category < NK_MEMORY_CATEGORY_COUNT) {
+        return vm->categoryPeakMemoryUsage[category];
+    }
+    return 0;
+}
+
+const char *nkxGetMemoryCategoryName(enum NKMemoryCategory category)
+{
+    // Makes no allocations. No need for wrapper.
+    return nkiMemCategoryGetName(category);
+}
+
 // ----------------------------------------------------------------------
 // Memory stuff
 
@@ -1141,7 +1289,7 @@ void *nkxMalloc(
     void *ret = NULL;
     NK_FAILURE_RECOVERY_DECL();
     NK_SET_FAILURE_RECOVERY(ret);
-    ret = nkiMalloc(vm, size);
+    ret = nkiMallocCategory(vm, size, NK_MEMORY_CATEGORY_EXTERNAL);
     NK_CLEAR_FAILURE_RECOVERY();
     return ret;
 }
@@ -1152,7 +1300,8 @@ void *nkxMallocArray(
     void *ret = NULL;
     NK_FAILURE_RECOVERY_DECL();
     NK_SET_FAILURE_RECOVERY(ret);
-    ret = nkiMallocArray(vm, size, count);
+    ret = nkiMallocArrayCategory(
+        vm, size, count, NK_MEMORY_CATEGORY_EXTERNAL);
     NK_CLEAR_FAILURE_RECOVERY();
     return ret;
 }
@@ -1170,7 +1319,8 @@ void *nkxRealloc(struct NKVM *vm, void *data, nkuint32_t size)
     void *ret = NULL;
     NK_FAILURE_RECOVERY_DECL();
     NK_SET_FAILURE_RECOVERY(ret);
-    ret = nkiRealloc(vm, data, size);
+    ret = nkiReallocCategory(
+        vm, data, size, NK_MEMORY_CATEGORY_EXTERNAL);
     NK_CLEAR_FAILURE_RECOVERY();
     return ret;
 }
@@ -1181,7 +1331,8 @@ void *nkxReallocArray(
     void *ret = NULL;
     NK_FAILURE_RECOVERY_DECL();
     NK_SET_FAILURE_RECOVERY(ret);
-    ret = nkiReallocArray(vm, data, size, count);
+    ret = nkiReallocArrayCategory(
+        vm, data, size, count, NK_MEMORY_CATEGORY_EXTERNAL);
     NK_CLEAR_FAILURE_RECOVERY();
     return ret;
 }
@@ -1191,7 +1342,7 @@ char *nkxStrdup(struct NKVM *vm, const char *str)
     char *ret = NULL;
     NK_FAILURE_RECOVERY_DECL();
     NK_SET_FAILURE_RECOVERY(ret);
-    ret = nkiStrdup(vm, str);
+    ret = nkiStrdupCategory(vm, str, NK_MEMORY_CATEGORY_EXTERNAL);
     NK_CLEAR_FAILURE_RECOVERY();
     return ret;
 }
@@ -94,9 +94,26 @@ nkbool nkxVmExecuteProgram(struct NKVM *vm);
 /// program counter.
 void nkxVmIterate(struct NKVM *vm, nkuint32_t count);
 
+/// Use ahead-of-time compiled code generated by ninkasi_aot. The
+/// module is only used if it was generated from the same bytecode
+/// the VM has. Returns nkfalse (and doesn't use the module) if it
+/// wasn't. Pass NULL to stop using a module. The module must stay
+/// around as long as the VM does.
+struct NKAotModule;
+nkbool nkxVmLoadAotModule(
+    struct NKVM *vm,
+    const struct NKAotModule *module);
+
 /// Force a garbage collection pass.
 void nkxVmGarbageCollect(struct NKVM *vm);
 
+/// Do one step of an incremental garbage collection, starting a new
+/// one if none is in progress. The amount of work done is set with
+/// nkxSetGarbageCollectionIncrementalBudget(), or if that's zero, the
+/// whole collection happens in one step. Returns nktrue if this step
+/// finished the collection.
+nkbool nkxVmGarbageCollectStep(struct NKVM *vm);
+
 /// Call a function inside the VM. This does not do any kind of
 /// iteration control, and will simply keep iterating until the
 /// instruction pointer points to the end of addressable program
@@ -135,13 +152,23 @@ struct NKValue *nkxVmFindGlobalVariable(
     struct NKCompilerState *cs,
     const char *name);
 
-/// Convert a value to a string. This will return a pointer to an
-/// internal string table entry (which it may have to create), and the
-/// address returned may be freed in the next garbage collection pass.
-/// So do not free it yourself, and save a copy of it if you wish to
-/// hold onto it.
+/// Convert a value to a string. For strings this will return a
+/// pointer to an internal string table entry, and the address
+/// returned may be freed in the next garbage collection pass. Other
+/// types are converted into a small rotating buffer that gets reused
+/// after a few more conversions. So do not free it yourself, and save
+/// a copy of it if you wish to hold onto it.
 const char *nkxValueToString(struct NKVM *vm, struct NKValue *value);
 
+/// Same as nkxValueToString(), but also writes the length in bytes to
+/// length. Strings may contain zero bytes, so use this instead of
+/// strlen() when passing binary data around. The returned data is
+/// still followed by a terminator.
+const char *nkxValueToStringBytes(
+    struct NKVM *vm,
+    struct NKValue *value,
+    nkuint32_t *length);
+
 nkint32_t nkxValueToInt(struct NKVM *vm, struct NKValue *value);
 
 float nkxValueToFloat(struct NKVM *vm, struct NKValue *value);
@@ -182,6 +209,14 @@ void nkxValueSetFloat(struct NKVM *vm, struct NKValue *value, float floatData);
 /// that entry to the value.
 void nkxValueSetString(struct NKVM *vm, struct NKValue *value, const char *str);
 
+/// Same as nkxValueSetString(), but takes a length, so the data can
+/// contain zero bytes.
+void nkxValueSetStringBytes(
+    struct NKVM *vm,
+    struct NKValue *value,
+    const char *data,
+    nkuint32_t length);
+
 /// Write a function ID into an NKValue.
 void nkxValueSetFunction(struct NKVM *vm, struct NKValue *value, NKVMInternalFunctionID id);
 
@@ -198,7 +233,8 @@ void nkxVmObjectClearEntry(
 // so we don't have to make the NKValue directly.
 
 /// Get a pointer to a field on an object. This pointer may be
-/// invalidated once VM execution resumes!
+/// invalidated once VM execution resumes, or when another field is
+/// added to the same object!
 struct NKValue *nkxVmObjectFindOrAddEntry(
     struct NKVM *vm,
     struct NKValue *objectId,
@@ -227,6 +263,22 @@ nkuint32_t nkxVmGetCurrentMemoryUsage(struct NKVM *vm);
 /// Returns the peak memory usage by the VM.
 nkuint32_t nkxVmGetPeakMemoryUsage(struct NKVM *vm);
 
+/// Returns the part of nkxVmGetCurrentMemoryUsage() that belongs to
+/// one category. The categories always add up to the total. Returns
+/// 0 for invalid categories.
+nkuint32_t nkxVmGetCategoryMemoryUsage(
+    struct NKVM *vm, enum NKMemoryCategory category);
+
+/// Returns the peak memory usage of one category. Categories peak
+/// at different times, so these don't add up to
+/// nkxVmGetPeakMemoryUsage().
+nkuint32_t nkxVmGetCategoryPeakMemoryUsage(
+    struct NKVM *vm, enum NKMemoryCategory category);
+
+/// Returns a short name for a memory category, for reports and
+/// logging, or NULL for invalid categories.
+const char *nkxGetMemoryCategoryName(enum NKMemoryCategory category);
+
 // ----------------------------------------------------------------------
 // Limits-related stuff
 
@@ -262,6 +314,14 @@ nkuint32_t nkxGetGarbageCollectionInterval(struct NKVM *vm);
 void nkxSetGarbageCollectionNewObjectInterval(struct NKVM *vm, nkuint32_t gcNewObjectInterval);
 nkuint32_t nkxGetGarbageCollectionNewObjectInterval(struct NKVM *vm);
 
+/// Set the amount of work the garbage collector can do each time it
+/// runs, for spreading collections out over several intervals instead
+/// of doing them all at once. The units are roughly the number of
+/// values scanned or freed. Zero (the default) turns incremental
+/// collection off. Not saved with nkxVmSerialize().
+void nkxSetGarbageCollectionIncrementalBudget(struct NKVM *vm, nkuint32_t budget);
+nkuint32_t nkxGetGarbageCollectionIncrementalBudget(struct NKVM *vm);
+
 /// Set the number of instructions to execute before throwing an
 /// error. Set to NK_INVALID_VALUE for no limit (default). Note that
 /// this limit is only checked on intervals where the garbage
@@ -285,6 +345,8 @@ struct NKVMFunctionCallbackData
 {
     struct NKVM *vm;
 
+    /// Points directly at the arguments on the VM's stack. Only valid
+    /// until the function returns.
     struct NKValue *arguments;
     nkuint32_t argumentCount;
 
@@ -345,6 +407,34 @@ NKVMExternalFunctionID nkxVmSetupExternalFunction(
     nkbool setupGlobalVariable,
     nkuint32_t argumentCount, ...);
 
+/// Register a typed native function. Typed functions take a fixed
+/// number of arguments with fixed types, listed in
+/// NKTypedFunctionSignature. The VM checks the arguments, passes them
+/// unboxed, and boxes the return value itself, which is much cheaper
+/// than a full NKVMFunctionCallback call for small things like math
+/// functions. Cast the function to NKVMTypedFunction to pass it in.
+///
+/// "cs" and setupGlobalVariable work like they do for
+/// nkxVmSetupExternalFunction().
+///
+/// Example:
+///   static float myPow(struct NKVM *vm, float a, float b)
+///   {
+///       return pow(a, b);
+///   }
+///
+///   nkxVmSetupTypedExternalFunction(
+///       vm, cs, "pow",
+///       NK_TYPEDFUNCTION_FLOAT_FLOAT_FLOAT,
+///       (NKVMTypedFunction)myPow,
+///       nktrue);
+NKVMExternalFunctionID nkxVmSetupTypedExternalFunction(
+    struct NKVM *vm, struct NKCompilerState *cs,
+    const char *name,
+    enum NKTypedFunctionSignature signature,
+    NKVMTypedFunction func,
+    nkbool setupGlobalVariable);
+
 /// Note: See nkxVmSetupExternalFunction(). That is probably what
 /// you're looking for.
 ///
@@ -580,6 +670,18 @@ nkbool nkxCompilerCompileScriptFile(
 void nkxCompilerFinalize(
     struct NKCompilerState *cs);
 
+/// Set compiler options. options is a set of NKCompilerOption flags
+/// OR'd together. Options that affect the finished bytecode (like
+/// NK_COMPILER_OPTION_PEEPHOLE) are applied in nkxCompilerFinalize(),
+/// and are never applied by nkxCompilerPartiallyFinalize().
+void nkxCompilerSetOptions(
+    struct NKCompilerState *cs,
+    nkuint32_t options);
+
+/// Get the current compiler options.
+nkuint32_t nkxCompilerGetOptions(
+    struct NKCompilerState *cs);
+
 // ----------------------------------------------------------------------
 // REPL-specific compiler interface.
 
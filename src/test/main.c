@@ -161,6 +161,8 @@ void setVmLimits(
         vm, getGlobalSettings()->maxMemory);
     nkxSetRemainingInstructionLimit(
         vm, getGlobalSettings()->instructionCountLimit);
+    nkxSetGarbageCollectionIncrementalBudget(
+        vm, getGlobalSettings()->gcIncrementalBudget);
 }
 
 struct NKVM *testSerializer(struct NKVM *vm)
@@ -353,6 +355,7 @@ int main(int argc, char *argv[])
         cs = nkxCompilerCreate(vm);
         if(cs) {
             initInternalFunctions(vm, cs);
+            nkxCompilerSetOptions(cs, getGlobalSettings()->compilerOptions);
             nkxCompilerCompileScript(
                 cs, script, getGlobalSettings()->filename);
             nkxCompilerFinalize(cs);
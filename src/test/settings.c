@@ -62,6 +62,8 @@ void printHelp(const char *argv0, nkbool isError)
         "\n"
         "Options:\n"
         "  -c          Compile the file to a .nkb only. Do not execute.\n"
+        "  -O          Enable the bytecode peephole optimizer.\n"
+        "  -S          Enable frame slot (three-address) instructions.\n"
         "  -f <count>  Set the rate of malloc calls before a forced failure.\n"
 #if !NK_MALLOC_FAILURE_TEST_MODE
         "              (This feature is disabled in this build!)\n"
@@ -76,6 +78,7 @@ void printHelp(const char *argv0, nkbool isError)
         "              break.)\n"
         "  -il <count> Set the instruction count limit. (Only checked during garbage\n"
         "              collection.\n"
+        "  -gi <work>  Collect garbage incrementally, doing this much work per step.\n"
         "  -v <level>  Set the verbosity level of output (default: 1).\n"
         "  --help      You just stepped in it.\n"
         "  --          Use this to indicate that the filename may contain a dash so\n"
@@ -119,6 +122,14 @@ nkbool parseCmdLine(int argc, char *argv[])
 
             settings->compileOnly = nktrue;
 
+        } else if(strcmp("-O", argv[i]) == 0) {
+
+            settings->compilerOptions |= NK_COMPILER_OPTION_PEEPHOLE;
+
+        } else if(strcmp("-S", argv[i]) == 0) {
+
+            settings->compilerOptions |= NK_COMPILER_OPTION_FRAMESLOTS;
+
         } else if(strcmp("-f", argv[i]) == 0) {
 
             i++;
@@ -183,6 +194,16 @@ nkbool parseCmdLine(int argc, char *argv[])
                 return nkfalse;
             }
 
+        } else if(strcmp("-gi", argv[i]) == 0) {
+
+            i++;
+            if(i < argc) {
+                settings->gcIncrementalBudget = atoi(argv[i]);
+            } else {
+                fprintf(stderr, "Missing parameter for -gi.\n");
+                return nkfalse;
+            }
+
         } else if(strcmp("-v", argv[i]) == 0) {
 
             i++;
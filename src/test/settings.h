@@ -49,11 +49,13 @@
 struct Settings
 {
     nkbool compileOnly;
+    nkuint32_t compilerOptions;
     const char *filename;
     nkuint32_t maxMemory;
     nkuint32_t serializerTestFrequency;
     nkuint32_t shrinkFrequency;
     nkuint32_t instructionCountLimit;
+    nkuint32_t gcIncrementalBudget;
     nkint32_t verbosity;
     int exitErrorCode;
 };
@@ -350,6 +350,44 @@ void subsystemTest_widgetGetData(struct NKVMFunctionCallbackData *data)
     }
 }
 
+// Typed functions. These get their arguments already checked and
+// unboxed.
+nkint32_t subsystemTest_typedAdd(struct NKVM *vm, nkint32_t a, nkint32_t b)
+{
+    return a + b;
+}
+
+float subsystemTest_typedScale(struct NKVM *vm, float a, float b)
+{
+    return a * b;
+}
+
+void subsystemTest_widgetIncrement(struct NKVM *vm, struct NKValue *widget)
+{
+    struct SubsystemTest_InternalData *internalData;
+    struct SubsystemTest_WidgetData *widgetData;
+
+    internalData =
+        (struct SubsystemTest_InternalData *)nkxGetExternalSubsystemDataOrError(
+            vm, "subsystemTest");
+
+    if(internalData) {
+
+        if(nkxVmObjectGetExternalType(vm, widget).id != internalData->widgetTypeId.id) {
+            nkxAddError(vm, "subsystemTest_widgetIncrement: Not a widget.");
+            return;
+        }
+
+        widgetData =
+            (struct SubsystemTest_WidgetData *)nkxVmObjectGetExternalData(
+                vm, widget);
+
+        if(widgetData) {
+            widgetData->data++;
+        }
+    }
+}
+
 void subsystemTest_widgetSerializeData(
     struct NKVM *vm,
     struct NKValue *objectValue,
@@ -691,6 +729,24 @@ void subsystemTest_initLibrary(struct NKVM *vm, struct NKCompilerState *cs)
         1,
         NK_VALUETYPE_OBJECTID, internalData->widgetTypeId);
 
+    nkxVmSetupTypedExternalFunction(
+        vm, cs, "subsystemTest_typedAdd",
+        NK_TYPEDFUNCTION_INT_INT_INT,
+        (NKVMTypedFunction)subsystemTest_typedAdd,
+        nktrue);
+
+    nkxVmSetupTypedExternalFunction(
+        vm, cs, "subsystemTest_typedScale",
+        NK_TYPEDFUNCTION_FLOAT_FLOAT_FLOAT,
+        (NKVMTypedFunction)subsystemTest_typedScale,
+        nktrue);
+
+    nkxVmSetupTypedExternalFunction(
+        vm, cs, "subsystemTest_widgetIncrement",
+        NK_TYPEDFUNCTION_VOID_OBJECT,
+        (NKVMTypedFunction)subsystemTest_widgetIncrement,
+        nktrue);
+
     // Set up an object method.
     {
         NKVMExternalFunctionID extId;